@@ -2937,12 +2937,47 @@ event_post_call_entry_added(app_pc postcall)
  * insertions and deletions), so sticking with a hashtable!
  */
 #define ALLOC_TABLE_HASH_BITS 12
-static hashtable_t malloc_table;
-/* we could switch to a full-fledged known-owner lock, or a recursive lock.
- * xref i#129.
+/* To avoid serializing every malloc and free on a single lock in wrap mode,
+ * the table is split into shards selected by address.  Each shard has an
+ * operation lock, which serializes the multi-step sequences on its entries
+ * (free's lookup+remove, the client callbacks around an add or remove, etc.),
+ * and a table lock (the hashtable's own lock), which is only held across the
+ * table access itself and is never held while acquiring another lock.
+ * A thread holds at most one operation lock, except for malloc_lock(), which
+ * acquires all of them in order for whole-table operations like leak scans,
+ * and for removing an entry along with an inner entry in another shard,
+ * which takes both in order (see malloc_lock_inner_if_needed()).
+ * If the thread already holds one, malloc_lock() takes every table lock
+ * instead (see malloc_wrap__lock()).
+ * A thread holding one operation lock that needs to look at an entry in
+ * another shard (e.g., checking neighboring allocs while reporting an error
+ * in free) takes just that shard's table lock, so there is no lock order to
+ * violate.  Adding or removing entries in another shard is not supported
+ * from such a nested context.
+ * With alloc_ops.global_lock we use a single shard, which is equivalent to
+ * the old single-lock table.
  */
+#define MALLOC_TABLE_SHARD_BITS 4
+#define MALLOC_TABLE_MAX_SHARDS (1 << MALLOC_TABLE_SHARD_BITS)
+typedef struct _malloc_shard_t {
+    hashtable_t table;
+    void *lock;
+    /* we could switch to a full-fledged known-owner lock, or a recursive lock.
+     * xref i#129.
+     */
+    thread_id_t lock_owner;
+    thread_id_t table_owner;
+} malloc_shard_t;
+static malloc_shard_t malloc_shards[MALLOC_TABLE_MAX_SHARDS];
+static uint malloc_shard_bits;
+#define MALLOC_NUM_SHARDS() (1U << malloc_shard_bits)
 #define THREAD_ID_INVALID ((thread_id_t)0) /* invalid thread id on Linux+Windows */
+/* owner of every shard's operation lock, via malloc_lock() */
 static thread_id_t malloc_lock_owner = THREAD_ID_INVALID;
+/* owner of every shard's table lock, via malloc_lock() from a thread that
+ * already held one operation lock and so could not acquire the rest
+ */
+static thread_id_t malloc_nested_owner = THREAD_ID_INVALID;
 
 /* PR 525807: to handle malloc-based stacks we need an interval tree
  * for large mallocs.  Putting all mallocs in a tree instead of a table
@@ -3021,6 +3056,18 @@ malloc_hash(void *v)
     return (hash >> 5);
 }
 
+/* The hashtable indexes by the low bits of malloc_hash() so we pick the shard
+ * from the top bits of a multiplicative hash to keep the two independent.
+ */
+static inline malloc_shard_t *
+malloc_shard(app_pc start)
+{
+    uint hash = malloc_hash((void *)start) * 0x9e3779b1;
+    if (malloc_shard_bits == 0)
+        return &malloc_shards[0];
+    return &malloc_shards[hash >> (32 - malloc_shard_bits)];
+}
+
 static size_t
 malloc_entry_redzone_size(malloc_entry_t *e)
 {
@@ -3146,8 +3193,13 @@ alloc_exit(void)
         alloc_replace_exit();
 
     if (alloc_ops.track_allocs) {
-        if (!alloc_ops.replace_malloc)
-            hashtable_delete_with_stats(&malloc_table, "malloc table");
+        if (!alloc_ops.replace_malloc) {
+            uint i;
+            for (i = 0; i < MALLOC_NUM_SHARDS(); i++) {
+                hashtable_delete_with_stats(&malloc_shards[i].table, "malloc table");
+                dr_mutex_destroy(malloc_shards[i].lock);
+            }
+        }
         rb_tree_destroy(large_malloc_tree);
         dr_mutex_destroy(large_malloc_lock);
 #ifdef USE_DRSYMS
@@ -3781,62 +3833,190 @@ malloc_iterate(malloc_iter_cb_t cb, void *iter_data)
  * own or from within malloc_iterate(), so we need self-recursion support
  * of one level.  We do not need general recursion support.
  */
-static bool
-malloc_lock_held_by_self(void)
+static thread_id_t
+malloc_lock_self(void)
 {
-    /* reading this variable should be atomic */
     void *drcontext = dr_get_current_drcontext();
     if (drcontext == NULL) {
         ASSERT(false, "should always have dcontext w/ PR 536058");
+        return THREAD_ID_INVALID;
+    }
+    return dr_get_thread_id(drcontext);
+}
+
+/* Returns whether we hold the whole table: every shard's operation lock, or
+ * our own shard's operation lock plus every table lock.
+ */
+static bool
+malloc_table_held_by_self(thread_id_t self)
+{
+    /* reading these variables should be atomic */
+    if (self == THREAD_ID_INVALID)
         return false;
+    return (malloc_lock_owner == self || malloc_nested_owner == self ||
+            (MALLOC_NUM_SHARDS() == 1 && malloc_shards[0].lock_owner == self));
+}
+
+/* Returns whether we hold any shard's operation lock */
+static bool
+malloc_lock_held_by_self(void)
+{
+    thread_id_t self = malloc_lock_self();
+    uint i;
+    if (self == THREAD_ID_INVALID)
+        return false;
+    if (malloc_lock_owner == self)
+        return true;
+    for (i = 0; i < MALLOC_NUM_SHARDS(); i++) {
+        if (malloc_shards[i].lock_owner == self)
+            return true;
     }
-    return (dr_get_thread_id(drcontext) == malloc_lock_owner);
+    return false;
 }
 
 static void
-malloc_lock_internal(void)
+malloc_shard_lock(malloc_shard_t *shard, thread_id_t self)
 {
-    void *drcontext = dr_get_current_drcontext();
-    hashtable_lock(&malloc_table);
-    if (drcontext != NULL) /* paranoid even w/ PR 536058 */
-        malloc_lock_owner = dr_get_thread_id(drcontext);
+    dr_mutex_lock(shard->lock);
+    shard->lock_owner = self;
 }
 
 static void
-malloc_unlock_internal(void)
+malloc_shard_unlock(malloc_shard_t *shard)
 {
-    malloc_lock_owner = THREAD_ID_INVALID;
-    hashtable_unlock(&malloc_table);
+    shard->lock_owner = THREAD_ID_INVALID;
+    dr_mutex_unlock(shard->lock);
+}
+
+static void
+malloc_table_lock(malloc_shard_t *shard, thread_id_t self)
+{
+    hashtable_lock(&shard->table);
+    shard->table_owner = self;
+}
+
+static void
+malloc_table_unlock(malloc_shard_t *shard)
+{
+    shard->table_owner = THREAD_ID_INVALID;
+    hashtable_unlock(&shard->table);
 }
 
+/* Another thread holding a different shard's operation lock can access this
+ * shard's table under just its table lock, so we need the table lock for
+ * each access unless we already hold it or hold every operation lock.
+ */
 static bool
-malloc_lock_if_not_held_by_me(void)
+malloc_table_lock_if_needed(malloc_shard_t *shard)
 {
-    if (malloc_lock_held_by_self())
+    thread_id_t self = malloc_lock_self();
+    if (malloc_table_held_by_self(self) ||
+        (self != THREAD_ID_INVALID && shard->table_owner == self))
         return false;
-    malloc_lock_internal();
+    malloc_table_lock(shard, self);
     return true;
 }
 
 static void
-malloc_unlock_if_locked_by_me(bool by_me)
+malloc_table_unlock_if_locked(malloc_shard_t *shard, bool locked)
 {
-    if (by_me)
-        malloc_unlock_internal();
+    if (locked)
+        malloc_table_unlock(shard);
+}
+
+/* Return values for malloc_lock_if_not_held_by_me() */
+enum {
+    MALLOC_LOCKED_NONE,  /* we already held what we need */
+    MALLOC_LOCKED_SHARD, /* we acquired the shard's operation lock */
+    MALLOC_LOCKED_TABLE, /* we hold another shard so we acquired the table lock */
+    MALLOC_HELD_TABLE,   /* we already held just the table lock, via malloc_lock() */
+};
+
+/* Acquires what we need to operate on the entry for start.  The return value
+ * must be passed to malloc_unlock_if_locked_by_me() with the same start.
+ */
+static uint
+malloc_lock_if_not_held_by_me(app_pc start)
+{
+    malloc_shard_t *shard = malloc_shard(start);
+    thread_id_t self = malloc_lock_self();
+    if (self != THREAD_ID_INVALID && malloc_nested_owner == self &&
+        shard->lock_owner != self) {
+        /* Another thread may be partway through an operation on this shard */
+        return MALLOC_HELD_TABLE;
+    }
+    if (malloc_table_held_by_self(self) ||
+        (self != THREAD_ID_INVALID &&
+         (shard->lock_owner == self || shard->table_owner == self)))
+        return MALLOC_LOCKED_NONE;
+    if (malloc_lock_held_by_self()) {
+        /* Acquiring a second operation lock could deadlock */
+        malloc_table_lock(shard, self);
+        return MALLOC_LOCKED_TABLE;
+    }
+    malloc_shard_lock(shard, self);
+    return MALLOC_LOCKED_SHARD;
 }
 
-/* For wrapping, alloc_ops.global_lock is essentially always on. */
+static void
+malloc_unlock_if_locked_by_me(app_pc start, uint locked)
+{
+    malloc_shard_t *shard = malloc_shard(start);
+    if (locked == MALLOC_LOCKED_SHARD)
+        malloc_shard_unlock(shard);
+    else if (locked == MALLOC_LOCKED_TABLE)
+        malloc_table_unlock(shard);
+}
+
+/* For wrapping, alloc_ops.global_lock is essentially always on.
+ * This is the whole-table lock, used for iteration and by clients.
+ * A thread that already holds one shard's operation lock (e.g., a client
+ * callback during free) cannot acquire the others without risking deadlock
+ * against a thread acquiring them in order, so it takes every table lock
+ * instead, in increasing order as malloc_iterate_internal() does.  That stops
+ * every other thread from touching any table, which is all iteration needs,
+ * while adds and removes in the other shards are refused.
+ */
 static void
 malloc_wrap__lock(void)
 {
-    /* For external calls we can't store the result so we look up in unlock */
-    malloc_lock_if_not_held_by_me();
+    thread_id_t self = malloc_lock_self();
+    uint i;
+    if (malloc_table_held_by_self(self))
+        return;
+    if (malloc_lock_held_by_self()) {
+        for (i = 0; i < MALLOC_NUM_SHARDS(); i++)
+            malloc_table_lock(&malloc_shards[i], self);
+        malloc_nested_owner = self;
+        return;
+    }
+    for (i = 0; i < MALLOC_NUM_SHARDS(); i++)
+        malloc_shard_lock(&malloc_shards[i], self);
+    malloc_lock_owner = self;
 }
 
 static void
 malloc_wrap__unlock(void)
 {
-    malloc_unlock_if_locked_by_me(malloc_lock_held_by_self());
+    /* For external calls we can't store whether we acquired the lock in
+     * malloc_wrap__lock() so we release whatever we hold.
+     */
+    thread_id_t self = malloc_lock_self();
+    uint i;
+    if (self == THREAD_ID_INVALID)
+        return;
+    if (malloc_nested_owner == self) {
+        /* leave the operation lock we held before malloc_lock() */
+        malloc_nested_owner = THREAD_ID_INVALID;
+        for (i = 0; i < MALLOC_NUM_SHARDS(); i++)
+            malloc_table_unlock(&malloc_shards[i]);
+        return;
+    }
+    malloc_lock_owner = THREAD_ID_INVALID;
+    for (i = 0; i < MALLOC_NUM_SHARDS(); i++) {
+        if (malloc_shards[i].lock_owner == self)
+            malloc_shard_unlock(&malloc_shards[i]);
+    }
 }
 
 /* If a client needs the real (usable) end, for pre_us mallocs the client can't
@@ -3852,7 +4032,9 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
 {
     malloc_entry_t *e = (malloc_entry_t *) global_alloc(sizeof(*e), HEAPSTAT_WRAP);
     malloc_entry_t *old_e;
-    bool locked_by_me;
+    malloc_shard_t *shard = malloc_shard(start);
+    uint locked;
+    bool table_locked;
     malloc_info_t info;
     ASSERT((alloc_ops.redzone_size > 0 && TEST(MALLOC_PRE_US, flags)) ||
            alloc_ops.record_allocs,
@@ -3870,7 +4052,9 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
     LOG(3, "%s: type=%x\n", __FUNCTION__, alloc_type);
     e->flags |= (client_flags & MALLOC_POSSIBLE_CLIENT_FLAGS);
     /* grab lock around client call and hashtable operations */
-    locked_by_me = malloc_lock_if_not_held_by_me();
+    locked = malloc_lock_if_not_held_by_me(start);
+    ASSERT(locked != MALLOC_LOCKED_TABLE && locked != MALLOC_HELD_TABLE,
+           "cannot add to another shard");
 
     e->data = NULL;
     malloc_entry_to_info(e, &info);
@@ -3885,7 +4069,9 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
      * when the free succeeds, so a race can hit a conflict.
      * Update: we no longer do this but leaving code for now
      */
-    old_e = hashtable_add_replace(&malloc_table, (void *) start, (void *)e);
+    table_locked = malloc_table_lock_if_needed(shard);
+    old_e = hashtable_add_replace(&shard->table, (void *) start, (void *)e);
+    malloc_table_unlock_if_locked(shard, table_locked);
 
     if (!malloc_entry_is_native(e) && end - start >= LARGE_MALLOC_MIN_SIZE) {
         malloc_large_add(e->start, e->end - e->start);
@@ -3900,12 +4086,14 @@ malloc_add_common(app_pc start, app_pc end, app_pc real_end,
     if (!malloc_entry_is_native(e))
         STATS_INC(num_mallocs);
     if (num_mallocs % 10000 == 0) {
-        hashtable_cluster_stats(&malloc_table, "malloc table");
-        LOG(1, "malloc table stats after %u malloc calls\n", num_mallocs);
+        table_locked = malloc_table_lock_if_needed(shard);
+        hashtable_cluster_stats(&shard->table, "malloc table shard");
+        malloc_table_unlock_if_locked(shard, table_locked);
+        LOG(1, "malloc table shard stats after %u malloc calls\n", num_mallocs);
     }
 #endif
 
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     if (old_e != NULL) {
         ASSERT(!TEST(MALLOC_VALID, old_e->flags), "internal error in malloc tracking");
         malloc_entry_free(old_e);
@@ -3924,11 +4112,72 @@ malloc_wrap__add(app_pc start, app_pc end, app_pc real_end,
                       client_flags, mc, post_call, 0);
 }
 
-/* up to caller to lock and unlock */
+/* up to caller to lock and unlock via malloc_lock_if_not_held_by_me() */
 static malloc_entry_t *
 malloc_lookup(app_pc start)
 {
-    return hashtable_lookup(&malloc_table, (void *) start);
+    malloc_shard_t *shard = malloc_shard(start);
+    bool table_locked = malloc_table_lock_if_needed(shard);
+    malloc_entry_t *e = (malloc_entry_t *) hashtable_lookup(&shard->table, (void *) start);
+    malloc_table_unlock_if_locked(shard, table_locked);
+    return e;
+}
+
+static bool
+malloc_table_remove(app_pc start)
+{
+    malloc_shard_t *shard = malloc_shard(start);
+    bool table_locked = malloc_table_lock_if_needed(shard);
+    bool res = hashtable_remove(&shard->table, (void *) start);
+    malloc_table_unlock_if_locked(shard, table_locked);
+    return res;
+}
+
+/* malloc_entry_remove() also removes the inner entry of an alloc marked
+ * MALLOC_CONTAINS_LIBC_ALLOC, which may be in another shard, so removing *e
+ * needs that shard's operation lock as well.  Given start's lock from
+ * malloc_lock_if_not_held_by_me(), this acquires the inner one, taking the two
+ * in shard order so that threads doing the same cannot deadlock.  That can
+ * mean releasing start's shard, in which case *e is looked up again.
+ * The return value must be passed to malloc_unlock_inner_if_locked().
+ */
+static uint
+malloc_lock_inner_if_needed(app_pc start, uint locked, malloc_entry_t **e)
+{
+#ifdef WINDOWS
+    malloc_shard_t *shard = malloc_shard(start);
+    malloc_shard_t *inner_shard = malloc_shard(start + DBGCRT_PRE_REDZONE_SIZE);
+    thread_id_t self;
+    if (*e == NULL || !TEST(MALLOC_CONTAINS_LIBC_ALLOC, (*e)->flags) ||
+        inner_shard == shard)
+        return MALLOC_LOCKED_NONE;
+    if (locked != MALLOC_LOCKED_SHARD) {
+        /* Either we hold every shard, or an outer operation holds start's
+         * shard and acquiring a second operation lock out of order could
+         * deadlock, so we fall back to malloc_table_remove()'s table lock.
+         */
+        return MALLOC_LOCKED_NONE;
+    }
+    self = malloc_lock_self();
+    if (inner_shard < shard) {
+        malloc_shard_unlock(shard);
+        malloc_shard_lock(inner_shard, self);
+        malloc_shard_lock(shard, self);
+        *e = malloc_lookup(start);
+    } else
+        malloc_shard_lock(inner_shard, self);
+    return MALLOC_LOCKED_SHARD;
+#else
+    return MALLOC_LOCKED_NONE;
+#endif
+}
+
+static void
+malloc_unlock_inner_if_locked(app_pc start, uint inner_locked)
+{
+#ifdef WINDOWS
+    malloc_unlock_if_locked_by_me(start + DBGCRT_PRE_REDZONE_SIZE, inner_locked);
+#endif
 }
 
 /* Note that this also frees the entry.  Caller should be holding lock. */
@@ -3953,10 +4202,13 @@ malloc_entry_remove(malloc_entry_t *e)
      */
     if (TEST(MALLOC_CONTAINS_LIBC_ALLOC, e->flags)) {
         ASSERT(e->start + DBGCRT_PRE_REDZONE_SIZE < e->end, "invalid internal alloc");
-        hashtable_remove(&malloc_table, e->start + DBGCRT_PRE_REDZONE_SIZE);
+        /* This may be in another shard, whose operation lock the caller
+         * should hold via malloc_lock_inner_if_needed().
+         */
+        malloc_table_remove(e->start + DBGCRT_PRE_REDZONE_SIZE);
     }
 #endif
-    if (hashtable_remove(&malloc_table, e->start)) {
+    if (malloc_table_remove(e->start)) {
 #ifdef STATISTICS
         if (!native)
             STATS_INC(num_frees);
@@ -3973,11 +4225,16 @@ static void
 malloc_remove(app_pc start)
 {
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    uint inner_locked;
+    ASSERT(locked != MALLOC_LOCKED_TABLE && locked != MALLOC_HELD_TABLE,
+           "cannot remove from another shard");
     e = malloc_lookup(start);
+    inner_locked = malloc_lock_inner_if_needed(start, locked, &e);
     if (e != NULL)
         malloc_entry_remove(e);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_inner_if_locked(start, inner_locked);
+    malloc_unlock_if_locked_by_me(start, locked);
 }
 #endif
 
@@ -4042,11 +4299,13 @@ static void
 malloc_set_valid(app_pc start, bool valid)
 {
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    ASSERT(locked != MALLOC_LOCKED_TABLE && locked != MALLOC_HELD_TABLE,
+           "cannot update another shard");
+    e = malloc_lookup(start);
     if (e != NULL)
         malloc_entry_set_valid(e, valid);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
 }
 
 static bool
@@ -4088,12 +4347,12 @@ static uint
 malloc_alloc_type(byte *start)
 {
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
+    uint locked = malloc_lock_if_not_held_by_me(start);
     uint res = 0;
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = malloc_alloc_entry_type(e);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return res;
 }
 
@@ -4102,11 +4361,11 @@ malloc_wrap__is_pre_us_ex(app_pc start, bool ok_if_invalid)
 {
     bool res = false;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = malloc_entry_is_pre_us(e, ok_if_invalid);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return res;
 }
 
@@ -4141,10 +4400,10 @@ malloc_is_native(app_pc start, cls_alloc_t *pt, bool consider_being_freed)
 #ifdef WINDOWS
     bool res = false;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     res = malloc_entry_is_native_ex(e, start, pt, consider_being_freed);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return res;
 #else
     /* optimization: currently nothing in the table */
@@ -4159,7 +4418,8 @@ malloc_is_native(app_pc start, cls_alloc_t *pt, bool consider_being_freed)
 static bool
 malloc_entry_exists_racy_nolock(app_pc start)
 {
-    malloc_entry_t *e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    malloc_entry_t *e = (malloc_entry_t *)
+        hashtable_lookup(&malloc_shard(start)->table, (void *) start);
     return (e != NULL && MALLOC_VISIBLE(e->flags));
 }
 #endif
@@ -4169,11 +4429,11 @@ malloc_wrap__end(app_pc start)
 {
     app_pc end = NULL;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL && MALLOC_VISIBLE(e->flags))
         end = e->end;
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return end;
 }
 
@@ -4183,11 +4443,11 @@ malloc_wrap__size(app_pc start)
 {
     ssize_t sz = -1;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL && MALLOC_VISIBLE(e->flags))
         sz = (e->end - start);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return sz;
 }
 
@@ -4197,11 +4457,11 @@ malloc_wrap__size_invalid_only(app_pc start)
 {
     ssize_t sz = -1;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL && !TEST(MALLOC_VALID, e->flags))
         sz = (e->end - start);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return sz;
 }
 
@@ -4210,11 +4470,11 @@ malloc_wrap__get_client_data(app_pc start)
 {
     void *res = NULL;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = e->data;
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return res;
 }
 
@@ -4223,11 +4483,11 @@ malloc_wrap__get_client_flags(app_pc start)
 {
     uint res = 0;
     malloc_entry_t *e;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL)
         res = (e->flags & MALLOC_POSSIBLE_CLIENT_FLAGS);
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return res;
 }
 
@@ -4236,13 +4496,13 @@ malloc_wrap__set_client_flag(app_pc start, uint client_flag)
 {
     malloc_entry_t *e;
     bool found = false;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL) {
         e->flags |= (client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
         found = true;
     }
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return found;
 }
 
@@ -4251,44 +4511,67 @@ malloc_wrap__clear_client_flag(app_pc start, uint client_flag)
 {
     malloc_entry_t *e;
     bool found = false;
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    e = (malloc_entry_t *) hashtable_lookup(&malloc_table, (void *) start);
+    uint locked = malloc_lock_if_not_held_by_me(start);
+    e = malloc_lookup(start);
     if (e != NULL) {
         e->flags &= ~(client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
         found = true;
     }
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    malloc_unlock_if_locked_by_me(start, locked);
     return found;
 }
 
 static void
 malloc_iterate_internal(bool include_native, malloc_iter_cb_t cb, void *iter_data)
 {
-    uint i;
+    uint i, j;
+    thread_id_t self = malloc_lock_self();
+    uint locked = MALLOC_LOCKED_NONE;
+    malloc_info_t info;
     /* we do support being called while malloc lock is held but caller should
      * be careful that table is in a consistent state (staleness does this)
      */
-    bool locked_by_me = malloc_lock_if_not_held_by_me();
-    malloc_info_t info;
-    for (i = 0; i < HASHTABLE_SIZE(malloc_table.table_bits); i++) {
-        hash_entry_t *he, *nxt;
-        for (he = malloc_table.table[i]; he != NULL; he = nxt) {
-            malloc_entry_t *e = (malloc_entry_t *) he->payload;
-            /* support malloc_remove() while iterating */
-            nxt = he->next;
-            if (MALLOC_VISIBLE(e->flags) &&
-                (include_native || !malloc_entry_is_native(e))) {
-                malloc_entry_to_info(e, &info);
-                if (include_native)
-                    info.client_flags = e->flags; /* all of them */
-                if (!cb(&info, iter_data)) {
-                    goto malloc_iterate_done;
+    if (!malloc_table_held_by_self(self)) {
+        if (malloc_lock_held_by_self()) {
+            /* We hold one shard's operation lock (e.g., reporting an error in
+             * free) and cannot acquire the rest, so we hold every table lock
+             * instead.  These are only ever acquired in increasing order
+             * while another is held.  The callback must not add or remove.
+             */
+            for (i = 0; i < MALLOC_NUM_SHARDS(); i++)
+                malloc_table_lock(&malloc_shards[i], self);
+            locked = MALLOC_LOCKED_TABLE;
+        } else {
+            malloc_wrap__lock();
+            locked = MALLOC_LOCKED_SHARD;
+        }
+    }
+    for (j = 0; j < MALLOC_NUM_SHARDS(); j++) {
+        hashtable_t *table = &malloc_shards[j].table;
+        for (i = 0; i < HASHTABLE_SIZE(table->table_bits); i++) {
+            hash_entry_t *he, *nxt;
+            for (he = table->table[i]; he != NULL; he = nxt) {
+                malloc_entry_t *e = (malloc_entry_t *) he->payload;
+                /* support malloc_remove() while iterating */
+                nxt = he->next;
+                if (MALLOC_VISIBLE(e->flags) &&
+                    (include_native || !malloc_entry_is_native(e))) {
+                    malloc_entry_to_info(e, &info);
+                    if (include_native)
+                        info.client_flags = e->flags; /* all of them */
+                    if (!cb(&info, iter_data)) {
+                        goto malloc_iterate_done;
+                    }
                 }
             }
         }
     }
  malloc_iterate_done:
-    malloc_unlock_if_locked_by_me(locked_by_me);
+    if (locked == MALLOC_LOCKED_TABLE) {
+        for (i = 0; i < MALLOC_NUM_SHARDS(); i++)
+            malloc_table_unlock(&malloc_shards[i]);
+    } else if (locked == MALLOC_LOCKED_SHARD)
+        malloc_wrap__unlock();
 }
 
 static void
@@ -4337,16 +4620,27 @@ malloc_wrap_init(void)
 {
     if (alloc_ops.track_allocs) {
         hashtable_config_t hashconfig;
-        hashtable_init_ex(&malloc_table, ALLOC_TABLE_HASH_BITS, HASH_INTPTR,
-                          false/*!str_dup*/, false/*!synch*/, malloc_entry_free,
-                          malloc_hash, NULL);
+        uint i;
+        /* Clients that set global_lock want all table operations, including
+         * their callbacks, serialized.
+         */
+        malloc_shard_bits = alloc_ops.global_lock ? 0 : MALLOC_TABLE_SHARD_BITS;
         /* hash lookup can be a bottleneck so it's worth taking some extra space
          * to reduce the collision chains
          */
         hashconfig.size = sizeof(hashconfig);
         hashconfig.resizable = true;
         hashconfig.resize_threshold = 50; /* default is 75 */
-        hashtable_configure(&malloc_table, &hashconfig);
+        for (i = 0; i < MALLOC_NUM_SHARDS(); i++) {
+            malloc_shard_t *shard = &malloc_shards[i];
+            hashtable_init_ex(&shard->table, ALLOC_TABLE_HASH_BITS - malloc_shard_bits,
+                              HASH_INTPTR, false/*!str_dup*/, false/*!synch*/,
+                              malloc_entry_free, malloc_hash, NULL);
+            hashtable_configure(&shard->table, &hashconfig);
+            shard->lock = dr_mutex_create();
+            shard->lock_owner = THREAD_ID_INVALID;
+            shard->table_owner = THREAD_ID_INVALID;
+        }
     }
 
     malloc_interface.malloc_lock = malloc_wrap__lock;
@@ -5403,6 +5697,7 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     bool size_in_zone = (redzone_size(routine) > 0 && alloc_ops.size_in_redzone);
     size_t size = 0;
     malloc_entry_t *entry;
+    uint locked, inner_locked;
 
     base = (app_pc)arg;
     real_base = base;
@@ -5433,10 +5728,15 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
      * we require user to fix invalid frees before trusting all later errors.
      */
     /* We must have synchronized access to avoid races and ensure we report
-     * an error on the 2nd free to the same base
+     * an error on the 2nd free to the same base.  We lock base's shard plus
+     * that of any inner entry removed with it: base may be changed below so
+     * we unlock via arg.
      */
-    malloc_lock();
+    locked = malloc_lock_if_not_held_by_me(base);
+    ASSERT(locked != MALLOC_LOCKED_TABLE && locked != MALLOC_HELD_TABLE,
+           "free while holding another shard");
     entry = malloc_lookup(base);
+    inner_locked = malloc_lock_inner_if_needed(base, locked, &entry);
     if (entry != NULL &&
         (malloc_entry_is_native_ex(entry, base, pt, false)
 #ifdef WINDOWS
@@ -5448,7 +5748,8 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 #endif
          )) {
         malloc_entry_remove(entry);
-        malloc_unlock();
+        malloc_unlock_inner_if_locked((app_pc)arg, inner_locked);
+        malloc_unlock_if_locked_by_me((app_pc)arg, locked);
         return;
     }
     if (pt->in_heap_routine == 1/*alread incremented, so outer*/) {
@@ -5578,7 +5879,8 @@ handle_free_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 
         malloc_entry_remove(entry);
     }
-    malloc_unlock();
+    malloc_unlock_inner_if_locked((app_pc)arg, inner_locked);
+    malloc_unlock_if_locked_by_me((app_pc)arg, locked);
 
     set_handling_heap_layer(pt, base, size);
 #ifdef WINDOWS
@@ -6030,6 +6332,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     size_t size = (size_t) drwrap_get_arg(wrapcxt, ARGNUM_REALLOC_SIZE(type));
     app_pc base = (app_pc) drwrap_get_arg(wrapcxt, ARGNUM_REALLOC_PTR(type));
     malloc_entry_t *entry;
+    uint locked;
     if (base == NULL) {
         /* realloc(NULL, size) == malloc(size) (PR 416535) */
         /* call_site for call;jmp will be jmp, so retaddr better even if post-call */
@@ -6046,11 +6349,17 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
         LOG(2, "realloc-pre "PFX" new size %d\n", base, pt->realloc_replace_size);
         return;
     }
-    malloc_lock();
+    locked = malloc_lock_if_not_held_by_me(base);
+    ASSERT(locked != MALLOC_LOCKED_TABLE && locked != MALLOC_HELD_TABLE,
+           "realloc while holding another shard");
     entry = malloc_lookup(base);
     if (entry != NULL && malloc_entry_is_native_ex(entry, base, pt, true)) {
-        malloc_entry_remove(entry);
-        malloc_unlock();
+        uint inner_locked = malloc_lock_inner_if_needed(base, locked, &entry);
+        /* entry is looked up again if base's shard was released */
+        if (entry != NULL && malloc_entry_is_native_ex(entry, base, pt, true))
+            malloc_entry_remove(entry);
+        malloc_unlock_inner_if_locked(base, inner_locked);
+        malloc_unlock_if_locked_by_me(base, locked);
         return;
     }
 #ifdef WINDOWS
@@ -6060,7 +6369,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
 #endif
     if (check_recursive_same_sequence(drcontext, &pt, routine, pt->alloc_size,
                                       size - redzone_size(routine)*2)) {
-        malloc_unlock();
+        malloc_unlock_if_locked_by_me(base, locked);
         return;
     }
     set_handling_heap_layer(pt, base, size);
@@ -6072,7 +6381,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
     if (!check_valid_heap_block(entry == NULL, pt->alloc_base, pt, wrapcxt,
                                 routine->name, is_free_routine(type))) {
         pt->expect_lib_to_fail = true;
-        malloc_unlock();
+        malloc_unlock_if_locked_by_me(base, locked);
         return;
     }
     ASSERT(entry != NULL, "shouldn't get here: tangent or invalid checked above");
@@ -6123,7 +6432,7 @@ handle_realloc_pre(void *drcontext, cls_alloc_t *pt, void *wrapcxt,
         pt->alloc_base, pt->realloc_old_info.request_size, pt->alloc_size);
     if (alloc_ops.record_allocs && !invalidated)
         malloc_entry_set_valid(entry, false);
-    malloc_unlock();
+    malloc_unlock_if_locked_by_me(base, locked);
 }
 
 static void
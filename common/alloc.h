@@ -77,6 +77,14 @@ typedef struct _alloc_options_t {
     bool shared_redzones;
     uint delay_frees;
     uint delay_frees_maxsz;
+    /* Whether to keep per-thread caches of small free chunks (i#948).
+     * Currently only supported on UNIX and only when !global_lock.
+     * Small allocations and frees then call client_add_malloc_{pre,post}(),
+     * client_handle_malloc(), client_remove_malloc_{pre,post}(),
+     * client_malloc_data_to_free_list(), and client_handle_free() without
+     * holding the heap lock, so those must be thread-safe.
+     */
+    bool thread_cache;
 
     bool skip_msvc_importers;
 
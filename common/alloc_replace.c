@@ -123,14 +123,29 @@
 /* we only support allocation sizes under 4GB */
 typedef uint heapsz_t;
 
-/* each free list bucket contains freed chunks of at least its bucket size
- * XXX: add stats on searches to help in tuning these
+/* Each free list bucket contains freed chunks of at least its bucket size
+ * and smaller than the next bucket's size, except the final var-size bucket.
+ * We use a two-level segregated fit scheme, as in TLSF: below
+ * FREE_LIST_LINEAR_MAX there is one bucket per CHUNK_ALIGNMENT step, and
+ * above it each power of two is split into FREE_LIST_SUBDIVS buckets.  The
+ * final bucket holds every chunk of at least CHUNK_MIN_MMAP bytes, so any
+ * request that does not go to mmap is satisfied by the first entry of the
+ * first non-empty bucket at or above its guaranteed-size bucket, which we
+ * find with a bitmap of non-empty buckets.
  */
-static const uint free_list_sizes[] = {
-    IF_NOT_X64_(8) 16, 24, 32, 40, 64, 96, 128, 192, 256, 384, 512, 1024, 2048,
-    4096, 8192, 16384, 32768,
-};
-#define NUM_FREE_LISTS (sizeof(free_list_sizes)/sizeof(free_list_sizes[0]))
+#define FREE_LIST_LINEAR_MAX 128
+#define FREE_LIST_LINEAR_BITS 7 /* log2(FREE_LIST_LINEAR_MAX) */
+#define FREE_LIST_VAR_BITS 17 /* log2(CHUNK_MIN_MMAP) */
+#define FREE_LIST_SUBDIV_BITS 2
+#define FREE_LIST_SUBDIVS (1 << FREE_LIST_SUBDIV_BITS)
+#define FREE_LIST_LINEAR_BUCKETS \
+    ((FREE_LIST_LINEAR_MAX - CHUNK_MIN_SIZE) / CHUNK_ALIGNMENT)
+#define NUM_FREE_LISTS (FREE_LIST_LINEAR_BUCKETS + \
+    (FREE_LIST_VAR_BITS - FREE_LIST_LINEAR_BITS) * FREE_LIST_SUBDIVS + 1)
+#define FREE_LIST_BITMAP_WORDS ((NUM_FREE_LISTS + 31) / 32)
+
+/* filled in by free_list_sizes_init() */
+static uint free_list_sizes[NUM_FREE_LISTS];
 
 /* Values stored in chunk header flags */
 enum {
@@ -156,8 +171,26 @@ enum {
 #else
     ALLOCATOR_TYPE_FLAGS  = (MALLOC_ALLOCATOR_FLAGS),
 #endif
+    /* A chunk sitting in a per-thread cache (i#948).  It looks like a delayed
+     * free to the coalescing code, so it is never merged, and it is skipped
+     * by iteration as it is neither live nor on any arena list.
+     */
+    CHUNK_THREAD_CACHED   = (CHUNK_FREED | CHUNK_DELAY_FREE | CHUNK_SKIP_ITER),
 };
 
+/* With per-thread caches, a chunk's flags can be updated by its owning
+ * thread without the arena lock while a neighbor updates CHUNK_PREV_FREE
+ * under the lock, so such updates must be atomic.
+ */
+#ifdef UNIX
+# define CHUNK_FLAGS_SET(head, f) __sync_fetch_and_or(&(head)->flags, (ushort)(f))
+# define CHUNK_FLAGS_CLEAR(head, f) __sync_fetch_and_and(&(head)->flags, (ushort)~(f))
+#else
+/* thread caches are not supported on Windows */
+# define CHUNK_FLAGS_SET(head, f) ((head)->flags |= (f))
+# define CHUNK_FLAGS_CLEAR(head, f) ((head)->flags &= ~(f))
+#endif
+
 #define HEADER_MAGIC 0x5244 /* "DR" */
 
 /* This header struct is used in both a traditional co-located header
@@ -270,6 +303,8 @@ typedef struct _free_lists_t {
      */
     free_header_t *front[NUM_FREE_LISTS];
     free_header_t *last[NUM_FREE_LISTS];
+    /* bit i is set iff front[i] != NULL */
+    uint nonempty[FREE_LIST_BITMAP_WORDS];
 } free_lists_t;
 
 #ifdef LINUX
@@ -397,6 +432,13 @@ static uint num_coalesces;
 static uint num_dealloc;
 static uint dbgcrt_mismatch;
 static uint allocs_left_native;
+static uint free_list_searches;
+static uint free_list_search_misses;
+static uint free_list_larger_bucket;
+static uint thread_cache_hits;
+static uint thread_cache_fills;
+static uint thread_cache_flushes;
+static uint thread_cache_frees;
 #endif
 
 #ifdef DEBUG
@@ -555,9 +597,10 @@ app_heap_unlock(void *drcontext, void *recur_lock)
 static void
 arena_lock(void *drcontext, arena_header_t *arena, bool app_synch)
 {
-    /* XXX i#948: use per-thread free lists to avoid lock in common case,
-     * for Linux or Windows libc at least (where heap synch is not part
-     * of app API), and when !alloc_ops.global_lock.
+    /* i#948: on UNIX, small allocations are usually served from per-thread
+     * caches without calling here (see thread_cache_alloc()).
+     * XXX: extend that to Windows libc, where heap synch is not part of
+     * the app API.
      */
     if (app_synch)
         app_heap_lock(drcontext, arena->lock);
@@ -1171,7 +1214,7 @@ set_prev_size_field(arena_header_t *arena, chunk_header_t *head)
     if (next != NULL) {
         ASSERT(!TEST(CHUNK_FREED, next->flags) || TEST(CHUNK_DELAY_FREE, next->flags),
                "can't set prev size on true free");
-        next->flags |= CHUNK_PREV_FREE;
+        CHUNK_FLAGS_SET(next, CHUNK_PREV_FREE);
         if (head->alloc_size / CHUNK_MIN_SIZE <= USHRT_MAX) {
             next->u.unfree.prev_size_shr = head->alloc_size / CHUNK_MIN_SIZE;
             LOG(3, "set prev_size_shr of "PFX" to "PIFX"\n",
@@ -1207,28 +1250,76 @@ get_prev_size_field(chunk_header_t *head)
         return head->u.unfree.prev_size_shr * CHUNK_MIN_SIZE;
 }
 
-#define GCC_VERSION (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__)
+static void
+free_list_sizes_init(void)
+{
+    uint bucket, i;
+    for (bucket = 0; bucket < FREE_LIST_LINEAR_BUCKETS; bucket++)
+        free_list_sizes[bucket] = CHUNK_MIN_SIZE + bucket * CHUNK_ALIGNMENT;
+    for (i = 0; bucket < NUM_FREE_LISTS; bucket++, i++) {
+        uint shift = FREE_LIST_LINEAR_BITS + i / FREE_LIST_SUBDIVS;
+        free_list_sizes[bucket] = (1U << shift) +
+            (i % FREE_LIST_SUBDIVS) * (1U << (shift - FREE_LIST_SUBDIV_BITS));
+    }
+    ASSERT(free_list_sizes[FREE_LIST_LINEAR_BUCKETS] == FREE_LIST_LINEAR_MAX &&
+           free_list_sizes[NUM_FREE_LISTS - 1] == CHUNK_MIN_MMAP,
+           "free list size classes inconsistent");
+}
 
-/* XXX: i#1269 index above array bounds warning on x64 build using gcc 4.8.1 */
-#if defined(X64) && GCC_VERSION > 40801
-#  define IF_GCC_WARN(x)
-#else
-#  define IF_GCC_WARN(x) x
-#endif
+/* Returns the bucket whose size range contains size */
+static inline uint
+bucket_for_size(heapsz_t size)
+{
+    uint msb, bucket;
+    if (size < FREE_LIST_LINEAR_MAX) {
+        ASSERT(size >= CHUNK_MIN_SIZE, "chunk too small");
+        bucket = (size - CHUNK_MIN_SIZE) / CHUNK_ALIGNMENT;
+    } else if (size >= CHUNK_MIN_MMAP)
+        bucket = NUM_FREE_LISTS - 1;
+    else {
+        msb = bitscan_reverse32(size);
+        bucket = FREE_LIST_LINEAR_BUCKETS +
+            (msb - FREE_LIST_LINEAR_BITS) * FREE_LIST_SUBDIVS +
+            ((size >> (msb - FREE_LIST_SUBDIV_BITS)) & (FREE_LIST_SUBDIVS - 1));
+    }
+    ASSERT(size >= free_list_sizes[bucket] &&
+           (bucket == NUM_FREE_LISTS - 1 || size < free_list_sizes[bucket + 1]),
+           "bucket invariant violated");
+    return bucket;
+}
 
 static inline uint
 bucket_index(chunk_header_t *head)
 {
-    uint bucket;
-    /* pivot around small vs large first to avoid walking whole list for small: */
-    uint start = (head->alloc_size > free_list_sizes[6]) ? (NUM_FREE_LISTS - 1) : 6;
-    /* our buckets guarantee that all allocs in that bucket have at least that size */
-    for (bucket = start; head->alloc_size < free_list_sizes[bucket]
-         /* if bucket is 0 this cond breaks to avoid free_list_sizes[-1] */
-         IF_GCC_WARN(&& bucket > 0);
-         bucket--)
-        ; /* nothing */
-    ASSERT(head->alloc_size >= free_list_sizes[bucket], "bucket invariant violated");
+    return bucket_for_size(head->alloc_size);
+}
+
+/* Returns the smallest bucket whose entries are all at least aligned_size,
+ * or the var-size bucket if there is no such bucket.
+ */
+static inline uint
+guaranteed_bucket(heapsz_t aligned_size)
+{
+    uint bucket = bucket_for_size(aligned_size);
+    if (aligned_size > free_list_sizes[bucket] && bucket < NUM_FREE_LISTS - 1)
+        bucket++;
+    return bucket;
+}
+
+/* Returns the first non-empty bucket at or above bucket, or NUM_FREE_LISTS */
+static inline uint
+first_nonempty_bucket(free_lists_t *lists, uint bucket)
+{
+    uint word = bucket / 32;
+    uint bits = lists->nonempty[word] & ~((1U << (bucket % 32)) - 1);
+    while (bits == 0) {
+        if (++word >= FREE_LIST_BITMAP_WORDS)
+            return NUM_FREE_LISTS;
+        bits = lists->nonempty[word];
+    }
+    bucket = word * 32 + bitscan_forward32(bits);
+    ASSERT(bucket < NUM_FREE_LISTS && lists->front[bucket] != NULL,
+           "free list bitmap inconsistent");
     return bucket;
 }
 
@@ -1241,6 +1332,8 @@ remove_from_free_list(arena_header_t *arena, free_header_t *target, uint bucket)
             bucket = bucket_index(&target->head);
         ASSERT(target == arena->free_list->front[bucket], "free list corrupted");
         arena->free_list->front[bucket] = target->next;
+        if (target->next == NULL)
+            arena->free_list->nonempty[bucket / 32] &= ~(1U << (bucket % 32));
     } else {
         target->head.u.prev->next = target->next;
     }
@@ -1263,6 +1356,7 @@ add_to_free_list(arena_header_t *arena, chunk_header_t *head)
     if (arena->free_list->last[bucket] == NULL) {
         ASSERT(arena->free_list->front[bucket] == NULL, "inconsistent free list");
         arena->free_list->front[bucket] = cur;
+        arena->free_list->nonempty[bucket / 32] |= 1U << (bucket % 32);
         cur->head.u.prev = NULL;
     } else {
         cur->head.u.prev = arena->free_list->last[bucket];
@@ -1414,6 +1508,27 @@ coalesce_adjacent_frees(arena_header_t *arena, free_header_t *cur)
     return consider_giving_back_memory(arena, tofree);
 }
 
+/* Coalesces cur, which must be a true free, with its neighbors and places
+ * the result on the free lists.
+ */
+static void
+move_to_free_list(arena_header_t *arena, free_header_t *cur)
+{
+    ASSERT(TEST(CHUNK_FREED, cur->head.flags) &&
+           !TEST(CHUNK_DELAY_FREE, cur->head.flags), "must be a true free");
+    cur = coalesce_adjacent_frees(arena, cur);
+    if (cur != NULL) {
+        set_prev_size_field(arena, &cur->head);
+        add_to_free_list(arena, &cur->head);
+        ASSERT(!TEST(CHUNK_PREV_FREE, cur->head.flags), "no adjacent frees");
+        DOLOG(2, {
+            chunk_header_t *next = next_chunk_forward(arena, &cur->head, NULL);
+            ASSERT(next == NULL || TEST(CHUNK_PREV_FREE, next->flags),
+                   "missing prev free pointer");
+        });
+    }
+}
+
 static bool
 shift_from_delay_list_to_free_list(arena_header_t *arena)
 {
@@ -1436,17 +1551,7 @@ shift_from_delay_list_to_free_list(arena_header_t *arena)
     /* We coalesce here, rather than on initial free, b/c only now
      * can we throw away the user_data
      */
-    cur = coalesce_adjacent_frees(arena, cur);
-    if (cur != NULL) {
-        set_prev_size_field(arena, &cur->head);
-        add_to_free_list(arena, &cur->head);
-        ASSERT(!TEST(CHUNK_PREV_FREE, cur->head.flags), "no adjacent frees");
-        DOLOG(2, {
-            chunk_header_t *next = next_chunk_forward(arena, &cur->head, NULL);
-            ASSERT(next == NULL || TEST(CHUNK_PREV_FREE, next->flags),
-                   "missing prev free pointer");
-        });
-    }
+    move_to_free_list(arena, cur);
     return true;
 }
 
@@ -1478,31 +1583,6 @@ add_to_delay_list(arena_header_t *arena, chunk_header_t *head)
     }
 }
 
-static chunk_header_t *
-search_free_list_bucket(arena_header_t *arena, heapsz_t aligned_size, uint bucket)
-{
-    /* search for large enough chunk */
-    free_header_t *cur;
-    chunk_header_t *head = NULL;
-#ifdef UNIX
-    /* On Windows we have HEAP_NO_SERIALIZE.  Not worth passing the flags in. */
-    ASSERT(dr_recurlock_self_owns(arena->lock), "caller must hold lock");
-#endif
-    ASSERT(bucket < NUM_FREE_LISTS, "invalid param");
-    for (cur = arena->free_list->front[bucket];
-         cur != NULL && cur->head.alloc_size < aligned_size;
-         cur = cur->next)
-        ; /* nothing */
-    if (cur != NULL) {
-        remove_from_free_list(arena, cur, bucket);
-        head = (chunk_header_t *) cur;
-    }
-    LOG(3, "arena "PFX" taking cur="PFX" => bucket %d free front="PFX" last="PFX"\n",
-        arena, cur, bucket, arena->free_list->front[bucket],
-        arena->free_list->last[bucket]);
-    return head;
-}
-
 /* Caller needs only to point free_hdr at the right point: this routine will fill it in.
  */
 static void
@@ -1551,7 +1631,7 @@ static chunk_header_t *
 find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t aligned_size)
 {
     chunk_header_t *head = NULL;
-    uint bucket;
+    uint bucket, guaranteed;
 #ifdef UNIX
     /* On Windows we have HEAP_NO_SERIALIZE.  Not worth passing the flags in. */
     ASSERT(dr_recurlock_self_owns(arena->lock), "caller must hold lock");
@@ -1559,17 +1639,9 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
 
     /* b/c we're delaying, we're not able to re-use a just-freed chunk.
      * thus we go for time over space and use the guaranteed-size bucket
-     * before searching the maybe-big-enough bucket.
-     */
-    for (bucket = 0;
-         bucket < NUM_FREE_LISTS - 1 && aligned_size > free_list_sizes[bucket];
-         bucket++)
-        ; /* nothing */
-
-    /* I tried searching the maybe-big-enough bucket (bucket - 1) before
-     * going to bigger buckets but it's a huge time sink for some benchmarks
-     * and doesn't seem to help much on others so I removed it.
+     * rather than searching the maybe-big-enough bucket.
      */
+    guaranteed = guaranteed_bucket(aligned_size);
 
     /* Use a larger bucket to avoid delaying a ton of allocs of a
      * certain size and never re-using them for pathological app alloc
@@ -1578,33 +1650,27 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
      * it seems worth doing every time, even at the risk of fragmentation,
      * since we have coalescing in place.
      */
-    if (head == NULL && arena->free_list->front[bucket] == NULL) {
-        while (bucket < NUM_FREE_LISTS - 1 && arena->free_list->front[bucket] == NULL)
-            bucket++;
-    }
+    bucket = first_nonempty_bucket(arena->free_list, guaranteed);
+    STATS_INC(free_list_searches);
 
-    if (head == NULL && arena->free_list->front[bucket] != NULL) {
-        LOG(2, "\tallocating from larger bucket size to reduce delayed frees\n");
-        if (bucket == NUM_FREE_LISTS - 1) {
-            /* var-size bucket: have to search */
-            head = search_free_list_bucket(arena, aligned_size, bucket);
-        } else {
-            /* guaranteed to be big enough so take from front */
-            ASSERT(aligned_size <= free_list_sizes[bucket], "logic error");
-            head = (chunk_header_t *) arena->free_list->front[bucket];
-            arena->free_list->front[bucket] = arena->free_list->front[bucket]->next;
-            if (head == (chunk_header_t *) arena->free_list->last[bucket])
-                arena->free_list->last[bucket] = arena->free_list->front[bucket];
-            else {
-                free_header_t *cur = (free_header_t *) head;
-                ASSERT(cur->next != NULL, "free list corrupted");
-                cur->next->head.u.prev = NULL;
-            }
-            LOG(3, "arena "PFX" bucket %d taking "PFX" => free front="PFX" last="PFX"\n",
-                arena, bucket, head, arena->free_list->front[bucket],
-                arena->free_list->last[bucket]);
+    if (bucket < NUM_FREE_LISTS) {
+        if (bucket > guaranteed) {
+            LOG(2, "\tallocating from larger bucket size to reduce delayed frees\n");
+            STATS_INC(free_list_larger_bucket);
         }
+        /* Requests of CHUNK_MIN_MMAP or more are mmapped instead, so even
+         * the var-size bucket's entries are all big enough: we take from
+         * the front.
+         */
+        ASSERT(aligned_size <= free_list_sizes[bucket], "logic error");
+        head = (chunk_header_t *) arena->free_list->front[bucket];
+        remove_from_free_list(arena, (free_header_t *) head, bucket);
+        LOG(3, "arena "PFX" bucket %d taking "PFX" => free front="PFX" last="PFX"\n",
+            arena, bucket, head, arena->free_list->front[bucket],
+            arena->free_list->last[bucket]);
     }
+    if (head == NULL)
+        STATS_INC(free_list_search_misses);
 
     if (head != NULL) {
         chunk_header_t *next;
@@ -1634,13 +1700,364 @@ find_free_list_entry(arena_header_t *arena, heapsz_t request_size, heapsz_t alig
 
         next = next_chunk_forward(arena, head, &container);
         if (next != NULL)
-            next->flags &= ~CHUNK_PREV_FREE;
+            CHUNK_FLAGS_CLEAR(next, CHUNK_PREV_FREE);
         else if (container != NULL)
             container->prev_free_sz = 0;
     }
     return head;
 }
 
+/***************************************************************************
+ * per-thread caches
+ */
+
+/* i#948: to avoid the arena lock for most small allocations, each thread
+ * keeps a small cache of free chunks for each small size class.  Chunks only
+ * enter a cache from the arena free lists, i.e., after they have passed through
+ * the delayed free FIFO, so the use-after-free window and the redzones are
+ * unaffected.  A cached chunk is marked with CHUNK_THREAD_CACHED.  Small frees
+ * are likewise queued per thread and added to the delayed free FIFO
+ * THREAD_CACHE_FILL at a time; a queued chunk is already marked as a delayed
+ * free.  The caches are flushed back to the arena lists on thread exit and
+ * prior to any iteration (which includes leak scans).
+ *
+ * The client is told about a cached chunk leaving the free lists
+ * (client_handle_free_reuse()) under the arena lock when the cache is filled,
+ * but its allocation and free notifications run without the arena lock, so
+ * the client must only enable the caches if those are thread-safe.
+ *
+ * This is UNIX-only: on Windows, heap synchronization is part of the app API
+ * (HeapLock, HEAP_NO_SERIALIZE) so we can't bypass it.  It is also disabled
+ * with alloc_ops.global_lock, whose users need all operations serialized.
+ *
+ * Lock order: arena lock, then thread_cache_list_lock, then a cache's lock.
+ * The allocation and free fast paths take only their own thread's cache lock,
+ * which is only otherwise acquired when flushing.
+ */
+#ifdef UNIX
+/* we only cache buckets whose guaranteed size is at most this */
+# define THREAD_CACHE_MAX_SIZE 512
+/* how many chunks to move from the free lists into a cache at once */
+# define THREAD_CACHE_FILL 8
+
+typedef struct _thread_cache_t {
+    void *lock;
+    /* singly-linked via free_header_t.next */
+    free_header_t *front[NUM_FREE_LISTS];
+    /* frees not yet on the delayed free FIFO, oldest first */
+    free_header_t *pending_front;
+    free_header_t *pending_last;
+    uint num_pending;
+    struct _thread_cache_t *next_cache;
+    struct _thread_cache_t *prev_cache;
+} thread_cache_t;
+
+static int tls_idx_thread_cache = -1;
+/* protects thread_cache_list */
+static void *thread_cache_list_lock;
+static thread_cache_t *thread_cache_list;
+/* buckets [0, thread_cache_buckets) are cached */
+static uint thread_cache_buckets;
+
+static inline thread_cache_t *
+thread_cache_for_request(void *drcontext, arena_header_t *arena, alloc_flags_t flags,
+                         size_t alignment, heapsz_t aligned_size)
+{
+    if (tls_idx_thread_cache < 0 || arena != cur_arena ||
+        !TEST(ALLOC_SYNCHRONIZE, flags) || alignment > CHUNK_ALIGNMENT ||
+        aligned_size > THREAD_CACHE_MAX_SIZE)
+        return NULL;
+    return (thread_cache_t *) drmgr_get_tls_field(drcontext, tls_idx_thread_cache);
+}
+
+/* Adds the list of queued frees starting at front to the delayed free FIFO.
+ * Caller must hold the arena lock.
+ */
+static void
+thread_cache_add_delayed(arena_header_t *arena, free_header_t *front)
+{
+    ASSERT(dr_recurlock_self_owns(arena->lock), "caller must hold lock");
+    while (front != NULL) {
+        free_header_t *cur = front;
+        front = cur->next;
+        ASSERT(TESTALL(CHUNK_FREED | CHUNK_DELAY_FREE, cur->head.flags),
+               "queued free corrupted");
+        add_to_delay_list(arena, &cur->head);
+    }
+}
+
+/* Returns all of cache's chunks to the arena free lists and its queued frees
+ * to the delayed free FIFO.  Caller must hold both the arena lock and cache->lock.
+ */
+static void
+thread_cache_flush(arena_header_t *arena, thread_cache_t *cache)
+{
+    uint bucket;
+    ASSERT(dr_recurlock_self_owns(arena->lock), "caller must hold lock");
+    thread_cache_add_delayed(arena, cache->pending_front);
+    cache->pending_front = NULL;
+    cache->pending_last = NULL;
+    cache->num_pending = 0;
+    for (bucket = 0; bucket < thread_cache_buckets; bucket++) {
+        while (cache->front[bucket] != NULL) {
+            free_header_t *cur = cache->front[bucket];
+            cache->front[bucket] = cur->next;
+            ASSERT(TESTALL(CHUNK_THREAD_CACHED, cur->head.flags), "cache corrupted");
+            LOG(3, "%s: returning "PFX" from bucket %d\n", __FUNCTION__, cur, bucket);
+            CHUNK_FLAGS_CLEAR(&cur->head, CHUNK_DELAY_FREE | CHUNK_SKIP_ITER);
+            move_to_free_list(arena, cur);
+            STATS_INC(thread_cache_flushes);
+        }
+    }
+}
+
+/* Caller must hold the arena lock and thread_cache_list_lock */
+static void
+thread_cache_delete(thread_cache_t *cache)
+{
+    if (cache->prev_cache == NULL)
+        thread_cache_list = cache->next_cache;
+    else
+        cache->prev_cache->next_cache = cache->next_cache;
+    if (cache->next_cache != NULL)
+        cache->next_cache->prev_cache = cache->prev_cache;
+    dr_mutex_lock(cache->lock);
+    thread_cache_flush(cur_arena, cache);
+    dr_mutex_unlock(cache->lock);
+    dr_mutex_destroy(cache->lock);
+    global_free(cache, sizeof(*cache), HEAPSTAT_WRAP);
+}
+
+static void
+thread_cache_thread_init(void *drcontext)
+{
+    thread_cache_t *cache = (thread_cache_t *)
+        global_alloc(sizeof(*cache), HEAPSTAT_WRAP);
+    memset(cache, 0, sizeof(*cache));
+    cache->lock = dr_mutex_create();
+    dr_mutex_lock(thread_cache_list_lock);
+    cache->next_cache = thread_cache_list;
+    if (thread_cache_list != NULL)
+        thread_cache_list->prev_cache = cache;
+    thread_cache_list = cache;
+    dr_mutex_unlock(thread_cache_list_lock);
+    drmgr_set_tls_field(drcontext, tls_idx_thread_cache, (void *) cache);
+}
+
+static void
+thread_cache_thread_exit(void *drcontext)
+{
+    thread_cache_t *cache = (thread_cache_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_thread_cache);
+    if (cache == NULL)
+        return;
+    drmgr_set_tls_field(drcontext, tls_idx_thread_cache, NULL);
+    dr_recurlock_lock(cur_arena->lock);
+    dr_mutex_lock(thread_cache_list_lock);
+    thread_cache_delete(cache);
+    dr_mutex_unlock(thread_cache_list_lock);
+    dr_recurlock_unlock(cur_arena->lock);
+}
+
+static void
+thread_cache_init(void)
+{
+    thread_cache_buckets = guaranteed_bucket(THREAD_CACHE_MAX_SIZE) + 1;
+    ASSERT(thread_cache_buckets < NUM_FREE_LISTS, "var-size bucket can't be cached");
+    thread_cache_list_lock = dr_mutex_create();
+    tls_idx_thread_cache = drmgr_register_tls_field();
+    ASSERT(tls_idx_thread_cache > -1, "unable to reserve TLS field");
+    if (!drmgr_register_thread_init_event(thread_cache_thread_init) ||
+        !drmgr_register_thread_exit_event(thread_cache_thread_exit))
+        ASSERT(false, "drmgr registration failed");
+}
+
+static void
+thread_cache_exit(void)
+{
+    if (tls_idx_thread_cache < 0)
+        return;
+    if (!drmgr_unregister_thread_init_event(thread_cache_thread_init) ||
+        !drmgr_unregister_thread_exit_event(thread_cache_thread_exit))
+        ASSERT(false, "drmgr unregistration failed");
+    dr_recurlock_lock(cur_arena->lock);
+    dr_mutex_lock(thread_cache_list_lock);
+    while (thread_cache_list != NULL)
+        thread_cache_delete(thread_cache_list);
+    dr_mutex_unlock(thread_cache_list_lock);
+    dr_recurlock_unlock(cur_arena->lock);
+    drmgr_unregister_tls_field(tls_idx_thread_cache);
+    tls_idx_thread_cache = -1;
+    dr_mutex_destroy(thread_cache_list_lock);
+}
+#endif /* UNIX */
+
+/* Returns a chunk from the current thread's cache, or NULL.
+ * Does not require the arena lock.
+ */
+static chunk_header_t *
+thread_cache_alloc(void *drcontext, arena_header_t *arena, alloc_flags_t flags,
+                   size_t alignment, heapsz_t aligned_size)
+{
+#ifdef UNIX
+    thread_cache_t *cache =
+        thread_cache_for_request(drcontext, arena, flags, alignment, aligned_size);
+    free_header_t *cur;
+    uint bucket;
+    if (cache == NULL)
+        return NULL;
+    bucket = guaranteed_bucket(aligned_size);
+    dr_mutex_lock(cache->lock);
+    cur = cache->front[bucket];
+    if (cur != NULL)
+        cache->front[bucket] = cur->next;
+    dr_mutex_unlock(cache->lock);
+    if (cur == NULL)
+        return NULL;
+    ASSERT(TESTALL(CHUNK_THREAD_CACHED, cur->head.flags), "cache corrupted");
+    ASSERT(cur->head.alloc_size >= aligned_size, "cached chunk too small");
+    ASSERT(cur->head.user_data == NULL, "cached chunk should have no data");
+    /* a neighbor may be updating CHUNK_PREV_FREE under the arena lock */
+    CHUNK_FLAGS_CLEAR(&cur->head, CHUNK_THREAD_CACHED);
+    LOG(3, "%s: bucket %d taking "PFX"\n", __FUNCTION__, bucket, cur);
+    STATS_INC(thread_cache_hits);
+    return &cur->head;
+#else
+    return NULL;
+#endif
+}
+
+/* Moves up to THREAD_CACHE_FILL chunks from the guaranteed-size bucket for
+ * aligned_size into the current thread's cache, telling the client they are
+ * being reused now.  Caller must hold the arena lock.
+ */
+static void
+thread_cache_fill(void *drcontext, arena_header_t *arena, alloc_flags_t flags,
+                  size_t alignment, heapsz_t aligned_size, dr_mcontext_t *mc)
+{
+#ifdef UNIX
+    thread_cache_t *cache =
+        thread_cache_for_request(drcontext, arena, flags, alignment, aligned_size);
+    free_header_t *fill = NULL, *fill_last = NULL;
+    uint bucket, i;
+    if (cache == NULL)
+        return;
+    ASSERT(dr_recurlock_self_owns(arena->lock), "caller must hold lock");
+    bucket = guaranteed_bucket(aligned_size);
+    for (i = 0; i < THREAD_CACHE_FILL && arena->free_list->front[bucket] != NULL; i++) {
+        free_header_t *cur = arena->free_list->front[bucket];
+        chunk_header_t *next;
+        arena_header_t *container = NULL;
+        malloc_info_t info;
+        remove_from_free_list(arena, cur, bucket);
+        header_to_info(&cur->head, &info, NULL, 0);
+        client_handle_free_reuse(drcontext, &info, mc);
+        if (cur->head.user_data != NULL) {
+            client_malloc_data_free(cur->head.user_data);
+            cur->head.user_data = NULL;
+        }
+        cur->head.flags &= ~ALLOCATOR_TYPE_FLAGS;
+        cur->head.flags |= CHUNK_THREAD_CACHED;
+        /* A cached chunk is not a true free so its neighbors must not
+         * try to coalesce with it.
+         */
+        next = next_chunk_forward(arena, &cur->head, &container);
+        if (next != NULL)
+            CHUNK_FLAGS_CLEAR(next, CHUNK_PREV_FREE);
+        else if (container != NULL)
+            container->prev_free_sz = 0;
+        cur->next = fill;
+        fill = cur;
+        if (fill_last == NULL)
+            fill_last = cur;
+        STATS_INC(thread_cache_fills);
+    }
+    if (fill == NULL)
+        return;
+    LOG(3, "%s: moved %d chunks from bucket %d\n", __FUNCTION__, i, bucket);
+    dr_mutex_lock(cache->lock);
+    fill_last->next = cache->front[bucket];
+    cache->front[bucket] = fill;
+    dr_mutex_unlock(cache->lock);
+#endif
+}
+
+/* Returns the current thread's cache if the free of head, which must be live,
+ * can be queued there rather than added to the delayed free FIFO under the
+ * arena lock.  Returns NULL otherwise.
+ */
+static void *
+thread_cache_for_free(void *drcontext, arena_header_t *arena, alloc_flags_t flags,
+                      chunk_header_t *head)
+{
+#ifdef UNIX
+    if (TESTANY(CHUNK_MMAP | CHUNK_PRE_US, head->flags))
+        return NULL;
+    return thread_cache_for_request(drcontext, arena, flags, CHUNK_ALIGNMENT,
+                                    head->alloc_size);
+#else
+    return NULL;
+#endif
+}
+
+/* Queues head, already marked as a delayed free, in cache_in (which must come
+ * from thread_cache_for_free()), and adds the queue to the delayed free FIFO
+ * once it holds THREAD_CACHE_FILL frees.
+ */
+static void
+thread_cache_free(void *drcontext, arena_header_t *arena, alloc_flags_t flags,
+                  void *cache_in, chunk_header_t *head)
+{
+#ifdef UNIX
+    thread_cache_t *cache = (thread_cache_t *) cache_in;
+    free_header_t *cur = (free_header_t *) head;
+    free_header_t *full = NULL;
+    ASSERT(TESTALL(CHUNK_FREED | CHUNK_DELAY_FREE, head->flags), "not marked freed");
+    cur->next = NULL;
+    dr_mutex_lock(cache->lock);
+    if (cache->pending_last == NULL)
+        cache->pending_front = cur;
+    else
+        cache->pending_last->next = cur;
+    cache->pending_last = cur;
+    cache->num_pending++;
+    if (cache->num_pending >= THREAD_CACHE_FILL) {
+        full = cache->pending_front;
+        cache->pending_front = NULL;
+        cache->pending_last = NULL;
+        cache->num_pending = 0;
+    }
+    dr_mutex_unlock(cache->lock);
+    if (full != NULL) {
+        /* lock order: we must not hold cache->lock here */
+        arena_lock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
+        thread_cache_add_delayed(arena, full);
+        arena_unlock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
+    }
+    STATS_INC(thread_cache_frees);
+#endif
+}
+
+/* Flushes every thread's cache back to the free lists */
+static void
+thread_cache_flush_all(void)
+{
+#ifdef UNIX
+    thread_cache_t *cache;
+    if (tls_idx_thread_cache < 0)
+        return;
+    dr_recurlock_lock(cur_arena->lock);
+    dr_mutex_lock(thread_cache_list_lock);
+    for (cache = thread_cache_list; cache != NULL; cache = cache->next_cache) {
+        dr_mutex_lock(cache->lock);
+        thread_cache_flush(cur_arena, cache);
+        dr_mutex_unlock(cache->lock);
+    }
+    dr_mutex_unlock(thread_cache_list_lock);
+    dr_recurlock_unlock(cur_arena->lock);
+#endif
+}
+
 /* i#1581: to avoid retaddr local vars from callstack walks messing up app
  * callstacks, we invoke the 2nd layer on a clean dstack (this lets us keep
  * just the outer layer as stdcall, and avoids complicating drwrap further).
@@ -1669,6 +2086,7 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
     heapsz_t aligned_size;
     byte *res = NULL;
     chunk_header_t *head = NULL;
+    bool locked = false;
     ASSERT((alloc_type & ~(ALLOCATOR_TYPE_FLAGS)) == 0, "invalid type flags");
 
     if (request_size > UINT_MAX ||
@@ -1703,13 +2121,18 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
     if (aligned_size < CHUNK_MIN_SIZE)
         aligned_size = CHUNK_MIN_SIZE;
 
-    arena_lock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
+    /* i#948: try the per-thread cache before taking the arena lock */
+    head = thread_cache_alloc(drcontext, arena, flags, alignment, aligned_size);
+    if (head == NULL) {
+        arena_lock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
+        locked = true;
+    }
 
     /* for large requests we do direct mmap with own redzones.
      * we use the large malloc table to track them for iteration.
      * XXX: for simplicity, not delay-freeing these for now
      */
-    if (aligned_size + header_size >= CHUNK_MIN_MMAP) {
+    if (head == NULL && aligned_size + header_size >= CHUNK_MIN_MMAP) {
         mmap_header_t *mhead;
         size_t map_size = (size_t)
             ALIGN_FORWARD(aligned_size + sizeof(mmap_header_t) +
@@ -1747,13 +2170,18 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
         head->alloc_size = (map + map_size - alloc_ops.redzone_size - res);
         heap_region_add(map, map + map_size, HEAP_MMAP, mc);
     } else {
-        /* look for free list entry */
-        head = find_free_list_entry(arena, request_size, aligned_size);
-        if (head != NULL) {
-            malloc_info_t info;
-            header_to_info(head, &info, NULL, 0);
-            client_handle_free_reuse(drcontext, &info, mc);
+        if (head == NULL) {
+            /* look for free list entry */
+            head = find_free_list_entry(arena, request_size, aligned_size);
+            if (head != NULL) {
+                malloc_info_t info;
+                header_to_info(head, &info, NULL, 0);
+                client_handle_free_reuse(drcontext, &info, mc);
+                /* the cache missed, so refill it */
+                thread_cache_fill(drcontext, arena, flags, alignment, aligned_size, mc);
+            }
         }
+        /* else, a cached chunk's reuse was reported when it was cached */
     }
 
     /* if no free list entry, get new memory */
@@ -1829,7 +2257,8 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
     ASSERT(head->alloc_size - request_size <= REQUEST_DIFF_MAX,
            "illegally large chunk padding");
     head->u.unfree.request_diff = head->alloc_size - request_size;
-    head->flags |= alloc_type;
+    /* a neighbor may be updating CHUNK_PREV_FREE if we don't hold the lock */
+    CHUNK_FLAGS_SET(head, alloc_type);
     res = ptr_from_header(head);
     if (!ALIGNED(res, alignment)) {
         /* Place the pre-aligned padding onto the free list */
@@ -1865,7 +2294,8 @@ replace_alloc_common(arena_header_t *arena, size_t request_size, size_t alignmen
         STATS_INC(num_mallocs);
 
  replace_alloc_common_done:
-    arena_unlock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
+    if (locked)
+        arena_unlock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
 
     return res;
 }
@@ -1934,6 +2364,7 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
 {
     chunk_header_t *head = header_from_ptr(ptr);
     malloc_info_t info;
+    void *cache;
 
     if (!is_live_alloc(ptr, arena, head)) { /* including NULL */
         /* w/o early inject, or w/ delayed instru, there are allocs in place
@@ -2020,7 +2451,12 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
         }
     }
 
-    arena_lock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
+    /* i#948: a small free can be queued in the per-thread cache without
+     * taking the arena lock
+     */
+    cache = thread_cache_for_free(drcontext, arena, flags, head);
+    if (cache == NULL)
+        arena_lock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
 
     check_type_match(ptr, head, free_type, flags, mc, caller);
 
@@ -2041,7 +2477,13 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
     /* Mark this after client_remove_malloc_pre so client can iterate
      * and see the alloc as currently-live, matching wrapping behavior.
      */
-    head->flags |= CHUNK_FREED; /* even if CHUNK_MMAP, so a client iter will skip */
+    if (cache != NULL) {
+        /* A neighbor may be updating CHUNK_PREV_FREE under the arena lock.
+         * We mark it as a delayed free right away so it is never coalesced.
+         */
+        CHUNK_FLAGS_SET(head, CHUNK_FREED | CHUNK_DELAY_FREE);
+    } else
+        head->flags |= CHUNK_FREED; /* even if CHUNK_MMAP, so a client iter will skip */
 
     if (TEST(ALLOC_INVOKE_CLIENT_DATA, flags))
         client_remove_malloc_post(&info);
@@ -2058,7 +2500,10 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
     if (!TESTANY(CHUNK_MMAP | CHUNK_PRE_US, head->flags)) {
         LOG(2, "\treplace_free_common "PFX" == request=%d, alloc=%d, arena="PFX"\n",
             ptr, chunk_request_size(head), head->alloc_size, arena);
-        add_to_delay_list(arena, head);
+        if (cache != NULL)
+            thread_cache_free(drcontext, arena, flags, cache, head);
+        else
+            add_to_delay_list(arena, head);
         /* At this point head may be invalid to de-ref, if coalesced or freed (this
          * will only happen if -delay_frees is 0)
          */
@@ -2076,7 +2521,8 @@ replace_free_common(arena_header_t *arena, void *ptr, alloc_flags_t flags,
 
     STATS_INC(num_frees);
 
-    arena_unlock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
+    if (cache == NULL)
+        arena_unlock(drcontext, arena, TEST(ALLOC_SYNCHRONIZE, flags));
     return true;
 }
 
@@ -2367,6 +2813,11 @@ alloc_iterate(malloc_iter_cb_t cb, void *iter_data, bool only_live)
 
     ASSERT(!alloc_ops.external_headers, "NYI: walk malloc table");
 
+    /* Cached chunks are skipped by the walk: put them back where a leak
+     * scan or other iterator expects free memory to be.
+     */
+    thread_cache_flush_all();
+
     LOG(3, "%s: iterating heap regions\n", __FUNCTION__);
     heap_region_iterate(alloc_iter_own_arena, &data);
 
@@ -2513,7 +2964,9 @@ bool
 alloc_replace_overlaps_delayed_free(byte *start, byte *end,
                                     malloc_info_t *info OUT)
 {
-    return alloc_replace_overlaps_region(start, end, info, CHUNK_DELAY_FREE, 0);
+    /* exclude chunks in per-thread caches (CHUNK_THREAD_CACHED) */
+    return alloc_replace_overlaps_region(start, end, info, CHUNK_DELAY_FREE,
+                                         CHUNK_SKIP_ITER);
 }
 
 bool
@@ -5177,7 +5630,7 @@ malloc_replace__set_client_flag(app_pc start, uint client_flag)
     chunk_header_t *head = header_from_ptr_include_pre_us(start);
     if (head == NULL)
         return false;
-    head->flags |= (client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
+    CHUNK_FLAGS_SET(head, client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
     return true;
 }
 
@@ -5187,7 +5640,7 @@ malloc_replace__clear_client_flag(app_pc start, uint client_flag)
     chunk_header_t *head = header_from_ptr_include_pre_us(start);
     if (head == NULL)
         return false;
-    head->flags &= ~(client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
+    CHUNK_FLAGS_CLEAR(head, client_flag & MALLOC_POSSIBLE_CLIENT_FLAGS);
     return true;
 }
 
@@ -5251,6 +5704,8 @@ alloc_replace_init(void)
     if (!drmgr_register_bb_app2app_event(bb_event, NULL))
         ASSERT(false, "drmgr registration failed");
 
+    free_list_sizes_init();
+
     if (alloc_ops.shared_redzones) {
         /* For x64 we have to add 8 extra bytes to align this */
         header_size = ALIGN_FORWARD(sizeof(chunk_header_t), CHUNK_ALIGNMENT);
@@ -5341,6 +5796,11 @@ alloc_replace_init(void)
     heap_iterator(NULL, NULL _IF_WINDOWS(pre_existing_heap_init));
 #endif
 
+#ifdef UNIX
+    if (alloc_ops.thread_cache && !alloc_ops.global_lock)
+        thread_cache_init();
+#endif
+
     /* set up pointers for per-malloc API */
     malloc_interface.malloc_lock = malloc_replace__lock;
     malloc_interface.malloc_unlock = malloc_replace__unlock;
@@ -5403,6 +5863,13 @@ alloc_replace_exit(void)
     LOG(1, "  deallocs:           %9d\n", num_dealloc);
     LOG(1, "  dbgcrt mismatches:  %9d\n", dbgcrt_mismatch);
     LOG(1, "  allocs left native: %9d\n", allocs_left_native);
+    LOG(1, "  free list searches: %9d\n", free_list_searches);
+    LOG(1, "    misses:           %9d\n", free_list_search_misses);
+    LOG(1, "    larger bucket:    %9d\n", free_list_larger_bucket);
+    LOG(1, "  thread cache hits:  %9d\n", thread_cache_hits);
+    LOG(1, "  thread cache fills: %9d\n", thread_cache_fills);
+    LOG(1, "  thread cache flush: %9d\n", thread_cache_flushes);
+    LOG(1, "  thread cache frees: %9d\n", thread_cache_frees);
 #endif
 
     /* On Win10 at process exit, RtlLockHeap is called but the private
@@ -5414,6 +5881,10 @@ alloc_replace_exit(void)
         app_heap_unlock(dr_get_current_drcontext(), cur_arena->lock);
     }
 
+#ifdef UNIX
+    thread_cache_exit();
+#endif
+
     alloc_iterate(free_user_data_at_exit, NULL, false/*free too*/);
     /* XXX: should add hashtable_iterate() to drcontainers */
     for (i = 0; i < HASHTABLE_SIZE(pre_us_table.table_bits); i++) {
@@ -5499,3 +5970,51 @@ client_app_free(void *drcontext, void *ptr, app_pc caller)
                         drcontext, &mc, caller,
                         MALLOC_ALLOCATOR_MALLOC);
 }
+
+/***************************************************************************
+ * Unit tests
+ */
+
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+/* Checks bucket_for_size() and guaranteed_bucket() at each size class
+ * boundary, including the linear-to-subdivided and var-size transitions.
+ */
+static void
+test_free_list_buckets(void)
+{
+    uint bucket;
+    free_list_sizes_init();
+    EXPECT(bucket_for_size(CHUNK_MIN_SIZE) == 0);
+    EXPECT(bucket_for_size(FREE_LIST_LINEAR_MAX - CHUNK_ALIGNMENT) ==
+           FREE_LIST_LINEAR_BUCKETS - 1);
+    EXPECT(bucket_for_size(FREE_LIST_LINEAR_MAX) == FREE_LIST_LINEAR_BUCKETS);
+    EXPECT(bucket_for_size(CHUNK_MIN_MMAP - CHUNK_ALIGNMENT) == NUM_FREE_LISTS - 2);
+    EXPECT(bucket_for_size(CHUNK_MIN_MMAP) == NUM_FREE_LISTS - 1);
+    EXPECT(bucket_for_size(CHUNK_MIN_MMAP * 4) == NUM_FREE_LISTS - 1);
+    for (bucket = 0; bucket < NUM_FREE_LISTS; bucket++) {
+        heapsz_t size = free_list_sizes[bucket];
+        EXPECT(ALIGNED(size, CHUNK_ALIGNMENT));
+        EXPECT(bucket_for_size(size) == bucket);
+        EXPECT(guaranteed_bucket(size) == bucket);
+        if (bucket > 0) {
+            EXPECT(size > free_list_sizes[bucket - 1]);
+            EXPECT(bucket_for_size(size - CHUNK_ALIGNMENT) == bucket - 1);
+        }
+        if (bucket < NUM_FREE_LISTS - 1) {
+            /* Just past a boundary only the next bucket is guaranteed to fit */
+            EXPECT(bucket_for_size(size + CHUNK_ALIGNMENT) ==
+                   (size + CHUNK_ALIGNMENT < free_list_sizes[bucket + 1] ?
+                    bucket : bucket + 1));
+            EXPECT(guaranteed_bucket(size + CHUNK_ALIGNMENT) == bucket + 1);
+        }
+    }
+}
+
+void
+alloc_replace_unit_tests(void)
+{
+    test_free_list_buckets();
+
+    /* add more tests here */
+}
+#endif
@@ -39,4 +39,9 @@ alloc_replace_orig_brk();
 
 /* rest is in malloc_interface_t */
 
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+void
+alloc_replace_unit_tests(void);
+#endif
+
 #endif /* _ALLOC_REPLACE_H_ */
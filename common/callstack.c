@@ -29,6 +29,7 @@
 #include "callstack.h"
 #include "utils.h"
 #include "redblack.h"
+#include "unwind.h"
 #ifdef USE_DRSYMS
 # include "drsyms.h"
 #endif
@@ -58,6 +59,17 @@ static uint find_next_fp_strings;
 static uint find_next_fp_string_structs;
 static uint cstack_is_retaddr_tgt_mismatch;
 static uint symbol_names_truncated;
+static uint callstack_intern_hits;
+static uint callstack_intern_misses;
+static uint cct_nodes_created;
+static uint cct_frames_stored;
+static uint modcache_hits;
+static uint modcache_misses;
+static uint walk_memo_hits;
+static uint walk_memo_stale;
+static uint symbol_cache_hits;
+static uint symbol_cache_stale;
+static uint symbol_batch_lookups;
 static uint cstack_is_retaddr;
 static uint cstack_is_retaddr_backdecode;
 static uint cstack_is_retaddr_unreadable;
@@ -77,6 +89,49 @@ typedef struct _fpscan_cache_entry {
  */
 #define FPSCAN_CACHE_ENTRIES 16
 
+/* Per-thread module_lookup() results, valid while the thread's copy of
+ * modtree_generation matches the global one.
+ */
+typedef struct _modcache_entry_t {
+    app_pc start;
+    size_t size;
+    struct _modname_info_t *name_info;
+} modcache_entry_t;
+
+#define MODCACHE_ENTRIES 8
+
+/* One frame of a recorded fp walk.  We store the fp,retaddr pair as read
+ * from the stack so we can tell whether the frame is still there.
+ */
+typedef struct _walk_memo_frame_t {
+    app_pc slot;
+    app_pc next_fp;
+    app_pc retaddr;
+    /* the retaddr came from a scan rather than slot, so we can't validate it */
+    bool custom_retaddr;
+    /* we reached this frame through CFI, so only the retaddr is at slot */
+    bool unwound;
+    /* whether the walk added this frame to the callstack */
+    bool added;
+} walk_memo_frame_t;
+
+/* A recent walk, whose frames are in increasing stack address order */
+typedef struct _walk_memo_t {
+    walk_memo_frame_t *frames;
+    uint num_frames;
+    /* modtree_generation at the time: an unload invalidates the walk */
+    uint generation;
+    /* whether the walk ended on its own rather than at a frame limit */
+    bool complete;
+} walk_memo_t;
+
+/* Repeated allocations from the same loop share all but the top few frames,
+ * so a handful of recent walks catches most repeats.
+ */
+#define WALK_MEMO_ENTRIES 4
+/* Non-module frames are skipped, so a walk can visit more frames than it keeps */
+#define WALK_MEMO_MAX_FRAMES() (ops.global_max_frames * 2)
+
 typedef struct _tls_callstack_t {
     char *errbuf; /* buffer for atomic writes to global logfile */
     size_t errbufsz;
@@ -92,6 +147,23 @@ typedef struct _tls_callstack_t {
     /* Optimization for FPO-optimized apps */
     fpscan_cache_entry fpcache[FPSCAN_CACHE_ENTRIES];
     uint fpcache_idx;
+    /* Scratch space for packed_callstack_record_scratch(), so that recording a
+     * callstack that turns out to be already interned allocates nothing.
+     * The frames array holds ops.global_max_frames frames of either kind.
+     */
+    packed_callstack_t *scratch_pcs;
+    void *scratch_frames;
+    syscall_loc_t scratch_sysloc;
+    /* Lets module_lookup() avoid modtree_lock for modules we've seen */
+    modcache_entry_t modcache[MODCACHE_ENTRIES];
+    uint modcache_idx;
+    uint modcache_generation;
+    /* Recent packed callstack walks, so a new walk that reaches one of their
+     * frames can reuse the rest of it.  walk_memo[walk_memo_idx] is the one
+     * being recorded.
+     */
+    walk_memo_t walk_memo[WALK_MEMO_ENTRIES];
+    uint walk_memo_idx;
 } tls_callstack_t;
 
 static int tls_idx_callstack = -1;
@@ -159,6 +231,11 @@ typedef struct _modname_info_t {
     bool abort_fp_walk;
     /* i#1310: support user data */
     void *user_data;
+    /* modtree_generation after this module's last unload.  Symbol cache
+     * entries looked up before then may describe a different file at the
+     * same path and are stale.
+     */
+    volatile uint unload_generation;
 } modname_info_t;
 
 /* When the number of modules hits the max for our 8-bit index we
@@ -181,9 +258,79 @@ static const modname_info_t MODNAME_INFO_SYSCALL;
 
 #define MAX_MODOFFS_STORED (0x00ffffff)
 
+/* Calling-context tree for callstacks interned with ops.frame_tree set.
+ * Each node holds one frame and points at the node of its caller, so
+ * callstacks with common outer frames share the storage for them, and
+ * equal callstacks have the same node for their top frame.  Only packed
+ * callstacks are stored in the tree, and the nodes are chained in
+ * cct_table through their own link field rather than through a separate
+ * table entry, so a node is a packed frame plus two pointers and a
+ * refcount: 32 bytes on x64 against 12 for a frame in a flat callstack.
+ */
+typedef struct _cct_node_t {
+    struct _cct_node_t *parent; /* NULL for an outermost frame */
+    /* The next node in the same cct_table bucket */
+    struct _cct_node_t *hash_next;
+    /* A syscall frame's loc.sysloc points at storage owned by the node */
+    packed_frame_t frame;
+    /* Children plus callstacks whose top frame this is.  Only dropped while
+     * holding cct_lock, so that a lookup never finds a node that is about
+     * to be freed.
+     */
+    uint refcount;
+} cct_node_t;
+
+/* Holds every node, keyed by (parent, frame), chained through hash_next.
+ * cct_lock protects the table and tree structure.
+ */
+#define CCT_TABLE_INITIAL_BITS 8
+/* We double the buckets once the average chain is longer than this */
+#define CCT_TABLE_MAX_LOAD 2
+static cct_node_t **cct_table;
+static uint cct_table_bits;
+static uint cct_table_entries;
+static void *cct_lock;
+
+#ifdef USE_DRSYMS
+/* The result of a symbol lookup, cached when ops.symbol_cache is set.
+ * A module's entries are freed when it is unloaded, as the path may be
+ * reloaded with a different file.  An entry added by a lookup that raced
+ * with the unload is instead replaced on its first use.
+ */
+typedef struct _symbol_entry_t {
+    modname_info_t *name_info;
+    size_t modoffs;
+    /* name_info->unload_generation when looked up */
+    uint generation;
+    /* the rest is only valid once looked up */
+    bool found;
+    bool has_symbols;
+    size_t funcoffs;
+    uint64 line;
+    size_t lineoffs;
+    char *func;  /* NULL if !found */
+    char *fname; /* NULL if there's no line information */
+} symbol_entry_t;
+
+/* Keyed by the entry itself: i.e., by (name_info, modoffs) */
+# define SYMBOL_TABLE_HASH_BITS 12
+static hashtable_t symbol_table;
+
+static uint
+symbol_entry_hash(void *key);
+
+static bool
+symbol_entry_cmp(void *key1, void *key2);
+
+static void
+symbol_entry_free(void *p);
+#endif
+
 struct _packed_callstack_t {
     /* share callstacks to save space (PR 465174) */
     uint refcount;
+    /* packed_callstack_hash(), updated as each frame is added */
+    uint hash;
     /* variable-length to save space */
     ushort num_frames;
     /* whether frames are packed_frame_t or full_frame_t */
@@ -192,20 +339,183 @@ struct _packed_callstack_t {
     bool first_is_retaddr:1;
     /* whether first frame is a syscall (invariant: later frames never are) */
     bool first_is_syscall:1;
+    /* whether the frames are in the calling-context tree, in which case
+     * frames.node is the top frame and is_packed is true
+     */
+    bool in_tree:1;
     union {
         packed_frame_t *packed;
         full_frame_t *full;
+        cct_node_t *node;
     } frames;
 };
 
-/* multiplexing between packed and full frames */
+/* This walks up from the top frame, so it is only for looking up a single
+ * frame (usually the top one).  Loops over all the frames of a tree
+ * callstack follow the parent pointers instead.
+ */
+static inline cct_node_t *
+cct_node_at(packed_callstack_t *pcs, uint n)
+{
+    cct_node_t *node = pcs->frames.node;
+    ASSERT(pcs->in_tree && n < pcs->num_frames, "invalid tree frame");
+    for (; n > 0; n--)
+        node = node->parent;
+    return node;
+}
+
+static bool
+cct_frame_equal(const packed_frame_t *f1, const packed_frame_t *f2)
+{
+    /* modname_idx 0 is a syscall */
+    if (f1->modname_idx == 0 || f2->modname_idx == 0) {
+        return (f1->modname_idx == f2->modname_idx &&
+                memcmp(f1->loc.sysloc, f2->loc.sysloc, sizeof(syscall_loc_t)) == 0);
+    }
+    return (f1->loc.addr == f2->loc.addr && f1->modname_idx == f2->modname_idx &&
+            f1->modoffs == f2->modoffs);
+}
+
+static uint
+cct_node_hash(cct_node_t *node)
+{
+    ptr_uint_t val = (ptr_uint_t) node->parent >> 4;
+    if (node->frame.modname_idx == 0)
+        val = val * 31 + node->frame.loc.sysloc->sysnum.number;
+    else
+        val = val * 31 + (ptr_uint_t) node->frame.loc.addr;
+    return (uint) val;
+}
+
+static bool
+cct_node_cmp(cct_node_t *node1, cct_node_t *node2)
+{
+    return (node1->parent == node2->parent &&
+            cct_frame_equal(&node1->frame, &node2->frame));
+}
+
+static void
+cct_node_free(cct_node_t *node)
+{
+    if (node->frame.modname_idx == 0) {
+        global_free(node->frame.loc.sysloc, sizeof(*node->frame.loc.sysloc),
+                    HEAPSTAT_CALLSTACK);
+    }
+    global_free(node, sizeof(*node), HEAPSTAT_CALLSTACK);
+}
+
+static inline uint
+cct_bucket(cct_node_t *node, uint bits)
+{
+    /* Multiplicative hashing, as the low bits of the raw hash are poor */
+    return (cct_node_hash(node) * 0x9e3779b1U) >> (32 - bits);
+}
+
+static void
+cct_table_init(void)
+{
+    cct_table_bits = CCT_TABLE_INITIAL_BITS;
+    cct_table = (cct_node_t **)
+        global_alloc(HASHTABLE_SIZE(cct_table_bits) * sizeof(*cct_table),
+                     HEAPSTAT_CALLSTACK);
+    memset(cct_table, 0, HASHTABLE_SIZE(cct_table_bits) * sizeof(*cct_table));
+    cct_table_entries = 0;
+    cct_lock = dr_mutex_create();
+}
+
+static void
+cct_table_exit(void)
+{
+    uint i;
+    for (i = 0; i < HASHTABLE_SIZE(cct_table_bits); i++) {
+        cct_node_t *node, *next;
+        for (node = cct_table[i]; node != NULL; node = next) {
+            next = node->hash_next;
+            cct_node_free(node);
+        }
+    }
+    global_free(cct_table, HASHTABLE_SIZE(cct_table_bits) * sizeof(*cct_table),
+                HEAPSTAT_CALLSTACK);
+    cct_table = NULL;
+    dr_mutex_destroy(cct_lock);
+}
+
+/* Caller must hold cct_lock */
+static cct_node_t *
+cct_table_lookup(cct_node_t *key)
+{
+    cct_node_t *node;
+    for (node = cct_table[cct_bucket(key, cct_table_bits)]; node != NULL;
+         node = node->hash_next) {
+        if (cct_node_cmp(node, key))
+            return node;
+    }
+    return NULL;
+}
+
+/* Caller must hold cct_lock */
+static void
+cct_table_grow(void)
+{
+    uint i, new_bits = cct_table_bits + 1;
+    cct_node_t **grown = (cct_node_t **)
+        global_alloc(HASHTABLE_SIZE(new_bits) * sizeof(*grown), HEAPSTAT_CALLSTACK);
+    memset(grown, 0, HASHTABLE_SIZE(new_bits) * sizeof(*grown));
+    for (i = 0; i < HASHTABLE_SIZE(cct_table_bits); i++) {
+        cct_node_t *node, *next;
+        for (node = cct_table[i]; node != NULL; node = next) {
+            uint b = cct_bucket(node, new_bits);
+            next = node->hash_next;
+            node->hash_next = grown[b];
+            grown[b] = node;
+        }
+    }
+    global_free(cct_table, HASHTABLE_SIZE(cct_table_bits) * sizeof(*cct_table),
+                HEAPSTAT_CALLSTACK);
+    cct_table = grown;
+    cct_table_bits = new_bits;
+}
+
+/* Caller must hold cct_lock */
+static void
+cct_table_add(cct_node_t *node)
+{
+    uint b;
+    if (cct_table_entries >= CCT_TABLE_MAX_LOAD * HASHTABLE_SIZE(cct_table_bits))
+        cct_table_grow();
+    b = cct_bucket(node, cct_table_bits);
+    node->hash_next = cct_table[b];
+    cct_table[b] = node;
+    cct_table_entries++;
+}
+
+/* Caller must hold cct_lock.  Does not free node. */
+static bool
+cct_table_remove(cct_node_t *node)
+{
+    cct_node_t **prev_next = &cct_table[cct_bucket(node, cct_table_bits)];
+    for (; *prev_next != NULL; prev_next = &(*prev_next)->hash_next) {
+        if (*prev_next == node) {
+            *prev_next = node->hash_next;
+            cct_table_entries--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* multiplexing between packed, full, and tree frames */
 #define PCS_FRAME_LOC(pcs, n) \
-    ((pcs)->is_packed ? (pcs)->frames.packed[n].loc : (pcs)->frames.full[n].loc)
+    ((pcs)->in_tree ? cct_node_at(pcs, n)->frame.loc : \
+     ((pcs)->is_packed ? (pcs)->frames.packed[n].loc : (pcs)->frames.full[n].loc))
 #define PCS_FRAMES(pcs) \
     ((pcs)->is_packed ? (void*)((pcs)->frames.packed) : (void*)((pcs)->frames.full))
 #define PCS_FRAME_SZ(pcs) \
     ((pcs)->is_packed ? sizeof(*(pcs)->frames.packed) : sizeof(*(pcs)->frames.full))
 
+/* full_frame_t is the larger of the two */
+#define SCRATCH_FRAMES_SIZE() (sizeof(full_frame_t) * ops.global_max_frames)
+
 /* Hashtable that stores name info.  We never remove entries. */
 #define MODNAME_TABLE_HASH_BITS 8
 static hashtable_t modname_table;
@@ -240,6 +550,11 @@ static modname_info_t *modtree_last_name_info;
 /* cached values for is_in_module() */
 static app_pc modtree_last_hit;
 static app_pc modtree_last_miss;
+/* Incremented under modtree_lock on every module unload, invalidating all
+ * the per-thread module_lookup() caches.  A load can't invalidate a cached
+ * range so it leaves this alone.
+ */
+static volatile uint modtree_generation;
 
 /* i#1217: exclude DR and DrMem retaddrs on app stack from -replace_malloc */
 static app_pc libdr_base, libdr_end;
@@ -327,8 +642,19 @@ callstack_init(callstack_options_t *options)
     hashtable_init_ex(&modname_table, MODNAME_TABLE_HASH_BITS, HASH_STRING_NOCASE,
                       false/*!str_dup*/, false/*!synch*/, modname_info_free, NULL, NULL);
     modname_table_initialized = true;
+    if (ops.frame_tree)
+        cct_table_init();
+#ifdef USE_DRSYMS
+    if (ops.symbol_cache) {
+        hashtable_init_ex(&symbol_table, SYMBOL_TABLE_HASH_BITS, HASH_CUSTOM,
+                          false/*!str_dup*/, false/*explicit lock*/,
+                          symbol_entry_free, symbol_entry_hash, symbol_entry_cmp);
+    }
+#endif
     modtree_lock = dr_mutex_create();
     module_tree = rb_tree_create(NULL);
+    if (!TEST(FP_DO_NOT_UNWIND_CFI, ops.fp_flags))
+        unwind_init();
 
     if (!TEST(FP_SEARCH_ALLOW_UNSEEN_RETADDR, ops.fp_flags)) {
         hashtable_config_t hashconfig;
@@ -354,6 +680,12 @@ callstack_exit(void)
     ASSERT(!(ops.tool_lib_ignore != NULL && libtoolbase == NULL), "never found tool lib");
 
     hashtable_delete(&modname_table);
+    if (ops.frame_tree)
+        cct_table_exit();
+#ifdef USE_DRSYMS
+    if (ops.symbol_cache)
+        hashtable_delete_with_stats(&symbol_table, "symbol cache");
+#endif
     if (!TEST(FP_SEARCH_ALLOW_UNSEEN_RETADDR, ops.fp_flags))
         hashtable_delete_with_stats(&retaddr_table, "retaddr table");
 
@@ -361,6 +693,8 @@ callstack_exit(void)
     rb_tree_destroy(module_tree);
     dr_mutex_unlock(modtree_lock);
     dr_mutex_destroy(modtree_lock);
+    if (!TEST(FP_DO_NOT_UNWIND_CFI, ops.fp_flags))
+        unwind_exit();
 
 #ifdef USE_DRSYMS
     IF_WINDOWS(ASSERT(using_private_peb(), "private peb not preserved"));
@@ -386,6 +720,20 @@ callstack_dump_statistics(file_t f)
     dr_fprintf(f, "callstack is_retaddr cont'd: unseen %8u\n",
                cstack_is_retaddr_unseen);
     dr_fprintf(f, "symbol names truncated: %8u\n", symbol_names_truncated);
+    dr_fprintf(f, "callstacks interned: %8u hits, %8u misses\n",
+               callstack_intern_hits, callstack_intern_misses);
+    dr_fprintf(f, "module lookups: %8u cache hits, %8u misses\n",
+               modcache_hits, modcache_misses);
+    dr_fprintf(f, "callstack walk memo: %8u hits, %8u stale\n",
+               walk_memo_hits, walk_memo_stale);
+    dr_fprintf(f, "symbol cache: %8u hits, %8u stale, %8u batched lookups\n",
+               symbol_cache_hits, symbol_cache_stale, symbol_batch_lookups);
+    if (ops.frame_tree) {
+        dr_fprintf(f, "callstack tree: %8u live nodes, %8u created, for %8u frames\n",
+                   cct_table_entries, cct_nodes_created, cct_frames_stored);
+    }
+    if (!TEST(FP_DO_NOT_UNWIND_CFI, ops.fp_flags))
+        unwind_dump_statistics(f);
 }
 #endif
 
@@ -429,6 +777,18 @@ callstack_thread_init(void *drcontext)
     pt->errbuf = (char *) thread_alloc(drcontext, pt->errbufsz, HEAPSTAT_CALLSTACK);
     /* We take the space hit to avoid serializing all mallocs just for callstacks */
     pt->page_buf = (byte *) thread_alloc(drcontext, PAGE_SIZE, HEAPSTAT_CALLSTACK);
+    pt->scratch_pcs = (packed_callstack_t *)
+        thread_alloc(drcontext, sizeof(*pt->scratch_pcs), HEAPSTAT_CALLSTACK);
+    pt->scratch_frames = thread_alloc(drcontext, SCRATCH_FRAMES_SIZE(),
+                                      HEAPSTAT_CALLSTACK);
+    if (!TEST(FP_DO_NOT_MEMOIZE_WALK, ops.fp_flags)) {
+        uint i;
+        for (i = 0; i < WALK_MEMO_ENTRIES; i++) {
+            pt->walk_memo[i].frames = (walk_memo_frame_t *)
+                thread_alloc(drcontext, sizeof(walk_memo_frame_t) *
+                             WALK_MEMO_MAX_FRAMES(), HEAPSTAT_CALLSTACK);
+        }
+    }
 #ifdef WINDOWS
     if (get_TEB() != NULL) {
         pt->stack_lowest_frame = get_TEB()->StackBase;
@@ -486,6 +846,16 @@ callstack_thread_exit(void *drcontext)
         drmgr_get_tls_field(drcontext, tls_idx_callstack);
     thread_free(drcontext, (void *) pt->errbuf, pt->errbufsz, HEAPSTAT_CALLSTACK);
     thread_free(drcontext, (void *) pt->page_buf, PAGE_SIZE, HEAPSTAT_CALLSTACK);
+    thread_free(drcontext, pt->scratch_pcs, sizeof(*pt->scratch_pcs),
+                HEAPSTAT_CALLSTACK);
+    thread_free(drcontext, pt->scratch_frames, SCRATCH_FRAMES_SIZE(), HEAPSTAT_CALLSTACK);
+    if (!TEST(FP_DO_NOT_MEMOIZE_WALK, ops.fp_flags)) {
+        uint i;
+        for (i = 0; i < WALK_MEMO_ENTRIES; i++) {
+            thread_free(drcontext, pt->walk_memo[i].frames, sizeof(walk_memo_frame_t) *
+                        WALK_MEMO_MAX_FRAMES(), HEAPSTAT_CALLSTACK);
+        }
+    }
     drmgr_set_tls_field(drcontext, tls_idx_callstack, NULL);
     thread_free(drcontext, pt, sizeof(*pt), HEAPSTAT_MISC);
 }
@@ -521,14 +891,40 @@ init_symbolized_frame(symbolized_frame_t *frame OUT, uint frame_num)
 }
 
 #ifdef USE_DRSYMS
+static uint
+symbol_entry_hash(void *key)
+{
+    symbol_entry_t *entry = (symbol_entry_t *) key;
+    return (uint)(((ptr_uint_t)entry->name_info >> 4) ^ (entry->modoffs * 31));
+}
+
+static bool
+symbol_entry_cmp(void *key1, void *key2)
+{
+    symbol_entry_t *entry1 = (symbol_entry_t *) key1;
+    symbol_entry_t *entry2 = (symbol_entry_t *) key2;
+    return (entry1->name_info == entry2->name_info && entry1->modoffs == entry2->modoffs);
+}
+
+static void
+symbol_entry_free(void *p)
+{
+    symbol_entry_t *entry = (symbol_entry_t *) p;
+    if (entry->func != NULL)
+        global_free(entry->func, strlen(entry->func) + 1, HEAPSTAT_CALLSTACK);
+    if (entry->fname != NULL)
+        global_free(entry->fname, strlen(entry->fname) + 1, HEAPSTAT_CALLSTACK);
+    global_free(entry, sizeof(*entry), HEAPSTAT_CALLSTACK);
+}
+
 /* Symbol lookup: i#44/PR 243532 */
 static void
-lookup_func_and_line(symbolized_frame_t *frame OUT,
-                     modname_info_t *name_info IN, size_t modoffs)
+symbol_entry_fill(symbol_entry_t *entry INOUT)
 {
     drsym_error_t symres;
     drsym_info_t sym;
-    const char *modpath = name_info->path;
+    const char *modpath = entry->name_info->path;
+    size_t modoffs = entry->modoffs;
     char name[MAX_FUNC_LEN];
     char file[MAXIMUM_PATH];
     sym.struct_size = sizeof(sym);
@@ -553,35 +949,160 @@ lookup_func_and_line(symbolized_frame_t *frame OUT,
             });
             STATS_INC(symbol_names_truncated);
         }
-        frame->has_symbols = TEST(DRSYM_SYMBOLS, sym.debug_kind);
+        entry->found = true;
+        entry->has_symbols = TEST(DRSYM_SYMBOLS, sym.debug_kind);
         /* sym.name could be something like "BigInteger::operator%" */
-        dr_snprintf(frame->func, MAX_FUNC_LEN, "%s", sym.name);
-        NULL_TERMINATE_BUFFER(frame->func);
-        frame->funcoffs = (modoffs - sym.start_offs);
-        if (symres == DRSYM_ERROR_LINE_NOT_AVAILABLE) {
-            frame->fname[0] = '\0';
-            frame->line = 0;
-            frame->lineoffs = 0;
-        } else {
+        NULL_TERMINATE_BUFFER(name);
+        entry->func = drmem_strdup(sym.name, HEAPSTAT_CALLSTACK);
+        entry->funcoffs = (modoffs - sym.start_offs);
+        if (symres != DRSYM_ERROR_LINE_NOT_AVAILABLE) {
             char *fname = sym.file;
+            char buf[MAX_FILENAME_LEN+1];
             /* i#1634: if sym.file is longer than MAX_FILENAME_LEN,
              * we skip some prefix.
              */
-            /* frame->fname has the size of MAX_FILENAME_LEN+1, so we do not need
-             * extra byte for NULL.
-             */
             if (strlen(fname) > MAX_FILENAME_LEN) {
                 fname += (strlen(fname) - MAX_FILENAME_LEN + 3 /* ... */);
                 if (strchr(fname, DIRSEP) != NULL)
                     fname = strchr(fname, DIRSEP);
             }
-            dr_snprintf(frame->fname, MAX_FILENAME_LEN, "%s%s",
+            dr_snprintf(buf, MAX_FILENAME_LEN, "%s%s",
                         fname == sym.file ? "" : "...", fname);
-            NULL_TERMINATE_BUFFER(frame->fname);
-            frame->line = sym.line;
-            frame->lineoffs = sym.line_offs;
+            buf[MAX_FILENAME_LEN] = '\0';
+            entry->fname = drmem_strdup(buf, HEAPSTAT_CALLSTACK);
+            entry->line = sym.line;
+            entry->lineoffs = sym.line_offs;
+        }
+    }
+}
+
+static void
+symbol_entry_to_frame(symbol_entry_t *entry IN, symbolized_frame_t *frame OUT)
+{
+    if (!entry->found)
+        return;
+    frame->has_symbols = entry->has_symbols;
+    dr_snprintf(frame->func, MAX_FUNC_LEN, "%s", entry->func);
+    NULL_TERMINATE_BUFFER(frame->func);
+    frame->funcoffs = entry->funcoffs;
+    if (entry->fname == NULL) {
+        frame->fname[0] = '\0';
+        frame->line = 0;
+        frame->lineoffs = 0;
+    } else {
+        /* frame->fname has the size of MAX_FILENAME_LEN+1 */
+        dr_snprintf(frame->fname, MAX_FILENAME_LEN, "%s", entry->fname);
+        NULL_TERMINATE_BUFFER(frame->fname);
+        frame->line = entry->line;
+        frame->lineoffs = entry->lineoffs;
+    }
+}
+
+/* Returns the cached entry for modoffs in name_info's module, or NULL.  An
+ * entry from before the module's last unload is removed.  The caller must
+ * hold the symbol_table lock.
+ */
+static symbol_entry_t *
+symbol_cache_find(modname_info_t *name_info, size_t modoffs)
+{
+    symbol_entry_t key, *entry;
+    key.name_info = name_info;
+    key.modoffs = modoffs;
+    entry = (symbol_entry_t *) hashtable_lookup(&symbol_table, (void *)&key);
+    if (entry != NULL && entry->generation != name_info->unload_generation) {
+        STATS_INC(symbol_cache_stale);
+        hashtable_remove(&symbol_table, (void *)&key); /* frees entry */
+        entry = NULL;
+    }
+    return entry;
+}
+
+/* Frees all of the cached entries for name_info's module, which was just
+ * unloaded.  Without this, entries for offsets that are never looked up again
+ * would stay in the table for the rest of the run.
+ */
+static void
+symbol_cache_purge(modname_info_t *name_info)
+{
+    uint i, num_removed = 0;
+    hashtable_lock(&symbol_table);
+    for (i = 0; i < HASHTABLE_SIZE(symbol_table.table_bits); i++) {
+        hash_entry_t *he, *next;
+        for (he = symbol_table.table[i]; he != NULL; he = next) {
+            symbol_entry_t *entry = (symbol_entry_t *) he->payload;
+            next = he->next;
+            if (entry->name_info == name_info) {
+                hashtable_remove(&symbol_table, he->key); /* frees entry */
+                num_removed++;
+            }
         }
     }
+    hashtable_unlock(&symbol_table);
+    STATS_ADD(symbol_cache_stale, num_removed);
+    LOG(2, "removed %d symbol cache entries for %s\n", num_removed,
+        name_info->name == NULL ? "<name unavailable>" : name_info->name);
+}
+
+/* Looks up modoffs in name_info's module through the cache, adding it if
+ * necessary, and copies the result into frame unless frame is NULL.  Only
+ * valid if ops.symbol_cache is set.
+ */
+static void
+symbol_cache_lookup(modname_info_t *name_info, size_t modoffs,
+                    symbolized_frame_t *frame OUT)
+{
+    symbol_entry_t *entry, *existing;
+    /* We copy out under the lock as an unload can free the entry once we drop it */
+    hashtable_lock(&symbol_table);
+    entry = symbol_cache_find(name_info, modoffs);
+    if (entry != NULL) {
+        STATS_INC(symbol_cache_hits);
+        if (frame != NULL)
+            symbol_entry_to_frame(entry, frame);
+        hashtable_unlock(&symbol_table);
+        return;
+    }
+    hashtable_unlock(&symbol_table);
+    /* We don't hold the table lock across the drsyms query, so another
+     * thread can race us to add the same entry.  We read the generation
+     * first so that an unload during the query makes the result stale.
+     */
+    entry = (symbol_entry_t *) global_alloc(sizeof(*entry), HEAPSTAT_CALLSTACK);
+    memset(entry, 0, sizeof(*entry));
+    entry->name_info = name_info;
+    entry->modoffs = modoffs;
+    entry->generation = name_info->unload_generation;
+    symbol_entry_fill(entry);
+    hashtable_lock(&symbol_table);
+    existing = symbol_cache_find(name_info, modoffs);
+    if (existing != NULL) {
+        symbol_entry_free(entry);
+        entry = existing;
+    } else
+        hashtable_add(&symbol_table, (void *)entry, (void *)entry);
+    if (frame != NULL)
+        symbol_entry_to_frame(entry, frame);
+    hashtable_unlock(&symbol_table);
+}
+
+static void
+lookup_func_and_line(symbolized_frame_t *frame OUT,
+                     modname_info_t *name_info IN, size_t modoffs)
+{
+    symbol_entry_t local;
+    if (ops.symbol_cache)
+        symbol_cache_lookup(name_info, modoffs, frame);
+    else {
+        memset(&local, 0, sizeof(local));
+        local.name_info = name_info;
+        local.modoffs = modoffs;
+        symbol_entry_fill(&local);
+        symbol_entry_to_frame(&local, frame);
+        if (local.func != NULL)
+            global_free(local.func, strlen(local.func) + 1, HEAPSTAT_CALLSTACK);
+        if (local.fname != NULL)
+            global_free(local.fname, strlen(local.fname) + 1, HEAPSTAT_CALLSTACK);
+    }
 
     if (!frame->has_symbols) {
         warn_no_symbols(name_info);
@@ -914,6 +1435,7 @@ address_to_frame(symbolized_frame_t *frame OUT, packed_callstack_t *pcs OUT,
                 pcs->frames.full[pcs_idx].modoffs = sz;
                 pcs->frames.full[pcs_idx].modname = name_info;
             }
+            pcs->hash ^= (ptr_uint_t) pc;
             pcs->num_frames++;
         } else {
             const char *modname = (name_info->name == NULL) ?
@@ -945,6 +1467,7 @@ address_to_frame(symbolized_frame_t *frame OUT, packed_callstack_t *pcs OUT,
                 pcs->frames.full[pcs->num_frames].modoffs = 0;
                 pcs->frames.full[pcs->num_frames].modname = NULL;
             }
+            pcs->hash ^= (ptr_uint_t) pc;
             pcs->num_frames++;
         } else {
             ASSERT(!frame->is_module, "frame not initialized");
@@ -1366,6 +1889,119 @@ fpcache_update(tls_callstack_t *pt, byte *fp_in, byte *fp_out, app_pc retaddr)
     pt->fpcache_idx = (pt->fpcache_idx + 1) % FPSCAN_CACHE_ENTRIES;
 }
 
+static void
+walk_memo_start(tls_callstack_t *pt)
+{
+    /* mark the oldest walk invalid while we overwrite it */
+    pt->walk_memo[pt->walk_memo_idx].num_frames = 0;
+}
+
+/* Returns the recorded frame, or NULL if the record is full */
+static walk_memo_frame_t *
+walk_memo_note(tls_callstack_t *pt, app_pc slot, app_pc next_fp, app_pc retaddr,
+               bool custom_retaddr, bool unwound)
+{
+    walk_memo_t *walk = &pt->walk_memo[pt->walk_memo_idx];
+    walk_memo_frame_t *frame;
+    if (walk->num_frames > 0 && slot <= walk->frames[walk->num_frames - 1].slot) {
+        /* We restarted lower on the stack (i#521).  Whatever comes next is
+         * still a suffix of this walk so we drop what we have.
+         */
+        walk->num_frames = 0;
+    }
+    if (walk->num_frames >= WALK_MEMO_MAX_FRAMES())
+        return NULL;
+    frame = &walk->frames[walk->num_frames++];
+    frame->slot = slot;
+    frame->next_fp = next_fp;
+    frame->retaddr = retaddr;
+    frame->custom_retaddr = custom_retaddr;
+    frame->unwound = unwound;
+    frame->added = false;
+    return frame;
+}
+
+static void
+walk_memo_finish(tls_callstack_t *pt, bool complete)
+{
+    walk_memo_t *walk = &pt->walk_memo[pt->walk_memo_idx];
+    if (walk->num_frames == 0)
+        return;
+    /* if we ran out of room we don't know how the walk continued */
+    walk->complete = complete && walk->num_frames < WALK_MEMO_MAX_FRAMES();
+    walk->generation = modtree_generation;
+    pt->walk_memo_idx = (pt->walk_memo_idx + 1) % WALK_MEMO_ENTRIES;
+}
+
+/* If a recent walk went through the frame at slot, and its frames from there
+ * on are all still on the stack, adds them to pcs and returns true.
+ */
+static bool
+walk_memo_replay(tls_callstack_t *pt, packed_callstack_t *pcs, app_pc slot,
+                 app_pc next_fp, app_pc retaddr, uint max_frames,
+                 app_pc *lowest_frame OUT)
+{
+    uint w;
+    for (w = 0; w < WALK_MEMO_ENTRIES; w++) {
+        walk_memo_t *walk = &pt->walk_memo[w];
+        walk_memo_frame_t *frames = walk->frames;
+        uint lo, hi, i, avail;
+        if (w == pt->walk_memo_idx || walk->num_frames == 0 ||
+            walk->generation != modtree_generation ||
+            slot < frames[0].slot || slot > frames[walk->num_frames - 1].slot)
+            continue;
+        lo = 0;
+        hi = walk->num_frames;
+        while (lo < hi) {
+            uint mid = (lo + hi) / 2;
+            if (frames[mid].slot < slot)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == walk->num_frames || frames[lo].slot != slot ||
+            frames[lo].next_fp != next_fp || frames[lo].retaddr != retaddr ||
+            frames[lo].custom_retaddr)
+            continue;
+        /* If the old walk stopped at its frame limit it may not reach ours */
+        for (avail = 0, i = lo; i < walk->num_frames; i++) {
+            if (frames[i].added)
+                avail++;
+        }
+        if (!walk->complete && pcs->num_frames + avail < max_frames)
+            continue;
+        /* The frames above a live frame can't have changed, but an identical
+         * fp,retaddr pair may be a new frame, so we check them all.
+         */
+        for (i = lo + 1; i < walk->num_frames; i++) {
+            app_pc pair[2];
+            if (frames[i].custom_retaddr ||
+                !safe_read(frames[i].slot, sizeof(pair), pair) ||
+                (!frames[i].unwound && pair[0] != frames[i].next_fp) ||
+                pair[1] != frames[i].retaddr)
+                break;
+        }
+        if (i < walk->num_frames) {
+            STATS_INC(walk_memo_stale);
+            walk->num_frames = 0;
+            continue;
+        }
+        LOG(4, "callstack walk memo hit at "PFX"\n", slot);
+        STATS_INC(walk_memo_hits);
+        for (i = lo; i < walk->num_frames && pcs->num_frames < max_frames; i++) {
+            address_to_frame(NULL, pcs, frames[i].retaddr, NULL,
+                             !TEST(FP_SHOW_NON_MODULE_FRAMES, ops.fp_flags),
+                             true, pcs->num_frames);
+            *lowest_frame = frames[i].slot;
+            if (frames[i].retaddr == pt->stack_lowest_retaddr &&
+                pt->stack_lowest_retaddr != NULL)
+                break;
+        }
+        return true;
+    }
+    return false;
+}
+
 static app_pc
 find_next_fp(void *drcontext, tls_callstack_t *pt, app_pc fp, app_pc prior_ra,
              bool top_frame, app_pc *retaddr/*OUT*/)
@@ -1634,6 +2270,16 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
     bool scanned = false;
     bool last_frame = false;
     byte *tos = (mc == NULL ? NULL : (byte *) MC_SP_REG(mc));
+    /* we only memoize walks for packed callstacks, which are the frequent ones */
+    bool memoize = (mc != NULL && pcs != NULL && pt != NULL &&
+                    !TEST(FP_DO_NOT_MEMOIZE_WALK, ops.fp_flags));
+    bool walk_complete = true;
+    walk_memo_frame_t *memo_frame;
+    bool use_cfi = !TEST(FP_DO_NOT_UNWIND_CFI, ops.fp_flags);
+    /* whether we reached the current frame through CFI */
+    bool unwound = false;
+    /* whether the current retaddr is in the slot after pc */
+    bool retaddr_in_frame;
 
     ASSERT(max_frames <= ops.global_max_frames, "max_frames > global_max_frames");
 
@@ -1718,6 +2364,8 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
                                          &custom_retaddr);
         scanned = true;
     }
+    if (memoize)
+        walk_memo_start(pt);
     while (pc != NULL) {
         if (!have_appdata &&
             !safe_read((byte *)pc, sizeof(appdata), &appdata)) {
@@ -1726,6 +2374,22 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
         }
         LOG(4, "print_callstack: pc="PFX" => FP="PFX", RA="PFX"\n",
             pc, appdata.next_fp, appdata.retaddr);
+        memo_frame = NULL;
+        if (memoize) {
+            /* the top frame may duplicate the caller's, so we don't start there */
+            if (!first_iter && custom_retaddr == NULL &&
+                walk_memo_replay(pt, pcs, (app_pc) pc, appdata.next_fp,
+                                 appdata.retaddr, max_frames, &lowest_frame)) {
+                /* we have no record of the frames below this one */
+                memoize = false;
+                break;
+            }
+            memo_frame = walk_memo_note(pt, (app_pc) pc, appdata.next_fp,
+                                        appdata.retaddr, custom_retaddr != NULL,
+                                        unwound);
+        }
+        unwound = false;
+        retaddr_in_frame = (custom_retaddr == NULL);
         /* if we scanned and took the top dword as retaddr, don't use beyond-TOS as FP */
         if ((byte *)pc < tos)
             appdata.next_fp = NULL;
@@ -1769,6 +2433,8 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
                                      !TEST(FP_SHOW_NON_MODULE_FRAMES, ops.fp_flags),
                                      true, pcs->num_frames))) {
             num++;
+            if (memo_frame != NULL)
+                memo_frame->added = true;
             if (last_frame)
                 break;
             if (appdata.retaddr == pt->stack_lowest_retaddr &&
@@ -1803,6 +2469,7 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
                 BUFPRINT(buf, bufsz, *sofar, len, FP_PREFIX"..."NL);
             LOG(4, "truncating callstack: hit max frames %d %d\n",
                 num, pcs == NULL ? -1 : pcs->num_frames);
+            walk_complete = false;
             break;
         }
         /* yes I've seen weird recursive cases before */
@@ -1810,6 +2477,30 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
             LOG(4, "truncating callstack: recursion\n");
             break;
         }
+        if (use_cfi && retaddr_in_frame) {
+            /* If the caller has unwind info we can find its frame exactly,
+             * whether or not it keeps a frame pointer.
+             */
+            app_pc cfi_retaddr;
+            byte *cfi_slot, *cfi_fp;
+            if (unwind_step(appdata.retaddr, (byte *)pc + sizeof(appdata),
+                            appdata.next_fp, &cfi_retaddr, &cfi_slot, &cfi_fp) &&
+                cfi_retaddr != NULL &&
+                cfi_slot >= (byte *)pc + sizeof(appdata) &&
+                (ptr_uint_t)(cfi_slot - (byte *)pc) < ops.stack_swap_threshold &&
+                /* as for fp walks, only check the retaddr if we've scanned */
+                ((!scanned && !TEST(FP_CHECK_RETADDR_PRE_SCAN, ops.fp_flags)) ||
+                 is_retaddr(cfi_retaddr, false/*include drmem*/))) {
+                LOG(4, "print_callstack: CFI for "PFX" => RA slot "PFX", FP="PFX"\n",
+                    appdata.retaddr, cfi_slot, cfi_fp);
+                pc = (ptr_uint_t *)(cfi_slot - sizeof(app_pc));
+                appdata.next_fp = cfi_fp;
+                appdata.retaddr = cfi_retaddr;
+                have_appdata = true;
+                unwound = true;
+                continue;
+            }
+        }
         have_appdata = false;
         if (appdata.next_fp == 0) {
             /* We definitely need to search for the first frame, and also in the
@@ -1884,6 +2575,8 @@ print_callstack(char *buf, size_t bufsz, size_t *sofar, dr_mcontext_t *mc,
             LOG(4, "truncating callstack: can't find next fp\n");
     }
  print_callstack_done:
+    if (memoize)
+        walk_memo_finish(pt, walk_complete);
     if (num == 0 && buf != NULL && print_fps) {
         BUFPRINT(buf, bufsz, *sofar, len,
                  FP_PREFIX"<call stack frame ptr "PFX" unreadable>"NL, pc);
@@ -1989,31 +2682,16 @@ callstack_next_retaddr(dr_mcontext_t *mc)
  * Binary callstacks for storing callstacks of allocation sites.
  */
 
-/* Used for standalone allocation, rather than printing as part of an error report.
- * Caller must call free_callstack() to free buf_out.
+/* Fills in pcs, whose frames array must have room for max_frames frames of
+ * the kind selected by pcs->is_packed.  A syscall frame's location is stored
+ * in sysloc if non-NULL and otherwise in newly allocated memory.
  */
-void
-packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
-                        app_loc_t *loc, uint max_frames)
+static void
+packed_callstack_record_frames(packed_callstack_t *pcs, dr_mcontext_t *mc,
+                               app_loc_t *loc, uint max_frames,
+                               syscall_loc_t *sysloc)
 {
-    packed_callstack_t *pcs = (packed_callstack_t *)
-        global_alloc(sizeof(*pcs), HEAPSTAT_CALLSTACK);
-    size_t sz_out;
     int num_frames_printed = 0;
-    ASSERT(max_frames <= ops.global_max_frames, "max_frames > global_max_frames");
-    ASSERT(pcs_out != NULL, "invalid args");
-    memset(pcs, 0, sizeof(*pcs));
-    pcs->refcount = 1;
-    if (modname_array_end < MAX_MODNAMES_STORED) {
-        pcs->is_packed = true;
-        pcs->frames.packed = (packed_frame_t *)
-            global_alloc(sizeof(*pcs->frames.packed) * max_frames,
-                         HEAPSTAT_CALLSTACK);
-    } else {
-        pcs->is_packed = false;
-        pcs->frames.full = (full_frame_t *)
-            global_alloc(sizeof(*pcs->frames.full) * max_frames, HEAPSTAT_CALLSTACK);
-    }
     if (loc != NULL) {
         if (loc->type == APP_LOC_SYSCALL) {
             /* For syscalls, we use index 0 and external storage.
@@ -2022,16 +2700,17 @@ packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
              * and compare it by just using its address.
              */
             pcs->first_is_syscall = true;
+            if (sysloc == NULL) {
+                sysloc = (syscall_loc_t *)
+                    global_alloc(sizeof(syscall_loc_t), HEAPSTAT_CALLSTACK);
+            }
+            *sysloc = loc->u.syscall;
             if (pcs->is_packed) {
                 pcs->frames.packed[0].modname_idx = 0;
-                pcs->frames.packed[0].loc.sysloc = (syscall_loc_t *)
-                    global_alloc(sizeof(syscall_loc_t), HEAPSTAT_CALLSTACK);
-                *pcs->frames.packed[0].loc.sysloc = loc->u.syscall;
+                pcs->frames.packed[0].loc.sysloc = sysloc;
             } else {
                 pcs->frames.full[0].modname = (modname_info_t *) &MODNAME_INFO_SYSCALL;
-                pcs->frames.full[0].loc.sysloc = (syscall_loc_t *)
-                    global_alloc(sizeof(syscall_loc_t), HEAPSTAT_CALLSTACK);
-                *pcs->frames.full[0].loc.sysloc = loc->u.syscall;
+                pcs->frames.full[0].loc.sysloc = sysloc;
             }
             pcs->num_frames++;
         } else {
@@ -2043,6 +2722,65 @@ packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
     }
     print_callstack(NULL, 0, NULL, mc, false, pcs, num_frames_printed, false,
                     max_frames);
+}
+
+packed_callstack_t *
+packed_callstack_record_scratch(dr_mcontext_t *mc, app_loc_t *loc, uint max_frames)
+{
+    void *drcontext = dr_get_current_drcontext();
+    tls_callstack_t *pt = (tls_callstack_t *)
+        ((drcontext == NULL) ? NULL : drmgr_get_tls_field(drcontext, tls_idx_callstack));
+    packed_callstack_t *pcs;
+    ASSERT(max_frames <= ops.global_max_frames, "max_frames > global_max_frames");
+    if (pt == NULL || pt->scratch_pcs == NULL)
+        return NULL;
+    pcs = pt->scratch_pcs;
+    memset(pcs, 0, sizeof(*pcs));
+    pcs->refcount = 1;
+    if (modname_array_end < MAX_MODNAMES_STORED) {
+        pcs->is_packed = true;
+        pcs->frames.packed = (packed_frame_t *) pt->scratch_frames;
+    } else {
+        pcs->is_packed = false;
+        pcs->frames.full = (full_frame_t *) pt->scratch_frames;
+    }
+    packed_callstack_record_frames(pcs, mc, loc, max_frames, &pt->scratch_sysloc);
+    return pcs;
+}
+
+/* Used for standalone allocation, rather than printing as part of an error report.
+ * Caller must call free_callstack() to free buf_out.
+ */
+void
+packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
+                        app_loc_t *loc, uint max_frames)
+{
+    packed_callstack_t *pcs;
+    size_t sz_out;
+    ASSERT(max_frames <= ops.global_max_frames, "max_frames > global_max_frames");
+    ASSERT(pcs_out != NULL, "invalid args");
+    /* If we have scratch space, walking into it and then making a right-sized
+     * copy saves allocating and freeing a max-sized frames array.
+     */
+    pcs = packed_callstack_record_scratch(mc, loc, max_frames);
+    if (pcs != NULL) {
+        *pcs_out = packed_callstack_clone(pcs);
+        return;
+    }
+    pcs = (packed_callstack_t *) global_alloc(sizeof(*pcs), HEAPSTAT_CALLSTACK);
+    memset(pcs, 0, sizeof(*pcs));
+    pcs->refcount = 1;
+    if (modname_array_end < MAX_MODNAMES_STORED) {
+        pcs->is_packed = true;
+        pcs->frames.packed = (packed_frame_t *)
+            global_alloc(sizeof(*pcs->frames.packed) * max_frames,
+                         HEAPSTAT_CALLSTACK);
+    } else {
+        pcs->is_packed = false;
+        pcs->frames.full = (full_frame_t *)
+            global_alloc(sizeof(*pcs->frames.full) * max_frames, HEAPSTAT_CALLSTACK);
+    }
+    packed_callstack_record_frames(pcs, mc, loc, max_frames, NULL);
     if (pcs->is_packed) {
         packed_frame_t *frames_out;
         sz_out = sizeof(*pcs->frames.packed) * pcs->num_frames;
@@ -2079,64 +2817,194 @@ packed_callstack_first_frame_retaddr(packed_callstack_t *pcs)
 
 /* Returns false if a syscall.  If returns true, also fills in the OUT params. */
 static bool
-packed_callstack_frame_modinfo(packed_callstack_t *pcs, uint frame,
-                               modname_info_t **name_info OUT, size_t *modoffs OUT)
+packed_frame_modinfo(const packed_frame_t *packed,
+                     modname_info_t **name_info OUT, size_t *modoffs OUT)
 {
     modname_info_t *info = NULL;
     size_t offs = 0;
+    /* modname_idx==0 is the code for a system call */
+    if (packed->modname_idx == 0)
+        return false;
+    if (packed->modoffs < MAX_MODOFFS_STORED) {
+        /* If module is larger than 16M, we need to adjust offset.
+         * The hashtable holds the first index.
+         */
+        int start_idx;
+        int idx = packed->modname_idx;
+        ASSERT(idx < MAX_MODNAMES_STORED, "invalid modname idx");
+        offs = packed->modoffs;
+        info = modname_array[idx];
+        start_idx = info->index;
+        ASSERT(start_idx != 0, "module in array must be in table");
+        if (start_idx < idx)
+            offs += (idx - start_idx) * MAX_MODOFFS_STORED;
+    }
+    if (name_info != NULL)
+        *name_info = info;
+    if (modoffs != NULL)
+        *modoffs = offs;
+    return true;
+}
+
+/* Returns false if a syscall.  If returns true, also fills in the OUT params.
+ * For a tree callstack, node is frame's node if the caller has it, or NULL.
+ */
+static bool
+packed_callstack_frame_modinfo(packed_callstack_t *pcs, cct_node_t *node, uint frame,
+                               modname_info_t **name_info OUT, size_t *modoffs OUT)
+{
     ASSERT(pcs != NULL, "invalid arg");
     ASSERT(frame < pcs->num_frames, "invalid arg");
-    /* modname_idx==0 or modname==NULL is the code for a system call */
+    /* modname==MODNAME_INFO_SYSCALL is the code for a system call */
     if (!pcs->is_packed) {
-        info = pcs->frames.full[frame].modname;
-        if (info == &MODNAME_INFO_SYSCALL) {
+        full_frame_t *full = &pcs->frames.full[frame];
+        if (full->modname == &MODNAME_INFO_SYSCALL) {
             ASSERT(frame == 0, "syscall should only be top frame");
             ASSERT(pcs->first_is_syscall, "flag not set");
             return false;
         }
-        offs = pcs->frames.full[frame].modoffs;
+        if (name_info != NULL)
+            *name_info = full->modname;
+        if (modoffs != NULL)
+            *modoffs = full->modoffs;
+        return true;
+    }
+    if (pcs->in_tree && node == NULL)
+        node = cct_node_at(pcs, frame);
+    if (!packed_frame_modinfo(node != NULL ? &node->frame : &pcs->frames.packed[frame],
+                              name_info, modoffs)) {
+        ASSERT(frame == 0, "syscall should only be top frame");
+        ASSERT(pcs->first_is_syscall, "flag not set");
+        return false;
+    }
+    return true;
+}
+
+/* Fills in the full frame equivalent of packed */
+static void
+packed_frame_full(const packed_frame_t *packed, full_frame_t *full OUT)
+{
+    modname_info_t *info;
+    size_t offs;
+    full->loc = packed->loc;
+    if (packed_frame_modinfo(packed, &info, &offs)) {
+        full->modname = info;
+        full->modoffs = offs;
     } else {
-        if (pcs->frames.packed[frame].modname_idx == 0) {
-            ASSERT(frame == 0, "syscall should only be top frame");
-            ASSERT(pcs->first_is_syscall, "flag not set");
-            return false;
-        }
-        if (pcs->frames.packed[frame].modoffs < MAX_MODOFFS_STORED) {
-            /* If module is larger than 16M, we need to adjust offset.
-             * The hashtable holds the first index.
-             */
-            int start_idx;
-            int idx = pcs->frames.packed[frame].modname_idx;
-            ASSERT(idx < MAX_MODNAMES_STORED, "invalid modname idx");
-            offs = pcs->frames.packed[frame].modoffs;
-            info = modname_array[idx];
-            start_idx = info->index;
-            ASSERT(start_idx != 0, "module in array must be in table");
-            if (start_idx < idx)
-                offs += (idx - start_idx) * MAX_MODOFFS_STORED;
+        full->modname = (modname_info_t *) &MODNAME_INFO_SYSCALL;
+        full->modoffs = 0;
+    }
+}
+
+static bool
+full_frame_equal(const full_frame_t *f1, const full_frame_t *f2)
+{
+    if (f1->modname == &MODNAME_INFO_SYSCALL || f2->modname == &MODNAME_INFO_SYSCALL) {
+        return (f1->modname == f2->modname &&
+                memcmp(f1->loc.sysloc, f2->loc.sysloc, sizeof(syscall_loc_t)) == 0);
+    }
+    return (f1->loc.addr == f2->loc.addr && f1->modname == f2->modname &&
+            f1->modoffs == f2->modoffs);
+}
+
+/* Returns the tree node for the top frame of pcs, adding nodes for any
+ * frames not already there, with a reference for the caller.
+ */
+static cct_node_t *
+cct_insert(packed_callstack_t *pcs)
+{
+    cct_node_t key;
+    cct_node_t *node = NULL;
+    int i;
+    ASSERT(ops.frame_tree, "tree not initialized");
+    ASSERT(!pcs->in_tree && pcs->is_packed && pcs->num_frames > 0, "invalid args");
+    key.parent = NULL;
+    key.hash_next = NULL;
+    key.refcount = 0;
+    dr_mutex_lock(cct_lock);
+    for (i = pcs->num_frames - 1; i >= 0; i--) {
+        key.frame = pcs->frames.packed[i];
+        node = cct_table_lookup(&key);
+        if (node == NULL) {
+            node = (cct_node_t *) global_alloc(sizeof(*node), HEAPSTAT_CALLSTACK);
+            *node = key;
+            if (node->frame.modname_idx == 0) {
+                node->frame.loc.sysloc = (syscall_loc_t *)
+                    global_alloc(sizeof(syscall_loc_t), HEAPSTAT_CALLSTACK);
+                *node->frame.loc.sysloc = *key.frame.loc.sysloc;
+            }
+            cct_table_add(node);
+            if (node->parent != NULL)
+                ATOMIC_INC32(node->parent->refcount);
+            STATS_INC(cct_nodes_created);
         }
+        key.parent = node;
     }
-    if (name_info != NULL)
-        *name_info = info;
-    if (modoffs != NULL)
-        *modoffs = offs;
-    return true;
+    ATOMIC_INC32(node->refcount);
+    dr_mutex_unlock(cct_lock);
+    return node;
 }
 
+/* Drops a reference to node, removing it and any ancestors left unused */
 static void
-packed_frame_to_symbolized(packed_callstack_t *pcs IN, symbolized_frame_t *frame OUT,
-                           uint idx)
+cct_release(cct_node_t *node)
+{
+    dr_mutex_lock(cct_lock);
+    while (node != NULL &&
+           atomic_add32_return_sum((volatile int *)&node->refcount, -1) == 0) {
+        cct_node_t *parent = node->parent;
+        IF_DEBUG(bool found =)
+            cct_table_remove(node);
+        ASSERT(found, "tree node missing from table");
+        cct_node_free(node);
+        node = parent;
+    }
+    dr_mutex_unlock(cct_lock);
+}
+
+/* Returns a new callstack equal to src with its frames in the tree */
+static packed_callstack_t *
+packed_callstack_tree_clone(packed_callstack_t *src)
+{
+    packed_callstack_t *dst = (packed_callstack_t *)
+        global_alloc(sizeof(*dst), HEAPSTAT_CALLSTACK);
+    memset(dst, 0, sizeof(*dst));
+    dst->refcount = 1;
+    dst->hash = src->hash;
+    dst->num_frames = src->num_frames;
+    dst->is_packed = true;
+    dst->first_is_retaddr = src->first_is_retaddr;
+    dst->first_is_syscall = src->first_is_syscall;
+    dst->in_tree = true;
+    if (src->in_tree) {
+        /* src holds a reference so the node can't go away */
+        dst->frames.node = src->frames.node;
+        ATOMIC_INC32(dst->frames.node->refcount);
+    } else {
+        dst->frames.node = cct_insert(src);
+        STATS_ADD(cct_frames_stored, src->num_frames);
+    }
+    return dst;
+}
+
+/* For a tree callstack, node is the node of frame idx */
+static void
+packed_frame_to_symbolized(packed_callstack_t *pcs IN, cct_node_t *node,
+                           symbolized_frame_t *frame OUT, uint idx)
 {
     modname_info_t *info = NULL;
     size_t offs;
+    frame_loc_t loc;
+    ASSERT(pcs->in_tree == (node != NULL), "tree frames need their node");
     init_symbolized_frame(frame, idx);
-    if (!packed_callstack_frame_modinfo(pcs, idx, &info, &offs)) {
+    loc = (node != NULL) ? node->frame.loc : PCS_FRAME_LOC(pcs, idx);
+    if (!packed_callstack_frame_modinfo(pcs, node, idx, &info, &offs)) {
         size_t sofar = 0;
         ssize_t len;
         const char *name = "<unknown>";
         frame->loc.type = APP_LOC_SYSCALL;
 
-        frame->loc.u.syscall = *(PCS_FRAME_LOC(pcs, idx).sysloc);
+        frame->loc.u.syscall = *loc.sysloc;
 
         /* we print the string now so we can compare to suppressions.
          * we use func since modname is too short in windows.
@@ -2160,7 +3028,7 @@ packed_frame_to_symbolized(packed_callstack_t *pcs IN, symbolized_frame_t *frame
         }
         NULL_TERMINATE_BUFFER(frame->func);
     } else {
-        pc_to_loc(&frame->loc, PCS_FRAME_LOC(pcs, idx).addr);
+        pc_to_loc(&frame->loc, loc.addr);
         if (info != NULL) {
             const char *modname = (info->name == NULL) ?
                 "<name unavailable>" : info->name;
@@ -2200,10 +3068,13 @@ packed_callstack_print(packed_callstack_t *pcs, uint num_frames,
 {
     uint i;
     symbolized_frame_t frame; /* 480 bytes but our stack can handle it */
+    cct_node_t *node;
     STATS_INC(callstacks_symbolized);
     ASSERT(pcs != NULL, "invalid args");
-    for (i = 0; i < pcs->num_frames && (num_frames == 0 || i < num_frames); i++) {
-        packed_frame_to_symbolized(pcs, &frame, i);
+    node = pcs->in_tree ? pcs->frames.node : NULL;
+    for (i = 0; i < pcs->num_frames && (num_frames == 0 || i < num_frames);
+         i++, node = (node == NULL ? NULL : node->parent)) {
+        packed_frame_to_symbolized(pcs, node, &frame, i);
         print_frame(&frame, buf, bufsz, sofar, false, 0, 0, prefix);
         if (ops.truncate_below != NULL &&
             text_matches_any_pattern((const char *)frame.func, ops.truncate_below, false))
@@ -2216,6 +3087,7 @@ packed_callstack_to_symbolized(packed_callstack_t *pcs IN,
                                symbolized_callstack_t *scs OUT)
 {
     uint i;
+    cct_node_t *node;
     STATS_INC(callstacks_symbolized);
     scs->num_frames = pcs->num_frames;
     scs->num_frames_allocated = pcs->num_frames;
@@ -2223,8 +3095,9 @@ packed_callstack_to_symbolized(packed_callstack_t *pcs IN,
     scs->frames = (symbolized_frame_t *)
         global_alloc(sizeof(*scs->frames) * scs->num_frames, HEAPSTAT_CALLSTACK);
     ASSERT(pcs != NULL, "invalid args");
-    for (i = 0; i < pcs->num_frames; i++) {
-        packed_frame_to_symbolized(pcs, &scs->frames[i], i);
+    node = pcs->in_tree ? pcs->frames.node : NULL;
+    for (i = 0; i < pcs->num_frames; i++, node = (node == NULL ? NULL : node->parent)) {
+        packed_frame_to_symbolized(pcs, node, &scs->frames[i], i);
         /* we truncate for real and not just on printing (i#700) */
         if (ops.truncate_below != NULL &&
             text_matches_any_pattern((const char *)scs->frames[i].func,
@@ -2236,6 +3109,91 @@ packed_callstack_to_symbolized(packed_callstack_t *pcs IN,
     }
 }
 
+#ifdef USE_DRSYMS
+/* The offsets to look up in one module, for packed_callstack_symbolize_batch() */
+typedef struct _symbol_batch_t {
+    modname_info_t *name_info;
+    rb_tree_t *offsets; /* nodes are [offset, offset+1) */
+    struct _symbol_batch_t *next;
+} symbol_batch_t;
+
+static bool
+symbol_batch_lookup_cb(rb_node_t *node, void *iter_data)
+{
+    modname_info_t *name_info = (modname_info_t *) iter_data;
+    byte *offs;
+    rb_node_fields(node, &offs, NULL, NULL);
+    symbol_cache_lookup(name_info, (size_t) offs, NULL);
+    STATS_INC(symbol_batch_lookups);
+    return true;
+}
+#endif
+
+void
+packed_callstack_symbolize_batch(packed_callstack_t **pcs, uint num_pcs)
+{
+#ifdef USE_DRSYMS
+    symbol_batch_t *batches = NULL, *batch, *prev;
+    uint i, j;
+    if (!ops.symbol_cache)
+        return;
+    /* Gather the unique offsets we haven't looked up, per module */
+    for (i = 0; i < num_pcs; i++) {
+        cct_node_t *node;
+        if (pcs[i] == NULL)
+            continue;
+        node = pcs[i]->in_tree ? pcs[i]->frames.node : NULL;
+        for (j = 0; j < pcs[i]->num_frames;
+             j++, node = (node == NULL ? NULL : node->parent)) {
+            modname_info_t *info;
+            size_t offs;
+            bool cached;
+            if (!packed_callstack_frame_modinfo(pcs[i], node, j, &info, &offs) ||
+                info == NULL)
+                continue;
+            /* Match the retaddr adjustment in packed_frame_to_symbolized() */
+            if (j > 0 || pcs[i]->first_is_retaddr)
+                offs--;
+            hashtable_lock(&symbol_table);
+            cached = (symbol_cache_find(info, offs) != NULL);
+            hashtable_unlock(&symbol_table);
+            if (cached)
+                continue;
+            /* Consecutive frames are often in the same module, so we keep the
+             * most recently used module at the front.
+             */
+            for (prev = NULL, batch = batches; batch != NULL && batch->name_info != info;
+                 prev = batch, batch = batch->next)
+                ; /* nothing */
+            if (batch == NULL) {
+                batch = (symbol_batch_t *)
+                    global_alloc(sizeof(*batch), HEAPSTAT_CALLSTACK);
+                batch->name_info = info;
+                batch->offsets = rb_tree_create(NULL);
+                batch->next = batches;
+                batches = batch;
+            } else if (prev != NULL) {
+                prev->next = batch->next;
+                batch->next = batches;
+                batches = batch;
+            }
+            /* returns the existing node for a duplicate */
+            rb_insert(batch->offsets, (byte *) offs, 1, NULL);
+        }
+    }
+    /* Look them up a module at a time, in offset order */
+    while (batches != NULL) {
+        batch = batches;
+        batches = batch->next;
+        LOG(2, "symbolizing batch of offsets in %s\n",
+            batch->name_info->name == NULL ? "<null>" : batch->name_info->name);
+        rb_iterate(batch->offsets, symbol_batch_lookup_cb, batch->name_info);
+        rb_tree_destroy(batch->offsets);
+        global_free(batch, sizeof(*batch), HEAPSTAT_CALLSTACK);
+    }
+#endif
+}
+
 #ifdef DEBUG
 void
 packed_callstack_log(packed_callstack_t *pcs, file_t f)
@@ -2271,7 +3229,10 @@ packed_callstack_free(packed_callstack_t *pcs)
     uint refcount;
     ASSERT(pcs != NULL, "invalid args");
     refcount = atomic_add32_return_sum((volatile int *)&pcs->refcount, - 1);
-    if (refcount == 0) {
+    if (refcount == 0 && pcs->in_tree) {
+        cct_release(pcs->frames.node);
+        global_free(pcs, sizeof(*pcs), HEAPSTAT_CALLSTACK);
+    } else if (refcount == 0) {
         if (pcs->first_is_syscall) {
             global_free(PCS_FRAME_LOC(pcs, 0).sysloc, sizeof(syscall_loc_t),
                         HEAPSTAT_CALLSTACK);
@@ -2311,16 +3272,22 @@ packed_callstack_add_ref(packed_callstack_t *pcs)
 packed_callstack_t *
 packed_callstack_clone(packed_callstack_t *src)
 {
-    packed_callstack_t *dst = (packed_callstack_t *)
-        global_alloc(sizeof(*dst), HEAPSTAT_CALLSTACK);
+    packed_callstack_t *dst;
     ASSERT(src != NULL, "invalid args");
+    /* tree frames are never modified so we share them */
+    if (src->in_tree)
+        return packed_callstack_tree_clone(src);
+    dst = (packed_callstack_t *) global_alloc(sizeof(*dst), HEAPSTAT_CALLSTACK);
     memset(dst, 0, sizeof(*dst));
     dst->refcount = 1;
+    dst->hash = src->hash;
     dst->num_frames = src->num_frames;
     dst->is_packed = src->is_packed;
     dst->first_is_retaddr = src->first_is_retaddr;
     dst->first_is_syscall = src->first_is_syscall;
-    if (dst->is_packed) {
+    if (src->num_frames == 0) {
+        /* frames stay NULL, as for packed_callstack_record() */
+    } else if (dst->is_packed) {
         dst->frames.packed = (packed_frame_t *)
             global_alloc(sizeof(*dst->frames.packed) * src->num_frames,
                          HEAPSTAT_CALLSTACK);
@@ -2350,28 +3317,43 @@ packed_callstack_clone(packed_callstack_t *src)
 uint
 packed_callstack_hash(packed_callstack_t *pcs)
 {
-    uint hash = 0;
-    uint i;
-    for (i = 0; i < pcs->num_frames; i++) {
-        if (!pcs->first_is_syscall || i > 0)
-            hash ^= (ptr_uint_t) PCS_FRAME_LOC(pcs, i).addr;
-    }
-    return hash;
+    /* The xor of the non-syscall frame addresses, computed as the frames
+     * were recorded.
+     */
+    return pcs->hash;
 }
 
 bool
 packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2)
 {
     uint i;
-    if (PCS_FRAMES(pcs1) == NULL) {
-        if (PCS_FRAMES(pcs2) != NULL)
-            return false;
-        return true;
-    }
-    if (PCS_FRAMES(pcs2) == NULL)
-        return false;
+    /* A scratch callstack has a frames array even when it has no frames */
     if (pcs1->num_frames != pcs2->num_frames)
         return false;
+    if (pcs1->num_frames == 0)
+        return true;
+    if (pcs1->in_tree && pcs2->in_tree) {
+        /* the tree holds each distinct callstack once */
+        return pcs1->frames.node == pcs2->frames.node;
+    }
+    if (pcs1->in_tree || pcs2->in_tree) {
+        /* walk up the tree alongside the other callstack's frames */
+        packed_callstack_t *flat = pcs1->in_tree ? pcs2 : pcs1;
+        cct_node_t *node = pcs1->in_tree ? pcs1->frames.node : pcs2->frames.node;
+        full_frame_t frame;
+        for (i = 0; i < flat->num_frames; i++, node = node->parent) {
+            if (flat->is_packed) {
+                if (!cct_frame_equal(&flat->frames.packed[i], &node->frame))
+                    return false;
+            } else {
+                /* recorded after the module name array filled up */
+                packed_frame_full(&node->frame, &frame);
+                if (!full_frame_equal(&flat->frames.full[i], &frame))
+                    return false;
+            }
+        }
+        return true;
+    }
     if (!pcs1->first_is_syscall && !pcs2->first_is_syscall &&
         ((pcs1->is_packed && pcs2->is_packed) ||
          (!pcs1->is_packed && !pcs2->is_packed))) {
@@ -2385,8 +3367,8 @@ packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2)
         modname_info_t *info1 = NULL, *info2 = NULL;
         size_t offs1 = 0, offs2 = 0;
         bool nonsys1, nonsys2;
-        nonsys1 = packed_callstack_frame_modinfo(pcs1, i, &info1, &offs1);
-        nonsys2 = packed_callstack_frame_modinfo(pcs2, i, &info2, &offs2);
+        nonsys1 = packed_callstack_frame_modinfo(pcs1, NULL, i, &info1, &offs1);
+        nonsys2 = packed_callstack_frame_modinfo(pcs2, NULL, i, &info2, &offs2);
         if ((nonsys1 && !nonsys2) || (!nonsys1 && nonsys2))
             return false;
         if (!nonsys1) {
@@ -2408,6 +3390,7 @@ packed_callstack_cmp(packed_callstack_t *pcs1, packed_callstack_t *pcs2)
 void
 packed_callstack_md5(packed_callstack_t *pcs, byte digest[MD5_RAW_BYTES])
 {
+    ASSERT(!pcs->in_tree, "tree frames are not contiguous");
     if (pcs->num_frames == 0) {
         memset(digest, 0, sizeof(digest[0])*MD5_RAW_BYTES);
     } else {
@@ -2419,6 +3402,7 @@ packed_callstack_md5(packed_callstack_t *pcs, byte digest[MD5_RAW_BYTES])
 void
 packed_callstack_crc32(packed_callstack_t *pcs, uint crc[2])
 {
+    ASSERT(!pcs->in_tree, "tree frames are not contiguous");
     crc32_whole_and_half((const char *)PCS_FRAMES(pcs),
                          PCS_FRAME_SZ(pcs)*pcs->num_frames, crc);
 }
@@ -2447,6 +3431,21 @@ packed_callstack_destroy(packed_callstack_t *pcs)
     } while (count > 0);
 }
 
+static void
+packed_callstack_add_new_to_table(hashtable_t *table, packed_callstack_t *pcs
+                                  _IF_STATS(uint *callstack_count))
+{
+    /* avoid calling lookup twice by not calling hashtable_add() */
+    IF_DEBUG(void *prior =)
+        hashtable_add_replace(table, (void *)pcs, (void *)pcs);
+    ASSERT(prior == NULL, "just did lookup: cannot happen");
+    DOLOG(3, {
+        LOG(3, "@@@ unique callstack #%d\n", *callstack_count);
+        packed_callstack_log(pcs, INVALID_FILE);
+    });
+    STATS_INC(*callstack_count);
+}
+
 /* add the packed callstack into the hashtable, assuming the caller is holding the lock */
 packed_callstack_t *
 packed_callstack_add_to_table(hashtable_t *table, packed_callstack_t *pcs
@@ -2456,15 +3455,7 @@ packed_callstack_add_to_table(hashtable_t *table, packed_callstack_t *pcs
 
     existing = hashtable_lookup(table, (void *)pcs);
     if (existing == NULL) {
-        /* avoid calling lookup twice by not calling hashtable_add() */
-        IF_DEBUG(void *prior =)
-            hashtable_add_replace(table, (void *)pcs, (void *)pcs);
-        ASSERT(prior == NULL, "just did lookup: cannot happen");
-        DOLOG(3, {
-            LOG(3, "@@@ unique callstack #%d\n", *callstack_count);
-            packed_callstack_log(pcs, INVALID_FILE);
-        });
-        STATS_INC(*callstack_count);
+        packed_callstack_add_new_to_table(table, pcs _IF_STATS(callstack_count));
     } else {
         IF_DEBUG(uint count =) packed_callstack_free(pcs);
         ASSERT(count == 0, "refcount should be 0");
@@ -2478,6 +3469,28 @@ packed_callstack_add_to_table(hashtable_t *table, packed_callstack_t *pcs
     return pcs;
 }
 
+packed_callstack_t *
+packed_callstack_intern(hashtable_t *table, packed_callstack_t *scratch
+                        _IF_STATS(uint *callstack_count))
+{
+    packed_callstack_t *pcs = hashtable_lookup(table, (void *)scratch);
+    if (pcs == NULL) {
+        STATS_INC(callstack_intern_misses);
+        /* The table probe above compares against tree callstacks by walking
+         * up from their top frames, so hits never touch the tree lock.
+         */
+        if (ops.frame_tree && scratch->is_packed && scratch->num_frames > 0)
+            pcs = packed_callstack_tree_clone(scratch);
+        else
+            pcs = packed_callstack_clone(scratch);
+        packed_callstack_add_new_to_table(table, pcs _IF_STATS(callstack_count));
+    } else
+        STATS_INC(callstack_intern_hits);
+    /* as in packed_callstack_add_to_table(), one reference is the table's */
+    packed_callstack_add_ref(pcs);
+    return pcs;
+}
+
 /***************************************************************************
  * SYMBOLIZED CALLSTACKS
  */
@@ -2639,6 +3652,7 @@ add_new_module(void *drcontext, const module_data_t *info)
         if (ops.module_load != NULL)
             name_info->user_data = ops.module_load(name_info->path, name, info->start);
         name_info->warned_no_syms = false;
+        name_info->unload_generation = 0;
         hashtable_add(&modname_table, (void*)name_info->path, (void*)name_info);
         /* We need an entry for every 16M of module size */
         sz = info->end - info->start;
@@ -2793,6 +3807,9 @@ callstack_module_load(void *drcontext, const module_data_t *info, bool loaded)
     modtree_last_hit = NULL;
     modtree_last_miss = NULL;
     dr_mutex_unlock(modtree_lock);
+
+    if (!TEST(FP_DO_NOT_UNWIND_CFI, ops.fp_flags))
+        unwind_module_load(info);
 }
 
 void
@@ -2802,11 +3819,17 @@ callstack_module_unload(void *drcontext, const module_data_t *info)
     rb_node_t *node;
     app_pc node_start;
     size_t node_size;
+    modname_info_t *name_info = NULL;
     ASSERT(info->end > info->start, "invalid mod bounds");
     LOG(1, "module unload event: \"%s\" "PFX"-"PFX"\n",
         (dr_module_preferred_name(info) == NULL) ? "" :
         dr_module_preferred_name(info), info->start, info->end);
+    if (!TEST(FP_DO_NOT_UNWIND_CFI, ops.fp_flags))
+        unwind_module_unload(info);
     dr_mutex_lock(modtree_lock);
+    node = rb_in_node(module_tree, info->start);
+    if (node != NULL)
+        rb_node_fields(node, NULL, NULL, (void **) &name_info);
 
 #ifdef WINDOWS
     callstack_module_remove_region(info->start, info->end);
@@ -2848,15 +3871,55 @@ callstack_module_unload(void *drcontext, const module_data_t *info)
     modtree_last_start = NULL;
     modtree_last_hit = NULL;
     modtree_last_miss = NULL;
+    modtree_generation++;
+    /* Invalidates this module's symbol cache entries */
+    if (name_info != NULL)
+        name_info->unload_generation = modtree_generation;
 
     dr_mutex_unlock(modtree_lock);
+
+#ifdef USE_DRSYMS
+    if (ops.symbol_cache && name_info != NULL)
+        symbol_cache_purge(name_info);
+#endif
 }
 
 static bool
 module_lookup(byte *pc, app_pc *start OUT, size_t *size OUT, modname_info_t **name)
 {
+    void *drcontext = dr_get_current_drcontext();
+    tls_callstack_t *pt = (tls_callstack_t *)
+        ((drcontext == NULL) ? NULL : drmgr_get_tls_field(drcontext, tls_idx_callstack));
+    modcache_entry_t *entry = NULL;
     rb_node_t *node;
     bool res = false;
+    uint i;
+    if (pt != NULL) {
+        /* Callstack walks look up every frame, so for modules this thread has
+         * already seen we avoid the lock.  The module can be unloaded as we
+         * return it, but that was already true once we dropped the lock, and
+         * the name info is never freed.
+         */
+        if (pt->modcache_generation != modtree_generation) {
+            memset(pt->modcache, 0, sizeof(pt->modcache));
+            pt->modcache_generation = modtree_generation;
+        }
+        for (i = 0; i < MODCACHE_ENTRIES; i++) {
+            entry = &pt->modcache[i];
+            if (entry->start != NULL &&
+                pc >= entry->start && pc < entry->start + entry->size) {
+                STATS_INC(modcache_hits);
+                if (start != NULL)
+                    *start = entry->start;
+                if (size != NULL)
+                    *size = entry->size;
+                if (name != NULL)
+                    *name = entry->name_info;
+                return true;
+            }
+        }
+        STATS_INC(modcache_misses);
+    }
     dr_mutex_lock(modtree_lock);
     /* We cache to avoid the rb_in_node cost */
     if (modtree_last_start != NULL &&
@@ -2881,6 +3944,14 @@ module_lookup(byte *pc, app_pc *start OUT, size_t *size OUT, modname_info_t **na
             *size = modtree_last_size;
         if (name != NULL)
             *name = modtree_last_name_info;
+        /* If there was an unload since we flushed, our entry could be stale */
+        if (pt != NULL && pt->modcache_generation == modtree_generation) {
+            entry = &pt->modcache[pt->modcache_idx];
+            pt->modcache_idx = (pt->modcache_idx + 1) % MODCACHE_ENTRIES;
+            entry->start = modtree_last_start;
+            entry->size = modtree_last_size;
+            entry->name_info = modtree_last_name_info;
+        }
     }
     dr_mutex_unlock(modtree_lock);
     return res;
@@ -165,6 +165,16 @@ enum {
      * that we've already executed.
      */
     FP_SEARCH_ALLOW_UNSEEN_RETADDR    = 0x00010000,
+    /* By default, a packed callstack walk that reaches a frame of one of the
+     * thread's recent walks reuses the rest of that walk, after checking that
+     * its frames are still on the stack.
+     */
+    FP_DO_NOT_MEMOIZE_WALK            = 0x00020000,
+    /* By default, where a module has .eh_frame unwind info covering a frame
+     * we use it to find the caller instead of following the frame pointer
+     * or scanning.
+     */
+    FP_DO_NOT_UNWIND_CFI              = 0x00040000,
     FP_SEARCH_AGGRESSIVE              = (FP_SHOW_NON_MODULE_FRAMES |
                                          FP_SEARCH_MATCH_SINGLE_FRAME),
 };
@@ -266,6 +276,20 @@ typedef struct _callstack_options_t {
     void (*module_unload)(const char * /*module path*/,
                           void * /*user data returned by module_load()*/);
 
+    /* Whether packed_callstack_intern() stores frames in a calling-context
+     * tree shared by all interned callstacks, rather than giving each its
+     * own frame array.  Tree callstacks with common outer frames share them,
+     * and two tree callstacks compare in constant time.  They do not support
+     * packed_callstack_md5() or packed_callstack_crc32().
+     */
+    bool frame_tree;
+
+    /* Whether symbol lookups are cached by module and offset, so that a frame
+     * shared by many reported callstacks is only looked up once.  This also
+     * enables packed_callstack_symbolize_batch().
+     */
+    bool symbol_cache;
+
     /* Add new options here */
 } callstack_options_t;
 
@@ -303,6 +327,15 @@ void
 packed_callstack_record(packed_callstack_t **pcs_out/*out*/, dr_mcontext_t *mc,
                         app_loc_t *loc, uint max_frames);
 
+/* Records a callstack like packed_callstack_record() but into scratch space
+ * owned by the calling thread, allocating nothing.  The result is only valid
+ * until the thread's next call and must not be freed or stored: pass it to
+ * packed_callstack_intern() or packed_callstack_clone().  Returns NULL if the
+ * thread has no scratch space (e.g., it is not an app thread).
+ */
+packed_callstack_t *
+packed_callstack_record_scratch(dr_mcontext_t *mc, app_loc_t *loc, uint max_frames);
+
 void
 packed_callstack_first_frame_retaddr(packed_callstack_t *pcs);
 
@@ -352,6 +385,16 @@ packed_callstack_t *
 packed_callstack_add_to_table(hashtable_t *table, packed_callstack_t *pcs
                               _IF_STATS(uint *callstack_count));
 
+/* Returns the callstack in table equal to the scratch callstack, adding a
+ * heap copy of scratch first if there is none (a copy whose frames are in the
+ * calling-context tree, if the frame_tree option is set).  As with
+ * packed_callstack_add_to_table(), the caller must hold the table lock, and
+ * the returned callstack has a reference for the caller besides the table's.
+ */
+packed_callstack_t *
+packed_callstack_intern(hashtable_t *table, packed_callstack_t *scratch
+                        _IF_STATS(uint *callstack_count));
+
 /* The user must call this from a DR dr_register_module_load_event() event */
 void
 callstack_module_load(void *drcontext, const module_data_t *info, bool loaded);
@@ -411,6 +454,14 @@ void
 packed_callstack_to_symbolized(packed_callstack_t *pcs IN,
                                symbolized_callstack_t *scs OUT);
 
+/* Looks up symbols for the frames of all num_pcs callstacks in pcs that are
+ * not yet in the symbol cache, one module at a time in offset order, so that
+ * later symbolization of any of them is satisfied from the cache.  NULL
+ * entries are ignored.  A nop unless the symbol_cache option is set.
+ */
+void
+packed_callstack_symbolize_batch(packed_callstack_t **pcs, uint num_pcs);
+
 void
 symbolized_callstack_print(const symbolized_callstack_t *scs IN,
                            char *buf, size_t bufsz, size_t *sofar,
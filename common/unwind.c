@@ -0,0 +1,1110 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Frame unwinding from .eh_frame CFI.  See unwind.h. */
+
+#include "dr_api.h"
+#include "utils.h"
+#include "redblack.h"
+#include "unwind.h"
+
+#if defined(LINUX) && defined(X86)
+# define UNWIND_SUPPORTED 1
+#endif
+
+#ifdef UNWIND_SUPPORTED
+# include <elf.h>
+
+# ifdef X64
+typedef Elf64_Ehdr elf_ehdr_t;
+typedef Elf64_Phdr elf_phdr_t;
+#  define ELF_CLASS ELFCLASS64
+/* DWARF register numbers from the x86-64 psABI */
+#  define DWARF_REG_FP 6
+#  define DWARF_REG_SP 7
+# else
+typedef Elf32_Ehdr elf_ehdr_t;
+typedef Elf32_Phdr elf_phdr_t;
+#  define ELF_CLASS ELFCLASS32
+/* DWARF register numbers from the i386 psABI */
+#  define DWARF_REG_FP 5
+#  define DWARF_REG_SP 4
+# endif
+
+/* Pointer encodings used in .eh_frame and .eh_frame_hdr */
+# define DW_EH_PE_absptr   0x00
+# define DW_EH_PE_uleb128  0x01
+# define DW_EH_PE_udata2   0x02
+# define DW_EH_PE_udata4   0x03
+# define DW_EH_PE_udata8   0x04
+# define DW_EH_PE_sleb128  0x09
+# define DW_EH_PE_sdata2   0x0a
+# define DW_EH_PE_sdata4   0x0b
+# define DW_EH_PE_sdata8   0x0c
+# define DW_EH_PE_pcrel    0x10
+# define DW_EH_PE_datarel  0x30
+# define DW_EH_PE_indirect 0x80
+# define DW_EH_PE_omit     0xff
+
+/* Call frame instructions */
+# define DW_CFA_advance_loc        0x40
+# define DW_CFA_offset             0x80
+# define DW_CFA_restore            0xc0
+# define DW_CFA_nop                0x00
+# define DW_CFA_set_loc            0x01
+# define DW_CFA_advance_loc1       0x02
+# define DW_CFA_advance_loc2       0x03
+# define DW_CFA_advance_loc4       0x04
+# define DW_CFA_offset_extended    0x05
+# define DW_CFA_restore_extended   0x06
+# define DW_CFA_undefined          0x07
+# define DW_CFA_same_value         0x08
+# define DW_CFA_register           0x09
+# define DW_CFA_remember_state     0x0a
+# define DW_CFA_restore_state      0x0b
+# define DW_CFA_def_cfa            0x0c
+# define DW_CFA_def_cfa_register   0x0d
+# define DW_CFA_def_cfa_offset     0x0e
+# define DW_CFA_def_cfa_expression 0x0f
+# define DW_CFA_expression         0x10
+# define DW_CFA_offset_extended_sf 0x11
+# define DW_CFA_def_cfa_sf         0x12
+# define DW_CFA_def_cfa_offset_sf  0x13
+# define DW_CFA_val_offset         0x14
+# define DW_CFA_val_offset_sf      0x15
+# define DW_CFA_val_expression     0x16
+# define DW_CFA_GNU_args_size      0x2e
+# define DW_CFA_GNU_negative_offset_extended 0x2f
+
+/* How to find the CFA for a row */
+enum {
+    CFA_NONE, /* no CFI, or rules we don't support: can't unwind */
+    CFA_SP,
+    CFA_FP,
+};
+
+/* One row of the table: the rules for [start, next row's start) */
+typedef struct _cfi_row_t {
+    uint start; /* offset from the table's base */
+    int cfa_offset;
+    /* Offsets from the CFA of the return address and, if fp_saved, of the
+     * caller's frame pointer.  Otherwise the frame pointer is unchanged.
+     */
+    short ra_offset;
+    short fp_offset;
+    byte cfa_reg;
+    bool fp_saved;
+} cfi_row_t;
+
+/* Per-module table, sorted by start and ending with a CFA_NONE row */
+typedef struct _cfi_table_t {
+    app_pc base;
+    cfi_row_t *rows;
+    uint num_rows;
+    uint capacity;
+} cfi_table_t;
+
+typedef enum {
+    RULE_SAME,
+    RULE_UNDEFINED,
+    RULE_OFFSET, /* saved at CFA + offset */
+    RULE_OTHER,  /* anything else, which we don't support */
+} reg_rule_kind_t;
+
+typedef struct _reg_rule_t {
+    reg_rule_kind_t kind;
+    ptr_int_t offset;
+} reg_rule_t;
+
+/* The registers we track while executing call frame instructions */
+typedef struct _cfa_state_t {
+    uint cfa_reg;
+    ptr_int_t cfa_offset;
+    bool cfa_expr;
+    reg_rule_t fp;
+    reg_rule_t ra;
+} cfa_state_t;
+
+# define CFA_STATE_STACK_DEPTH 8
+
+typedef struct _cie_info_t {
+    byte *cie;
+    ptr_uint_t code_align;
+    ptr_int_t data_align;
+    uint ra_reg;
+    byte fde_enc;
+    bool has_aug_data;
+    cfa_state_t initial;
+} cie_info_t;
+
+typedef struct _cfi_reader_t {
+    byte *cur;
+    byte *end;
+    bool error;
+} cfi_reader_t;
+
+/* Tables keyed by the pc range they cover */
+static rb_tree_t *unwind_tree;
+static void *unwind_lock;
+
+# ifdef STATISTICS
+static uint unwind_modules;
+static uint unwind_rows;
+static uint unwind_fdes;
+static uint unwind_fdes_unsupported;
+static uint unwind_steps;
+static uint unwind_step_misses;
+# endif
+
+/***************************************************************************
+ * PARSING
+ */
+
+static bool
+reader_has(cfi_reader_t *r, size_t sz)
+{
+    if (r->error || r->cur + sz > r->end || r->cur + sz < r->cur) {
+        r->error = true;
+        return false;
+    }
+    return true;
+}
+
+static byte
+read_u8(cfi_reader_t *r)
+{
+    if (!reader_has(r, 1))
+        return 0;
+    return *r->cur++;
+}
+
+# define DEFINE_READER(name, type)                      \
+    static type                                         \
+    name(cfi_reader_t *r)                               \
+    {                                                   \
+        type val;                                       \
+        if (!reader_has(r, sizeof(val)))                \
+            return 0;                                   \
+        memcpy(&val, r->cur, sizeof(val));              \
+        r->cur += sizeof(val);                          \
+        return val;                                     \
+    }
+DEFINE_READER(read_u16, ushort)
+DEFINE_READER(read_u32, uint)
+DEFINE_READER(read_u64, uint64)
+DEFINE_READER(read_s16, short)
+DEFINE_READER(read_s32, int)
+DEFINE_READER(read_s64, int64)
+
+static ptr_uint_t
+read_uleb128(cfi_reader_t *r)
+{
+    ptr_uint_t val = 0;
+    uint shift = 0;
+    byte b;
+    do {
+        b = read_u8(r);
+        if (shift < sizeof(val) * 8)
+            val |= ((ptr_uint_t)(b & 0x7f)) << shift;
+        shift += 7;
+    } while (TEST(0x80, b) && !r->error);
+    return val;
+}
+
+static ptr_int_t
+read_sleb128(cfi_reader_t *r)
+{
+    ptr_int_t val = 0;
+    uint shift = 0;
+    byte b;
+    do {
+        b = read_u8(r);
+        if (shift < sizeof(val) * 8)
+            val |= ((ptr_int_t)(b & 0x7f)) << shift;
+        shift += 7;
+    } while (TEST(0x80, b) && !r->error);
+    if (shift < sizeof(val) * 8 && TEST(0x40, b))
+        val |= -((ptr_int_t)1 << shift);
+    return val;
+}
+
+/* Reads a value in pointer encoding enc.  datarel is the base for
+ * DW_EH_PE_datarel, which is only used in .eh_frame_hdr.
+ */
+static ptr_uint_t
+read_encoded(cfi_reader_t *r, byte enc, byte *datarel)
+{
+    byte *field = r->cur;
+    ptr_uint_t val;
+    if (enc == DW_EH_PE_omit) {
+        r->error = true;
+        return 0;
+    }
+    switch (enc & 0x0f) {
+    case DW_EH_PE_absptr:  val = IF_X64_ELSE(read_u64(r), read_u32(r)); break;
+    case DW_EH_PE_uleb128: val = read_uleb128(r); break;
+    case DW_EH_PE_udata2:  val = read_u16(r); break;
+    case DW_EH_PE_udata4:  val = read_u32(r); break;
+    case DW_EH_PE_udata8:  val = (ptr_uint_t) read_u64(r); break;
+    case DW_EH_PE_sleb128: val = (ptr_uint_t) read_sleb128(r); break;
+    case DW_EH_PE_sdata2:  val = (ptr_uint_t)(ptr_int_t) read_s16(r); break;
+    case DW_EH_PE_sdata4:  val = (ptr_uint_t)(ptr_int_t) read_s32(r); break;
+    case DW_EH_PE_sdata8:  val = (ptr_uint_t)(ptr_int_t) read_s64(r); break;
+    default:
+        r->error = true;
+        return 0;
+    }
+    switch (enc & 0x70) {
+    case 0: break;
+    case DW_EH_PE_pcrel: val += (ptr_uint_t) field; break;
+    case DW_EH_PE_datarel:
+        if (datarel == NULL)
+            r->error = true;
+        val += (ptr_uint_t) datarel;
+        break;
+    default:
+        /* textrel and funcrel aren't used on Linux */
+        r->error = true;
+    }
+    if (TEST(DW_EH_PE_indirect, enc))
+        r->error = true;
+    return val;
+}
+
+/* Reads a CIE or FDE length, returning the end of the entry (NULL at the
+ * terminator or on error) and leaving r at the id field.
+ */
+static byte *
+read_entry_length(cfi_reader_t *r)
+{
+    ptr_uint_t len = read_u32(r);
+    if (len == 0xffffffff)
+        len = (ptr_uint_t) read_u64(r);
+    if (len == 0 || !reader_has(r, len))
+        return NULL;
+    return r->cur + len;
+}
+
+static void
+cfa_state_set_rule(cfa_state_t *state, cie_info_t *cie, ptr_uint_t reg,
+                   reg_rule_kind_t kind, ptr_int_t offset)
+{
+    reg_rule_t *rule = NULL;
+    if (reg == DWARF_REG_FP)
+        rule = &state->fp;
+    else if (reg == cie->ra_reg)
+        rule = &state->ra;
+    if (rule != NULL) {
+        rule->kind = kind;
+        rule->offset = offset;
+    }
+}
+
+static void
+cfa_state_restore_rule(cfa_state_t *state, cie_info_t *cie, ptr_uint_t reg)
+{
+    if (reg == DWARF_REG_FP)
+        state->fp = cie->initial.fp;
+    else if (reg == cie->ra_reg)
+        state->ra = cie->initial.ra;
+}
+
+static bool
+cfi_row_same_rules(cfi_row_t *row1, cfi_row_t *row2)
+{
+    if (row1->cfa_reg == CFA_NONE || row2->cfa_reg == CFA_NONE)
+        return row1->cfa_reg == row2->cfa_reg;
+    return (row1->cfa_reg == row2->cfa_reg && row1->cfa_offset == row2->cfa_offset &&
+            row1->ra_offset == row2->ra_offset && row1->fp_saved == row2->fp_saved &&
+            (!row1->fp_saved || row1->fp_offset == row2->fp_offset));
+}
+
+static void
+cfi_table_add_row(cfi_table_t *table, app_pc pc, cfi_row_t *row)
+{
+    uint start = (uint)(pc - table->base);
+    if (table->num_rows > 0) {
+        cfi_row_t *last = &table->rows[table->num_rows - 1];
+        ASSERT(start >= last->start, "cfi rows out of order");
+        if (start == last->start) {
+            /* e.g., the end of the prior FDE is the start of this one */
+            *last = *row;
+            last->start = start;
+            return;
+        }
+        if (cfi_row_same_rules(last, row))
+            return;
+    }
+    if (table->num_rows == table->capacity) {
+        uint new_cap = (table->capacity == 0) ? 256 : table->capacity * 2;
+        cfi_row_t *new_rows = (cfi_row_t *)
+            global_alloc(new_cap * sizeof(*new_rows), HEAPSTAT_CALLSTACK);
+        if (table->rows != NULL) {
+            memcpy(new_rows, table->rows, table->num_rows * sizeof(*new_rows));
+            global_free(table->rows, table->capacity * sizeof(*new_rows),
+                        HEAPSTAT_CALLSTACK);
+        }
+        table->rows = new_rows;
+        table->capacity = new_cap;
+    }
+    table->rows[table->num_rows] = *row;
+    table->rows[table->num_rows].start = start;
+    table->num_rows++;
+}
+
+static void
+cfi_table_add_state(cfi_table_t *table, app_pc pc, cfa_state_t *state)
+{
+    cfi_row_t row;
+    memset(&row, 0, sizeof(row));
+    row.cfa_reg = CFA_NONE;
+    if (!state->cfa_expr && state->ra.kind == RULE_OFFSET &&
+        state->fp.kind != RULE_OTHER &&
+        (state->cfa_reg == DWARF_REG_SP || state->cfa_reg == DWARF_REG_FP) &&
+        state->cfa_offset == (int) state->cfa_offset &&
+        state->ra.offset == (short) state->ra.offset &&
+        (state->fp.kind != RULE_OFFSET || state->fp.offset == (short) state->fp.offset)) {
+        row.cfa_reg = (state->cfa_reg == DWARF_REG_SP) ? CFA_SP : CFA_FP;
+        row.cfa_offset = (int) state->cfa_offset;
+        row.ra_offset = (short) state->ra.offset;
+        row.fp_saved = (state->fp.kind == RULE_OFFSET);
+        row.fp_offset = row.fp_saved ? (short) state->fp.offset : 0;
+    }
+    cfi_table_add_row(table, pc, &row);
+}
+
+static void
+cfi_table_add_none(cfi_table_t *table, app_pc pc)
+{
+    cfi_row_t row;
+    memset(&row, 0, sizeof(row));
+    row.cfa_reg = CFA_NONE;
+    cfi_table_add_row(table, pc, &row);
+}
+
+/* Executes call frame instructions.  If table is non-NULL, adds a row for
+ * each location from loc up to loc_end, ignoring any instructions for
+ * locations past that.  Returns false on anything we can't handle.
+ */
+static bool
+cfi_execute(cfi_reader_t *r, cie_info_t *cie, cfa_state_t *state, cfi_table_t *table,
+            app_pc loc, app_pc loc_end)
+{
+    cfa_state_t stack[CFA_STATE_STACK_DEPTH];
+    uint depth = 0;
+    while (r->cur < r->end && !r->error) {
+        byte op = read_u8(r);
+        byte low = op & 0x3f;
+        ptr_uint_t reg, delta = 0;
+        switch (op & 0xc0) {
+        case DW_CFA_advance_loc:
+            delta = low * cie->code_align;
+            break;
+        case DW_CFA_offset:
+            cfa_state_set_rule(state, cie, low, RULE_OFFSET,
+                               (ptr_int_t) read_uleb128(r) * cie->data_align);
+            continue;
+        case DW_CFA_restore:
+            cfa_state_restore_rule(state, cie, low);
+            continue;
+        default:
+            break;
+        }
+        if (delta == 0) {
+            switch (op) {
+            case DW_CFA_nop:
+                continue;
+            case DW_CFA_set_loc: {
+                app_pc new_loc = (app_pc) read_encoded(r, cie->fde_enc, NULL);
+                if (new_loc < loc)
+                    return false;
+                delta = new_loc - loc;
+                break;
+            }
+            case DW_CFA_advance_loc1: delta = read_u8(r) * cie->code_align; break;
+            case DW_CFA_advance_loc2: delta = read_u16(r) * cie->code_align; break;
+            case DW_CFA_advance_loc4: delta = read_u32(r) * cie->code_align; break;
+            case DW_CFA_offset_extended:
+                reg = read_uleb128(r);
+                cfa_state_set_rule(state, cie, reg, RULE_OFFSET,
+                                   (ptr_int_t) read_uleb128(r) * cie->data_align);
+                continue;
+            case DW_CFA_offset_extended_sf:
+                reg = read_uleb128(r);
+                cfa_state_set_rule(state, cie, reg, RULE_OFFSET,
+                                   read_sleb128(r) * cie->data_align);
+                continue;
+            case DW_CFA_GNU_negative_offset_extended:
+                reg = read_uleb128(r);
+                cfa_state_set_rule(state, cie, reg, RULE_OFFSET,
+                                   -(ptr_int_t) read_uleb128(r) * cie->data_align);
+                continue;
+            case DW_CFA_restore_extended:
+                cfa_state_restore_rule(state, cie, read_uleb128(r));
+                continue;
+            case DW_CFA_undefined:
+                cfa_state_set_rule(state, cie, read_uleb128(r), RULE_UNDEFINED, 0);
+                continue;
+            case DW_CFA_same_value:
+                cfa_state_set_rule(state, cie, read_uleb128(r), RULE_SAME, 0);
+                continue;
+            case DW_CFA_register:
+                reg = read_uleb128(r);
+                read_uleb128(r);
+                cfa_state_set_rule(state, cie, reg, RULE_OTHER, 0);
+                continue;
+            case DW_CFA_val_offset:
+                reg = read_uleb128(r);
+                read_uleb128(r);
+                cfa_state_set_rule(state, cie, reg, RULE_OTHER, 0);
+                continue;
+            case DW_CFA_val_offset_sf:
+                reg = read_uleb128(r);
+                read_sleb128(r);
+                cfa_state_set_rule(state, cie, reg, RULE_OTHER, 0);
+                continue;
+            case DW_CFA_expression:
+            case DW_CFA_val_expression: {
+                ptr_uint_t len;
+                reg = read_uleb128(r);
+                len = read_uleb128(r);
+                if (!reader_has(r, len))
+                    return false;
+                r->cur += len;
+                cfa_state_set_rule(state, cie, reg, RULE_OTHER, 0);
+                continue;
+            }
+            case DW_CFA_remember_state:
+                if (depth == CFA_STATE_STACK_DEPTH)
+                    return false;
+                stack[depth++] = *state;
+                continue;
+            case DW_CFA_restore_state:
+                /* Like libgcc we restore the CFA rule too */
+                if (depth == 0)
+                    return false;
+                *state = stack[--depth];
+                continue;
+            case DW_CFA_def_cfa:
+                state->cfa_reg = (uint) read_uleb128(r);
+                state->cfa_offset = (ptr_int_t) read_uleb128(r);
+                state->cfa_expr = false;
+                continue;
+            case DW_CFA_def_cfa_sf:
+                state->cfa_reg = (uint) read_uleb128(r);
+                state->cfa_offset = read_sleb128(r) * cie->data_align;
+                state->cfa_expr = false;
+                continue;
+            case DW_CFA_def_cfa_register:
+                state->cfa_reg = (uint) read_uleb128(r);
+                state->cfa_expr = false;
+                continue;
+            case DW_CFA_def_cfa_offset:
+                state->cfa_offset = (ptr_int_t) read_uleb128(r);
+                continue;
+            case DW_CFA_def_cfa_offset_sf:
+                state->cfa_offset = read_sleb128(r) * cie->data_align;
+                continue;
+            case DW_CFA_def_cfa_expression: {
+                ptr_uint_t len = read_uleb128(r);
+                if (!reader_has(r, len))
+                    return false;
+                r->cur += len;
+                state->cfa_expr = true;
+                continue;
+            }
+            case DW_CFA_GNU_args_size:
+                read_uleb128(r);
+                continue;
+            default:
+                LOG(2, "unwind: unsupported CFA op 0x%x\n", op);
+                return false;
+            }
+        }
+        /* We only get here for an advance */
+        if (table == NULL)
+            return false; /* not allowed in a CIE */
+        cfi_table_add_state(table, loc, state);
+        if (delta >= (ptr_uint_t)(loc_end - loc)) {
+            /* Rows past the FDE's range would be out of order in the table */
+            return !r->error;
+        }
+        loc += delta;
+    }
+    if (r->error)
+        return false;
+    if (table != NULL)
+        cfi_table_add_state(table, loc, state);
+    return true;
+}
+
+static bool
+cie_parse(byte *cie_start, byte *limit, cie_info_t *cie OUT)
+{
+    cfi_reader_t r = {cie_start, limit, false};
+    byte *end = read_entry_length(&r);
+    byte version;
+    const char *aug;
+    if (end == NULL)
+        return false;
+    r.end = end;
+    if (read_u32(&r) != 0) /* the CIE id is 0 in .eh_frame */
+        return false;
+    version = read_u8(&r);
+    if (version != 1 && version != 3)
+        return false;
+    aug = (const char *) r.cur;
+    while (read_u8(&r) != '\0' && !r.error)
+        ; /* skip string */
+    memset(cie, 0, sizeof(*cie));
+    cie->cie = cie_start;
+    cie->fde_enc = DW_EH_PE_absptr;
+    cie->code_align = read_uleb128(&r);
+    cie->data_align = read_sleb128(&r);
+    cie->ra_reg = (version == 1) ? read_u8(&r) : (uint) read_uleb128(&r);
+    if (aug[0] == 'z') {
+        ptr_uint_t aug_len = read_uleb128(&r);
+        cfi_reader_t aug_r = {r.cur, r.cur + aug_len, false};
+        const char *c;
+        if (!reader_has(&r, aug_len))
+            return false;
+        cie->has_aug_data = true;
+        for (c = aug + 1; *c != '\0'; c++) {
+            if (*c == 'R')
+                cie->fde_enc = read_u8(&aug_r);
+            else if (*c == 'L')
+                read_u8(&aug_r);
+            else if (*c == 'P') {
+                /* we don't need the personality routine, which is often indirect */
+                byte enc = read_u8(&aug_r);
+                read_encoded(&aug_r, enc & ~DW_EH_PE_indirect, NULL);
+            }
+            else if (*c != 'S')
+                break; /* the length lets us skip the rest */
+        }
+        r.cur += aug_len;
+    } else if (aug[0] != '\0')
+        return false;
+    if (r.error)
+        return false;
+    cie->initial.cfa_reg = DWARF_REG_SP;
+    cie->initial.fp.kind = RULE_SAME;
+    cie->initial.ra.kind = RULE_UNDEFINED;
+    return cfi_execute(&r, cie, &cie->initial, NULL, NULL, NULL);
+}
+
+/* Adds rows for one FDE, returning false if it's malformed */
+static bool
+fde_parse(cfi_table_t *table, byte *fde, byte *limit, cie_info_t *cie,
+          app_pc *last_end INOUT)
+{
+    cfi_reader_t r = {fde, limit, false};
+    byte *end = read_entry_length(&r);
+    byte *id_field = r.cur;
+    uint cie_offs;
+    app_pc pc_begin;
+    ptr_uint_t pc_range;
+    cfa_state_t state;
+    uint rows_before;
+    if (end == NULL)
+        return false;
+    r.end = end;
+    cie_offs = read_u32(&r);
+    if (cie_offs == 0 || id_field < (byte *) (ptr_uint_t) cie_offs)
+        return false;
+    if (cie->cie != id_field - cie_offs &&
+        !cie_parse(id_field - cie_offs, limit, cie)) {
+        cie->cie = NULL;
+        return false;
+    }
+    pc_begin = (app_pc) read_encoded(&r, cie->fde_enc, NULL);
+    /* the range has the same format but no application */
+    pc_range = read_encoded(&r, cie->fde_enc & 0x0f, NULL);
+    if (cie->has_aug_data) {
+        ptr_uint_t aug_len = read_uleb128(&r);
+        if (!reader_has(&r, aug_len))
+            return false;
+        r.cur += aug_len;
+    }
+    if (r.error || pc_begin + pc_range < pc_begin)
+        return false;
+    STATS_INC(unwind_fdes);
+    if (pc_begin < *last_end || pc_begin < table->base) {
+        LOG(2, "unwind: skipping overlapping FDE for "PFX"\n", pc_begin);
+        return true;
+    }
+    rows_before = table->num_rows;
+    state = cie->initial;
+    if (!cfi_execute(&r, cie, &state, table, pc_begin, pc_begin + pc_range)) {
+        STATS_INC(unwind_fdes_unsupported);
+        table->num_rows = rows_before;
+        cfi_table_add_none(table, pc_begin);
+    }
+    /* this is overwritten if the next FDE starts right here */
+    cfi_table_add_none(table, pc_begin + pc_range);
+    *last_end = pc_begin + pc_range;
+    return true;
+}
+
+/* Returns the end of the segment of info containing addr, or NULL */
+static byte *
+module_segment_end(const module_data_t *info, byte *addr)
+{
+    uint i;
+    if (info->contiguous)
+        return (addr >= info->start && addr < info->end) ? info->end : NULL;
+    for (i = 0; i < info->num_segments; i++) {
+        if (addr >= info->segments[i].start && addr < info->segments[i].end)
+            return info->segments[i].end;
+    }
+    return NULL;
+}
+
+/* Returns the mapped .eh_frame_hdr, or NULL */
+static byte *
+module_find_eh_frame_hdr(const module_data_t *info)
+{
+    elf_ehdr_t *ehdr = (elf_ehdr_t *) info->start;
+    byte *limit = module_segment_end(info, info->start);
+    elf_phdr_t *phdr;
+    ptr_uint_t min_vaddr = POINTER_MAX, hdr_vaddr = 0;
+    bool found = false;
+    uint i;
+    if (limit == NULL || info->start + sizeof(*ehdr) > limit ||
+        memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELF_CLASS ||
+        info->start + ehdr->e_phoff + ehdr->e_phnum * sizeof(*phdr) > limit)
+        return NULL;
+    phdr = (elf_phdr_t *) (info->start + ehdr->e_phoff);
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type == PT_LOAD && phdr[i].p_vaddr < min_vaddr)
+            min_vaddr = phdr[i].p_vaddr;
+        else if (phdr[i].p_type == PT_GNU_EH_FRAME) {
+            hdr_vaddr = phdr[i].p_vaddr;
+            found = true;
+        }
+    }
+    if (!found || min_vaddr == POINTER_MAX)
+        return NULL;
+    return info->start + (hdr_vaddr - ALIGN_BACKWARD(min_vaddr, PAGE_SIZE));
+}
+
+static cfi_table_t *
+cfi_table_build(const module_data_t *info)
+{
+    byte *hdr = module_find_eh_frame_hdr(info);
+    byte *hdr_limit, *eh_frame, *eh_limit;
+    cfi_reader_t r;
+    ptr_uint_t fde_count, i;
+    byte table_enc;
+    cfi_table_t *table;
+    cie_info_t cie;
+    app_pc last_end = NULL;
+    if (hdr == NULL)
+        return NULL;
+    hdr_limit = module_segment_end(info, hdr);
+    if (hdr_limit == NULL || hdr + 4 > hdr_limit || hdr[0] != 1/*version*/)
+        return NULL;
+    r.cur = hdr + 4;
+    r.end = hdr_limit;
+    r.error = false;
+    eh_frame = (byte *) read_encoded(&r, hdr[1], hdr);
+    fde_count = read_encoded(&r, hdr[2], hdr);
+    table_enc = hdr[3];
+    /* we rely on the sorted search table rather than sorting ourselves */
+    if (r.error || table_enc == DW_EH_PE_omit || fde_count == 0)
+        return NULL;
+    eh_limit = module_segment_end(info, eh_frame);
+    if (eh_limit == NULL)
+        return NULL;
+    table = (cfi_table_t *) global_alloc(sizeof(*table), HEAPSTAT_CALLSTACK);
+    memset(table, 0, sizeof(*table));
+    table->base = info->start;
+    memset(&cie, 0, sizeof(cie));
+    for (i = 0; i < fde_count && !r.error; i++) {
+        byte *fde;
+        read_encoded(&r, table_enc, hdr); /* initial location */
+        fde = (byte *) read_encoded(&r, table_enc, hdr);
+        if (r.error || fde < eh_frame || fde >= eh_limit ||
+            !fde_parse(table, fde, eh_limit, &cie, &last_end)) {
+            LOG(1, "unwind: malformed .eh_frame in %s\n",
+                dr_module_preferred_name(info) == NULL ? "<null>" :
+                dr_module_preferred_name(info));
+            break;
+        }
+    }
+    if (table->num_rows < 2) {
+        if (table->rows != NULL) {
+            global_free(table->rows, table->capacity * sizeof(*table->rows),
+                        HEAPSTAT_CALLSTACK);
+        }
+        global_free(table, sizeof(*table), HEAPSTAT_CALLSTACK);
+        return NULL;
+    }
+    ASSERT(table->rows[table->num_rows - 1].cfa_reg == CFA_NONE, "unterminated table");
+    return table;
+}
+
+static void
+cfi_table_free(void *p)
+{
+    cfi_table_t *table = (cfi_table_t *) p;
+    global_free(table->rows, table->capacity * sizeof(*table->rows),
+                HEAPSTAT_CALLSTACK);
+    global_free(table, sizeof(*table), HEAPSTAT_CALLSTACK);
+}
+
+/* Returns the row covering pc, which must be inside the table */
+static cfi_row_t *
+cfi_table_lookup(cfi_table_t *table, app_pc pc)
+{
+    uint offs = (uint)(pc - table->base);
+    uint lo = 0, hi = table->num_rows;
+    ASSERT(offs >= table->rows[0].start, "pc not in table");
+    /* find the last row whose start is <= offs */
+    while (hi - lo > 1) {
+        uint mid = (lo + hi) / 2;
+        if (table->rows[mid].start <= offs)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &table->rows[lo];
+}
+#endif /* UNWIND_SUPPORTED */
+
+/***************************************************************************
+ * INTERFACE
+ */
+
+void
+unwind_init(void)
+{
+#ifdef UNWIND_SUPPORTED
+    unwind_lock = dr_rwlock_create();
+    unwind_tree = rb_tree_create(cfi_table_free);
+#endif
+}
+
+void
+unwind_exit(void)
+{
+#ifdef UNWIND_SUPPORTED
+    dr_rwlock_write_lock(unwind_lock);
+    rb_tree_destroy(unwind_tree);
+    unwind_tree = NULL;
+    dr_rwlock_write_unlock(unwind_lock);
+    dr_rwlock_destroy(unwind_lock);
+#endif
+}
+
+void
+unwind_module_load(const module_data_t *info)
+{
+#ifdef UNWIND_SUPPORTED
+    /* We parse outside of the lock: other threads only need it for lookups */
+    cfi_table_t *table = cfi_table_build(info);
+    app_pc start, end;
+    if (table == NULL)
+        return;
+    start = table->base + table->rows[0].start;
+    end = table->base + table->rows[table->num_rows - 1].start;
+    LOG(2, "unwind: %u rows for "PFX"-"PFX" in %s\n", table->num_rows, start, end,
+        dr_module_preferred_name(info) == NULL ? "<null>" :
+        dr_module_preferred_name(info));
+    STATS_INC(unwind_modules);
+    STATS_ADD(unwind_rows, table->num_rows);
+    dr_rwlock_write_lock(unwind_lock);
+    if (rb_insert(unwind_tree, start, end - start, table) != NULL) {
+        ASSERT(false, "overlapping unwind tables");
+        cfi_table_free(table);
+    }
+    dr_rwlock_write_unlock(unwind_lock);
+#endif
+}
+
+void
+unwind_module_unload(const module_data_t *info)
+{
+#ifdef UNWIND_SUPPORTED
+    /* Each module has at most one table, which starts at or above its base */
+    rb_node_t *node;
+    dr_rwlock_write_lock(unwind_lock);
+    node = rb_next_higher_node(unwind_tree, info->start);
+    if (node != NULL) {
+        cfi_table_t *table;
+        rb_node_fields(node, NULL, NULL, (void **) &table);
+        if (table->base == info->start)
+            rb_delete(unwind_tree, node); /* frees the table */
+    }
+    dr_rwlock_write_unlock(unwind_lock);
+#endif
+}
+
+bool
+unwind_step(app_pc retaddr, byte *sp, byte *fp, app_pc *caller_retaddr OUT,
+            byte **caller_retaddr_slot OUT, byte **caller_fp OUT)
+{
+#ifdef UNWIND_SUPPORTED
+    /* Look up the call, in case it's the last instruction in its function */
+    app_pc pc = retaddr - 1;
+    rb_node_t *node;
+    cfi_row_t row;
+    byte *cfa, *slot;
+    app_pc ra;
+    byte *new_fp = fp;
+    bool found = false;
+    dr_rwlock_read_lock(unwind_lock);
+    node = rb_in_node(unwind_tree, pc);
+    if (node != NULL) {
+        cfi_table_t *table;
+        rb_node_fields(node, NULL, NULL, (void **) &table);
+        row = *cfi_table_lookup(table, pc);
+        found = true;
+    }
+    dr_rwlock_read_unlock(unwind_lock);
+    if (!found || row.cfa_reg == CFA_NONE) {
+        STATS_INC(unwind_step_misses);
+        return false;
+    }
+    cfa = ((row.cfa_reg == CFA_SP) ? sp : fp) + row.cfa_offset;
+    slot = cfa + row.ra_offset;
+    if (!safe_read(slot, sizeof(ra), &ra) ||
+        (row.fp_saved && !safe_read(cfa + row.fp_offset, sizeof(new_fp), &new_fp))) {
+        STATS_INC(unwind_step_misses);
+        return false;
+    }
+    STATS_INC(unwind_steps);
+    *caller_retaddr = ra;
+    *caller_retaddr_slot = slot;
+    *caller_fp = new_fp;
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef STATISTICS
+void
+unwind_dump_statistics(file_t f)
+{
+# ifdef UNWIND_SUPPORTED
+    dr_fprintf(f, "unwind tables: %6u modules, %8u rows, %8u FDEs, %6u unsupported\n",
+               unwind_modules, unwind_rows, unwind_fdes, unwind_fdes_unsupported);
+    dr_fprintf(f, "unwind steps: %8u, no rule: %8u\n", unwind_steps, unwind_step_misses);
+# endif
+}
+#endif
+
+/***************************************************************************
+ * Unit tests
+ */
+
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+# ifdef UNWIND_SUPPORTED
+/* Canned .eh_frame entries laid out the way gcc emits them, followed by the
+ * "code" they describe.  Static so that the pc-relative FDE addresses fit.
+ */
+#  define TEST_EH_CODE_OFFS 256
+static byte test_eh[TEST_EH_CODE_OFFS + 128];
+static uint test_eh_len;
+
+#  define TEST_EH_PUT(...) do {                         \
+        byte bytes_[] = {__VA_ARGS__};                  \
+        memcpy(test_eh + test_eh_len, bytes_, sizeof(bytes_)); \
+        test_eh_len += sizeof(bytes_);                  \
+    } while (0)
+#  define TEST_PTRSZ sizeof(void*)
+#  define TEST_RA_REG IF_X64_ELSE(16, 8)
+
+static void
+test_eh_put_u32(uint val)
+{
+    memcpy(test_eh + test_eh_len, &val, sizeof(val));
+    test_eh_len += sizeof(val);
+}
+
+/* Pads with nops and fills in the length of the entry starting at entry */
+static void
+test_eh_end_entry(byte *entry)
+{
+    uint len;
+    while (test_eh_len % TEST_PTRSZ != 0)
+        TEST_EH_PUT(DW_CFA_nop);
+    len = (uint)(test_eh + test_eh_len - (entry + 4));
+    memcpy(entry, &len, sizeof(len));
+}
+
+/* Starts an FDE for [code + offs, code + offs + range) */
+static byte *
+test_eh_fde(byte *cie, uint offs, uint range)
+{
+    byte *fde = test_eh + test_eh_len;
+    test_eh_put_u32(0); /* length */
+    test_eh_put_u32((uint)(test_eh + test_eh_len - cie));
+    /* pc_begin in the CIE's DW_EH_PE_pcrel|DW_EH_PE_sdata4 */
+    test_eh_put_u32((uint)(test_eh + TEST_EH_CODE_OFFS + offs - (test_eh + test_eh_len)));
+    test_eh_put_u32(range);
+    TEST_EH_PUT(0); /* augmentation data length */
+    return fde;
+}
+
+static void
+test_expect_row(cfi_table_t *table, uint offs, byte cfa_reg, int cfa_offset,
+                bool fp_saved, short fp_offset)
+{
+    cfi_row_t *row = cfi_table_lookup(table, table->base + offs);
+    EXPECT(row->cfa_reg == cfa_reg);
+    if (cfa_reg == CFA_NONE)
+        return;
+    EXPECT(row->cfa_offset == cfa_offset);
+    EXPECT(row->ra_offset == -(short)TEST_PTRSZ);
+    EXPECT(row->fp_saved == fp_saved);
+    if (fp_saved)
+        EXPECT(row->fp_offset == fp_offset);
+}
+
+static void
+test_cfi_parse(void)
+{
+    byte *cie, *fde;
+    cie_info_t info;
+    app_pc last_end = NULL;
+    cfi_table_t *table;
+    ptr_uint_t stack[4], fp_frame[2];
+    app_pc ra;
+    byte *slot, *fp;
+
+    /* CIE: augmentation "zR", code align 1, data align -ptrsz, pc-relative
+     * sdata4 FDE addresses, CFA = sp + ptrsz with the return address below it.
+     */
+    test_eh_len = 0;
+    cie = test_eh;
+    test_eh_put_u32(0); /* length */
+    test_eh_put_u32(0); /* CIE id */
+    TEST_EH_PUT(1, 'z', 'R', 0, 1, (byte)(0x80 - TEST_PTRSZ), TEST_RA_REG, 1, 0x1b);
+    TEST_EH_PUT(DW_CFA_def_cfa, DWARF_REG_SP, TEST_PTRSZ, DW_CFA_offset | TEST_RA_REG, 1);
+    test_eh_end_entry(cie);
+
+    /* A frameless function: push fp; sub 2*ptrsz from sp; an epilogue in the
+     * middle bracketed by remember/restore_state.
+     */
+    fde = test_eh_fde(cie, 0, 20);
+    TEST_EH_PUT(DW_CFA_advance_loc | 1, DW_CFA_def_cfa_offset, 2*TEST_PTRSZ,
+                DW_CFA_offset | DWARF_REG_FP, 2);
+    TEST_EH_PUT(DW_CFA_advance_loc | 4, DW_CFA_def_cfa_offset, 4*TEST_PTRSZ);
+    TEST_EH_PUT(DW_CFA_advance_loc | 10, DW_CFA_remember_state,
+                DW_CFA_def_cfa_offset, TEST_PTRSZ, DW_CFA_restore | DWARF_REG_FP);
+    TEST_EH_PUT(DW_CFA_advance_loc | 1, DW_CFA_restore_state);
+    test_eh_end_entry(fde);
+
+    /* A function that sets up a frame pointer */
+    fde = test_eh_fde(cie, 32, 10);
+    TEST_EH_PUT(DW_CFA_advance_loc | 1, DW_CFA_def_cfa_offset, 2*TEST_PTRSZ,
+                DW_CFA_offset | DWARF_REG_FP, 2);
+    TEST_EH_PUT(DW_CFA_advance_loc | 3, DW_CFA_def_cfa_register, DWARF_REG_FP);
+    test_eh_end_entry(fde);
+
+    /* A CFA expression, as in a PLT, which we don't support */
+    fde = test_eh_fde(cie, 48, 8);
+    TEST_EH_PUT(DW_CFA_def_cfa_expression, 2, 0x77/*DW_OP_breg7*/, 8);
+    test_eh_end_entry(fde);
+
+    /* An advance past the end of the range, whose rules we must drop */
+    fde = test_eh_fde(cie, 56, 4);
+    TEST_EH_PUT(DW_CFA_advance_loc | 1, DW_CFA_def_cfa_offset, 2*TEST_PTRSZ);
+    TEST_EH_PUT(DW_CFA_advance_loc | 10, DW_CFA_def_cfa_offset, 4*TEST_PTRSZ);
+    test_eh_end_entry(fde);
+
+    /* An op we don't know, which makes us give up on the whole FDE */
+    fde = test_eh_fde(cie, 64, 8);
+    TEST_EH_PUT(DW_CFA_advance_loc | 1, DW_CFA_def_cfa_offset, 2*TEST_PTRSZ, 0x2d);
+    test_eh_end_entry(fde);
+    ASSERT(test_eh_len <= TEST_EH_CODE_OFFS, "test .eh_frame too large");
+
+    table = (cfi_table_t *) global_alloc(sizeof(*table), HEAPSTAT_CALLSTACK);
+    memset(table, 0, sizeof(*table));
+    table->base = test_eh + TEST_EH_CODE_OFFS;
+    memset(&info, 0, sizeof(info));
+    for (fde = test_eh + *(uint *)cie + 4; fde < test_eh + test_eh_len;
+         fde += *(uint *)fde + 4)
+        EXPECT(fde_parse(table, fde, test_eh + test_eh_len, &info, &last_end));
+    EXPECT(info.code_align == 1 && info.data_align == -(ptr_int_t)TEST_PTRSZ);
+    EXPECT(info.ra_reg == TEST_RA_REG);
+
+    test_expect_row(table, 0, CFA_SP, TEST_PTRSZ, false, 0);
+    test_expect_row(table, 1, CFA_SP, 2*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 4, CFA_SP, 2*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 5, CFA_SP, 4*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 15, CFA_SP, TEST_PTRSZ, false, 0);
+    test_expect_row(table, 16, CFA_SP, 4*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 19, CFA_SP, 4*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 20, CFA_NONE, 0, false, 0);
+    test_expect_row(table, 32, CFA_SP, TEST_PTRSZ, false, 0);
+    test_expect_row(table, 33, CFA_SP, 2*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 36, CFA_FP, 2*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 41, CFA_FP, 2*TEST_PTRSZ, true, -2*(short)TEST_PTRSZ);
+    test_expect_row(table, 42, CFA_NONE, 0, false, 0);
+    test_expect_row(table, 48, CFA_NONE, 0, false, 0);
+    test_expect_row(table, 56, CFA_SP, TEST_PTRSZ, false, 0);
+    test_expect_row(table, 57, CFA_SP, 2*TEST_PTRSZ, false, 0);
+    test_expect_row(table, 59, CFA_SP, 2*TEST_PTRSZ, false, 0);
+    test_expect_row(table, 60, CFA_NONE, 0, false, 0);
+    test_expect_row(table, 64, CFA_NONE, 0, false, 0);
+    test_expect_row(table, 65, CFA_NONE, 0, false, 0);
+    EXPECT(table->rows[table->num_rows - 1].cfa_reg == CFA_NONE);
+    /* the unsupported FDE merges into the preceding no-rule row */
+    EXPECT(table->rows[table->num_rows - 1].start == 60);
+
+    /* Step through fake frames using the table */
+    unwind_init();
+    dr_rwlock_write_lock(unwind_lock);
+    rb_insert(unwind_tree, table->base, table->rows[table->num_rows - 1].start, table);
+    dr_rwlock_write_unlock(unwind_lock);
+    /* frameless: CFA = sp + 4*ptrsz, the saved fp at CFA - 2*ptrsz */
+    stack[2] = 0xabc;
+    stack[3] = 0x1234;
+    EXPECT(unwind_step(table->base + 7, (byte *)stack, (byte *)0x99, &ra, &slot, &fp));
+    EXPECT(ra == (app_pc)0x1234 && slot == (byte *)&stack[3] && fp == (byte *)0xabc);
+    /* frame pointer: CFA = fp + 2*ptrsz */
+    fp_frame[0] = 0x555;
+    fp_frame[1] = 0x4321;
+    EXPECT(unwind_step(table->base + 40, (byte *)stack, (byte *)fp_frame,
+                       &ra, &slot, &fp));
+    EXPECT(ra == (app_pc)0x4321 && slot == (byte *)&fp_frame[1] && fp == (byte *)0x555);
+    /* no rule */
+    EXPECT(!unwind_step(table->base + 50, (byte *)stack, (byte *)fp_frame,
+                        &ra, &slot, &fp));
+    unwind_exit(); /* frees the table */
+}
+#  undef TEST_PTRSZ
+# endif /* UNWIND_SUPPORTED */
+
+void
+unwind_unit_tests(void)
+{
+# ifdef UNWIND_SUPPORTED
+    test_cfi_parse();
+# endif
+
+    /* add more tests here */
+}
+#endif
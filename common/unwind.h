@@ -0,0 +1,72 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _UNWIND_H_
+#define _UNWIND_H_ 1
+
+/* Frame unwinding driven by the DWARF call frame information (CFI) that
+ * modules carry in .eh_frame, so that we can walk through code built without
+ * frame pointers without scanning the stack.  When a module is loaded we
+ * translate its CFI into a sorted table of rows, each giving the rules for
+ * finding the caller's frame from a range of pcs, so that each step is a
+ * binary search plus a few loads.
+ *
+ * Currently only ELF modules on Linux are supported.  For others, and for
+ * pcs whose rules we don't handle (e.g., DWARF expressions), unwind_step()
+ * returns false and callers should fall back to other means.
+ */
+
+#include "dr_api.h"
+
+void
+unwind_init(void);
+
+void
+unwind_exit(void);
+
+void
+unwind_module_load(const module_data_t *info);
+
+void
+unwind_module_unload(const module_data_t *info);
+
+/* Computes the caller of the frame for the function containing retaddr, which
+ * must be a return address into that function.  sp is the stack pointer the
+ * function will have once the callee returns (i.e., just past the slot
+ * holding retaddr) and fp is its frame pointer register value.  On success,
+ * returns the function's own return address and the stack slot holding it,
+ * along with the caller's frame pointer register value.
+ */
+bool
+unwind_step(app_pc retaddr, byte *sp, byte *fp, app_pc *caller_retaddr OUT,
+            byte **caller_retaddr_slot OUT, byte **caller_fp OUT);
+
+#ifdef STATISTICS
+void
+unwind_dump_statistics(file_t f);
+#endif
+
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+void
+unwind_unit_tests(void);
+#endif
+
+#endif /* _UNWIND_H_ */
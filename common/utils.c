@@ -41,6 +41,13 @@
 #endif
 #include <stddef.h> /* for offsetof */
 #include <ctype.h> /* for tolower */
+#if defined(X86) && defined(HAVE_TARGET_AVX2)
+# ifdef WINDOWS
+#  include <intrin.h>   /* __cpuidex */
+# else
+#  include <cpuid.h>
+# endif
+#endif
 
 /* globals that affect NOTIFY* and *LOG* macros */
 int tls_idx_util = -1;
@@ -1313,6 +1320,25 @@ instrlist_last_app_instr(instrlist_t *ilist)
     return instr_get_prev_app_instr(instr);
 }
 
+#if defined(X86) && defined(HAVE_TARGET_AVX2)
+bool
+cpu_has_avx2(void)
+{
+    uint regs[4]; /* eax, ebx, ecx, edx */
+# ifdef WINDOWS
+    __cpuid((int *)regs, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuidex((int *)regs, 7, 0);
+# else
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+# endif
+    return TEST(1 << 5, regs[1]); /* CPUID.(EAX=7,ECX=0):EBX.AVX2[bit 5] */
+}
+#endif
+
 /***************************************************************************
  * HASHTABLE
  */
@@ -42,6 +42,9 @@ extern "C" {
 #include "drsyscall.h"
 
 #include <limits.h>
+#ifdef WINDOWS
+# include <intrin.h> /* _BitScanForward, _BitScanReverse */
+#endif
 
 #ifdef WINDOWS
 # define IF_WINDOWS(x) x
@@ -841,6 +844,57 @@ test_one_bit_set(uint x)
     return (x > 0) && (x & (x-1)) == 0;
 }
 
+/* Returns the index of the least significant set bit.  x must be non-zero. */
+static inline uint
+bitscan_forward32(uint x)
+{
+#ifdef WINDOWS
+    unsigned long idx;
+    _BitScanForward(&idx, x);
+    return (uint) idx;
+#else
+    return (uint) __builtin_ctz(x);
+#endif
+}
+
+/* Returns the index of the most significant set bit.  x must be non-zero. */
+static inline uint
+bitscan_reverse32(uint x)
+{
+#ifdef WINDOWS
+    unsigned long idx;
+    _BitScanReverse(&idx, x);
+    return (uint) idx;
+#else
+    return (uint) (31 - __builtin_clz(x));
+#endif
+}
+
+#ifdef X86
+/* gcc and clang need per-function target attributes to use SIMD intrinsics
+ * without compiling the whole file for a newer ISA.
+ */
+# ifdef WINDOWS
+#  define TARGET_SSE2 /* nothing */
+#  define TARGET_AVX2 /* nothing */
+#  define HAVE_TARGET_AVX2 1
+# else
+#  define TARGET_SSE2 __attribute__((target("sse2")))
+#  define TARGET_AVX2 __attribute__((target("avx2")))
+#  if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#   define HAVE_TARGET_AVX2 1
+#  endif
+# endif
+
+# ifdef HAVE_TARGET_AVX2
+/* Callers must also check proc_avx_enabled(), which checks that the OS saves
+ * the ymm state.
+ */
+bool
+cpu_has_avx2(void);
+# endif
+#endif
+
 static inline generic_func_t
 cast_to_func(void *p)
 {
@@ -1031,6 +1085,27 @@ const char *
 find_next_line(const char *start, const char *eof, const char **sol OUT,
                const char **eol OUT, bool skip_ws);
 
+/***************************************************************************
+ * BIT STREAMS
+ */
+
+/* These treat a buffer as a little-endian stream of bits, for shadow values
+ * that are smaller than a byte.
+ */
+
+/* Copies nbits bits from bit offset src_bit of src to bit offset dst_bit of
+ * dst.  The two ranges can overlap.
+ */
+void
+bitstream_copy(byte *dst, size_t dst_bit, const byte *src, size_t src_bit,
+               size_t nbits);
+
+/* Fills nbits bits starting at bit offset dst_bit of dst with the bits at the
+ * same positions in the repeating byte pattern.
+ */
+void
+bitstream_fill(byte *dst, size_t dst_bit, size_t nbits, byte pattern);
+
 /***************************************************************************
  * REGISTER CONVERSION UTILITIES
  */
@@ -143,3 +143,122 @@ find_next_line(const char *start, const char *eof, const char **sol,
         *eol = newline;
     return next_line;
 }
+
+/***************************************************************************
+ * BIT STREAMS
+ */
+
+/* Copying between bit streams whose values are not at the same offset
+ * within a byte requires shifting, so we move a pointer-sized word per step.
+ * Only the aligned words that contain the source bits are ever read, and
+ * only the bytes that contain destination bits are ever written.
+ */
+#define BITS_PER_WORD (sizeof(ptr_uint_t) * 8)
+
+/* Returns the n <= BITS_PER_WORD bits at bit offset pos in the low bits.
+ * The bits above n are garbage.
+ */
+static inline ptr_uint_t
+bitstream_fetch(const ptr_uint_t *words, size_t pos, size_t n)
+{
+    size_t idx = pos / BITS_PER_WORD, shift = pos % BITS_PER_WORD;
+    ptr_uint_t val = words[idx] >> shift;
+    if (shift + n > BITS_PER_WORD)
+        val |= words[idx + 1] << (BITS_PER_WORD - shift);
+    return val;
+}
+
+/* Writes the low n bits of val at bit offset pos, which must not cross a word.
+ * A whole word is written with a single store.  A partial word, which only
+ * occurs at either end of a range, is written a byte at a time so that bytes
+ * outside the range are never rewritten and only a partially covered edge
+ * byte needs a read-modify-write, as a concurrent writer to the neighbouring
+ * shadow would otherwise lose its update.  We assume little-endian words.
+ */
+static inline void
+bitstream_store(ptr_uint_t *words, size_t pos, size_t n, ptr_uint_t val)
+{
+    size_t idx = pos / BITS_PER_WORD, shift = pos % BITS_PER_WORD;
+    size_t first, last, i;
+    ptr_uint_t mask;
+    byte *bytes;
+    ASSERT(shift + n <= BITS_PER_WORD, "store crosses word");
+    if (n == BITS_PER_WORD) {
+        words[idx] = val;
+        return;
+    }
+    mask = ((((ptr_uint_t)1) << n) - 1) << shift;
+    val <<= shift;
+    bytes = (byte *) &words[idx];
+    first = shift / 8;
+    last = (shift + n - 1) / 8;
+    for (i = first; i <= last; i++) {
+        byte bmask = (byte)(mask >> (i * 8));
+        byte bval = (byte)(val >> (i * 8));
+        if (bmask == 0xff)
+            bytes[i] = bval;
+        else
+            bytes[i] = (bytes[i] & ~bmask) | (bval & bmask);
+    }
+}
+
+/* see description in header */
+void
+bitstream_copy(byte *dst, size_t dst_bit, const byte *src, size_t src_bit,
+               size_t nbits)
+{
+    byte *dst_byte = dst + dst_bit / 8;
+    const byte *src_byte = src + src_bit / 8;
+    ptr_uint_t *dst_words = (ptr_uint_t *) ALIGN_BACKWARD(dst_byte, sizeof(ptr_uint_t));
+    const ptr_uint_t *src_words = (const ptr_uint_t *)
+        ALIGN_BACKWARD(src_byte, sizeof(ptr_uint_t));
+    size_t dst_pos = (dst_byte - (byte *)dst_words) * 8 + dst_bit % 8;
+    size_t src_pos = (src_byte - (byte *)src_words) * 8 + src_bit % 8;
+    size_t done, n;
+    if (dst_byte < src_byte || (dst_byte == src_byte && dst_bit % 8 <= src_bit % 8)) {
+        /* Forward: each destination word is written only after every source
+         * bit that it could overlap has been read.
+         */
+        for (done = 0; done < nbits; done += n) {
+            n = BITS_PER_WORD - (dst_pos + done) % BITS_PER_WORD;
+            if (n > nbits - done)
+                n = nbits - done;
+            bitstream_store(dst_words, dst_pos + done, n,
+                            bitstream_fetch(src_words, src_pos + done, n));
+        }
+    } else {
+        /* Backward, for a destination that overlaps the end of the source */
+        for (done = nbits; done > 0; done -= n) {
+            n = (dst_pos + done) % BITS_PER_WORD;
+            if (n == 0)
+                n = BITS_PER_WORD;
+            if (n > done)
+                n = done;
+            bitstream_store(dst_words, dst_pos + done - n, n,
+                            bitstream_fetch(src_words, src_pos + done - n, n));
+        }
+    }
+}
+
+/* see description in header */
+void
+bitstream_fill(byte *dst, size_t dst_bit, size_t nbits, byte pattern)
+{
+    byte *cur = dst + dst_bit / 8;
+    uint shift = dst_bit % 8;
+    size_t n;
+    byte mask;
+    if (shift != 0 && nbits > 0) {
+        n = MIN(8 - shift, nbits);
+        mask = (byte)(((1 << n) - 1) << shift);
+        *cur = (*cur & ~mask) | (pattern & mask);
+        cur++;
+        nbits -= n;
+    }
+    memset(cur, pattern, nbits / 8);
+    cur += nbits / 8;
+    if (nbits % 8 != 0) {
+        mask = (byte)((1 << (nbits % 8)) - 1);
+        *cur = (*cur & ~mask) | (pattern & mask);
+    }
+}
@@ -71,10 +71,11 @@ file_t f_callstack = INVALID_FILE;
 file_t f_snapshot = INVALID_FILE;
 file_t f_staleness = INVALID_FILE;
 file_t f_nudge = INVALID_FILE;      /* PR 502468 - nudge visualization */
+file_t f_snapshot_idx = INVALID_FILE; /* for -binary_snapshots */
 static uint num_threads;
 
 /* Counters for time unit intervals */
-static int instr_count;
+static volatile int instr_count;
 static int byte_count;
 static int allocfree_count;
 
@@ -102,6 +103,16 @@ static int reachable_leak_count;
  * and exiting with an indirect jump to a stored return point.
  */
 static byte *shared_instrcnt_callout;
+
+/* For -time_instrs, each thread decrements its own counter in a raw TLS slot
+ * and only folds what it executed into instr_count once that goes negative,
+ * so the shared counter is no longer written on every block.  The number of
+ * instrs a thread counts locally is its quantum, which we derive from
+ * -time_instrs_error and the number of live threads.
+ */
+static reg_id_t tls_instrcnt_seg;
+static uint tls_instrcnt_base;
+static volatile int instrcnt_threads;
 static byte *shared_code_region;
 #define SHARED_CODE_SIZE \
     (PAGE_SIZE + (options.staleness ? (SHARED_SLOWPATH_SIZE) : 0))
@@ -159,6 +170,8 @@ typedef struct _tls_heapstat_t {
 # ifdef UNIX
     int64 filepos; /* f_callstack file position */
 # endif
+    int *instrcnt; /* our raw TLS instr counter, for -time_instrs */
+    int instrcnt_quantum; /* the value *instrcnt was last reset to */
 } tls_heapstat_t;
 
 /* XXX: share w/ syscall_os.h */
@@ -390,6 +403,247 @@ unit_name(void)
     return "<error>";
 }
 
+/* Binary snapshot format (-binary_snapshots).
+ *
+ * snapshot.bin and staleness.bin each start with an 8-byte magic, then a
+ * varint version and the unit name as a varint length plus chars.  After
+ * that come frames, each starting with a one-byte tag:
+ *   'S': varint payload size, then the payload for one snapshot
+ *   'N': varint stamp of a nudge (the "NUDGE" line of the text format)
+ *   'E': end of the log (the "LOG END" line of the text format)
+ * All values are unsigned LEB128 varints.  Fields that are deltas are
+ * zigzag-encoded, since they can be negative.
+ *
+ * A snapshot.bin payload holds the number, zigzag idx, stamp (including
+ * stamp_offs), stamp_offs, the four totals, and the record count.  Then
+ * come the records: the callstack id as a delta from the prior record's id
+ * (starting at 0), instances, bytes_asked_for, extra_usable and
+ * extra_occupied.
+ *
+ * A staleness.bin payload holds the number, stamp and record count.  Then
+ * come the records: the callstack id delta, the bytes, and the last access
+ * time as a delta from the prior record's (starting at the snapshot stamp).
+ *
+ * Frames only refer to earlier records in the same frame, so any frame can
+ * be decoded on its own.  snapshot.bidx locates them without a scan.  It is
+ * a 16-byte header (magic, version, record size) followed by one fixed-size
+ * binsnap_index_t per snapshot, in the order the snapshots were written.
+ */
+#define BINSNAP_VERSION 1
+#define BINSNAP_MAX_VARINT 10 /* for a uint64 */
+#define BINSNAP_MAGIC_SNAPSHOT "DHSNAPSH"
+#define BINSNAP_MAGIC_STALENESS "DHSTALES"
+#define BINSNAP_MAGIC_INDEX "DHSNAPIX"
+#define BINSNAP_TAG_SNAPSHOT 'S'
+#define BINSNAP_TAG_NUDGE 'N'
+#define BINSNAP_TAG_END 'E'
+
+/* A snapshot.bidx record.  The fields are ordered to avoid any padding. */
+typedef struct _binsnap_index_t {
+    uint64 stamp;
+    uint64 snapshot_pos;  /* file offset of the 'S' frame in snapshot.bin */
+    uint64 staleness_pos; /* file offset of the 'S' frame in staleness.bin */
+    uint64 tot_mallocs;
+    uint64 tot_bytes_asked_for;
+    uint64 tot_bytes_usable;
+    uint64 tot_bytes_occupied;
+    uint snapshot_num;
+    int idx;
+    uint snapshot_size;   /* total bytes of the frame, including tag and size */
+    uint staleness_size;
+} binsnap_index_t;
+
+static uint
+binsnap_encode_varint(byte *buf, uint64 val)
+{
+    uint len = 0;
+    do {
+        byte b = (byte)(val & 0x7f);
+        val >>= 7;
+        if (val != 0)
+            b |= 0x80;
+        buf[len++] = b;
+    } while (val != 0);
+    return len;
+}
+
+static inline uint64
+binsnap_zigzag(int64 val)
+{
+    return ((uint64)val << 1) ^ (uint64)(val >> 63);
+}
+
+static void
+binsnap_write(file_t f, size_t *sofar, const void *data, size_t len)
+{
+    ASSERT(len <= SNAPSHOT_LOG_BUF_SIZE, "binary write too large");
+    if (*sofar + len > SNAPSHOT_LOG_BUF_SIZE)
+        FLUSH_BUFFER(f, snaps_log_buf, *sofar);
+    memcpy(snaps_log_buf + *sofar, data, len);
+    *sofar += len;
+}
+
+/* If f is INVALID_FILE, just returns the encoded size, so that the frame
+ * bodies below can be sized before they are written.
+ */
+static size_t
+binsnap_put_varint(file_t f, size_t *sofar, uint64 val)
+{
+    byte buf[BINSNAP_MAX_VARINT];
+    uint len = binsnap_encode_varint(buf, val);
+    if (f != INVALID_FILE)
+        binsnap_write(f, sofar, buf, len);
+    return len;
+}
+
+static void
+binsnap_write_header(file_t f, const char *magic)
+{
+    size_t sofar = 0;
+    const char *unit = unit_name();
+    size_t unit_len = strlen(unit);
+    ASSERT(strlen(magic) == 8, "binary magic must be 8 chars");
+    binsnap_write(f, &sofar, magic, 8);
+    binsnap_put_varint(f, &sofar, BINSNAP_VERSION);
+    binsnap_put_varint(f, &sofar, unit_len);
+    binsnap_write(f, &sofar, unit, unit_len);
+    FLUSH_BUFFER(f, snaps_log_buf, sofar);
+}
+
+static void
+binsnap_write_index_header(file_t f)
+{
+    uint fields[2] = { BINSNAP_VERSION, sizeof(binsnap_index_t) };
+    /* The readers hardcode this layout */
+    ASSERT(sizeof(binsnap_index_t) == 72, "binsnap_index_t layout changed");
+    dr_write_file(f, BINSNAP_MAGIC_INDEX, 8);
+    dr_write_file(f, fields, sizeof(fields));
+}
+
+/* Writes a one-byte frame such as 'E', or an 'N' frame if tag is 'N'.
+ * We don't use snaps_log_buf as we're not always called under snapshot_lock.
+ */
+static void
+binsnap_write_marker(file_t f, byte tag, uint64 val)
+{
+    byte buf[1 + BINSNAP_MAX_VARINT];
+    uint len = 1;
+    buf[0] = tag;
+    if (tag == BINSNAP_TAG_NUDGE)
+        len += binsnap_encode_varint(buf + 1, val);
+    dr_write_file(f, buf, len);
+}
+
+static size_t
+binsnap_snapshot_body(file_t f, size_t *sofar, per_snapshot_t *snap, int idx)
+{
+    heap_used_t *u;
+    uint num_records = 0;
+    uint prev_id = 0;
+    size_t size = 0;
+    for (u = snap->used; u != NULL; u = u->next) {
+        if (u->bytes_asked_for + u->extra_usable > 0)
+            num_records++;
+    }
+    size += binsnap_put_varint(f, sofar, snapshot_count);
+    size += binsnap_put_varint(f, sofar, binsnap_zigzag(idx));
+    size += binsnap_put_varint(f, sofar, snap->stamp + stamp_offs);
+    size += binsnap_put_varint(f, sofar, stamp_offs);
+    size += binsnap_put_varint(f, sofar, snap->tot_mallocs);
+    size += binsnap_put_varint(f, sofar, snap->tot_bytes_asked_for);
+    size += binsnap_put_varint(f, sofar, snap->tot_bytes_usable);
+    size += binsnap_put_varint(f, sofar, snap->tot_bytes_occupied);
+    size += binsnap_put_varint(f, sofar, num_records);
+    for (u = snap->used; u != NULL; u = u->next) {
+        if (u->bytes_asked_for + u->extra_usable > 0) {
+            uint id = u->callstack->id;
+            size += binsnap_put_varint(f, sofar,
+                                       binsnap_zigzag((int64)id - (int64)prev_id));
+            size += binsnap_put_varint(f, sofar, u->instances);
+            size += binsnap_put_varint(f, sofar, u->bytes_asked_for);
+            size += binsnap_put_varint(f, sofar, u->extra_usable);
+            size += binsnap_put_varint(f, sofar, u->extra_occupied);
+            prev_id = id;
+        }
+    }
+    return size;
+}
+
+static size_t
+binsnap_staleness_body(file_t f, size_t *sofar, per_snapshot_t *snap)
+{
+    stale_snap_allocs_t *stale = snap->stale;
+    uint num_records = 0;
+    uint prev_id = 0;
+    uint64 prev_access = snap->stamp + stamp_offs;
+    size_t size = 0;
+    uint i, j;
+    for (i = 0; stale != NULL && i < staleness_get_snap_num_cstacks(stale); i++)
+        num_records += staleness_get_snap_num_entries(stale, i);
+    size += binsnap_put_varint(f, sofar, snapshot_count);
+    size += binsnap_put_varint(f, sofar, snap->stamp + stamp_offs);
+    size += binsnap_put_varint(f, sofar, num_records);
+    for (i = 0; stale != NULL && i < staleness_get_snap_num_cstacks(stale); i++) {
+        uint id = staleness_get_snap_cstack_id(stale, i);
+        for (j = 0; j < staleness_get_snap_num_entries(stale, i); j++) {
+            uint64 access = staleness_get_snap_last_access(stale, i, j);
+            size += binsnap_put_varint(f, sofar,
+                                       binsnap_zigzag((int64)id - (int64)prev_id));
+            size += binsnap_put_varint(f, sofar, staleness_get_snap_bytes(stale, i, j));
+            size += binsnap_put_varint(f, sofar,
+                                       binsnap_zigzag((int64)(access - prev_access)));
+            prev_id = id;
+            prev_access = access;
+        }
+    }
+    return size;
+}
+
+/* Up to caller to synchronize */
+static void
+dump_snapshot_binary(per_snapshot_t *snap, int idx)
+{
+    binsnap_index_t entry;
+    byte tag = BINSNAP_TAG_SNAPSHOT;
+    size_t sofar = 0, size;
+    uint header;
+    IF_DEBUG(size_t written;)
+
+    memset(&entry, 0, sizeof(entry));
+    entry.stamp = snap->stamp + stamp_offs;
+    entry.tot_mallocs = snap->tot_mallocs;
+    entry.tot_bytes_asked_for = snap->tot_bytes_asked_for;
+    entry.tot_bytes_usable = snap->tot_bytes_usable;
+    entry.tot_bytes_occupied = snap->tot_bytes_occupied;
+    entry.snapshot_num = snapshot_count;
+    entry.idx = idx;
+
+    /* Size each body first so the size can precede it without a seek */
+    entry.snapshot_pos = dr_file_tell(f_snapshot);
+    size = binsnap_snapshot_body(INVALID_FILE, NULL, snap, idx);
+    binsnap_write(f_snapshot, &sofar, &tag, 1);
+    header = 1 + (uint) binsnap_put_varint(f_snapshot, &sofar, size);
+    IF_DEBUG(written =)
+        binsnap_snapshot_body(f_snapshot, &sofar, snap, idx);
+    ASSERT(written == size, "binary snapshot size mismatch");
+    FLUSH_BUFFER(f_snapshot, snaps_log_buf, sofar);
+    entry.snapshot_size = header + (uint) size;
+
+    if (options.staleness) {
+        entry.staleness_pos = dr_file_tell(f_staleness);
+        size = binsnap_staleness_body(INVALID_FILE, NULL, snap);
+        binsnap_write(f_staleness, &sofar, &tag, 1);
+        header = 1 + (uint) binsnap_put_varint(f_staleness, &sofar, size);
+        IF_DEBUG(written =)
+            binsnap_staleness_body(f_staleness, &sofar, snap);
+        ASSERT(written == size, "binary staleness size mismatch");
+        FLUSH_BUFFER(f_staleness, snaps_log_buf, sofar);
+        entry.staleness_size = header + (uint) size;
+    }
+
+    dr_write_file(f_snapshot_idx, &entry, sizeof(entry));
+}
+
 /* Up to caller to synchronize */
 static void
 dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
@@ -400,6 +654,11 @@ dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
 
     LOG(2, "dumping snapshot idx=%d count=%"INT64_FORMAT"u\n",
         idx, snap->stamp);
+    if (options.binary_snapshots) {
+        dump_snapshot_binary(snap, idx);
+        snapshot_count++;
+        return;
+    }
     dr_fprintf(f_snapshot, "SNAPSHOT #%4d @ %16"INT64_FORMAT"u %s\n",
                snapshot_count, snap->stamp + stamp_offs, unit_name());
     dr_fprintf(f_snapshot, "idx=%d, stamp_offs=%16"INT64_FORMAT"u\n",
@@ -424,18 +683,26 @@ dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
         uint i;
         dr_fprintf(f_staleness, "SNAPSHOT #%4d @ %16"INT64_FORMAT"u %s\n",
                    snapshot_count, snap->stamp + stamp_offs, unit_name());
-        /* FIXME: optimize by listing cstack id only once; or binary format.
+        /* Each line aggregates all of a callstack's live mallocs that share
+         * a last-access timestamp.
+         * FIXME: optimize by listing cstack id only once; or binary format.
          * If still too big then collapse similar timestamps and give up
          * some runtime flexibility in granularity
          */
         sofar = 0;
-        for (i = 0; snap->stale != NULL && i < snap->stale->num_entries; i++) {
-            /* PR 551841: improve perf by printing to buffer to reduce # file writes */
-            BUFFERED_WRITE(f_staleness, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE,
-                           sofar, len, "%u,%u,%"INT64_FORMAT"u\n",
-                           staleness_get_snap_cstack_id(snap->stale, i),
-                           staleness_get_snap_bytes(snap->stale, i),
-                           staleness_get_snap_last_access(snap->stale, i));
+        for (i = 0; snap->stale != NULL &&
+                 i < staleness_get_snap_num_cstacks(snap->stale); i++) {
+            uint j;
+            for (j = 0; j < staleness_get_snap_num_entries(snap->stale, i); j++) {
+                /* PR 551841: improve perf by printing to buffer to reduce # file
+                 * writes
+                 */
+                BUFFERED_WRITE(f_staleness, snaps_log_buf, SNAPSHOT_LOG_BUF_SIZE,
+                               sofar, len, "%u,%"INT64_FORMAT"u,%"INT64_FORMAT"u\n",
+                               staleness_get_snap_cstack_id(snap->stale, i),
+                               staleness_get_snap_bytes(snap->stale, i, j),
+                               staleness_get_snap_last_access(snap->stale, i, j));
+            }
         }
         FLUSH_BUFFER(f_staleness, snaps_log_buf, sofar);
     }
@@ -443,7 +710,7 @@ dump_snapshot(per_snapshot_t *snap, int idx/*-1 means peak*/)
     snapshot_count++;
 }
 
-/* Caller must hold snapshot_lock */
+/* Caller must hold malloc_lock() and snapshot_lock */
 static void
 free_snapshot(per_snapshot_t *snap)
 {
@@ -459,7 +726,7 @@ free_snapshot(per_snapshot_t *snap)
     }
 }
 
-/* Caller must hold snapshot_lock.
+/* Caller must hold malloc_lock() and snapshot_lock.
  * Calls free_snapshot on dst first.
  * If new_live is true, dst is the new "live" in-progress snapshot
  * whose list is where callstack table entries point.
@@ -758,6 +1025,7 @@ client_add_malloc_pre(malloc_info_t *info, dr_mcontext_t *mc, app_pc post_call)
 #ifndef USE_MD5
         uint crc[2];
 #endif
+        bool scratch = false;
         /* Printing to a buffer is slow (quite noticeable: 2x on cfrac) so it's
          * faster to create a packed callstack for computing the checksum to
          * decide uniqueness, limiting printing to new callstacks only.
@@ -765,7 +1033,14 @@ client_add_malloc_pre(malloc_info_t *info, dr_mcontext_t *mc, app_pc post_call)
         packed_callstack_t *pcs;
         app_loc_t loc;
         pc_to_loc(&loc, post_call);
-        packed_callstack_record(&pcs, mc, &loc, options.callstack_max_frames);
+        /* We only need the frames long enough to checksum and maybe print
+         * them, so we use per-thread scratch space when we have it.
+         */
+        pcs = packed_callstack_record_scratch(mc, &loc, options.callstack_max_frames);
+        if (pcs == NULL)
+            packed_callstack_record(&pcs, mc, &loc, options.callstack_max_frames);
+        else
+            scratch = true;
 
 #if defined(USE_MD5) || defined(CHECK_WITH_MD5)
         packed_callstack_md5(pcs, md5);
@@ -802,8 +1077,10 @@ client_add_malloc_pre(malloc_info_t *info, dr_mcontext_t *mc, app_pc post_call)
             dump_callstack(pcs, per, buf, bufsz, &sofar);
         }
         hashtable_unlock(&alloc_stack_table);
-        sofar = packed_callstack_free(pcs);
-        ASSERT(sofar == 0, "pcs should have 0 ref count");
+        if (!scratch) {
+            sofar = packed_callstack_free(pcs);
+            ASSERT(sofar == 0, "pcs should have 0 ref count");
+        }
     }
 
 #ifdef X64
@@ -818,7 +1095,7 @@ client_add_malloc_pre(malloc_info_t *info, dr_mcontext_t *mc, app_pc post_call)
     release_buffer(drcontext, buf, bufsz);
 
     if (options.staleness)
-        return (void *) staleness_create_per_alloc(per, stamp);
+        return (void *) staleness_create_per_alloc(per, info->request_size, stamp);
     else
         return (void *) per;
 }
@@ -906,12 +1183,16 @@ snapshot_exit(void)
 {
     int i;
 
+    malloc_lock(); /* must be acquired before snapshot_lock */
     snapshot_dump_all();
 
+    dr_mutex_lock(snapshot_lock);
     for (i = 0; i < options.snapshots; i++)
         free_snapshot(&snaps[i]);
     global_free(snaps, options.snapshots*sizeof(*snaps), HEAPSTAT_SNAPSHOT);
     free_snapshot(&snap_peak);
+    dr_mutex_unlock(snapshot_lock);
+    malloc_unlock();
 
     dr_mutex_destroy(snapshot_lock);
 }
@@ -943,6 +1224,10 @@ client_handle_realloc(void *drcontext, malloc_info_t *old_info, malloc_info_t *n
         }
         account_for_bytes_pre(per, delta_req, delta_pad, delta_head, true/*realloc*/);
         account_for_bytes_post(delta_req, delta_pad, 0);
+        if (options.staleness) {
+            staleness_resize_per_alloc((stale_per_alloc_t *)new_info->client_data,
+                                       new_info->request_size);
+        }
     }
 
     if (options.check_leaks)
@@ -1088,6 +1373,12 @@ client_post_syscall(void *drcontext, int sysnum)
 {
 }
 
+void
+client_prepare_leak_reports(void **client_data, uint num)
+{
+    /* nothing: we symbolize each leak callstack as we report it */
+}
+
 void
 client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
                   bool pre_us, bool reachable,
@@ -1138,30 +1429,87 @@ client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
  * INSTRUMENTATION
  */
 
+static void
+instrcnt_init(void)
+{
+    IF_DEBUG(bool ok =)
+        dr_raw_tls_calloc(&tls_instrcnt_seg, &tls_instrcnt_base, 1, 0);
+    ASSERT(ok, "fatal error: unable to reserve tls slot");
+}
+
+static void
+instrcnt_exit(void)
+{
+    IF_DEBUG(bool ok =)
+        dr_raw_tls_cfree(tls_instrcnt_base, 1);
+    ASSERT(ok, "WARNING: unable to free tls slot");
+}
+
+/* The smallest quantum we use for a non-zero -time_instrs_error.  Below this
+ * the callout cost dominates again with many threads or a small -dump_freq.
+ */
+#define INSTRCNT_MIN_QUANTUM 4096
+
+/* Each live thread can have up to a quantum of instrs not yet in instr_count
+ * when another thread crosses a snapshot boundary, so we split the allowed
+ * error among them.  Threads only pick up a new quantum when they next fold,
+ * so the bound is approximate while the thread count or -dump_freq changes.
+ * With the floor, a snapshot is within
+ * max(-dump_freq * -time_instrs_error / 100, threads * INSTRCNT_MIN_QUANTUM)
+ * instrs of its exact point, plus a bb per thread.
+ */
+static int
+instrcnt_quantum(void)
+{
+    int threads = instrcnt_threads;
+    uint64 quantum = ((uint64)options.dump_freq * options.time_instrs_error) / 100;
+    if (threads > 1)
+        quantum /= threads;
+    if (options.time_instrs_error > 0 && quantum < INSTRCNT_MIN_QUANTUM)
+        quantum = INSTRCNT_MIN_QUANTUM;
+    /* Leave room for a bb's worth of instrs below zero */
+    if (quantum > INT_MAX/2)
+        quantum = INT_MAX/2;
+    return (int) quantum;
+}
+
+/* Adds instrs executed by this thread to the global clock.  Whichever thread
+ * takes instr_count from non-negative to negative owns the snapshot, so no
+ * lock is needed to pick a single thread: others keep folding into the
+ * negative count until the owner adds the next interval back.
+ */
+static void
+instrcnt_fold(int executed)
+{
+    int left = atomic_add32_return_sum(&instr_count, -executed);
+    if (left < 0 && left + executed >= 0) {
+        do {
+            /* A single fold can span several intervals if -dump_freq is small */
+            left = atomic_add32_return_sum(&instr_count, options.dump_freq);
+            /* Like the clock timer, we must hold the malloc lock first */
+            malloc_lock();
+            take_snapshot();
+            malloc_unlock();
+        } while (left < 0);
+    }
+}
+
 /* N.B.: mcontext is not in consistent app state, for efficiency.
  */
 static void
 shared_instrcnt_callee(void)
 {
-    bool do_snapshot = false;
+    void *drcontext = dr_get_current_drcontext();
+    tls_heapstat_t *pt = (tls_heapstat_t *)
+        drmgr_get_tls_field(drcontext, tls_idx_heapstat);
+    int executed;
     ASSERT(options.time_instrs, "option mismatch");
-    /* We racily subtract and check, so serialize now for a single snapshot */
-    dr_mutex_lock(snapshot_lock);
-    /* We can still have a double-snapshot if threshold is low enough that
-     * other threads bump the instr_count over it before 2nd guy to get lock
-     * can do this check, but that's ok
-     */
-    if (instr_count < 0) {
-        do_snapshot = true;
-        instr_count = options.dump_freq;
-    } else {
-        /* We assume can't take so long that it wraps around */
-        ASSERT(instr_count <= options.dump_freq, "callee incorrectly invoked");
-    }
-    /* Release lock so take_snapshot can grab it */
-    dr_mutex_unlock(snapshot_lock);
-    if (do_snapshot)
-        take_snapshot();
+    /* Only this thread writes its counter, so there's no race here */
+    ASSERT(*pt->instrcnt < 0, "callee incorrectly invoked");
+    executed = pt->instrcnt_quantum - *pt->instrcnt;
+    pt->instrcnt_quantum = instrcnt_quantum();
+    *pt->instrcnt = pt->instrcnt_quantum;
+    instrcnt_fold(executed);
 }
 
 /* To avoid the code expansion from a clean call in every bb we use
@@ -1252,16 +1600,17 @@ insert_instr_counter(void *drcontext, instrlist_t *bb,
     if (!flags_dead)
         dr_save_arith_flags(drcontext, bb, first, SPILL_SLOT_1);
     /* Rather than an ongoing count that would need a 64-bit
-     * counter, we do a racy subtract of a 32-bit counter and if
+     * counter, we subtract from this thread's 32-bit counter and if
      * negative (so we don't need a cmp) then we go to a callout
-     * that synchs for a counter reset and single snapshot.
-     * We assume that racy mods during that synch won't overflow
-     * the counter.  We also ignore the detail of how many instrs
-     * in this bb we've executed yet.
+     * that folds the count into the global clock and takes a snapshot
+     * if that crosses the threshold.  We ignore the detail of how many
+     * instrs in this bb we've executed yet.
      */
     instrlist_meta_preinsert
-        (bb, where, INSTR_CREATE_sub(drcontext, OPND_CREATE_ABSMEM
-                                     ((byte *)&instr_count, OPSZ_4),
+        (bb, where, INSTR_CREATE_sub(drcontext, opnd_create_far_base_disp_ex
+                                     (tls_instrcnt_seg, REG_NULL, REG_NULL, 1,
+                                      tls_instrcnt_base, OPSZ_4,
+                                      false, true, false),
                                      (instrs_in_bb <= CHAR_MAX) ?
                                      OPND_CREATE_INT8(instrs_in_bb) :
                                      OPND_CREATE_INT32(instrs_in_bb)));
@@ -1453,8 +1802,8 @@ dump_statistics(void)
     dr_fprintf(f_global, "peaks detected: %8u, skipped: %8u\n",
                peaks_detected, peaks_skipped);
     if (options.staleness) {
-        dr_fprintf(f_global, "staleness: needs large: %7u, needs ext: %7u\n",
-                   stale_needs_large, stale_small_needs_ext);
+        dr_fprintf(f_global, "staleness callstacks: frozen: %7u, shared: %7u\n",
+                   stale_cstacks_frozen, stale_cstacks_shared);
     }
 
     /* FIXME: share w/ drmemory.c */
@@ -1605,9 +1954,20 @@ create_global_logfile(void)
     LOGF(1, f_global, "global logfile fd=%d\n", f_global);
 
     f_callstack = open_logfile("callstack.log", false, -1);
-    f_snapshot = open_logfile("snapshot.log", false, -1);
-    if (options.staleness)
-        f_staleness = open_logfile("staleness.log", false, -1);
+    if (options.binary_snapshots) {
+        f_snapshot = open_logfile("snapshot.bin", false, -1);
+        binsnap_write_header(f_snapshot, BINSNAP_MAGIC_SNAPSHOT);
+        f_snapshot_idx = open_logfile("snapshot.bidx", false, -1);
+        binsnap_write_index_header(f_snapshot_idx);
+        if (options.staleness) {
+            f_staleness = open_logfile("staleness.bin", false, -1);
+            binsnap_write_header(f_staleness, BINSNAP_MAGIC_STALENESS);
+        }
+    } else {
+        f_snapshot = open_logfile("snapshot.log", false, -1);
+        if (options.staleness)
+            f_staleness = open_logfile("staleness.log", false, -1);
+    }
 
     /* For long running multi-process apps like sfcbd, this can mean a lot of
      * index files.  With each file being 1 MB minimum on esxi, space can be
@@ -1634,6 +1994,7 @@ static void
 reset_to_time_zero(bool keep_offs)
 {
     int i;
+    malloc_lock(); /* must be acquired before snapshot_lock */
     dr_mutex_lock(snapshot_lock);
 
     /* take current data and make it the cur val of to-be-snapshot 0 */
@@ -1652,6 +2013,7 @@ reset_to_time_zero(bool keep_offs)
     /* malloc_count we do not reset */
 
     dr_mutex_unlock(snapshot_lock);
+    malloc_unlock();
 }
 
 static void
@@ -1792,7 +2154,9 @@ event_fork(void *drcontext)
     if (options.staleness)
         close_file(f_staleness);
     close_file(f_nudge);
-    /* now create new files for all 5 */
+    if (options.binary_snapshots)
+        close_file(f_snapshot_idx);
+    /* now create new files for all of these */
     create_global_logfile();
     utils_thread_set_file(drcontext, f_global);
     LOG(0, "new logfile after fork fd=%d\n", f_global);
@@ -1961,6 +2325,10 @@ check_reachability(bool at_exit)
 static void
 print_nudge_header(file_t f)
 {
+    if (options.binary_snapshots && (f == f_snapshot || f == f_staleness)) {
+        binsnap_write_marker(f, BINSNAP_TAG_NUDGE, snaps[snap_idx].stamp);
+        return;
+    }
     dr_fprintf(f, "NUDGE @ %16"INT64_FORMAT"u %s\n\n",
                snaps[snap_idx].stamp, unit_name());
 }
@@ -2069,6 +2437,17 @@ event_thread_init(void *drcontext)
         shadow_thread_init(drcontext);
     if (options.staleness)
         instrument_thread_init(drcontext);
+    if (options.time_instrs) {
+#ifdef UNIX
+        pt->instrcnt = (int *)
+            (dr_get_dr_segment_base(tls_instrcnt_seg) + tls_instrcnt_base);
+#else
+        pt->instrcnt = (int *)(get_own_seg_base() + tls_instrcnt_base);
+#endif
+        atomic_add32_return_sum(&instrcnt_threads, 1);
+        pt->instrcnt_quantum = instrcnt_quantum();
+        *pt->instrcnt = pt->instrcnt_quantum;
+    }
 }
 
 static void
@@ -2077,6 +2456,11 @@ event_thread_exit(void *drcontext)
     tls_heapstat_t *pt = (tls_heapstat_t *)
         drmgr_get_tls_field(drcontext, tls_idx_heapstat);
     LOGPT(2, PT_GET(drcontext), "in event_thread_exit()\n");
+    if (options.time_instrs) {
+        /* Don't lose what we counted locally since our last fold */
+        atomic_add32_return_sum(&instrcnt_threads, -1);
+        instrcnt_fold(pt->instrcnt_quantum - *pt->instrcnt);
+    }
     if (options.staleness)
         instrument_thread_init(drcontext);
     callstack_thread_exit(drcontext);
@@ -2116,8 +2500,10 @@ event_exit(void)
         leak_exit();
     }
 
-    if (options.staleness)
+    if (options.staleness) {
         malloc_iterate(alloc_itercb_exit, NULL);
+        staleness_exit();
+    }
 
     alloc_exit(); /* must be before deleting alloc_stack_table */
     heap_region_exit(); /* must be after alloc_exit */
@@ -2149,6 +2535,8 @@ event_exit(void)
     if (drsys_exit() != DRMF_SUCCESS)
         ASSERT(false, "drsys failed to exit");
     drmgr_unregister_tls_field(tls_idx_heapstat);
+    if (options.time_instrs)
+        instrcnt_exit();
     drwrap_exit();
     drmgr_exit();
 
@@ -2156,11 +2544,21 @@ event_exit(void)
     close_file(f_global);
     dr_fprintf(f_callstack, "LOG END\n");
     close_file(f_callstack);
-    dr_fprintf(f_snapshot, "LOG END\n");
-    close_file(f_snapshot);
-    if (options.staleness) {
-        dr_fprintf(f_staleness, "LOG END\n");
-        close_file(f_staleness);
+    if (options.binary_snapshots) {
+        binsnap_write_marker(f_snapshot, BINSNAP_TAG_END, 0);
+        close_file(f_snapshot);
+        close_file(f_snapshot_idx);
+        if (options.staleness) {
+            binsnap_write_marker(f_staleness, BINSNAP_TAG_END, 0);
+            close_file(f_staleness);
+        }
+    } else {
+        dr_fprintf(f_snapshot, "LOG END\n");
+        close_file(f_snapshot);
+        if (options.staleness) {
+            dr_fprintf(f_staleness, "LOG END\n");
+            close_file(f_staleness);
+        }
     }
     close_file(f_nudge);
 }
@@ -2182,6 +2580,8 @@ dr_init(client_id_t client_id)
     drmgr_init(); /* must be before utils_init and any other tls/cls uses */
     tls_idx_heapstat = drmgr_register_tls_field();
     ASSERT(tls_idx_heapstat > -1, "unable to reserve TLS slot");
+    if (options.time_instrs)
+        instrcnt_init();
 
     drwrap_init();
     utils_init();
@@ -2284,6 +2684,8 @@ dr_init(client_id_t client_id)
     /* must be before heap_walk() and alloc_init() */
     if (options.check_leaks || options.staleness)
         shadow_init();
+    if (options.staleness)
+        staleness_init();
 
     hashtable_init_ex(&alloc_stack_table, ASTACK_TABLE_HASH_BITS, HASH_CUSTOM,
                       false/*!str_dup*/, false/* !synch; + higher-level synch covered
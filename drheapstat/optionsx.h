@@ -101,6 +101,9 @@ OPTION_FRONT_BOOL(post, group_by_files, false,
 OPTION_CLIENT_BOOL(client, time_instrs, false,
                    "Use instrs executed as time unit",
                    "Select the number of instructions executed as the time unit.")
+OPTION_CLIENT(client, time_instrs_error, uint, 2, 0, 50,
+              "Accuracy of -time_instrs snapshots, in percentage of -dump_freq",
+              "For -time_instrs, each thread counts its instructions locally and only adds them to the global count in batches, to avoid contention between threads.  The batch size is chosen so that each snapshot is taken within approximately this percentage of -dump_freq instructions of its exact point, though each thread counts at least 4096 instructions per batch, so with many threads or a small -dump_freq the error can be up to 4096 instructions per thread.  A value of 0 adds every block's instructions to the global count as they execute, which is exact but slower.")
 OPTION_CLIENT_BOOL(client, time_allocs, false,
                    "Use allocations and frees as time unit",
                    "Select the number of allocations and frees made as the time unit.")
@@ -119,6 +122,9 @@ OPTION_CLIENT_BOOL(client, dump, false,
 OPTION_CLIENT(client, dump_freq, uint, 1, 0, UINT_MAX,
               "Frequency at which to take snapshots for -dump",
               "If explicitly set to a non-zero value, enables -dump and indicates the frequency at which data will be written to the log files.  For -time_instrs, the frequency is -dump_freq*1000 instructions.  For -time_clock, the frequency is -dump_freq*10 milliseconds.  For -time_allocs, the frequency is -dump_freq instances of allocations and deallocations.  For -time_bytes, the frequency is -dump_freq bytes of allocations and deallocations.  For all cases the exact point of each snapshot may vary slightly from the precise -dump_freq specified.")
+OPTION_CLIENT_BOOL(client, binary_snapshots, false,
+                   "Write snapshots in a compact binary format",
+                   "Write snapshot and staleness data to snapshot.bin and staleness.bin in a compact binary format, along with an index of the snapshots in snapshot.bidx, rather than as text to snapshot.log and staleness.log.  For long runs this makes the files many times smaller.  The visualizer and the -visualize post-processing read either format.")
 OPTION_CLIENT(client, peak_threshold, uint, 5, 0, 99,
               "Accuracy of peak snapshot, in percentage from the true peak.",
               "A new peak snapshot will only be taken if it is more than this percentage different from the existing peak snapshot in any of total size, number of allocations and frees, and timestamp.  Lowering this number can reduce performance but will also increase accuracy.")
@@ -64,6 +64,9 @@ my @staleness_idx = ();
 my @cstack_idx = ();
 my $vistool = "$RealBin/drheapstat.swf";
 my $visualize = 0;
+# Only checks that the logs decode consistently, for testing, rather than
+# launching the vistool.
+my $check_logs = 0;
 my $from_nudge = -1;    # Which nudge to start reading data from.  PR 502468.
 my $to_nudge = -1;      # Up to which nudge.
 # Specifies which nudge to view - used only for constant number of snapshots;
@@ -126,8 +129,6 @@ if ($is_vmk || $vs_vmk) {
     $use_vmtree = &vmk_expect_vmtree();
 }
 
-init_flash();   # Init flash before doing any work.
-
 if (!GetOptions("x=s" => \$exename,
                 "profdir=s" => \$logdir,
                 "v" => \$verbose,
@@ -137,11 +138,14 @@ if (!GetOptions("x=s" => \$exename,
                 "stale_since=i" => \$stale_since,
                 "stale_for=i" => \$stale_for,
                 "group_by_files" => \$group_by_files,
-                "use_vmtree" => \$use_vmtree)) {
+                "use_vmtree" => \$use_vmtree,
+                "check_logs" => \$check_logs)) {
     die "Incorrect options passed - not meant to be invoked directly; ".
         "use drheapstat.pl.";
 }
 
+init_flash() if (!$check_logs);   # Init flash before doing any work.
+
 die "can't find directory: $logdir\n" if (! -e $logdir);
 die "can't find executable: $exename\n" if (! -e $exename);
 
@@ -154,6 +158,16 @@ my $snapshot_logfile = $logdir."/snapshot.log";
 my $staleness_logfile = $logdir."/staleness.log";
 my $nudge_idxfile = $logdir."/nudge.idx";
 
+# With -binary_snapshots the client writes snapshot.bin and staleness.bin
+# instead, along with snapshot.bidx, an index of fixed-size records that
+# locates each snapshot in them.  See the format description in drheapstat.c.
+my $binary_snapshots = (-e $logdir."/snapshot.bin");
+my $snapshot_bidxfile = $logdir."/snapshot.bidx";
+if ($binary_snapshots) {
+    $snapshot_logfile = $logdir."/snapshot.bin";
+    $staleness_logfile = $logdir."/staleness.bin";
+}
+
 my $have_stale = ($stale_since != -1 || $stale_for != -1);
 die "Can't specify -stale_since and -stale_for together.\n"
     if ($stale_since != -1 && $stale_for != -1);
@@ -163,6 +177,8 @@ die "Can't specify -stale_since and -stale_for together.\n"
 die "can't find $cstack_logfile: $!\n" if (!-e $cstack_logfile);
 die "can't find $snapshot_logfile: $!\n" if (!-e $snapshot_logfile);
 die "can't find $nudge_idxfile: $!\n" if (!-e $nudge_idxfile);
+die "can't find $snapshot_bidxfile: $!\n"
+    if ($binary_snapshots && !-e $snapshot_bidxfile);
 if (!-e $staleness_logfile) {
     die "can't find $staleness_logfile: $!\n" if ($have_stale);
 } elsif (!$have_stale) {
@@ -171,6 +187,10 @@ if (!-e $staleness_logfile) {
 }
 
 process_all_logs();
+if ($check_logs) {
+    check_logs();
+    exit 0;
+}
 collaborate_with_vistool();
 
 unlink $flash_trust_file or
@@ -305,8 +325,11 @@ sub collaborate_with_vistool()
             if ($have_stale) {
                 $staleness_data = get_using_idx($staleness_logfile,
                                                 \@staleness_idx, $1);
+                $staleness_data = binary_staleness_to_text($staleness_data)
+                    if ($binary_snapshots);
             }
             $res = get_using_idx($snapshot_logfile, \@snapshot_idx, $1);
+            $res = binary_snapshot_to_text($res) if ($binary_snapshots);
             $res = create_snapshot_xml($res, $staleness_data, $from, $to);
         } elsif (/summary:(\d+)-(\d+)/){
             # Client requested snapshot summary for a specific range.
@@ -495,8 +518,13 @@ sub process_all_logs()
     # Processing of staleness assumes that snapshot log file was read first.
     # Don't change order.
     my @snapshots = ();
-    process_log($snapshot_logfile, "snapshot", \@snapshots);
-    process_log($staleness_logfile, "staleness", \@snapshots) if ($have_stale);
+    if ($binary_snapshots) {
+        process_binary_logs(\@snapshots);
+    } else {
+        process_log($snapshot_logfile, "snapshot", \@snapshots);
+        process_log($staleness_logfile, "staleness", \@snapshots)
+            if ($have_stale);
+    }
 
     # Snapshots in the log file are numbered sequentially but aren't sorted by
     # the x-axis value, so sort them and re-number them.  This way the user
@@ -966,6 +994,7 @@ sub get_using_idx($file_in, $idx_ref_in, $num_in)
 
     die "no entry index for $num\n" if (!defined(${$idx_ref}[$num]));
     open INPUT, $file or die "can't open $file: $!\n";
+    binmode INPUT if ($binary_snapshots);
     my $pos = ${$idx_ref}[$num]{"pos"};
     my $size = ${$idx_ref}[$num]{"size"};
     seek INPUT, $pos, SEEK_SET || die "can't seek to $pos in $file: $!\n";
@@ -974,6 +1003,40 @@ sub get_using_idx($file_in, $idx_ref_in, $num_in)
     return $str;
 }
 
+#-------------------------------------------------------------------------------
+# For -check_logs: reads back every snapshot in the chosen nudge range through
+# the same paths the vistool requests use, checks each against what indexing
+# the logs found, and checks that the log has an end.  This tests the client's
+# writer, text or binary, against the readers here.
+#
+sub check_logs()
+{
+    my $i;
+    for ($i = 0; $i < $total_ss; $i++) {
+        my $ss = $sorted_ss[$i];
+        my $res = &get_using_idx($snapshot_logfile, \@snapshot_idx, $i);
+        $res = binary_snapshot_to_text($res) if ($binary_snapshots);
+        die "snapshot $i: malformed header\n"
+            if ($res !~ /^SNAPSHOT\s*#\s*\d+\s+@\s+(\d+)\s+$xaxis_label\n/);
+        die "snapshot $i: stamp $1 isn't ".$$ss{"x_axis_val"}."\n"
+            if ($1 != $$ss{"x_axis_val"});
+        die "snapshot $i: totals don't match\n"
+            if ($res !~ /^total:\s*\d+,(\d+),(\d+),(\d+)$/m ||
+                $1 != $$ss{"totMemReq"} || $2 != $$ss{"totMemPad"} ||
+                $3 != $$ss{"totMemTot"});
+        if ($have_stale) {
+            my $stale = &get_using_idx($staleness_logfile, \@staleness_idx, $i);
+            $stale = binary_staleness_to_text($stale) if ($binary_snapshots);
+            die "snapshot $i: staleness doesn't match\n"
+                if ($stale !~ /^SNAPSHOT\s*#\s*\d+\s+@\s+(\d+)\s/ ||
+                    $1 != $$ss{"x_axis_val"});
+        }
+    }
+    die "no snapshots found\n" if ($total_ss == 0);
+    die "$snapshot_logfile has no end\n" if (!has_log_end($snapshot_logfile));
+    print "checked $total_ss snapshots\n";
+}
+
 #-------------------------------------------------------------------------------
 # Helper routine to avoid some repeated code.
 #
@@ -990,14 +1053,66 @@ sub file_pos_before_read()
 sub has_log_end($file_in)
 {
     my ($file) = @_;
+    return binary_log_has_end($file) if ($binary_snapshots);
     my $marker = "LOG END\n";
     my $fpos = (stat($file))[$fsize_idx] - length($marker);
 
     open LOG_END, $file or die "Can't open file for LOG END check: $!\n";
     seek LOG_END, $fpos, SEEK_SET;
-    $line = <LOG_END>;
-    return $line =~ /$marker/ ? 1 : 0;
+    read LOG_END, $line, length($marker);
     close LOG_END;
+    return $line eq $marker ? 1 : 0;
+}
+
+#-------------------------------------------------------------------------------
+# The binary equivalent of has_log_end().  A last byte of 'E' could just as
+# well be the end of a truncated snapshot frame, so we start from the end of
+# the last snapshot in snapshot.bidx and require that only 'N' frames follow
+# it, then an 'E' frame that ends the file.
+#
+sub binary_log_has_end($file_in)
+{
+    my ($file) = @_;
+    my ($hdr, $rec, $buf, $start);
+
+    open BIDX, $snapshot_bidxfile or die "can't open $snapshot_bidxfile: $!\n";
+    binmode BIDX;
+    read BIDX, $hdr, 16;
+    die "$snapshot_bidxfile isn't a snapshot index\n"
+        if (length($hdr) != 16 || substr($hdr, 0, 8) ne "DHSNAPIX");
+    my ($version, $rec_size) = unpack "VV", substr($hdr, 8);
+    die "$snapshot_bidxfile has an unknown record size $rec_size\n"
+        if ($rec_size < 72);
+    # A partial last record was never completed, so it doesn't count.
+    my $num = int(((stat($snapshot_bidxfile))[$fsize_idx] - 16) / $rec_size);
+    if ($num > 0) {
+        seek BIDX, 16 + ($num - 1) * $rec_size, SEEK_SET;
+        read BIDX, $rec, $rec_size;
+        my ($ss_pos, $ss_size) = (unpack "Q<7 V l< V V", $rec)[1, 9];
+        $start = $ss_pos + $ss_size;
+    } else {
+        ($start) = read_binary_log_header($file);
+    }
+    close BIDX;
+
+    my $size = (stat($file))[$fsize_idx];
+    return 0 if ($start >= $size);
+    open LOG_END, $file or die "Can't open file for LOG END check: $!\n";
+    binmode LOG_END;
+    seek LOG_END, $start, SEEK_SET;
+    read LOG_END, $buf, $size - $start;
+    close LOG_END;
+
+    my $pos = 0;
+    while ($pos < length($buf)) {
+        my $tag = substr($buf, $pos++, 1);
+        return ($pos == length($buf) ? 1 : 0) if ($tag eq "E");
+        return 0 if ($tag ne "N");
+        # Skip the nudge's varint stamp.
+        $pos++ while ($pos < length($buf) && (ord(substr($buf, $pos, 1)) & 0x80));
+        return 0 if ($pos++ >= length($buf));
+    }
+    return 0;
 }
 
 #-------------------------------------------------------------------------------
@@ -1155,6 +1270,197 @@ sub process_log($log_file, $log_type, $ss_aref)
     close LOG;
 }
 
+#-------------------------------------------------------------------------------
+# The binary equivalent of process_log(): reads snapshot.bidx to find the
+# position, size and totals of each snapshot in the nudge range without
+# scanning snapshot.bin.  Only the staleness frames have to be decoded, to
+# compute each snapshot's total stale memory.
+#
+sub process_binary_logs($ss_aref)
+{
+    my ($ss_aref) = @_;
+    my ($buf, $hdr, $rec, $unit);
+
+    # The unit name is in the snapshot.bin header.
+    (undef, $unit) = read_binary_log_header($snapshot_logfile);
+    ($xaxis_label) = ($unit =~ /^(\w+)/);
+
+    open BIDX, $snapshot_bidxfile or die "can't open $snapshot_bidxfile: $!\n";
+    binmode BIDX;
+    read BIDX, $hdr, 16;
+    die "$snapshot_bidxfile isn't a snapshot index\n"
+        if (length($hdr) != 16 || substr($hdr, 0, 8) ne "DHSNAPIX");
+    my ($version, $rec_size) = unpack "VV", substr($hdr, 8);
+    die "$snapshot_bidxfile has an unknown record size $rec_size\n"
+        if ($rec_size < 72);
+
+    if ($have_stale) {
+        open STALE, $staleness_logfile or
+            die "can't open $staleness_logfile: $!\n";
+        binmode STALE;
+    }
+    my $i = -1;
+    while (read(BIDX, $rec, $rec_size) == $rec_size) {
+        # binsnap_index_t: 7 uint64 fields then 4 32-bit fields.
+        my ($stamp, $ss_pos, $st_pos, $mallocs, $req, $usable, $occupied,
+            $num, $idx, $ss_size, $st_size) = unpack "Q<7 V l< V V", $rec;
+        # Only take snapshots written between the chosen nudges.  PR 502468.
+        next if ($ss_pos < $nudge[$from_nudge]{"snapshot"} ||
+                 $ss_pos >= $nudge[$to_nudge]{"snapshot"});
+        $i++;
+        $$ss_aref[$i]{"id"} = $num;
+        $$ss_aref[$i]{"x_axis_val"} = $stamp;
+        $$ss_aref[$i]{"totMemReq"} = $req;
+        $$ss_aref[$i]{"totMemPad"} = $usable;
+        $$ss_aref[$i]{"totMemTot"} = $occupied;
+        $$ss_aref[$i]{"snapshot_pos"} = $ss_pos;
+        $$ss_aref[$i]{"snapshot_size"} = $ss_size;
+        if ($have_stale) {
+            $$ss_aref[$i]{"staleness_pos"} = $st_pos;
+            $$ss_aref[$i]{"staleness_size"} = $st_size;
+            $$ss_aref[$i]{"totMemStale"} = 0;
+            seek STALE, $st_pos, SEEK_SET ||
+                die "can't seek to $st_pos in $staleness_logfile: $!\n";
+            read STALE, $buf, $st_size;
+            foreach my $entry (decode_binary_staleness($buf)) {
+                $$ss_aref[$i]{"totMemStale"} += $$entry[1]
+                    if (is_stale($stamp, $$entry[2]));
+            }
+        }
+    }
+    close STALE if ($have_stale);
+    close BIDX;
+}
+
+#-------------------------------------------------------------------------------
+# Reads the header of snapshot.bin and returns its size and the unit name.
+#
+sub read_binary_log_header($file_in)
+{
+    my ($file) = @_;
+    my $buf;
+    open BIN, $file or die "can't open $file: $!\n";
+    binmode BIN;
+    read BIN, $buf, 4096;
+    close BIN;
+    die "$file isn't a binary snapshot log\n"
+        if (substr($buf, 0, 8) ne "DHSNAPSH");
+    my $pos = 8;
+    read_varint(\$buf, \$pos);    # version
+    my $unit_len = read_varint(\$buf, \$pos);
+    die "truncated binary snapshot log header\n"
+        if ($pos + $unit_len > length($buf));
+    return ($pos + $unit_len, substr($buf, $pos, $unit_len));
+}
+
+#-------------------------------------------------------------------------------
+# Converts a snapshot.bin frame into the snapshot.log text that
+# create_snapshot_xml() parses.
+#
+sub binary_snapshot_to_text($frame)
+{
+    my ($frame) = @_;
+    my $pos = binary_frame_payload($frame);
+    my $num = read_varint(\$frame, \$pos);
+    my $idx = read_zigzag(\$frame, \$pos);
+    my $stamp = read_varint(\$frame, \$pos);
+    my $stamp_offs = read_varint(\$frame, \$pos);
+    my @totals = map { read_varint(\$frame, \$pos) } (1..4);
+    my $count = read_varint(\$frame, \$pos);
+    my $str = "SNAPSHOT #$num @ $stamp $xaxis_label\n".
+              "idx=$idx, stamp_offs=$stamp_offs\n".
+              "total: ".join(",", @totals)."\n";
+    my $id = 0;
+    for (my $i = 0; $i < $count; $i++) {
+        $id += read_zigzag(\$frame, \$pos);
+        my @vals = map { read_varint(\$frame, \$pos) } (1..4);
+        $str .= join(",", $id, @vals)."\n";
+    }
+    return $str;
+}
+
+#-------------------------------------------------------------------------------
+# Converts a staleness.bin frame into the staleness.log text that
+# create_snapshot_xml() parses.
+#
+sub binary_staleness_to_text($frame)
+{
+    my ($frame) = @_;
+    my $pos = binary_frame_payload($frame);
+    my $num = read_varint(\$frame, \$pos);
+    my $stamp = read_varint(\$frame, \$pos);
+    my $str = "SNAPSHOT #$num @ $stamp $xaxis_label\n";
+    foreach my $entry (decode_binary_staleness($frame)) {
+        $str .= join(",", @{$entry})."\n";
+    }
+    return $str;
+}
+
+#-------------------------------------------------------------------------------
+# Decodes a staleness.bin frame into a list of [callstack id, bytes, last
+# access] triples.
+#
+sub decode_binary_staleness($frame)
+{
+    my ($frame) = @_;
+    my $pos = binary_frame_payload($frame);
+    my @entries = ();
+    read_varint(\$frame, \$pos);      # snapshot number
+    my $access = read_varint(\$frame, \$pos);
+    my $count = read_varint(\$frame, \$pos);
+    my $id = 0;
+    for (my $i = 0; $i < $count; $i++) {
+        $id += read_zigzag(\$frame, \$pos);
+        my $bytes = read_varint(\$frame, \$pos);
+        $access += read_zigzag(\$frame, \$pos);
+        push @entries, [$id, $bytes, $access];
+    }
+    return @entries;
+}
+
+#-------------------------------------------------------------------------------
+# Checks the tag and size of the 'S' frame in $frame and returns the offset
+# of its payload.
+#
+sub binary_frame_payload($frame)
+{
+    my ($frame) = @_;
+    my $pos = 1;
+    die "invalid binary snapshot frame\n" if (substr($frame, 0, 1) ne "S");
+    my $size = read_varint(\$frame, \$pos);
+    die "truncated binary snapshot frame\n" if ($pos + $size > length($frame));
+    return $pos;
+}
+
+#-------------------------------------------------------------------------------
+# Reads a zigzag-encoded signed varint, as read_varint() does.
+#
+sub read_zigzag($buf_ref, $pos_ref)
+{
+    my ($buf_ref, $pos_ref) = @_;
+    my $val = read_varint($buf_ref, $pos_ref);
+    return ($val & 1) ? -($val >> 1) - 1 : ($val >> 1);
+}
+
+#-------------------------------------------------------------------------------
+# Reads an unsigned LEB128 varint at offset $$pos_ref in $$buf_ref and
+# advances the offset past it.
+#
+sub read_varint($buf_ref, $pos_ref)
+{
+    my ($buf_ref, $pos_ref) = @_;
+    my ($val, $shift) = (0, 0);
+    while (1) {
+        die "truncated varint in binary snapshot data\n"
+            if ($$pos_ref >= length($$buf_ref));
+        my $b = ord(substr($$buf_ref, $$pos_ref++, 1));
+        $val |= ($b & 0x7f) << $shift;
+        last if (!($b & 0x80));
+        $shift += 7;
+    }
+    return $val;
+}
+
 #-------------------------------------------------------------------------------
 # Returns 1 if the last access time of a malloc was earlier than what the user
 # specified (either via -stale_since or -stale_for), 0 otherwise.
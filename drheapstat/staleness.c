@@ -371,22 +371,183 @@ instr_ok_for_instrument_fastpath(instr_t *inst, fastpath_info_t *mi, bb_info_t *
  * STALENESS DATA
  */
 
-/* We need the count of live mallocs so we can alloc an array to store
- * per snapshot (PR 557636)
+/* A group of one callstack's live mallocs that share a last-access timestamp */
+typedef struct _stale_bucket_t {
+    uint64 last_access;
+    uint64 bytes_asked_for;
+    uint num_allocs;
+    struct _stale_per_cstack_t *owner;
+    struct _stale_bucket_t *prev, *next;
+} stale_bucket_t;
+
+/* The live staleness histogram for one callstack */
+typedef struct _stale_per_cstack_t {
+    per_callstack_t *cstack;
+    /* Newest first, since the newest stamp is where allocs and accesses go */
+    stale_bucket_t *buckets;
+    uint num_buckets;
+    /* The histogram as of the last snapshot, or NULL if it changed since */
+    stale_snap_cstack_t *frozen;
+    /* On the stale_active list iff num_buckets > 0 */
+    struct _stale_per_cstack_t *prev_active, *next_active;
+} stale_per_cstack_t;
+
+/* Maps per_callstack_t * to stale_per_cstack_t *.  Like the alloc stack
+ * table, this and the histograms are protected by the malloc lock, which all
+ * our callers hold.
  */
-static uint num_live_mallocs;
+#define STALE_CSTACK_TABLE_HASH_BITS 8
+static hashtable_t stale_cstack_table;
+
+/* The callstacks with live mallocs, which is what each snapshot records */
+static stale_per_cstack_t *stale_active;
+static uint num_active_cstacks;
 
 #ifdef STATISTICS
-uint stale_small_needs_ext;
-uint stale_needs_large;
+uint stale_cstacks_frozen;
+uint stale_cstacks_shared;
 #endif
 
+static void
+stale_frozen_release(stale_snap_cstack_t *frozen)
+{
+    ASSERT(frozen->refcount > 0, "frozen staleness refcount underflow");
+    frozen->refcount--;
+    if (frozen->refcount == 0) {
+        global_free(frozen->entries, frozen->num_entries*sizeof(*frozen->entries),
+                    HEAPSTAT_STALENESS);
+        global_free(frozen, sizeof(*frozen), HEAPSTAT_STALENESS);
+    }
+}
+
+/* Snapshots already taken keep the old copy: we just drop ours */
+static void
+stale_cstack_changed(stale_per_cstack_t *spc)
+{
+    if (spc->frozen != NULL) {
+        stale_frozen_release(spc->frozen);
+        spc->frozen = NULL;
+    }
+}
+
+static void
+stale_cstack_free(void *p)
+{
+    stale_per_cstack_t *spc = (stale_per_cstack_t *) p;
+    ASSERT(spc->buckets == NULL, "live mallocs remain at staleness exit");
+    stale_cstack_changed(spc);
+    global_free(spc, sizeof(*spc), HEAPSTAT_STALENESS);
+}
+
+void
+staleness_init(void)
+{
+    ASSERT(options.staleness, "should not get here");
+    hashtable_init_ex(&stale_cstack_table, STALE_CSTACK_TABLE_HASH_BITS, HASH_INTPTR,
+                      false/*!str_dup*/, false/*!synch: covered by malloc lock*/,
+                      stale_cstack_free, NULL, NULL);
+}
+
+void
+staleness_exit(void)
+{
+    ASSERT(options.staleness, "should not get here");
+    hashtable_delete(&stale_cstack_table);
+}
+
+/* Adds spa, which is in no bucket, to spc's bucket for stamp.
+ * The buckets are kept sorted newest first with one per stamp.  The stamp
+ * normally only grows, so we stop at the head, but it starts over after a
+ * fork, so older buckets can be newer than the current stamp.
+ */
+static void
+stale_bucket_add(stale_per_cstack_t *spc, stale_per_alloc_t *spa, uint64 stamp)
+{
+    stale_bucket_t *b, *prev = NULL;
+    ASSERT(spa->bucket == NULL, "alloc already in a bucket");
+    for (b = spc->buckets; b != NULL && b->last_access > stamp; b = b->next)
+        prev = b;
+    if (b == NULL || b->last_access != stamp) {
+        stale_bucket_t *next = b;
+        b = (stale_bucket_t *) global_alloc(sizeof(*b), HEAPSTAT_STALENESS);
+        b->last_access = stamp;
+        b->bytes_asked_for = 0;
+        b->num_allocs = 0;
+        b->owner = spc;
+        b->prev = prev;
+        b->next = next;
+        if (next != NULL)
+            next->prev = b;
+        if (prev != NULL)
+            prev->next = b;
+        else
+            spc->buckets = b;
+        spc->num_buckets++;
+        if (spc->num_buckets == 1) {
+            spc->prev_active = NULL;
+            spc->next_active = stale_active;
+            if (stale_active != NULL)
+                stale_active->prev_active = spc;
+            stale_active = spc;
+            num_active_cstacks++;
+        }
+    }
+    b->bytes_asked_for += spa->bytes_asked_for;
+    b->num_allocs++;
+    spa->bucket = b;
+    stale_cstack_changed(spc);
+}
+
+static void
+stale_bucket_remove(stale_per_alloc_t *spa)
+{
+    stale_bucket_t *b = spa->bucket;
+    stale_per_cstack_t *spc = b->owner;
+    ASSERT(b->num_allocs > 0 && b->bytes_asked_for >= spa->bytes_asked_for,
+           "staleness bucket inconsistent");
+    b->bytes_asked_for -= spa->bytes_asked_for;
+    b->num_allocs--;
+    spa->bucket = NULL;
+    if (b->num_allocs == 0) {
+        if (b->prev != NULL)
+            b->prev->next = b->next;
+        else
+            spc->buckets = b->next;
+        if (b->next != NULL)
+            b->next->prev = b->prev;
+        global_free(b, sizeof(*b), HEAPSTAT_STALENESS);
+        spc->num_buckets--;
+        if (spc->num_buckets == 0) {
+            if (spc->prev_active != NULL)
+                spc->prev_active->next_active = spc->next_active;
+            else
+                stale_active = spc->next_active;
+            if (spc->next_active != NULL)
+                spc->next_active->prev_active = spc->prev_active;
+            num_active_cstacks--;
+        }
+    }
+    stale_cstack_changed(spc);
+}
+
 /* We assume a lock is held by caller */
 stale_per_alloc_t *
-staleness_create_per_alloc(per_callstack_t *cstack, uint64 stamp)
+staleness_create_per_alloc(per_callstack_t *cstack, size_t bytes_asked_for,
+                           uint64 stamp)
 {
     stale_per_alloc_t *spa = (stale_per_alloc_t *)
         global_alloc(sizeof(*spa), HEAPSTAT_STALENESS);
+    stale_per_cstack_t *spc = (stale_per_cstack_t *)
+        hashtable_lookup(&stale_cstack_table, (void *)cstack);
+    if (spc == NULL) {
+        spc = (stale_per_cstack_t *) global_alloc(sizeof(*spc), HEAPSTAT_STALENESS);
+        memset(spc, 0, sizeof(*spc));
+        spc->cstack = cstack;
+        hashtable_add(&stale_cstack_table, (void *)cstack, (void *)spc);
+    }
+    spa->cstack = cstack;
+    spa->bucket = NULL;
+    spa->bytes_asked_for = bytes_asked_for;
     /* we mark as "last accessed" with the timestamp of the alloc, which
      * is the most straightforward technique.
      *
@@ -395,9 +556,7 @@ staleness_create_per_alloc(per_callstack_t *cstack, uint64 stamp)
      * identify memory not used since allocated even when not much
      * time has gone by.
      */
-    spa->last_access = stamp;
-    spa->cstack = cstack;
-    num_live_mallocs++;
+    stale_bucket_add(spc, spa, stamp);
     return spa;
 }
 
@@ -405,8 +564,19 @@ staleness_create_per_alloc(per_callstack_t *cstack, uint64 stamp)
 void
 staleness_free_per_alloc(stale_per_alloc_t *spa)
 {
+    stale_bucket_remove(spa);
     global_free(spa, sizeof(*spa), HEAPSTAT_STALENESS);
-    num_live_mallocs--;
+}
+
+/* For an in-place realloc.  We assume a lock is held by caller. */
+void
+staleness_resize_per_alloc(stale_per_alloc_t *spa, size_t bytes_asked_for)
+{
+    stale_bucket_t *b = spa->bucket;
+    ASSERT(b->bytes_asked_for >= spa->bytes_asked_for, "staleness bucket inconsistent");
+    b->bytes_asked_for = b->bytes_asked_for - spa->bytes_asked_for + bytes_asked_for;
+    spa->bytes_asked_for = bytes_asked_for;
+    stale_cstack_changed(b->owner);
 }
 
 /* The basic algorithm is to have each read/write set the shadow metadata,
@@ -423,7 +593,11 @@ alloc_itercb_sweep(malloc_info_t *info, void *iter_data)
         stale_per_alloc_t *spa = (stale_per_alloc_t *) info->client_data;
         uint64 stamp = *((uint64 *)iter_data);
         LOG(3, "\t"PFX"-"PFX" was accessed @%"INT64_FORMAT"u\\n", info->base, end, stamp);
-        spa->last_access = stamp;
+        if (spa->bucket->last_access != stamp) {
+            stale_per_cstack_t *spc = spa->bucket->owner;
+            stale_bucket_remove(spa);
+            stale_bucket_add(spc, spa, stamp);
+        }
         shadow_set_range(info->base, end, 0);
     }
     return true;
@@ -445,98 +619,64 @@ staleness_sweep(uint64 stamp)
     global_free(iter_data, sizeof(*iter_data), HEAPSTAT_STALENESS);
 }
 
-/* Accessors for compressed per-snapshot data */
+/* Accessors for per-snapshot data */
+uint
+staleness_get_snap_num_cstacks(stale_snap_allocs_t *snaps)
+{
+    return snaps->num_cstacks;
+}
+
 uint
 staleness_get_snap_cstack_id(stale_snap_allocs_t *snaps, uint idx)
 {
-    ASSERT(idx < snaps->num_entries, "idx out of range");
-    if (snaps->uses_large)
-        return snaps->data.lg[idx].cstack_id;
-    if (snaps->data.sm.main[idx].uses_ext)
-        return snaps->data.sm.ext[snaps->data.sm.main[idx].u.ext_idx].cstack_id;
-    else
-        return snaps->data.sm.main[idx].u.val.cstack_id;
+    ASSERT(idx < snaps->num_cstacks, "idx out of range");
+    return snaps->cstacks[idx]->cstack_id;
 }
 
 uint
-staleness_get_snap_bytes(stale_snap_allocs_t *snaps, uint idx)
+staleness_get_snap_num_entries(stale_snap_allocs_t *snaps, uint idx)
 {
-    ASSERT(idx < snaps->num_entries, "idx out of range");
-    if (snaps->uses_large)
-        return snaps->data.lg[idx].bytes_asked_for;
-    if (snaps->data.sm.main[idx].uses_ext)
-        return snaps->data.sm.ext[snaps->data.sm.main[idx].u.ext_idx].bytes_asked_for;
-    else
-        return snaps->data.sm.main[idx].u.val.bytes_asked_for;
+    ASSERT(idx < snaps->num_cstacks, "idx out of range");
+    return snaps->cstacks[idx]->num_entries;
 }
 
 uint64
-staleness_get_snap_last_access(stale_snap_allocs_t *snaps, uint idx)
+staleness_get_snap_bytes(stale_snap_allocs_t *snaps, uint idx, uint entry)
 {
-    ASSERT(idx < snaps->num_entries, "idx out of range");
-    if (snaps->uses_large)
-        return snaps->data.lg[idx].last_access;
-    else
-        return snaps->data.sm.main[idx].last_access;
+    ASSERT(idx < snaps->num_cstacks, "idx out of range");
+    ASSERT(entry < snaps->cstacks[idx]->num_entries, "entry out of range");
+    return snaps->cstacks[idx]->entries[entry].bytes_asked_for;
 }
 
-static bool
-alloc_itercb_snapshot(malloc_info_t *info, void *iter_data)
-{
-    stale_snap_allocs_t *snaps = (stale_snap_allocs_t *) iter_data;
-    stale_per_alloc_t *spa = (stale_per_alloc_t *) info->client_data;
-    uint cstack_id;
-    uint bytes_asked_for;
-    ASSERT(snaps != NULL, "invalid param");
-    ASSERT(spa != NULL, "invalid param");
-    /* FIXME: ignore pre_us? option-controlled? */
-    cstack_id = get_cstack_id(spa->cstack);
-    bytes_asked_for = info->request_size;
-    ASSERT(snaps->idx < snaps->num_entries, "stale array overflow");
-    if (snaps->uses_large) {
-        snaps->data.lg[snaps->idx].cstack_id = cstack_id;
-        snaps->data.lg[snaps->idx].bytes_asked_for = bytes_asked_for;
-        snaps->data.lg[snaps->idx].last_access = spa->last_access;
-    } else {
-        ASSERT(spa->last_access <= STALE_SMALL_MAX_STAMP, "stale stamp overflow");
-        snaps->data.sm.main[snaps->idx].last_access = spa->last_access;
-        if (cstack_id <= STALE_SMALL_MAX_ID &&
-            bytes_asked_for <= STALE_SMALL_MAX_SZ) {
-            snaps->data.sm.main[snaps->idx].uses_ext = false;
-            snaps->data.sm.main[snaps->idx].u.val.cstack_id = cstack_id;
-            snaps->data.sm.main[snaps->idx].u.val.bytes_asked_for = bytes_asked_for;
-        } else {
-            STATS_INC(stale_small_needs_ext);
-            snaps->data.sm.main[snaps->idx].uses_ext = true;
-            if (snaps->data.sm.ext_entries >= snaps->data.sm.ext_capacity) {
-                stale_snap_alloc_ext_t *newext;
-                uint old_cap = snaps->data.sm.ext_capacity;
-                if (snaps->data.sm.ext_capacity == 0)
-                    snaps->data.sm.ext_capacity = STALE_SMALL_EXT_INITIAL_CAPACITY;
-                else
-                    snaps->data.sm.ext_capacity *= 2;
-                newext = (stale_snap_alloc_ext_t *)
-                    global_alloc(snaps->data.sm.ext_capacity*sizeof(*newext),
-                                 HEAPSTAT_STALENESS);
-                if (snaps->data.sm.ext != NULL) {
-                    memcpy(newext, snaps->data.sm.ext,
-                           snaps->data.sm.ext_entries*sizeof(*newext));
-                    global_free(snaps->data.sm.ext, old_cap*sizeof(*newext),
-                                HEAPSTAT_STALENESS);
-                }
-                snaps->data.sm.ext = newext;
-            }
-            snaps->data.sm.ext[snaps->data.sm.ext_entries].cstack_id = cstack_id;
-            snaps->data.sm.ext[snaps->data.sm.ext_entries].bytes_asked_for =
-                bytes_asked_for;
-            snaps->data.sm.main[snaps->idx].u.ext_idx = snaps->data.sm.ext_entries;
-            snaps->data.sm.ext_entries++;
-        }
+uint64
+staleness_get_snap_last_access(stale_snap_allocs_t *snaps, uint idx, uint entry)
+{
+    ASSERT(idx < snaps->num_cstacks, "idx out of range");
+    ASSERT(entry < snaps->cstacks[idx]->num_entries, "entry out of range");
+    return snaps->cstacks[idx]->entries[entry].last_access;
+}
+
+static stale_snap_cstack_t *
+stale_cstack_freeze(stale_per_cstack_t *spc)
+{
+    stale_snap_cstack_t *frozen = (stale_snap_cstack_t *)
+        global_alloc(sizeof(*frozen), HEAPSTAT_STALENESS);
+    stale_bucket_t *b;
+    uint i = 0;
+    ASSERT(spc->num_buckets > 0, "only active callstacks are frozen");
+    frozen->cstack_id = get_cstack_id(spc->cstack);
+    frozen->refcount = 1; /* for spc->frozen */
+    frozen->num_entries = spc->num_buckets;
+    frozen->entries = (stale_snap_entry_t *)
+        global_alloc(frozen->num_entries*sizeof(*frozen->entries), HEAPSTAT_STALENESS);
+    for (b = spc->buckets; b != NULL; b = b->next) {
+        ASSERT(i < frozen->num_entries, "bucket count mismatch");
+        frozen->entries[i].bytes_asked_for = b->bytes_asked_for;
+        frozen->entries[i].last_access = b->last_access;
+        i++;
     }
-    LOG(3, "\tadding "PFX"-"PFX" stamp %"INT64_FORMAT"u to snapshot idx %d\n",
-        info->base, info->base + info->request_size, spa->last_access, snaps->idx);
-    snaps->idx++;
-    return true;
+    ASSERT(i == frozen->num_entries, "bucket count mismatch");
+    return frozen;
 }
 
 /* The malloc lock must be held by the caller */
@@ -545,63 +685,50 @@ staleness_take_snapshot(uint64 cur_stamp)
 {
     stale_snap_allocs_t *snaps = (stale_snap_allocs_t *)
         global_alloc(sizeof(*snaps), HEAPSTAT_STALENESS);
-    snaps->num_entries = num_live_mallocs;
-    snaps->idx = 0;
-    snaps->uses_large = (cur_stamp > STALE_SMALL_MAX_STAMP);
-    if (snaps->uses_large) {
-        /* FIXME: this path was tested by forcing uses_large to be true but
-         * has not been tested w/ a really long running app
-         */
-        STATS_INC(stale_needs_large);
-        if (snaps->num_entries == 0) {
-            snaps->data.lg = NULL;
-        } else {
-            snaps->data.lg = (stale_snap_alloc_large_t *)
-                global_alloc(snaps->num_entries*sizeof(*snaps->data.lg),
-                             HEAPSTAT_STALENESS);
-        }
+    stale_per_cstack_t *spc;
+    uint i = 0;
+    ASSERT(options.staleness, "should not get here");
+    LOG(2, "\nSTALENESS SNAPSHOT @%"INT64_FORMAT"u: %u callstacks\n",
+        cur_stamp, num_active_cstacks);
+    snaps->num_cstacks = num_active_cstacks;
+    if (snaps->num_cstacks == 0) {
+        snaps->cstacks = NULL;
     } else {
-        if (snaps->num_entries == 0) {
-            snaps->data.sm.main = NULL;
-        } else {
-            snaps->data.sm.main = (stale_snap_alloc_small_t *)
-                global_alloc(snaps->num_entries*sizeof(*snaps->data.sm.main),
-                             HEAPSTAT_STALENESS);
-        }
-        snaps->data.sm.ext = NULL;
-        snaps->data.sm.ext_entries = 0;
-        snaps->data.sm.ext_capacity = 0;
+        snaps->cstacks = (stale_snap_cstack_t **)
+            global_alloc(snaps->num_cstacks*sizeof(*snaps->cstacks),
+                         HEAPSTAT_STALENESS);
     }
-    ASSERT(options.staleness, "should not get here");
-    /* These two could be done at init time but there is no staleness_init() */
-    ASSERT(sizeof(stale_snap_alloc_small_t) == 8, "struct size changed");
-    ASSERT(STALE_SMALL_BITS_ID + STALE_SMALL_BITS_SZ == 32, "bitfields inconsistent");
-    LOG(2, "\nSTALENESS SNAPSHOT\n");
-    if (snaps->num_entries > 0)
-        malloc_iterate(alloc_itercb_snapshot, (void *) snaps);
-    ASSERT(snaps->idx == snaps->num_entries, "mismatch in # mallocs");
+    /* Only callstacks whose histograms changed since the last snapshot need
+     * to be copied: the rest share the copy that snapshot took.
+     */
+    for (spc = stale_active; spc != NULL; spc = spc->next_active) {
+        if (spc->frozen == NULL) {
+            STATS_INC(stale_cstacks_frozen);
+            spc->frozen = stale_cstack_freeze(spc);
+        } else
+            STATS_INC(stale_cstacks_shared);
+        ASSERT(i < snaps->num_cstacks, "active callstack count mismatch");
+        spc->frozen->refcount++;
+        snaps->cstacks[i++] = spc->frozen;
+    }
+    ASSERT(i == snaps->num_cstacks, "active callstack count mismatch");
     return snaps;
 }
 
+/* The malloc lock must be held by the caller, as the copies we release
+ * can be shared with the live histograms.
+ */
 void
 staleness_free_snapshot(stale_snap_allocs_t *snaps)
 {
+    uint i;
     if (snaps == NULL)
         return;
-    if (snaps->num_entries > 0) {
-        if (snaps->uses_large) {
-            global_free(snaps->data.lg, snaps->num_entries*sizeof(*snaps->data.lg),
-                        HEAPSTAT_STALENESS);
-        } else {
-            global_free(snaps->data.sm.main,
-                        snaps->num_entries*sizeof(*snaps->data.sm.main),
-                        HEAPSTAT_STALENESS);
-            if (snaps->data.sm.ext != NULL) {
-                global_free(snaps->data.sm.ext, snaps->data.sm.ext_capacity*
-                            sizeof(*snaps->data.sm.ext), HEAPSTAT_STALENESS);
-            }
-        }
+    for (i = 0; i < snaps->num_cstacks; i++)
+        stale_frozen_release(snaps->cstacks[i]);
+    if (snaps->cstacks != NULL) {
+        global_free(snaps->cstacks, snaps->num_cstacks*sizeof(*snaps->cstacks),
+                    HEAPSTAT_STALENESS);
     }
     global_free(snaps, sizeof(*snaps), HEAPSTAT_STALENESS);
 }
-
@@ -454,10 +454,15 @@ dhvis_tool_t::read_log_data(void)
     QDir dr_log_dir(log_dir_loc);
     if (!dr_check_dir(dr_log_dir))
         return;
-    /* Find log files */
+    /* Find log files.  With -binary_snapshots the snapshot and staleness
+     * data are in .bin files instead.
+     */
+    bool binary = dr_log_dir.exists("snapshot.bin");
     QFile callstack_log(dr_log_dir.absoluteFilePath("callstack.log"));
-    QFile snapshot_log(dr_log_dir.absoluteFilePath("snapshot.log"));
-    QFile staleness_log(dr_log_dir.absoluteFilePath("staleness.log"));
+    QFile snapshot_log(dr_log_dir.absoluteFilePath(binary ? "snapshot.bin" :
+                                                   "snapshot.log"));
+    QFile staleness_log(dr_log_dir.absoluteFilePath(binary ? "staleness.bin" :
+                                                    "staleness.log"));
     if (!dr_check_file(callstack_log) ||
         !dr_check_file(snapshot_log) ||
         !dr_check_file(staleness_log))
@@ -470,8 +475,13 @@ dhvis_tool_t::read_log_data(void)
     delete_data();
 
     read_callstack_log(callstack_log);
-    read_snapshot_log(snapshot_log);
-    read_staleness_log(staleness_log);
+    if (binary) {
+        read_snapshot_bin(snapshot_log);
+        read_staleness_bin(staleness_log);
+    } else {
+        read_snapshot_log(snapshot_log);
+        read_staleness_log(staleness_log);
+    }
 
     /* Sort all of the information properly */
     sort_log_data();
@@ -762,6 +772,242 @@ dhvis_tool_t::read_staleness_log(QFile &staleness_log)
     qDebug() << "INFO: staleness.log read";
 }
 
+/* Static
+ * Helpers for the -binary_snapshots format, which is described in
+ * drheapstat.c.  Values are unsigned LEB128 varints, and deltas are
+ * zigzag-encoded.
+ */
+static bool
+read_file_varint(QFile &file, quint64 *val)
+{
+    char c;
+    int shift = 0;
+    *val = 0;
+    do {
+        if (!file.getChar(&c) || shift > 63)
+            return false;
+        *val |= (quint64)(c & 0x7f) << shift;
+        shift += 7;
+    } while ((c & 0x80) != 0);
+    return true;
+}
+
+/* Sets *pos past the end of buf if the varint is truncated, which callers
+ * check once per frame.
+ */
+static quint64
+get_varint(const QByteArray &buf, int *pos)
+{
+    quint64 val = 0;
+    int shift = 0;
+    char c;
+    do {
+        if (*pos >= buf.size() || shift > 63) {
+            *pos = buf.size() + 1;
+            return 0;
+        }
+        c = buf.at((*pos)++);
+        val |= (quint64)(c & 0x7f) << shift;
+        shift += 7;
+    } while ((c & 0x80) != 0);
+    return val;
+}
+
+static qint64
+get_zigzag(const QByteArray &buf, int *pos)
+{
+    quint64 val = get_varint(buf, pos);
+    return (qint64)(val >> 1) ^ -(qint64)(val & 1);
+}
+
+/* Checks the magic and version and returns the first word of the unit name,
+ * which is what the text logs' readers use.
+ */
+static bool
+read_binary_header(QFile &file, const char *magic, QString *unit)
+{
+    quint64 version, len;
+    if (file.read(8) != QByteArray(magic) ||
+        !read_file_varint(file, &version) || version != 1 ||
+        !read_file_varint(file, &len))
+        return false;
+    QByteArray name = file.read(len);
+    if ((quint64)name.size() != len)
+        return false;
+    *unit = QString::fromLatin1(name).section(' ', 0, 0);
+    return true;
+}
+
+/* Reads the payload of the next snapshot frame, skipping nudge frames.
+ * Returns false at the end of the log.
+ */
+static bool
+read_binary_frame(QFile &file, QByteArray *frame)
+{
+    char tag;
+    quint64 val;
+    while (file.getChar(&tag)) {
+        if (tag == 'E')
+            return false;
+        if (!read_file_varint(file, &val))
+            break;
+        if (tag == 'N')
+            continue;
+        if (tag != 'S')
+            break;
+        *frame = file.read(val);
+        if ((quint64)frame->size() != val)
+            break;
+        return true;
+    }
+    if (!file.atEnd())
+        qDebug() << "Malformed binary log: " << file.fileName();
+    return false;
+}
+
+/* Private
+ * Processes snapshot.bin
+ */
+void
+dhvis_tool_t::read_snapshot_bin(QFile &snapshot_bin)
+{
+    /* Clear current snapshot data */
+    snapshots.clear();
+    if (snapshot_bin.open(QFile::ReadOnly)) {
+        dhvis_snapshot_listing_t *peak_snapshot = NULL;
+        QByteArray frame;
+        quint64 counter = 0;
+        if (!read_binary_header(snapshot_bin, "DHSNAPSH", &time_unit)) {
+            qDebug() << "Malformed binary snapshot header";
+            snapshot_bin.close();
+            return;
+        }
+        while (read_binary_frame(snapshot_bin, &frame)) {
+            int pos = 0;
+            dhvis_snapshot_listing_t *this_snapshot;
+            this_snapshot = new dhvis_snapshot_listing_t;
+            this_snapshot->snapshot_num = counter;
+            get_varint(frame, &pos); /* snapshot number */
+            get_zigzag(frame, &pos); /* idx */
+            this_snapshot->num_time = get_varint(frame, &pos);
+            get_varint(frame, &pos); /* stamp_offs */
+            this_snapshot->tot_mallocs = get_varint(frame, &pos);
+            this_snapshot->tot_bytes_asked_for = get_varint(frame, &pos);
+            this_snapshot->tot_bytes_usable = get_varint(frame, &pos);
+            this_snapshot->tot_bytes_occupied = get_varint(frame, &pos);
+            this_snapshot->is_peak = false;
+            quint64 num_records = get_varint(frame, &pos);
+            quint64 callstack_id = 0;
+            bool malformed = (pos > frame.size());
+            for (quint64 i = 0; i < num_records && !malformed; i++) {
+                callstack_id += get_zigzag(frame, &pos);
+                quint64 instances = get_varint(frame, &pos);
+                quint64 bytes_asked_for = get_varint(frame, &pos);
+                quint64 extra_usable = get_varint(frame, &pos);
+                quint64 extra_occupied = get_varint(frame, &pos);
+                /* Callstack ids start at 1 while the array index starts at 0 */
+                if (pos > frame.size() || callstack_id < 1 ||
+                    callstack_id > (quint64)callstacks.size()) {
+                    malformed = true;
+                    break;
+                }
+                dhvis_callstack_listing_t *this_callstack;
+                this_callstack = callstacks.at(callstack_id - 1);
+                this_callstack->instances = instances;
+                this_callstack->bytes_asked_for = bytes_asked_for;
+                this_callstack->extra_usable = extra_usable
+                                             + this_callstack->bytes_asked_for;
+                this_callstack->extra_occupied = extra_occupied
+                                               + this_callstack->extra_usable;
+                /* Same order as read_snapshot_log() */
+                this_snapshot->assoc_callstacks.prepend(this_callstack);
+            }
+            if (malformed) {
+                /* Reject the whole file rather than show part of it */
+                qDebug() << "Malformed binary snapshot " << counter;
+                delete this_snapshot;
+                while (snapshots.count() > 0) {
+                    dhvis_snapshot_listing_t *tmp = snapshots.back();
+                    snapshots.pop_back();
+                    delete tmp;
+                }
+                peak_snapshot = NULL;
+                break;
+            }
+            if (peak_snapshot == NULL ||
+                this_snapshot->tot_bytes_occupied > peak_snapshot->tot_bytes_occupied)
+                peak_snapshot = this_snapshot;
+            snapshots.append(this_snapshot);
+            counter++;
+        }
+        snapshot_bin.close();
+        if (peak_snapshot != NULL)
+            peak_snapshot->is_peak = true;
+    }
+    qDebug() << "INFO: snapshot.bin read";
+}
+
+/* Private
+ * Processes staleness.bin
+ */
+void
+dhvis_tool_t::read_staleness_bin(QFile &staleness_bin)
+{
+    if (staleness_bin.open(QFile::ReadOnly)) {
+        QByteArray frame;
+        QString unit;
+        quint64 counter = 0;
+        if (!read_binary_header(staleness_bin, "DHSTALES", &unit)) {
+            qDebug() << "Malformed binary staleness header";
+            staleness_bin.close();
+            return;
+        }
+        while (counter < (quint64)snapshots.size() &&
+               read_binary_frame(staleness_bin, &frame)) {
+            int pos = 0;
+            get_varint(frame, &pos); /* snapshot number */
+            quint64 last_access = get_varint(frame, &pos);
+            quint64 num_records = get_varint(frame, &pos);
+            quint64 callstack_id = 0;
+            bool malformed = (pos > frame.size());
+            for (quint64 i = 0; i < num_records && !malformed; i++) {
+                callstack_id += get_zigzag(frame, &pos);
+                quint64 num_bytes = get_varint(frame, &pos);
+                last_access += get_zigzag(frame, &pos);
+                /* Callstack ids start at 1 while the array index starts at 0 */
+                if (pos > frame.size() || callstack_id < 1 ||
+                    callstack_id > (quint64)callstacks.size()) {
+                    malformed = true;
+                    break;
+                }
+                dhvis_callstack_listing_t *this_callstack;
+                this_callstack = callstacks.at(callstack_id - 1);
+                /* Add to snapshot's vector */
+                if (!snapshots[counter]->stale_callstacks
+                                       .contains(this_callstack)) {
+                    snapshots[counter]->stale_callstacks
+                                      .append(this_callstack);
+                }
+                /* Map with snapshot_num as key */
+                stale_pair_t tmp_pair(num_bytes, last_access);
+                this_callstack->staleness_info[counter].append(tmp_pair);
+            }
+            if (malformed) {
+                /* Reject the whole file rather than show part of it */
+                qDebug() << "Malformed binary staleness " << counter;
+                foreach (dhvis_snapshot_listing_t *s, snapshots)
+                    s->stale_callstacks.clear();
+                foreach (dhvis_callstack_listing_t *c, callstacks)
+                    c->staleness_info.clear();
+                break;
+            }
+            counter++;
+        }
+        staleness_bin.close();
+    }
+    qDebug() << "INFO: staleness.bin read";
+}
+
 /* Private
  * Sorts the log data properly
  */
@@ -125,6 +125,10 @@ private:
 
     void read_staleness_log(QFile &staleness_log);
 
+    void read_snapshot_bin(QFile &snapshot_bin);
+
+    void read_staleness_bin(QFile &staleness_bin);
+
     void sort_log_data(void);
 
     void sort_stale_data(void);
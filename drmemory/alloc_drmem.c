@@ -97,13 +97,13 @@ static bool process_exiting;
  * DELAYED-FREE LIST
  */
 
-/* A FIFO implemented by an array since we have a fixed size equal
- * to options.delay_frees.
+/* A FIFO implemented by an array since we have a fixed size derived
+ * from options.delay_frees.
  * We store the address that should be passed to free() (i.e., it
  * includes the redzone).
  */
 typedef struct _delay_free_t {
-    app_pc addr; /* includes redzone */
+    app_pc addr; /* includes redzone; NULL once freed out of FIFO order */
 #ifdef WINDOWS
     /* We assume the only flag even at Rtl level is HEAP_NO_SERIALIZE so we only have
      * to record the Heap (xref PR 502150).
@@ -113,37 +113,63 @@ typedef struct _delay_free_t {
 #endif
     size_t real_size; /* includes redzones */
     bool has_redzone;
+    uint seq; /* order of this free among all of the routine's shards */
     packed_callstack_t *pcs; /* i#205 for reporting where freed */
 } delay_free_t;
 
-/* We need a separate free queue per malloc routine (PR 476805) */
-typedef struct _delay_free_info_t {
+/* To avoid serializing all frees behind one lock, the delayed frees are
+ * split into shards, each with its own lock and interval tree.  A thread
+ * always inserts into the same shard, selected by its thread id.  We do not
+ * use per-thread queues as those could strand frees in idle threads.
+ * Each shard's FIFO holds -delay_frees / shards entries and is only
+ * allocated once its shard is used.  The -delay_frees_maxsz limit applies to
+ * all of a routine's shards together: each free is stamped with a sequence
+ * number, and a free that takes the total over the limit evicts the oldest
+ * large enough entry across the shards.  A thread never holds two shard
+ * locks at once.
+ */
+#define DELAY_FREE_MAX_SHARDS 8
+
+typedef struct _delay_free_queue_t {
+    /* FIFO array of delay_free_max entries, allocated on first use */
     delay_free_t *delay_free_list;
-    /* Head of FIFO array */
+    /* Capacity of this FIFO array */
+    int delay_free_max;
+    /* Head of FIFO array: the oldest entry, which is never an emptied slot */
     int delay_free_head;
-    /* If FIFO is full, equals options.delay_frees; else, equals
-     * one past the furthest index that has been filled.
-     */
+    /* Number of slots in use starting at the head, including emptied slots */
     int delay_free_fill;
-    /* We have a max delayed free bytes to avoid running out of memory by
-     * delaying one or two giant frees
+} delay_free_queue_t;
+
+/* We need a separate free queue per malloc routine (PR 476805) */
+typedef struct _delay_free_info_t {
+    /* Indexed by shard, protected by that shard's lock */
+    delay_free_queue_t queue[DELAY_FREE_MAX_SHARDS];
+    /* Source of delay_free_t.seq, only updated atomically */
+    volatile int delay_free_seq;
+    /* Total size of the live entries across all shards, only updated
+     * atomically.  This is a uint like -delay_frees_maxsz.
      */
-    size_t delay_free_bytes;
+    volatile int delay_free_bytes;
 } delay_free_info_t;
 
-/* We could do per-thread free lists but could strand frees in idle threads;
- * plus, already impacting performance plenty so global synch ok.
- * We could do per-malloc-routine lock as well: but we stick w/ global
- * for simplicity so we can use for delay_free_tree as well.
- */
-static void *delay_free_lock;
+typedef struct _delay_free_shard_t {
+    void *lock;
+    /* Interval tree for looking up whether an address is on the list (PR 535568).
+     * Shared across all the queues for this shard since should be no overlap.
+     */
+    rb_tree_t *tree;
+} delay_free_shard_t;
 
-/* Interval tree for looking up whether an address is on the list (PR 535568).
- * Shared across all the queues since should be no overlap.
- */
-static rb_tree_t *delay_free_tree;
+static delay_free_shard_t delay_free_shards[DELAY_FREE_MAX_SHARDS];
+static uint num_delay_free_shards;
 
-#define DELAY_FREE_FULL(info) (info->delay_free_fill == options.delay_frees)
+#define DELAY_FREE_FULL(queue) ((queue)->delay_free_fill == (queue)->delay_free_max)
+/* Index of the i-th slot from the head */
+#define DELAY_FREE_SLOT(queue, i) \
+    (((queue)->delay_free_head + (i)) % (queue)->delay_free_max)
+/* Whether sequence number a was stamped before b, allowing for wraparound */
+#define DELAY_FREE_SEQ_BEFORE(a, b) ((int)((a) - (b)) < 0)
 
 #ifdef STATISTICS
 uint delayed_free_bytes; /* includes redzones */
@@ -199,6 +225,11 @@ alloc_drmem_init(void)
     alloc_ops.shared_redzones = (options.pattern == 0);
     alloc_ops.delay_frees = options.delay_frees;
     alloc_ops.delay_frees_maxsz = options.delay_frees_maxsz;
+    /* Pattern mode writes the redzones shared with neighboring chunks, which
+     * needs the heap lock held across the alloc and free notifications.
+     */
+    alloc_ops.thread_cache =
+        options.replace_malloc_thread_cache && options.pattern == 0;
 #ifdef WINDOWS
     alloc_ops.skip_msvc_importers = options.skip_msvc_importers;
 #endif
@@ -233,8 +264,12 @@ alloc_drmem_init(void)
               is_register_defined);
 
     if (options.delay_frees > 0) {
-        delay_free_lock = dr_mutex_create();
-        delay_free_tree = rb_tree_create(NULL);
+        uint i;
+        num_delay_free_shards = MIN(DELAY_FREE_MAX_SHARDS, options.delay_frees);
+        for (i = 0; i < num_delay_free_shards; i++) {
+            delay_free_shards[i].lock = dr_mutex_create();
+            delay_free_shards[i].tree = rb_tree_create(NULL);
+        }
     }
 
 #ifdef WINDOWS /* for i#689 */
@@ -256,8 +291,11 @@ alloc_drmem_exit(void)
     dr_mutex_destroy(mmap_tree_lock);
 #endif
     if (options.delay_frees > 0) {
-        rb_tree_destroy(delay_free_tree);
-        dr_mutex_destroy(delay_free_lock);
+        uint i;
+        for (i = 0; i < num_delay_free_shards; i++) {
+            rb_tree_destroy(delay_free_shards[i].tree);
+            dr_mutex_destroy(delay_free_shards[i].lock);
+        }
     }
 }
 
@@ -413,12 +451,20 @@ get_shared_callstack(packed_callstack_t *existing_data, dr_mcontext_t *mc,
      * every-alloc scheme).
      */
     packed_callstack_t *pcs;
+    packed_callstack_t *scratch = NULL;
     if (existing_data != NULL)
         pcs = (packed_callstack_t *) existing_data;
     else {
         app_loc_t loc;
         pc_to_loc(&loc, post_call);
-        packed_callstack_record(&pcs, mc, &loc, max_frames);
+        /* Most callstacks are already in the table, so we walk into per-thread
+         * scratch space and only make a heap copy for a new one.
+         */
+        scratch = packed_callstack_record_scratch(mc, &loc, max_frames);
+        if (scratch != NULL)
+            pcs = scratch;
+        else
+            packed_callstack_record(&pcs, mc, &loc, max_frames);
         /* our malloc and free callstacks use post-call as the top frame when wrapping */
         if (!options.replace_malloc)
             packed_callstack_first_frame_retaddr(pcs);
@@ -436,8 +482,13 @@ get_shared_callstack(packed_callstack_t *existing_data, dr_mcontext_t *mc,
      * remove, ensuring pcs doesn't disappear underneath us.
      */
     hashtable_lock(&alloc_stack_table);
-    pcs = packed_callstack_add_to_table(&alloc_stack_table, pcs
-                                        _IF_STATS(&alloc_stack_count));
+    if (scratch != NULL) {
+        pcs = packed_callstack_intern(&alloc_stack_table, scratch
+                                      _IF_STATS(&alloc_stack_count));
+    } else {
+        pcs = packed_callstack_add_to_table(&alloc_stack_table, pcs
+                                            _IF_STATS(&alloc_stack_count));
+    }
     LOG(4, "%s: created pcs "PFX"\n", __FUNCTION__, pcs);
     hashtable_unlock(&alloc_stack_table);
     return pcs;
@@ -666,12 +717,10 @@ client_add_malloc_routine(app_pc pc)
     if (options.delay_frees > 0) {
         delay_free_info_t *info = (delay_free_info_t *)
             global_alloc(sizeof(*info), HEAPSTAT_MISC);
-        info->delay_free_list = (delay_free_t *)
-            global_alloc(options.delay_frees * sizeof(*info->delay_free_list),
-                         HEAPSTAT_MISC);
-        info->delay_free_head = 0;
-        info->delay_free_fill = 0;
-        info->delay_free_bytes = 0;
+        uint i;
+        memset(info, 0, sizeof(*info));
+        for (i = 0; i < num_delay_free_shards; i++)
+            info->queue[i].delay_free_max = options.delay_frees / num_delay_free_shards;
         return (void *) info;
     } else {
         return NULL;
@@ -684,15 +733,22 @@ client_remove_malloc_routine(void *client_data)
     /* We assume no lock is needed on destroy */
     if (options.delay_frees > 0) {
         delay_free_info_t *info = (delay_free_info_t *) client_data;
+        uint s;
         int i;
         ASSERT(info != NULL, "invalid param");
-        for (i = 0; i < info->delay_free_fill; i++) {
-            if (info->delay_free_list[i].addr != NULL) {
-                shared_callstack_free(info->delay_free_list[i].pcs);
+        for (s = 0; s < num_delay_free_shards; s++) {
+            delay_free_queue_t *queue = &info->queue[s];
+            if (queue->delay_free_list == NULL)
+                continue;
+            for (i = 0; i < queue->delay_free_fill; i++) {
+                int idx = DELAY_FREE_SLOT(queue, i);
+                if (queue->delay_free_list[idx].addr != NULL)
+                    shared_callstack_free(queue->delay_free_list[idx].pcs);
             }
+            global_free(queue->delay_free_list,
+                        queue->delay_free_max * sizeof(*queue->delay_free_list),
+                        HEAPSTAT_MISC);
         }
-        global_free(info->delay_free_list,
-                    options.delay_frees * sizeof(*info->delay_free_list), HEAPSTAT_MISC);
         global_free(info, sizeof(*info), HEAPSTAT_MISC);
     }
 }
@@ -709,55 +765,156 @@ print_free_tree(rb_node_t *node, void *data)
 }
 #endif
 
+/* Returns the shard used by the current thread */
+static uint
+delay_free_shard_index(void)
+{
+    return (uint) dr_get_thread_id(dr_get_current_drcontext()) % num_delay_free_shards;
+}
+
+/* Returns the total size of the routine's delayed frees.  Frees in flight on
+ * other threads may or may not be included.
+ */
+static inline uint
+delay_free_total_bytes(delay_free_info_t *info)
+{
+    return (uint) info->delay_free_bytes;
+}
+
+/* Returns the slot of the oldest live entry of at least min_size bytes in
+ * queue, or -1 if there is none.  Caller must hold the shard lock.
+ */
+static int
+delay_free_oldest_fit(delay_free_queue_t *queue, size_t min_size)
+{
+    int i;
+    /* XXX: we could end up doing a linear walk on every free when
+     * searching for a large enough entry.  We can also end up always
+     * freeing immediately once the queue gets full of small objects and
+     * the app is freeing large objects.  Not ideal!
+     */
+    for (i = 0; i < queue->delay_free_fill; i++) {
+        int idx = DELAY_FREE_SLOT(queue, i);
+        if (queue->delay_free_list[idx].addr != NULL &&
+            queue->delay_free_list[idx].real_size >= min_size)
+            return idx;
+    }
+    return -1;
+}
+
 /* Retrieves the fields for the free queue entry at idx (base and
- * auxarg), adjusts the delay_free_bytes count, and removes the
- * next-to-free entry from the rbtree.  Does not change the head
- * pointer.  Caller must hold lock.
+ * auxarg), adjusts the byte total, empties the slot, and removes
+ * the entry from the shard's rbtree.  Does not change the head
+ * pointer.  Caller must hold the shard lock.
  */
 static app_pc
-next_to_free(delay_free_info_t *info, int idx _IF_WINDOWS(ptr_int_t *auxarg OUT),
-             const char *reason)
+next_to_free(delay_free_info_t *info, delay_free_shard_t *shard,
+             delay_free_queue_t *queue, int idx
+             _IF_WINDOWS(ptr_int_t *auxarg OUT), const char *reason)
 {
     app_pc pass_to_free = NULL;
-    pass_to_free = info->delay_free_list[idx].addr;
+    pass_to_free = queue->delay_free_list[idx].addr;
 #ifdef WINDOWS
     if (auxarg != NULL)
-        *auxarg = info->delay_free_list[idx].auxarg;
+        *auxarg = queue->delay_free_list[idx].auxarg;
 #endif
     if (pass_to_free != NULL) {
-        rb_node_t *node = rb_find(delay_free_tree, pass_to_free);
+        rb_node_t *node = rb_find(shard->tree, pass_to_free);
         if (node != NULL) {
             DOLOG(2, {
                 byte *start;
                 size_t size;
                 rb_node_fields(node, &start, &size, NULL);
-                LOG(2, "deleting from delay_free_tree "PFX": "PFX"-"PFX"\n",
+                LOG(2, "deleting from delay free tree "PFX": "PFX"-"PFX"\n",
                     pass_to_free, start, start + size);
             });
-            rb_delete(delay_free_tree, node);
+            rb_delete(shard->tree, node);
         } else {
-            DOLOG(1, { rb_iterate(delay_free_tree, print_free_tree, NULL); });
-            ASSERT(false, "delay_free_tree inconsistent");
+            DOLOG(1, { rb_iterate(shard->tree, print_free_tree, NULL); });
+            ASSERT(false, "delay free tree inconsistent");
         }
-        info->delay_free_bytes -= info->delay_free_list[idx].real_size;
+        ATOMIC_ADD32(info->delay_free_bytes, -(int)queue->delay_free_list[idx].real_size);
         STATS_ADD(delayed_free_bytes,
-                  -(int)info->delay_free_list[idx].real_size);
+                  -(int)queue->delay_free_list[idx].real_size);
         LOG(2, "%s: freeing "PFX"-"PFX
             IF_WINDOWS(" auxarg="PFX) "\n", reason, pass_to_free,
-            pass_to_free + info->delay_free_list[idx].real_size
+            pass_to_free + queue->delay_free_list[idx].real_size
             _IF_WINDOWS(auxarg == NULL ? 0 : *auxarg));
         if (options.pattern != 0) {
             /* pattern_handle_real_free only cares about redzone bounds */
-            malloc_info_t mal = {sizeof(info), pass_to_free,
-                                 info->delay_free_list[idx].real_size,
-                                 info->delay_free_list[idx].real_size,
+            malloc_info_t mal = {sizeof(mal), pass_to_free,
+                                 queue->delay_free_list[idx].real_size,
+                                 queue->delay_free_list[idx].real_size,
                                  false/*!pre_us*/, false/*redzone already in bounds*/,
                                  /* rest 0 */};
             pattern_handle_real_free(&mal, true /* delayed */);
         }
     }
-    shared_callstack_free(info->delay_free_list[idx].pcs);
-    info->delay_free_list[idx].pcs = NULL;
+    shared_callstack_free(queue->delay_free_list[idx].pcs);
+    queue->delay_free_list[idx].pcs = NULL;
+    queue->delay_free_list[idx].addr = NULL;
+    return pass_to_free;
+}
+
+/* Drops emptied slots from the head so that the head is the oldest live
+ * entry.  Caller must hold the shard lock.
+ */
+static void
+delay_free_trim_head(delay_free_queue_t *queue)
+{
+    while (queue->delay_free_fill > 0 &&
+           queue->delay_free_list[queue->delay_free_head].addr == NULL) {
+        queue->delay_free_head = DELAY_FREE_SLOT(queue, 1);
+        queue->delay_free_fill--;
+    }
+}
+
+/* Evicts the oldest entry of at least min_size bytes across all shards and
+ * returns its address to pass to free(), or NULL if there is none.  We take
+ * one shard lock at a time: first to find each shard's candidate and then
+ * to evict the oldest one, which another thread may have evicted in the
+ * meantime, in which case that thread has already brought the totals down.
+ * Caller must not hold any shard lock.
+ */
+static app_pc
+delay_free_evict_oldest(delay_free_info_t *info, size_t min_size
+                        _IF_WINDOWS(ptr_int_t *auxarg OUT), const char *reason)
+{
+    app_pc pass_to_free = NULL;
+    uint s, best_shard = num_delay_free_shards;
+    uint best_seq = 0;
+    int idx, best_idx = 0;
+    for (s = 0; s < num_delay_free_shards; s++) {
+        delay_free_queue_t *queue = &info->queue[s];
+        if (queue->delay_free_fill == 0)
+            continue; /* racy but just a hint */
+        dr_mutex_lock(delay_free_shards[s].lock);
+        /* Later entries in this shard are newer */
+        idx = delay_free_oldest_fit(queue, min_size);
+        if (idx >= 0 &&
+            (best_shard == num_delay_free_shards ||
+             DELAY_FREE_SEQ_BEFORE(queue->delay_free_list[idx].seq, best_seq))) {
+            best_shard = s;
+            best_seq = queue->delay_free_list[idx].seq;
+            best_idx = idx;
+        }
+        dr_mutex_unlock(delay_free_shards[s].lock);
+    }
+    if (best_shard < num_delay_free_shards) {
+        delay_free_shard_t *shard = &delay_free_shards[best_shard];
+        delay_free_queue_t *queue = &info->queue[best_shard];
+        dr_mutex_lock(shard->lock);
+        if (queue->delay_free_list[best_idx].addr != NULL &&
+            queue->delay_free_list[best_idx].seq == best_seq) {
+            LOG(2, "freeing delayed shard=%d idx=%d "PFX" w/ size=%d\n",
+                best_shard, best_idx, queue->delay_free_list[best_idx].addr,
+                queue->delay_free_list[best_idx].real_size);
+            pass_to_free = next_to_free(info, shard, queue, best_idx
+                                        _IF_WINDOWS(auxarg), reason);
+            delay_free_trim_head(queue);
+        }
+        dr_mutex_unlock(shard->lock);
+    }
     return pass_to_free;
 }
 
@@ -787,136 +944,113 @@ client_handle_free(malloc_info_t *mal, byte *tofree, dr_mcontext_t *mc,
          * simply exclude from our leak report.
          */
         delay_free_info_t *info = (delay_free_info_t *) routine_set_data;
+        uint shard_idx = delay_free_shard_index();
+        delay_free_shard_t *shard = &delay_free_shards[shard_idx];
+        delay_free_queue_t *queue;
         app_pc pass_to_free = NULL;
 #ifdef WINDOWS
         ptr_int_t pass_auxarg;
-        bool full;
 #endif
-        uint idx;
+        int idx;
         size_t rz_sz = options.redzone_size;
         byte *rz_start = mal->base - (mal->has_redzone ? rz_sz : 0);
         size_t tot_sz = mal->pad_size + (mal->has_redzone ? rz_sz*2 : 0);
         ASSERT(info != NULL, "invalid param");
         ASSERT(rz_start == tofree, "tofree should equal start of redzone");
-        dr_mutex_lock(delay_free_lock);
+        queue = &info->queue[shard_idx];
         if (tot_sz > options.delay_frees_maxsz) {
             /* we have to free this one, it's too big */
             LOG(2, "malloc size %d is larger than max delay %d so freeing immediately\n",
                 tot_sz, options.delay_frees_maxsz);
-            dr_mutex_unlock(delay_free_lock);
             if (options.pattern != 0)
                 pattern_handle_real_free(mal, false);
             return tofree;
         }
-        /* Store real base and real size: i.e., including redzones (PR 572716) */
-        info->delay_free_bytes += tot_sz;
-        if (info->delay_free_bytes > options.delay_frees_maxsz) {
-            int head_start = info->delay_free_head;
-            int idx = info->delay_free_head;
-            LOG(2, "total delayed %d larger than max delay %d\n",
-                info->delay_free_bytes, options.delay_frees_maxsz);
-            /* we can't invoke the app's free() routine safely
-             * so we look for a single free that's bigger than this one:
-             * if none, we have to free this one.
-             * XXX: either need call-app-routine support in DR (though
-             * still have potential deadlock problems since holding lock here)
-             * or switch to replacing malloc&co.
+        dr_mutex_lock(shard->lock);
+        if (queue->delay_free_list == NULL) {
+            queue->delay_free_list = (delay_free_t *)
+                global_alloc(queue->delay_free_max * sizeof(*queue->delay_free_list),
+                             HEAPSTAT_MISC);
+        }
+        if (DELAY_FREE_FULL(queue)) {
+            /* We can only pass one free on, and it must make room in our
+             * shard.  If adding this one would exceed -delay_frees_maxsz, we
+             * need our oldest entry at least as big as this one, and if there
+             * is none we free this one now instead of delaying it.
              */
-            do {
-                /* XXX: we could end up doing a linear walk on every free.
-                 * we can also end up always freeing immediately once the
-                 * queue gets full of small objects and the app is freeing large
-                 * objects.  not ideal!
-                 */
-                if (info->delay_free_list[idx].addr != NULL &&
-                    info->delay_free_list[idx].real_size >= tot_sz) {
-                    LOG(2, "freeing delayed idx=%d "PFX" w/ size=%d (head=%d, fill=%d)\n",
-                        idx, info->delay_free_list[idx].addr,
-                        info->delay_free_list[idx].real_size,
-                        info->delay_free_head, info->delay_free_fill);
-                    pass_to_free = next_to_free(info, idx _IF_WINDOWS(&pass_auxarg),
-                                                "exceeded delay_frees_maxsz");
-                    ASSERT(info->delay_free_bytes <= options.delay_frees_maxsz,
-                           "cannot happen");
-                    info->delay_free_list[idx].addr = NULL;
-                    break;
+            idx = queue->delay_free_head;
+            if ((uint64)delay_free_total_bytes(info) + tot_sz >
+                options.delay_frees_maxsz) {
+                idx = delay_free_oldest_fit(queue, tot_sz);
+                if (idx < 0) {
+                    dr_mutex_unlock(shard->lock);
+                    LOG(2, "delayed free queue full and no entry of size %d, so "
+                        "freeing immediately\n", tot_sz);
+                    if (options.pattern != 0)
+                        pattern_handle_real_free(mal, false);
+                    return tofree;
                 }
-                idx++;
-                if (idx >= info->delay_free_fill)
-                    break;
-                if (idx >= options.delay_frees)
-                    idx = 0;
-            } while (idx != head_start);
-            if (pass_to_free == NULL) {
-                LOG(2, "malloc size %d larger than any entry + over size limit\n",
-                    tot_sz);
-                info->delay_free_bytes -= tot_sz;
-                dr_mutex_unlock(delay_free_lock);
-                if (options.pattern != 0) {
-                    pattern_handle_real_free(mal, false);
-                }
-                return tofree;
             }
+            pass_to_free = next_to_free(info, shard, queue, idx
+                                        _IF_WINDOWS(&pass_auxarg),
+                                        "delayed free queue full");
+            delay_free_trim_head(queue);
         }
-
-        LOG(2, "inserting into delay_free_tree (queue idx=%d): "PFX
-            "-"PFX" %d bytes redzone=%d\n",
-            DELAY_FREE_FULL(info) ? info->delay_free_head : info->delay_free_fill,
+        ASSERT(!DELAY_FREE_FULL(queue), "internal error");
+        idx = DELAY_FREE_SLOT(queue, queue->delay_free_fill);
+        queue->delay_free_fill++;
+        LOG(2, "inserting into delay free tree (shard=%d queue idx=%d): "PFX
+            "-"PFX" %d bytes redzone=%d\n", shard_idx, idx,
             rz_start, rz_start + tot_sz, tot_sz, mal->has_redzone);
 
-        if (DELAY_FREE_FULL(info)) {
-            IF_WINDOWS(full = true;)
-            if (pass_to_free == NULL) {
-                pass_to_free = next_to_free(info, info->delay_free_head
-                                            _IF_WINDOWS(&pass_auxarg),
-                                            "delayed free queue full");
-            }
-            idx = info->delay_free_head;
-            info->delay_free_head++;
-            if (info->delay_free_head >= options.delay_frees)
-                info->delay_free_head = 0;
-        } else {
-            LOG(2, "delayed free queue not full: delaying %d-th free of "PFX"-"PFX
-                IF_WINDOWS(" auxarg="PFX) "\n",
-                info->delay_free_fill, rz_start, rz_start + tot_sz
-                _IF_WINDOWS((auxarg==NULL) ? 0:*auxarg));
-            ASSERT(info->delay_free_fill <= options.delay_frees - 1, "internal error");
-            IF_WINDOWS(full = false;)
-            idx = info->delay_free_fill;
-            info->delay_free_fill++;
-            /* Rather than try to engineer a return, we continue on w/
-             * pass_to_free as NULL which free() is guaranteed to handle
-             */
-        }
-
-        rb_insert(delay_free_tree, rz_start, tot_sz,
-                  (void *)&info->delay_free_list[idx]);
+        /* Store real base and real size: i.e., including redzones (PR 572716) */
+        rb_insert(shard->tree, rz_start, tot_sz,
+                  (void *)&queue->delay_free_list[idx]);
 
-        info->delay_free_list[idx].addr = rz_start;
+        queue->delay_free_list[idx].addr = rz_start;
 #ifdef WINDOWS
         /* should we be doing safe_read() and safe_write()? */
-        if (auxarg != NULL) {
-            info->delay_free_list[idx].auxarg = *auxarg;
-            if (full)
-                *auxarg = pass_auxarg;
-        } else {
-            info->delay_free_list[idx].auxarg = 0;
-            if (full)
-                ASSERT(pass_auxarg == 0, "whether using auxarg should be consistent");
-        }
+        queue->delay_free_list[idx].auxarg = (auxarg != NULL) ? *auxarg : 0;
 #endif
-        info->delay_free_list[idx].real_size = tot_sz;
-        info->delay_free_list[idx].has_redzone = mal->has_redzone;
+        queue->delay_free_list[idx].real_size = tot_sz;
+        queue->delay_free_list[idx].has_redzone = mal->has_redzone;
+        queue->delay_free_list[idx].seq = (uint)
+            atomic_add32_return_sum(&info->delay_free_seq, 1);
         if (options.delay_frees_stack) {
-            info->delay_free_list[idx].pcs =
+            queue->delay_free_list[idx].pcs =
                 get_shared_callstack(NULL, mc, free_routine, options.free_max_frames);
         } else
-            info->delay_free_list[idx].pcs = NULL;
+            queue->delay_free_list[idx].pcs = NULL;
+        ATOMIC_ADD32(info->delay_free_bytes, (int)tot_sz);
 
         STATS_ADD(delayed_free_bytes, (uint)tot_sz);
 
-        dr_mutex_unlock(delay_free_lock);
-        if (options.pattern != 0)
+        dr_mutex_unlock(shard->lock);
+
+        /* A full shard already applied the limit above */
+        if (pass_to_free == NULL &&
+            delay_free_total_bytes(info) > options.delay_frees_maxsz) {
+            /* We can't invoke the app's free() routine safely so we look
+             * for a single free that's at least as big as this one, which
+             * may be this one itself.
+             * XXX: either need call-app-routine support in DR (though
+             * still have potential deadlock problems since holding lock here)
+             * or switch to replacing malloc&co.
+             */
+            LOG(2, "total delayed %u larger than max delay %d\n",
+                delay_free_total_bytes(info), options.delay_frees_maxsz);
+            pass_to_free = delay_free_evict_oldest(info, tot_sz
+                                                   _IF_WINDOWS(&pass_auxarg),
+                                                   "exceeded delay_frees_maxsz");
+        }
+        /* Rather than try to engineer a return, if nothing was evicted we
+         * continue on w/ pass_to_free as NULL which free() is guaranteed to handle.
+         */
+#ifdef WINDOWS
+        if (pass_to_free != NULL && auxarg != NULL)
+            *auxarg = pass_auxarg;
+#endif
+        if (options.pattern != 0 && pass_to_free != rz_start)
             pattern_handle_delayed_free(mal);
         return pass_to_free;
     }
@@ -982,30 +1116,40 @@ client_handle_heap_destroy(void *drcontext, HANDLE heap, void *client_data)
 {
     delay_free_info_t *info = (delay_free_info_t *) client_data;
     int i, num_removed = 0;
+    uint s;
     if (options.delay_frees == 0)
         return;
     ASSERT(info != NULL, "invalid param");
-    dr_mutex_lock(delay_free_lock);
-    for (i = 0; i < info->delay_free_fill; i++) {
-        if (info->delay_free_list[i].addr != NULL &&
-            info->delay_free_list[i].auxarg == (ptr_int_t)heap) {
-            /* not worth shifting the array around: just invalidate */
-            rb_node_t *node = rb_find(delay_free_tree, info->delay_free_list[i].addr);
-            LOG(3, "removing delayed free "PFX"-"PFX" from destroyed heap "PFX"\n",
-                info->delay_free_list[i].addr,
-                info->delay_free_list[i].addr +
-                info->delay_free_list[i].real_size, heap);
-            if (node != NULL)
-                rb_delete(delay_free_tree, node);
-            else
-                ASSERT(false, "delay_free_tree inconsistent");
-            info->delay_free_list[i].addr = NULL;
-            shared_callstack_free(info->delay_free_list[i].pcs);
-            info->delay_free_list[i].pcs = NULL;
-            num_removed++;
+    for (s = 0; s < num_delay_free_shards; s++) {
+        delay_free_shard_t *shard = &delay_free_shards[s];
+        delay_free_queue_t *queue = &info->queue[s];
+        dr_mutex_lock(shard->lock);
+        for (i = 0; i < queue->delay_free_fill; i++) {
+            int idx = DELAY_FREE_SLOT(queue, i);
+            if (queue->delay_free_list[idx].addr != NULL &&
+                queue->delay_free_list[idx].auxarg == (ptr_int_t)heap) {
+                /* not worth shifting the array around: just empty the slot */
+                rb_node_t *node = rb_find(shard->tree, queue->delay_free_list[idx].addr);
+                LOG(3, "removing delayed free "PFX"-"PFX" from destroyed heap "PFX"\n",
+                    queue->delay_free_list[idx].addr,
+                    queue->delay_free_list[idx].addr +
+                    queue->delay_free_list[idx].real_size, heap);
+                if (node != NULL)
+                    rb_delete(shard->tree, node);
+                else
+                    ASSERT(false, "delay free tree inconsistent");
+                ATOMIC_ADD32(info->delay_free_bytes,
+                             -(int)queue->delay_free_list[idx].real_size);
+                queue->delay_free_list[idx].addr = NULL;
+                shared_callstack_free(queue->delay_free_list[idx].pcs);
+                queue->delay_free_list[idx].pcs = NULL;
+                num_removed++;
+            }
         }
+        if (queue->delay_free_list != NULL)
+            delay_free_trim_head(queue);
+        dr_mutex_unlock(shard->lock);
     }
-    dr_mutex_unlock(delay_free_lock);
     LOG(2, "removed %d delayed frees from destroyed heap "PFX"\n",
         num_removed, heap);
 }
@@ -1021,6 +1165,7 @@ overlaps_delayed_free(byte *start, byte *end,
     bool res = false;
     rb_node_t *node;
     malloc_info_t info;
+    uint s;
     info.struct_size = sizeof(info);
     if (options.delay_frees == 0)
         return false;
@@ -1048,36 +1193,42 @@ overlaps_delayed_free(byte *start, byte *end,
             found = false;
         return found;
     }
-    dr_mutex_lock(delay_free_lock);
     LOG(3, "overlaps_delayed_free "PFX"-"PFX"\n", start, end);
-    DOLOG(3, { rb_iterate(delay_free_tree, print_free_tree, NULL); });
-    node = rb_overlaps_node(delay_free_tree, start, end);
-    if (node != NULL) {
-        app_pc real_base;
-        size_t size;
-        delay_free_t *info;
-        size_t redsz;
-        res = true;
-        rb_node_fields(node, &real_base, &size, (void **)&info);
-        ASSERT(info != NULL, "invalid free tree info");
-        redsz = (info->has_redzone ? options.redzone_size : 0);
-        LOG(3, "\toverlap real base: "PFX", size: %d, redzone: %d\n",
-            real_base, size, redsz);
-        if (free_start != NULL)
-            *free_start = real_base + redsz;
-        /* we didn't store the requested size or padded size so we include
-         * padding in free_end
-         */
-        if (free_end != NULL)
-            *free_end = real_base + size - redsz;
-        if (pcs != NULL) {
-            if (info->pcs == NULL)
-                *pcs = NULL;
-            else
-                *pcs = packed_callstack_clone(info->pcs);
+    /* Since there should be no overlap among delayed frees, at most one shard
+     * can match, so we can take each shard's lock in turn.
+     */
+    for (s = 0; s < num_delay_free_shards && !res; s++) {
+        delay_free_shard_t *shard = &delay_free_shards[s];
+        dr_mutex_lock(shard->lock);
+        DOLOG(3, { rb_iterate(shard->tree, print_free_tree, NULL); });
+        node = rb_overlaps_node(shard->tree, start, end);
+        if (node != NULL) {
+            app_pc real_base;
+            size_t size;
+            delay_free_t *info;
+            size_t redsz;
+            res = true;
+            rb_node_fields(node, &real_base, &size, (void **)&info);
+            ASSERT(info != NULL, "invalid free tree info");
+            redsz = (info->has_redzone ? options.redzone_size : 0);
+            LOG(3, "\toverlap real base: "PFX", size: %d, redzone: %d (shard %d)\n",
+                real_base, size, redsz, s);
+            if (free_start != NULL)
+                *free_start = real_base + redsz;
+            /* we didn't store the requested size or padded size so we include
+             * padding in free_end
+             */
+            if (free_end != NULL)
+                *free_end = real_base + size - redsz;
+            if (pcs != NULL) {
+                if (info->pcs == NULL)
+                    *pcs = NULL;
+                else
+                    *pcs = packed_callstack_clone(info->pcs);
+            }
         }
+        dr_mutex_unlock(shard->lock);
     }
-    dr_mutex_unlock(delay_free_lock);
     return res;
 }
 
@@ -2473,6 +2624,16 @@ handle_removed_heap_region(app_pc start, app_pc end, dr_mcontext_t *mc)
  * LEAK CHECKING
  */
 
+void
+client_prepare_leak_reports(void **client_data, uint num)
+{
+    /* The client data is the allocation callstack.  Looking up all their
+     * symbols up front lets us go through each module's debug info once.
+     */
+    if (options.check_leaks)
+        packed_callstack_symbolize_batch((packed_callstack_t **) client_data, num);
+}
+
 void
 client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
                   bool pre_us, bool reachable,
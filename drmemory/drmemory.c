@@ -270,6 +270,7 @@ dump_statistics(void)
                num_mallocs, num_frees, num_large_mallocs);
     dr_fprintf(f_global, "unique malloc stacks: %8u\n", alloc_stack_count);
     callstack_dump_statistics(f_global);
+    report_dump_statistics(f_global);
 #ifdef USE_DRSYMS
     dr_fprintf(f_global, "symbol lookups: %6u cached %6u, searches: %6u cached %6u\n",
                symbol_lookups, symbol_lookup_cache_hits,
@@ -304,6 +305,8 @@ dump_statistics(void)
                midchunk_postsize_ptrs, midchunk_postnew_ptrs,
                midchunk_postinheritance_ptrs, midchunk_string_ptrs);
     dr_fprintf(f_global, "strings not pointers: %5u\n", strings_not_pointers);
+    dr_fprintf(f_global, "leak scan words: %9u, candidates: %8u\n",
+               leak_scan_words, leak_scan_candidates);
 #ifdef WINDOWS
     if (options.check_handle_leaks)
         handlecheck_dump_statistics(f_global);
@@ -1952,8 +1955,11 @@ dr_init(client_id_t id)
     dr_log(NULL, LOG_ALL, 1, "client = Dr. Memory version %s\n", VERSION_STRING);
 
 #ifdef USE_DRSYMS
-    if (options.use_symcache)
+    if (options.use_symcache) {
         drsymcache_init(client_id, options.symcache_dir, options.symcache_minsize);
+        if (options.symcache_preload_threads > 0)
+            drsymcache_preload(options.symcache_preload_threads);
+    }
 #endif
 
     if (!options.perturb_only)
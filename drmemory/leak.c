@@ -28,6 +28,10 @@
 #include "alloc.h"
 #include "heap.h"
 #include "redblack.h"
+#ifdef X86
+# include <emmintrin.h> /* SSE2 */
+# include <immintrin.h> /* AVX2 */
+#endif
 #ifdef TOOL_DR_MEMORY
 # include "shadow.h"
 #endif
@@ -75,6 +79,34 @@ queue_add(pc_entry_t **head, pc_entry_t **tail, pc_entry_t *add)
     }
 }
 
+/* Caches the last region looked up by is_text() or is_image() (PR 570839).
+ * The world is suspended during the scan so the page protections remain
+ * constant throughout, and each parallel scan worker has its own copy so
+ * no synchronization is needed.
+ */
+typedef struct _region_cache_t {
+    byte *start;
+    byte *end;
+    bool ans;
+} region_cache_t;
+
+struct _scan_worker_t;
+
+#ifdef STATISTICS
+/* The counters the parallel scan workers update, kept per worker so they do
+ * not contend on the globals: they are added in at the end of the scan.
+ */
+typedef struct _scan_stats_t {
+    uint midchunk_postsize_ptrs;
+    uint midchunk_postnew_ptrs;
+    uint midchunk_postinheritance_ptrs;
+    uint midchunk_string_ptrs;
+    uint strings_not_pointers;
+    uint leak_scan_words;
+    uint leak_scan_candidates;
+} scan_stats_t;
+#endif
+
 /* For passing shared data to helper routines */
 typedef struct _reachability_data_t {
     /* The primary scans find chunks whose head is reachable.
@@ -99,6 +131,16 @@ typedef struct _reachability_data_t {
     rb_tree_t *stack_tree;
     /* Lowest possible pointer value */
     byte *low_ptr;
+    /* The parallel primary scan worker that owns this data, or NULL when
+     * scanning serially
+     */
+    struct _scan_worker_t *worker;
+#ifdef STATISTICS
+    /* The worker's counters, or NULL to update the globals */
+    scan_stats_t *stats;
+#endif
+    region_cache_t text_cache;
+    region_cache_t image_cache;
 } reachability_data_t;
 
 #ifdef STATISTICS
@@ -107,11 +149,22 @@ uint midchunk_postnew_ptrs;
 uint midchunk_postinheritance_ptrs;
 uint midchunk_string_ptrs;
 uint strings_not_pointers;
+uint leak_scan_words;
+uint leak_scan_candidates;
 # ifdef WINDOWS
 uint pointers_encoded;
 uint encoded_pointers_scanned;
 # endif
+# define LEAK_STATS_ADD(data, stat, val) do { \
+    if ((data)->stats != NULL)                 \
+        (data)->stats->stat += (val);          \
+    else                                       \
+        STATS_ADD(stat, val);                  \
+} while (0)
+#else
+# define LEAK_STATS_ADD(data, stat, val) /* nothing */
 #endif
+#define LEAK_STATS_INC(data, stat) LEAK_STATS_ADD(data, stat, 1)
 
 /* FIXME PR 487993: switch to file-private sets of options and option parsing */
 static bool op_have_defined_info;
@@ -151,6 +204,9 @@ static void leak_wrap_post_encode_ptr(void *wrapcxt, void *user_data);
 static app_pc crt_encode_ptr;
 #endif
 
+static void scan_pool_init(void);
+static void scan_pool_exit(void);
+
 void
 leak_init(bool have_defined_info,
           bool check_leaks_on_destroy,
@@ -216,11 +272,15 @@ leak_init(bool have_defined_info,
     } else
         ASSERT(false, "can't find ntdll");
 #endif
+
+    pointer_filter_init();
+    scan_pool_init();
 }
 
 void
 leak_exit(void)
 {
+    scan_pool_exit();
 #ifdef WINDOWS
     if (op_check_encoded_pointers) {
         hashtable_delete_with_stats(&encoded_ptr_table, "encoded_ptr");
@@ -539,48 +599,40 @@ leak_safe_read_heap(void *base, void **var)
 
 /* Helper for PR 484544.  Do not export: assumes world is suspended! */
 static bool
-is_text(byte *ptr)
+is_text(reachability_data_t *data, byte *ptr)
 {
     dr_mem_info_t info;
-    /* PR 570839: avoid perf hit by caching.  World is suspended so no locks needed
-     * and no races, so the page protections remain constant throughout the scan.
-     */
-    static byte *last_start = NULL;
-    static byte *last_end = NULL;
-    static bool last_ans = false;
+    /* PR 570839: avoid perf hit by caching */
+    region_cache_t *cache = &data->text_cache;
     if (ptr < LOWEST_POINTER)
         return false;
-    if (ptr >= last_start && ptr < last_end)
-        return last_ans;
+    if (ptr >= cache->start && ptr < cache->end)
+        return cache->ans;
     /* FIXME i#270: DR should provide a section iterator! */
-    last_ans = (dr_query_memory_ex(ptr, &info) &&
+    cache->ans = (dr_query_memory_ex(ptr, &info) &&
                 info.type == DR_MEMTYPE_IMAGE &&
                 TESTALL(DR_MEMPROT_READ | DR_MEMPROT_EXEC, info.prot) &&
                 (!TEST(DR_MEMPROT_WRITE, info.prot) ||
                  /* i#: allow pretend-writable from hooking, etc. */
                  TEST(DR_MEMPROT_PRETEND_WRITE, info.prot)));
-    last_start = info.base_pc;
-    last_end = info.base_pc + info.size;
-    return last_ans;
+    cache->start = info.base_pc;
+    cache->end = info.base_pc + info.size;
+    return cache->ans;
 }
 
 /* Helper for PR 484544.  Do not export: assumes world is suspended! */
 static bool
-is_image(byte *ptr)
+is_image(reachability_data_t *data, byte *ptr)
 {
     dr_mem_info_t info;
-    /* PR 570839: avoid perf hit by caching.  World is suspended so no locks needed
-     * and no races, so the page protections remain constant throughout the scan.
-     */
-    static byte *last_start = NULL;
-    static byte *last_end = NULL;
-    static bool last_ans = false;
+    /* PR 570839: avoid perf hit by caching */
+    region_cache_t *cache = &data->image_cache;
     if (ptr < LOWEST_POINTER)
         return false;
-    if (ptr >= last_start && ptr < last_end) {
+    if (ptr >= cache->start && ptr < cache->end) {
         LOG(4, "is_image match "PFX": cached in "PFX"-"PFX" => %d\n",
-            ptr, last_start, last_end, last_ans);
-        return last_ans;
+            ptr, cache->start, cache->end, cache->ans);
+        return cache->ans;
     }
     /* Even w/ the caching this is too slow on spec2k gap so we use the
      * fast module check from callstack.c
@@ -588,7 +640,7 @@ is_image(byte *ptr)
     if (!is_in_module(ptr))
         return false;
     /* FIXME i#270: DR should provide a section iterator! */
-    last_ans = (dr_query_memory_ex(ptr, &info) &&
+    cache->ans = (dr_query_memory_ex(ptr, &info) &&
                 info.type == DR_MEMTYPE_IMAGE &&
                 /* Turns out many libraries are loaded w/ the read-only data
                  * sections in a writable segment!  They have an rx segment and
@@ -598,20 +650,20 @@ is_image(byte *ptr)
                  * Xref i#270: DR-provided section iterator.
                  */
                 TEST(DR_MEMPROT_READ, info.prot));
-    last_start = info.base_pc;
-    last_end = info.base_pc + info.size;
+    cache->start = info.base_pc;
+    cache->end = info.base_pc + info.size;
     LOG(4, "is_image no match "PFX", now cached "PFX"-"PFX" => %d\n",
-        ptr, last_start, last_end, last_ans);
-    return last_ans;
+        ptr, cache->start, cache->end, cache->ans);
+    return cache->ans;
 }
 
 /* Heuristic for PR 484544 */
 static bool
-is_vtable(byte *ptr)
+is_vtable(reachability_data_t *data, byte *ptr)
 {
     if (ptr < LOWEST_POINTER)
         return false;
-    if (ALIGNED(ptr, sizeof(void*)) && is_image(ptr)) {
+    if (ALIGNED(ptr, sizeof(void*)) && is_image(data, ptr)) {
         /* We have no symbols so we use heuristics: see if looks like
          * a table of ptrs to funcs.
          * We assume has at least 2 non-NULL entries (is that always true?).
@@ -645,7 +697,7 @@ is_vtable(byte *ptr)
                 LOG(4, "\t  vtable entry @"PFX": "PFX"\n", p, val);
                 if (val == NULL)
                     continue; /* keep looking */
-                else if (is_text(val)) {
+                else if (is_text(data, val)) {
                     num_found++;
                     if (num_found >= 2)
                         break;
@@ -669,7 +721,8 @@ is_vtable(byte *ptr)
  * or any redzone from Dr. Memory
  */
 static bool
-is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end)
+is_midchunk_pointer_legitimate(reachability_data_t *data, byte *pointer,
+                               byte *chunk_start, byte *chunk_end)
 {
     /* PR 484544: remove new[] from possible-leak category.  Mid-chunk
      * pointers happen legitimately for C++ arrays, since if have
@@ -688,7 +741,7 @@ is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end
                 count > 0 && count < (chunk_end - chunk_start - sizeof(size_t)) &&
                 (chunk_end - chunk_start - sizeof(size_t)) % count == 0) {
                 LOG(3, "\tmid-chunk "PFX" is post-new[]-header => ok\n", pointer);
-                STATS_INC(midchunk_postnew_ptrs);
+                LEAK_STATS_INC(data, midchunk_postnew_ptrs);
                 return true;
             }
         }
@@ -710,12 +763,12 @@ is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end
                 /* risky perhaps but v4: */ *(byte **)pointer, *(byte **)chunk_start);
             if (leak_safe_read_heap(pointer, (void **) &val1) &&
                 /* PR 570839: check for non-addresses to avoid call cost */
-                val1 > LOWEST_POINTER && is_vtable(val1)) {
+                val1 > LOWEST_POINTER && is_vtable(data, val1)) {
                 if (leak_safe_read_heap(chunk_start, (void **) &val2) &&
-                    val2 > LOWEST_POINTER && is_vtable(val2)) {
+                    val2 > LOWEST_POINTER && is_vtable(data, val2)) {
                     LOG(3, "\tmid-chunk "PFX" is multi-inheritance parent ptr => ok\n",
                         pointer);
-                    STATS_INC(midchunk_postinheritance_ptrs);
+                    LEAK_STATS_INC(data, midchunk_postinheritance_ptrs);
                     return true;
                 }
             }
@@ -741,7 +794,7 @@ is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end
                   == (chunk_end - chunk_start)))) {
                 /* could also check for no nulls in char[] until length */
                 LOG(3, "\tmid-chunk "PFX" is std::string => ok\n", pointer);
-                STATS_INC(midchunk_string_ptrs);
+                LEAK_STATS_INC(data, midchunk_string_ptrs);
                 return true;
             }
         }
@@ -775,7 +828,7 @@ is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end
                     (val == (chunk_end - chunk_start) ||
                      val == (chunk_end - chunk_start - MALLOC_CHUNK_ALIGNMENT))) {
                     LOG(3, "\tmid-chunk "PFX" is post-size => ok\n", pointer);
-                    STATS_INC(midchunk_postsize_ptrs);
+                    LEAK_STATS_INC(data, midchunk_postsize_ptrs);
                     return true;
                 }
             }
@@ -796,7 +849,8 @@ is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end
  * of many strings.  So we loook for at least 3 min-10-char strings, separated
  * by at least one null char, starting at the given address.  We need to take in
  * max_scan so we know what's guaranteed to be readable (all the threads are
- * suspended so there are no races).
+ * suspended so there are no races).  If at_stop is non-NULL, it is set to
+ * whether the verdict depended on max_scan: i.e., we reached it.
  */
 
 #define STRING_MIN_LEN   10
@@ -810,7 +864,7 @@ is_midchunk_pointer_legitimate(byte *pointer, byte *chunk_start, byte *chunk_end
 
 #ifdef WINDOWS
 static bool
-is_part_of_string_wide(wchar_t *s, wchar_t *max_scan)
+is_part_of_string_wide(wchar_t *s, wchar_t *max_scan, bool *at_stop OUT)
 {
     uint count = 0;
     wchar_t *stop = (max_scan != NULL) ? max_scan :
@@ -831,12 +885,14 @@ is_part_of_string_wide(wchar_t *s, wchar_t *max_scan)
         } else if (s - start >= STRING_SINGLE_MAX_LEN)
             return true;
     }
+    if (at_stop != NULL)
+        *at_stop = (s >= stop);
     return (count >= STRING_MIN_COUNT);
 }
 #endif
 
 static bool
-is_part_of_string_ascii(byte *s, byte *max_scan)
+is_part_of_string_ascii(byte *s, byte *max_scan, bool *at_stop OUT)
 {
     uint count = 0;
     byte *stop = (max_scan != NULL) ? max_scan : (byte *) ALIGN_FORWARD(s, PAGE_SIZE);
@@ -856,17 +912,443 @@ is_part_of_string_ascii(byte *s, byte *max_scan)
         } else if (s - start >= STRING_SINGLE_MAX_LEN)
             return true;
     }
+    if (at_stop != NULL)
+        *at_stop = (s >= stop);
     return (count >= STRING_MIN_COUNT);
 }
 
 static bool
-is_part_of_string(byte *s, byte *max_scan)
+is_part_of_string(byte *s, byte *max_scan, bool *at_stop OUT)
 {
+    if (at_stop != NULL)
+        *at_stop = false;
 #ifdef WINDOWS
     if (*(s+1) == 0 && *(s+3) == 0)
-        return is_part_of_string_wide((wchar_t *)s, (wchar_t *)max_scan);
+        return is_part_of_string_wide((wchar_t *)s, (wchar_t *)max_scan, at_stop);
+#endif
+    return is_part_of_string_ascii(s, max_scan, at_stop);
+}
+
+/***************************************************************************
+ * POINTER CANDIDATE FILTER
+ *
+ * Most words in a large process are not heap pointers, so before any tree
+ * lookup we discard words outside the span of the heap chunks, several words
+ * at a time, and then words outside a coarse bitmap of which parts of that
+ * span hold chunks.  The vector kernels test whether
+ * (word - filter_min) >> filter_shift is zero, which rounds the span up to a
+ * power of two: pointer_in_heap_map() checks the exact span.
+ */
+
+/* The candidates in a block of words fit in a uint mask */
+#define FILTER_BLOCK_WORDS 32
+
+/* The heap map has at most 8M bits (1MB) and at least one bit per page */
+#define HEAP_MAP_MAX_BITS (8*1024*1024)
+#define HEAP_MAP_MIN_SHIFT 12
+
+typedef uint (*pointer_filter_func_t)(const ptr_uint_t *words, uint count);
+
+/* The kernel picked at init time */
+static pointer_filter_func_t pointer_filter_kernel;
+
+/* Set up for each scan by pointer_filter_build() */
+static pointer_filter_func_t pointer_filter;
+static bool filter_enabled;
+static ptr_uint_t filter_min;
+static ptr_uint_t filter_span;
+static uint filter_shift;
+static uint *heap_map;
+static size_t heap_map_size; /* in uints */
+static uint heap_map_shift;
+
+/* Used when the span is too large for the kernels or the filter is disabled */
+static uint
+pointer_filter_all(const ptr_uint_t *words, uint count)
+{
+    return (count == FILTER_BLOCK_WORDS) ? ~0U : ((1U << count) - 1);
+}
+
+static uint
+pointer_filter_scalar(const ptr_uint_t *words, uint count)
+{
+    uint i, mask = 0;
+    for (i = 0; i < count; i++) {
+        if (((words[i] - filter_min) >> filter_shift) == 0)
+            mask |= 1U << i;
+    }
+    return mask;
+}
+
+#ifdef X86
+static TARGET_SSE2 uint
+pointer_filter_sse2(const ptr_uint_t *words, uint count)
+{
+    uint i = 0, mask = 0;
+    __m128i zero = _mm_setzero_si128();
+    __m128i shift = _mm_cvtsi32_si128((int)filter_shift);
+# ifdef X64
+    __m128i min = _mm_set1_epi64x((long long)filter_min);
+    for (; i + 2 <= count; i += 2) {
+        __m128i high = _mm_srl_epi64
+            (_mm_sub_epi64(_mm_loadu_si128((__m128i *)(words + i)), min), shift);
+        /* SSE2 has no 64-bit compare so we require both halves to be zero */
+        __m128i eq = _mm_cmpeq_epi32(high, zero);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        mask |= (uint)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+    }
+# else
+    __m128i min = _mm_set1_epi32((int)filter_min);
+    for (; i + 4 <= count; i += 4) {
+        __m128i high = _mm_srl_epi32
+            (_mm_sub_epi32(_mm_loadu_si128((__m128i *)(words + i)), min), shift);
+        mask |= (uint)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(high, zero)))
+            << i;
+    }
+# endif
+    if (i < count)
+        mask |= pointer_filter_scalar(words + i, count - i) << i;
+    return mask;
+}
+
+# ifdef HAVE_TARGET_AVX2
+static TARGET_AVX2 uint
+pointer_filter_avx2(const ptr_uint_t *words, uint count)
+{
+    uint i = 0, mask = 0;
+    __m256i zero = _mm256_setzero_si256();
+    __m128i shift = _mm_cvtsi32_si128((int)filter_shift);
+#  ifdef X64
+    __m256i min = _mm256_set1_epi64x((long long)filter_min);
+    for (; i + 4 <= count; i += 4) {
+        __m256i high = _mm256_srl_epi64
+            (_mm256_sub_epi64(_mm256_loadu_si256((__m256i *)(words + i)), min), shift);
+        mask |= (uint)_mm256_movemask_pd
+            (_mm256_castsi256_pd(_mm256_cmpeq_epi64(high, zero))) << i;
+    }
+#  else
+    __m256i min = _mm256_set1_epi32((int)filter_min);
+    for (; i + 8 <= count; i += 8) {
+        __m256i high = _mm256_srl_epi32
+            (_mm256_sub_epi32(_mm256_loadu_si256((__m256i *)(words + i)), min), shift);
+        mask |= (uint)_mm256_movemask_ps
+            (_mm256_castsi256_ps(_mm256_cmpeq_epi32(high, zero))) << i;
+    }
+#  endif
+    if (i < count)
+        mask |= pointer_filter_scalar(words + i, count - i) << i;
+    return mask;
+}
+# endif /* HAVE_TARGET_AVX2 */
+#endif /* X86 */
+
+static void
+pointer_filter_init(void)
+{
+    pointer_filter_kernel = pointer_filter_scalar;
+#ifdef X86
+    if (!options.leak_scan_simd)
+        return;
+# ifdef HAVE_TARGET_AVX2
+    /* proc_avx_enabled() also checks that the OS saves the ymm state */
+    if (proc_avx_enabled() && cpu_has_avx2()) {
+        LOG(1, "using AVX2 leak scan filter\n");
+        pointer_filter_kernel = pointer_filter_avx2;
+        return;
+    }
+# endif
+    if (proc_has_feature(FEATURE_SSE2)) {
+        LOG(1, "using SSE2 leak scan filter\n");
+        pointer_filter_kernel = pointer_filter_sse2;
+    }
 #endif
-    return is_part_of_string_ascii(s, max_scan);
+}
+
+static bool
+heap_map_add_cb(rb_node_t *node, void *iter_data)
+{
+    byte *start;
+    size_t size, bit, last;
+    rb_node_fields(node, &start, &size, NULL);
+    if (size == 0)
+        return true;
+    bit = ((ptr_uint_t)start - filter_min) >> heap_map_shift;
+    last = ((ptr_uint_t)start + size - 1 - filter_min) >> heap_map_shift;
+    for (; bit <= last; bit++)
+        heap_map[bit / 32] |= 1U << (bit % 32);
+    return true;
+}
+
+/* Sets up the filter for a scan whose chunks are in alloc_tree */
+static void
+pointer_filter_build(rb_tree_t *alloc_tree)
+{
+    rb_node_t *lo = rb_min_node(alloc_tree);
+    rb_node_t *hi = rb_max_node(alloc_tree);
+    byte *base;
+    size_t size;
+    pointer_filter = pointer_filter_all;
+    filter_enabled = false;
+#ifdef WINDOWS
+    /* an encoded pointer can decode to a heap address (i#153) */
+    if (op_check_encoded_pointers)
+        return;
+#endif
+    if (lo == NULL)
+        return;
+    rb_node_fields(lo, &base, NULL, NULL);
+    filter_min = (ptr_uint_t) base;
+    rb_node_fields(hi, &base, &size, NULL);
+    filter_span = (ptr_uint_t) base + size - filter_min;
+    for (filter_shift = 0;
+         filter_shift < sizeof(ptr_uint_t)*8 - 1 &&
+             ((ptr_uint_t)1 << filter_shift) < filter_span;
+         filter_shift++)
+        ; /* nothing */
+    if (((ptr_uint_t)1 << filter_shift) >= filter_span)
+        pointer_filter = pointer_filter_kernel;
+    for (heap_map_shift = HEAP_MAP_MIN_SHIFT;
+         (filter_span >> heap_map_shift) >= HEAP_MAP_MAX_BITS; heap_map_shift++)
+        ; /* nothing */
+    heap_map_size = (size_t) ALIGN_FORWARD((filter_span >> heap_map_shift) + 1, 32) / 32;
+    heap_map = (uint *) global_alloc(heap_map_size * sizeof(*heap_map), HEAPSTAT_MISC);
+    memset(heap_map, 0, heap_map_size * sizeof(*heap_map));
+    rb_iterate(alloc_tree, heap_map_add_cb, NULL);
+    filter_enabled = true;
+    LOG(2, "leak scan filter: "PFX"-"PFX", shift %d, map shift %d\n",
+        filter_min, filter_min + filter_span, filter_shift, heap_map_shift);
+}
+
+static void
+pointer_filter_free(void)
+{
+    if (heap_map != NULL) {
+        global_free(heap_map, heap_map_size * sizeof(*heap_map), HEAPSTAT_MISC);
+        heap_map = NULL;
+    }
+    filter_enabled = false;
+}
+
+static inline bool
+pointer_in_heap_map(ptr_uint_t val)
+{
+    ptr_uint_t offs = val - filter_min;
+    size_t bit;
+    if (!filter_enabled)
+        return true;
+    if (offs >= filter_span)
+        return false;
+    bit = offs >> heap_map_shift;
+    return TEST(1U << (bit % 32), heap_map[bit / 32]);
+}
+
+/***************************************************************************
+ * PARALLEL PRIMARY SCAN
+ *
+ * With -leak_scan_threads > 1, the primary scan of a nudge-time leak scan
+ * is split across a pool of client threads that sit idle on an event
+ * between scans.  The serial scan walks the roots and then the reachable
+ * chunks in first-reached order, and which chunks end up on the
+ * maybe-reachable queue, and in what order, depends on that order: the
+ * secondary walk of the queue marks later members of a cycle of possible
+ * leaks as indirectly reachable from the first.  To produce exactly the
+ * same flags and queue, the parallel scan proceeds one breadth-first level
+ * at a time.  The roots form the first level and the chunks first reached
+ * from level n form level n+1.  Within a level, workers claim items (root
+ * pieces or chunks) in order and record the pointers that might newly
+ * reach a chunk in the order found.  The coordinator then replays each
+ * item's pointers in item order, which is the order in which the serial
+ * scan would have found them, applying the serial rules to mark chunks
+ * reachable (queueing them, in order, as the next level) or
+ * maybe-reachable (queueing them on the maybe-reachable queue).  Workers
+ * look chunks up in a sorted array built from the alloc tree rather than
+ * in the malloc table, so no malloc table lock is taken, and the flags
+ * are only transferred to the malloc table at the end.
+ */
+
+typedef struct _scan_chunk_t {
+    byte *start;
+    byte *end;
+    /* Only written by the coordinator between levels, so stable for the
+     * workers' reads within a level.
+     */
+    bool reached;
+    bool maybe_reached;
+} scan_chunk_t;
+
+/* A pointer found by a worker that may newly reach chunk */
+typedef struct _scan_event_t {
+    scan_chunk_t *chunk;
+    /* A mid-chunk pointer that only makes the chunk maybe-reachable */
+    bool maybe;
+} scan_event_t;
+
+typedef struct _scan_worker_t {
+    uint index;
+    /* Signaled to scan a level.  NULL for the thread coordinating the scan,
+     * which runs as worker 0.
+     */
+    void *go_event;
+    /* The events this worker found during the current level, in order */
+    scan_event_t *events;
+    uint num_events;
+    uint events_capacity;
+    /* The end and limit of the item being scanned, and the end of the
+     * defined range that reaches the item's end, once we need it.
+     */
+    byte *item_end;
+    byte *item_limit;
+    byte *item_defined_end;
+#ifdef STATISTICS
+    scan_stats_t stats;
+#endif
+    reachability_data_t data;
+} scan_worker_t;
+
+/* A unit of work within a level: a root piece or a reachable chunk.  The
+ * events found while scanning it are [events_begin, events_end) in the
+ * events of the worker that scanned it.
+ */
+typedef struct _scan_item_t {
+    byte *start;
+    byte *end;
+    /* The end of the region a root piece was split from, which is as far
+     * as the serial scan looks for strings.  The same as end for chunks.
+     */
+    byte *limit;
+    uint worker;
+    uint events_begin;
+    uint events_end;
+} scan_item_t;
+
+typedef struct _scan_item_list_t {
+    scan_item_t *items;
+    uint num;
+    uint capacity;
+} scan_item_list_t;
+
+/* Large root regions are split so they can be spread across workers */
+#define SCAN_PIECE_SIZE (4*1024*1024)
+#define SCAN_EVENTS_INITIAL_CAPACITY 256
+
+/* The pool of workers, including the coordinator at index 0 */
+static scan_worker_t *scan_workers;
+static uint scan_num_workers;
+static volatile bool scan_workers_exit;
+static volatile int scan_workers_finished;
+
+static scan_chunk_t *scan_chunks;
+static uint scan_num_chunks;
+
+/* The items of the level being scanned and of the next level */
+static scan_item_list_t scan_level_items;
+static scan_item_list_t scan_next_items;
+static volatile int scan_next_item;
+/* Whether the level being scanned is the roots */
+static bool scan_level_is_roots;
+
+static scan_chunk_t *
+scan_chunk_lookup(byte *pointer)
+{
+    uint lo = 0, hi = scan_num_chunks;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (pointer < scan_chunks[mid].start)
+            hi = mid;
+        else if (pointer >= scan_chunks[mid].end)
+            lo = mid + 1;
+        else
+            return &scan_chunks[mid];
+    }
+    return NULL;
+}
+
+static void
+scan_event_add(scan_worker_t *worker, scan_chunk_t *chunk, bool maybe)
+{
+    if (worker->num_events == worker->events_capacity) {
+        scan_event_t *grown = (scan_event_t *)
+            global_alloc(worker->events_capacity * 2 * sizeof(*grown), HEAPSTAT_MISC);
+        memcpy(grown, worker->events, worker->num_events * sizeof(*grown));
+        global_free(worker->events, worker->events_capacity * sizeof(*grown),
+                    HEAPSTAT_MISC);
+        worker->events = grown;
+        worker->events_capacity *= 2;
+    }
+    worker->events[worker->num_events].chunk = chunk;
+    worker->events[worker->num_events].maybe = maybe;
+    worker->num_events++;
+}
+
+#ifndef VMX86_SERVER /* unsafe to read */
+/* The serial scan looks for strings up to the end of the defined range
+ * holding the pointer, which for a root piece can extend past the end of the
+ * piece.  So if looking within the piece reaches its end, we look as far as
+ * the serial scan would have.
+ */
+static bool
+scan_is_part_of_string(scan_worker_t *worker, byte *ptr_addr, byte *defined_end)
+{
+    bool at_stop;
+    bool res = is_part_of_string(ptr_addr, defined_end, &at_stop);
+    if (at_stop && defined_end == worker->item_end &&
+        worker->item_end < worker->item_limit) {
+        if (worker->item_defined_end == NULL) {
+            worker->item_defined_end = op_have_defined_info ?
+                cb_end_of_defined_region(worker->item_end, worker->item_limit) :
+                worker->item_limit;
+        }
+        res = is_part_of_string(ptr_addr, worker->item_defined_end, NULL);
+    }
+    return res;
+}
+#endif
+
+/* The primary-scan counterpart of check_reachability_pointer() for workers.
+ * Pointers that cannot change a chunk's state, given what earlier levels
+ * found, are not recorded.
+ */
+static void
+check_reachability_pointer_parallel(byte *pointer, byte *ptr_addr, byte *defined_end,
+                                    reachability_data_t *data)
+{
+    scan_chunk_t *chunk = scan_chunk_lookup(pointer);
+    if (chunk == NULL || chunk->reached)
+        return;
+#ifndef VMX86_SERVER /* unsafe to read */
+    if (options.strings_vs_pointers &&
+        ptr_addr > (byte *) PAGE_SIZE && /* rule out register */
+        scan_is_part_of_string(data->worker, ptr_addr, defined_end)) {
+        LOG(3, "\t("PFX" is part of a string table so not considering a pointer)\n",
+            ptr_addr);
+        LEAK_STATS_INC(data, strings_not_pointers);
+        return;
+    }
+#endif
+    if (ptr_addr >= chunk->start && ptr_addr < chunk->end) {
+        LOG(3, "\t("PFX" points into its own chunk "PFX"-"PFX")\n",
+            ptr_addr, chunk->start, chunk->end);
+        return;
+    }
+    if (pointer == chunk->start ||
+        is_midchunk_pointer_legitimate(data, pointer, chunk->start, chunk->end)) {
+#ifdef WINDOWS
+        if (rtl_fail_info != NULL &&
+            ptr_addr >= rtl_fail_info && ptr_addr < rtl_fail_info + RTL_FAIL_INFO_SIZE) {
+            /* RtlHeap stores failed alloc info which can hide leaks (i#292) */
+            LOG(1, "WARNING: "PFX" is inside RtlpHeapFailureInfo data struct: "
+                "ignoring!\n", ptr_addr);
+            return;
+        }
+#endif
+        LOG(3, "\t"PFX" points to chunk "PFX"-"PFX"\n",
+            ptr_addr, chunk->start, chunk->end);
+        scan_event_add(data->worker, chunk, false);
+    } else if (!chunk->maybe_reached) {
+        LOG(3, "\t("PFX" points to mid-chunk "PFX" in "PFX"-"PFX")\n",
+            ptr_addr, pointer, chunk->start, chunk->end);
+        scan_event_add(data->worker, chunk, true);
+    }
 }
 
 /***************************************************************************/
@@ -914,6 +1396,10 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
      */
     if (pointer < data->low_ptr)
         return;
+    if (data->worker != NULL) {
+        check_reachability_pointer_parallel(pointer, ptr_addr, defined_end, data);
+        return;
+    }
     /* We look in rbtree first since likely to miss both so why do hash lookup */
     node = rb_in_node(data->alloc_tree, pointer);
     if (node != NULL) {
@@ -923,7 +1409,7 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
          */
         if (options.strings_vs_pointers &&
             ptr_addr > (byte *) PAGE_SIZE && /* rule out register */
-            is_part_of_string(ptr_addr, defined_end)) {
+            is_part_of_string(ptr_addr, defined_end, NULL)) {
             LOG(3, "\t("PFX" is part of a string table so not considering a pointer)\n",
                 ptr_addr);
             STATS_INC(strings_not_pointers);
@@ -960,7 +1446,8 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
                 LOG(3, "\t("PFX" points to mid-chunk "PFX" in "PFX"-"PFX")\n",
                     ptr_addr, pointer, chunk_start, chunk_end);
                 flags = malloc_get_client_flags(chunk_start);
-                if (is_midchunk_pointer_legitimate(pointer, chunk_start, chunk_end)) {
+                if (is_midchunk_pointer_legitimate(data, pointer, chunk_start,
+                                                   chunk_end)) {
                     /* We could split these out as "probably reachable" but that would
                      * require a new chunk queue and flags and extra logic for
                      * whether reached initially by which: not worth it since the
@@ -1035,15 +1522,143 @@ check_reachability_pointer(byte *pointer, byte *ptr_addr, byte *defined_end,
     }
 }
 
+/* Scans the aligned pointer-sized words in [start, defined_end) */
 static void
-check_reachability_helper(byte *start, byte *end, bool skip_heap,
-                          reachability_data_t *data)
+check_reachability_words(byte *start, byte *defined_end, bool skip_heap,
+                         reachability_data_t *data)
+{
+    byte *pc, *next_pc, *heap_end;
+    const ptr_uint_t *words;
+#ifdef UNIX
+    ptr_uint_t buf[FILTER_BLOCK_WORDS];
+#endif
+    for (pc = (byte *)ALIGN_FORWARD(start, sizeof(void*));
+         pc < defined_end && pc + sizeof(void*) <= defined_end; pc = next_pc) {
+        uint count = (uint) MIN(FILTER_BLOCK_WORDS, (defined_end - pc) / sizeof(void*));
+        uint readable = (count == FILTER_BLOCK_WORDS) ? ~0U : ((1U << count) - 1);
+        uint mask;
+        next_pc = pc + count * sizeof(void*);
+#ifdef UNIX
+        /* i#1773: we could hit a bus error even on a readable page.  Also
+         * on some UNIX platforms like VMX86_SERVER we do not have a
+         * reliable memory query.
+         */
+        if (!safe_read(pc, count * sizeof(void*), buf)) {
+            uint i;
+            for (i = 0; i < count; i++) {
+                if (!leak_safe_read_heap(pc + i * sizeof(void*), (void **)&buf[i]))
+                    readable &= ~(1U << i);
+            }
+        }
+        words = buf;
+#else
+        /* Threads are suspended and we checked readability so safe to deref */
+        words = (const ptr_uint_t *) pc;
+#endif
+        LEAK_STATS_ADD(data, leak_scan_words, count);
+        mask = pointer_filter(words, count) & readable;
+        while (mask != 0) {
+            uint i = bitscan_forward32(mask);
+            byte *addr = pc + i * sizeof(void*);
+            mask &= mask - 1;
+            /* Skip heap regions.  We only need to check where there is a
+             * candidate, and heap memory is dense with them so we move past
+             * most heap regions quickly.
+             */
+            if (skip_heap && heap_region_bounds(addr, NULL, &heap_end, NULL) &&
+                heap_end != NULL) {
+                ASSERT(ALIGNED(heap_end, sizeof(void*)), "heap region end not aligned!");
+                next_pc = heap_end;
+                break;
+            }
+            if (!pointer_in_heap_map(words[i]))
+                continue;
+            /* Now addr points to an aligned and defined (non-heap) ptrsz bytes */
+            LEAK_STATS_INC(data, leak_scan_candidates);
+            check_reachability_pointer((byte *)words[i], addr, defined_end, data);
+        }
+    }
+}
+
+/* Queries the region containing pc and returns in *skip whether it cannot
+ * hold roots for the leak scan, and in *region_end its page-aligned end.
+ * Returns false if the query fails.
+ */
+static bool
+scan_query_region(byte *pc, byte **region_end OUT, bool *skip OUT)
 {
-    byte *pc, *defined_end, *chunk_end, *pointer, *iter_end, *query_end = NULL;
     dr_mem_info_t info;
 #ifdef WINDOWS
     MEMORY_BASIC_INFORMATION mbi = {0};
 #endif
+    if (!dr_query_memory_ex(pc, &info)) {
+        /* query on Windows expected to fail on kernel memory */
+        ASSERT(IF_WINDOWS_ELSE(info.type == DR_MEMTYPE_ERROR_WINKERNEL, false),
+               "dr_query_memory_ex failed");
+        return false;
+    }
+#ifdef WINDOWS
+    /* We need to avoid touching guard pages on Windows
+     * We could not call dr_query_memory_ex() and convert the mbi fields,
+     * but simpler this way even if takes extra syscall.
+     */
+    if (dr_virtual_query(pc, &mbi, sizeof(mbi)) == sizeof(mbi) &&
+        TEST(PAGE_GUARD, mbi.Protect))
+        info.prot = DR_MEMPROT_NONE;
+#endif
+    /* PR 483063: bounds should be page-aligned, but be paranoid */
+    *region_end = (byte *) ALIGN_FORWARD(info.base_pc + info.size, PAGE_SIZE);
+    LOG(4, "query "PFX"-"PFX" prot=%x\n", info.base_pc, *region_end, info.prot);
+    *skip = (!TEST(DR_MEMPROT_READ, info.prot) ||
+             /* we skip r-x regions.  FIXME PR 475518: if we have info on
+              * what's been modified since it was loaded we can avoid
+              * potential false negatives here if the r-x was restored.
+              */
+             (TESTALL(DR_MEMPROT_READ|DR_MEMPROT_EXEC, info.prot) &&
+              !TEST(DR_MEMPROT_WRITE, info.prot)) ||
+             (!options.scan_read_only_files &&
+             /* This could result in false negatives, which is why this is
+              * under an option.  It's not worth tracking whether these pages
+              * have been unmodified since loaded since mapped (how often is
+              * someone going to store a heap pointer in a file-mapped page
+              * and then mark the page read-only?).
+              * We want to skip these not only for a significant performance
+              * gain but also to avoid false anchors in .pdata sections (PR 485354)
+              * and locale.nls (i#1096) that make our test suite non-deterministic.
+              */
+              TEST(DR_MEMPROT_READ, info.prot) &&
+              !TEST(DR_MEMPROT_WRITE, info.prot) &&
+              (info.type == DR_MEMTYPE_IMAGE
+               /* Windows-only b/c it's a pain to identify non-image maps on Linux */
+               IF_WINDOWS(|| mbi.Type == MEM_MAPPED))) ||
+#if defined(WINDOWS) && defined(USE_DRSYMS)
+             /* skip private heap: here we assume it's a single segment */
+             (pc == (byte *) get_private_heap_handle()) ||
+#endif
+#ifdef LINUX
+             /* i#1778: skip vvar page to avoid kernel soft lockups.
+              * This skips vdso as well but we're already doing that b/c it's +rx.
+              */
+             TEST(DR_MEMPROT_VDSO, info.prot) ||
+#endif
+             /* don't count references in DR data */
+             dr_memory_is_dr_internal(pc) ||
+#ifdef TOOL_DR_MEMORY
+             /* skip over shadow memory */
+             shadow_memory_is_shadow(pc) ||
+#endif
+             /* don't count references in DrMem data (e.g., report.c's
+              * page_buf holds a page's worth of old stack data)
+              */
+             dr_memory_is_in_client(pc));
+    return true;
+}
+
+static void
+check_reachability_helper(byte *start, byte *end, bool skip_heap,
+                          reachability_data_t *data)
+{
+    byte *pc, *defined_end, *iter_end, *query_end = NULL;
     ASSERT(data != NULL, "invalid args");
     LOG(4, "\nchecking reachability of "PFX"-"PFX"\n", start, end);
     pc = start;
@@ -1054,66 +1669,10 @@ check_reachability_helper(byte *start, byte *end, bool skip_heap,
          * pages on Linux or .stab section in a cygwin .exe).
          */
         if (pc >= query_end) {
-            if (!dr_query_memory_ex(pc, &info)) {
-                /* query on Windows expected to fail on kernel memory */
-                ASSERT(IF_WINDOWS_ELSE(info.type == DR_MEMTYPE_ERROR_WINKERNEL, false),
-                       "dr_query_memory_ex failed");
+            bool skip;
+            if (!scan_query_region(pc, &query_end, &skip))
                 return;
-            }
-#ifdef WINDOWS
-            /* We need to avoid touching guard pages on Windows
-             * We could not call dr_query_memory_ex() and convert the mbi fields,
-             * but simpler this way even if takes extra syscall.
-             */
-            if (dr_virtual_query(pc, &mbi, sizeof(mbi)) == sizeof(mbi) &&
-                TEST(PAGE_GUARD, mbi.Protect))
-                info.prot = DR_MEMPROT_NONE;
-#endif
-            /* PR 483063: bounds should be page-aligned, but be paranoid */
-            query_end = (byte *) ALIGN_FORWARD(info.base_pc + info.size, PAGE_SIZE);
-            LOG(4, "query "PFX"-"PFX" prot=%x\n", info.base_pc, query_end, info.prot);
-            if (!TEST(DR_MEMPROT_READ, info.prot) ||
-                /* we skip r-x regions.  FIXME PR 475518: if we have info on
-                 * what's been modified since it was loaded we can avoid
-                 * potential false negatives here if the r-x was restored.
-                 */
-                (TESTALL(DR_MEMPROT_READ|DR_MEMPROT_EXEC, info.prot) &&
-                 !TEST(DR_MEMPROT_WRITE, info.prot)) ||
-                (!options.scan_read_only_files &&
-                /* This could result in false negatives, which is why this is
-                 * under an option.  It's not worth tracking whether these pages
-                 * have been unmodified since loaded since mapped (how often is
-                 * someone going to store a heap pointer in a file-mapped page
-                 * and then mark the page read-only?).
-                 * We want to skip these not only for a significant performance
-                 * gain but also to avoid false anchors in .pdata sections (PR 485354)
-                 * and locale.nls (i#1096) that make our test suite non-deterministic.
-                 */
-                 TEST(DR_MEMPROT_READ, info.prot) &&
-                 !TEST(DR_MEMPROT_WRITE, info.prot) &&
-                 (info.type == DR_MEMTYPE_IMAGE
-                  /* Windows-only b/c it's a pain to identify non-image maps on Linux */
-                  IF_WINDOWS(|| mbi.Type == MEM_MAPPED))) ||
-#if defined(WINDOWS) && defined(USE_DRSYMS)
-                /* skip private heap: here we assume it's a single segment */
-                (pc == (byte *) get_private_heap_handle()) ||
-#endif
-#ifdef LINUX
-                /* i#1778: skip vvar page to avoid kernel soft lockups.
-                 * This skips vdso as well but we're already doing that b/c it's +rx.
-                 */
-                TEST(DR_MEMPROT_VDSO, info.prot) ||
-#endif
-                /* don't count references in DR data */
-                dr_memory_is_dr_internal(pc) ||
-#ifdef TOOL_DR_MEMORY
-                /* skip over shadow memory */
-                shadow_memory_is_shadow(pc) ||
-#endif
-                /* don't count references in DrMem data (e.g., report.c's
-                 * page_buf holds a page's worth of old stack data)
-                 */
-                dr_memory_is_in_client(pc)) {
+            if (skip) {
                 if (query_end < pc) /* overflow */
                     break;
                 pc = query_end;
@@ -1146,35 +1705,7 @@ check_reachability_helper(byte *start, byte *end, bool skip_heap,
         }
         LOG(3, "defined range "PFX"-"PFX"\n", pc, defined_end);
 
-        for (pc = (byte *)ALIGN_FORWARD(pc, sizeof(void*));
-             pc < defined_end && pc + sizeof(void*) <= defined_end; pc += sizeof(void*)) {
-            if (skip_heap) {
-                /* Skip heap regions */
-                if (heap_region_bounds(pc, NULL, &chunk_end, NULL) &&
-                    chunk_end != NULL) {
-                    pc = chunk_end - sizeof(void*); /* let loop inc bump pc */
-                    ASSERT(ALIGNED(pc, sizeof(void*)), "heap region end not aligned!");
-                    continue;
-                }
-            }
-            /* Now pc points to an aligned and defined (non-heap) ptrsz bytes */
-            /* XXX PR 475518: improve performance of all these reads and table
-             * lookups: this scan is where the noticeable pause at exit comes
-             * from, not the identification of defined regions.
-             */
-#ifdef UNIX
-            /* i#1773: we could hit a bus error even on a readable page.  Also
-             * on some UNIX platforms like VMX86_SERVER we do not have a
-             * reliable memory query.
-             */
-            if (leak_safe_read_heap(pc, (void **)&pointer))
-                check_reachability_pointer(pointer, pc, defined_end, data);
-#else
-            /* Threads are suspended and we checked readability so safe to deref */
-            pointer = *((app_pc*)pc);
-            check_reachability_pointer(pointer, pc, defined_end, data);
-#endif
-        }
+        check_reachability_words(pc, defined_end, skip_heap, data);
         pc = (byte *) ALIGN_FORWARD(defined_end, sizeof(void*));
     }
 }
@@ -1212,6 +1743,313 @@ check_reachability_regs(void *drcontext, dr_mcontext_t *mc, reachability_data_t
     }
 }
 
+static void
+scan_item_add(scan_item_list_t *list, byte *start, byte *end, byte *limit)
+{
+    if (list->num == list->capacity) {
+        uint capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+        scan_item_t *grown = (scan_item_t *)
+            global_alloc(capacity * sizeof(*grown), HEAPSTAT_MISC);
+        if (list->items != NULL) {
+            memcpy(grown, list->items, list->num * sizeof(*grown));
+            global_free(list->items, list->capacity * sizeof(*grown), HEAPSTAT_MISC);
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->num].start = start;
+    list->items[list->num].end = end;
+    list->items[list->num].limit = limit;
+    list->num++;
+}
+
+static void
+scan_item_list_free(scan_item_list_t *list)
+{
+    if (list->items != NULL)
+        global_free(list->items, list->capacity * sizeof(*list->items), HEAPSTAT_MISC);
+    memset(list, 0, sizeof(*list));
+}
+
+/* Splits the regions the serial primary scan walks for roots into pieces,
+ * in the same address order
+ */
+static void
+scan_collect_roots(scan_item_list_t *list)
+{
+    byte *pc = NULL, *region_end;
+    bool skip;
+    while (scan_query_region(pc, &region_end, &skip)) {
+        if (region_end <= pc) /* overflow */
+            break;
+        if (!skip) {
+            byte *piece = pc;
+            while (piece < region_end) {
+                byte *piece_end = (region_end - piece > SCAN_PIECE_SIZE) ?
+                    piece + SCAN_PIECE_SIZE : region_end;
+                scan_item_add(list, piece, piece_end, region_end);
+                piece = piece_end;
+            }
+        }
+        pc = region_end;
+    }
+}
+
+static bool
+scan_chunk_count_cb(rb_node_t *node, void *iter_data)
+{
+    uint *count = (uint *) iter_data;
+    (*count)++;
+    return true;
+}
+
+/* rb_iterate() is in-order, which keeps scan_chunks sorted */
+static bool
+scan_chunk_fill_cb(rb_node_t *node, void *iter_data)
+{
+    uint *idx = (uint *) iter_data;
+    byte *start;
+    size_t size;
+    rb_node_fields(node, &start, &size, NULL);
+    ASSERT(*idx < scan_num_chunks, "alloc tree changed during scan");
+    scan_chunks[*idx].start = start;
+    scan_chunks[*idx].end = start + size;
+    scan_chunks[*idx].reached = false;
+    scan_chunks[*idx].maybe_reached = false;
+    (*idx)++;
+    return true;
+}
+
+/* Scans the items of the current level that this worker claims */
+static void
+scan_worker_run(scan_worker_t *worker)
+{
+    int idx;
+    while ((idx = atomic_add32_return_sum(&scan_next_item, 1) - 1) <
+           (int) scan_level_items.num) {
+        scan_item_t *item = &scan_level_items.items[idx];
+        item->worker = worker->index;
+        item->events_begin = worker->num_events;
+        worker->item_end = item->end;
+        worker->item_limit = item->limit;
+        worker->item_defined_end = NULL;
+        check_reachability_helper(item->start, item->end,
+                                  scan_level_is_roots/*skip heap*/, &worker->data);
+        item->events_end = worker->num_events;
+    }
+}
+
+static void
+scan_worker_thread(void *arg)
+{
+    scan_worker_t *worker = (scan_worker_t *) arg;
+    /* Like drheapstat's sideline thread we must keep running while the
+     * scanning thread has the world suspended.  We only read app memory.
+     */
+    dr_client_thread_set_suspendable(false);
+    LOG(1, "leak scan thread "TIDFMT" running\n",
+        dr_get_thread_id(dr_get_current_drcontext()));
+    while (true) {
+        dr_event_wait(worker->go_event);
+        dr_event_reset(worker->go_event);
+        if (scan_workers_exit)
+            break;
+        scan_worker_run(worker);
+        ATOMIC_INC32(scan_workers_finished);
+    }
+}
+
+static void
+scan_pool_init(void)
+{
+    uint i, num = options.leak_scan_threads;
+    if (num <= 1)
+        return;
+    scan_workers = (scan_worker_t *)
+        global_alloc(num * sizeof(*scan_workers), HEAPSTAT_MISC);
+    memset(scan_workers, 0, num * sizeof(*scan_workers));
+    for (i = 0; i < num; i++) {
+        scan_worker_t *worker = &scan_workers[i];
+        worker->index = i;
+        worker->events_capacity = SCAN_EVENTS_INITIAL_CAPACITY;
+        worker->events = (scan_event_t *)
+            global_alloc(worker->events_capacity * sizeof(*worker->events),
+                         HEAPSTAT_MISC);
+    }
+    /* worker 0 is whichever thread runs the scan */
+    for (scan_num_workers = 1; scan_num_workers < num; scan_num_workers++) {
+        scan_worker_t *worker = &scan_workers[scan_num_workers];
+        worker->go_event = dr_event_create();
+        if (!dr_create_client_thread(scan_worker_thread, worker)) {
+            LOG(1, "WARNING: unable to create leak scan thread\n");
+            dr_event_destroy(worker->go_event);
+            worker->go_event = NULL;
+            break;
+        }
+    }
+}
+
+static void
+scan_pool_exit(void)
+{
+    uint i;
+    if (scan_workers == NULL)
+        return;
+    /* DR has already terminated our client threads (i#297) */
+    scan_workers_exit = true;
+    for (i = 0; i < options.leak_scan_threads; i++) {
+        scan_worker_t *worker = &scan_workers[i];
+        if (worker->go_event != NULL)
+            dr_event_destroy(worker->go_event);
+        global_free(worker->events, worker->events_capacity * sizeof(*worker->events),
+                    HEAPSTAT_MISC);
+    }
+    global_free(scan_workers, options.leak_scan_threads * sizeof(*scan_workers),
+                HEAPSTAT_MISC);
+    scan_workers = NULL;
+    scan_item_list_free(&scan_level_items);
+    scan_item_list_free(&scan_next_items);
+}
+
+/* Sets up a parallel primary scan over data->alloc_tree, returning whether
+ * one should be performed.  If so, the register roots must be scanned with
+ * worker 0's data before scan_parallel_run().
+ */
+static bool
+scan_parallel_begin(reachability_data_t *data, bool at_exit)
+{
+    uint i;
+    /* at exit our client threads are gone (i#297) */
+    if (at_exit || scan_num_workers <= 1)
+        return false;
+    scan_num_chunks = 0;
+    rb_iterate(data->alloc_tree, scan_chunk_count_cb, &scan_num_chunks);
+    if (scan_num_chunks == 0)
+        return false;
+    scan_chunks = (scan_chunk_t *)
+        global_alloc(scan_num_chunks * sizeof(*scan_chunks), HEAPSTAT_MISC);
+    i = 0;
+    rb_iterate(data->alloc_tree, scan_chunk_fill_cb, &i);
+    for (i = 0; i < scan_num_workers; i++) {
+        scan_workers[i].data = *data;
+        scan_workers[i].data.worker = &scan_workers[i];
+#ifdef STATISTICS
+        scan_workers[i].data.stats = &scan_workers[i].stats;
+        memset(&scan_workers[i].stats, 0, sizeof(scan_workers[i].stats));
+#endif
+        scan_workers[i].num_events = 0;
+    }
+    scan_level_is_roots = true;
+    return true;
+}
+
+/* Replays the current level's events in serial scan order, queueing newly
+ * reachable chunks as the next level and newly maybe-reachable chunks on
+ * data's maybe-reachable queue exactly as check_reachability_pointer()
+ * would have.
+ */
+static void
+scan_level_replay(reachability_data_t *data)
+{
+    scan_item_list_t swap;
+    uint i, j;
+    scan_next_items.num = 0;
+    for (i = 0; i < scan_level_items.num; i++) {
+        scan_item_t *item = &scan_level_items.items[i];
+        scan_worker_t *worker = &scan_workers[item->worker];
+        for (j = item->events_begin; j < item->events_end; j++) {
+            scan_chunk_t *chunk = worker->events[j].chunk;
+            if (chunk->reached)
+                continue;
+            if (!worker->events[j].maybe) {
+                chunk->reached = true;
+                scan_item_add(&scan_next_items, chunk->start, chunk->end, chunk->end);
+            } else if (!chunk->maybe_reached) {
+                pc_entry_t *add = (pc_entry_t *)
+                    global_alloc(sizeof(*add), HEAPSTAT_MISC);
+                chunk->maybe_reached = true;
+                add->start = chunk->start;
+                add->end = chunk->end;
+                add->next = NULL;
+                queue_add(&data->midreachq_head, &data->midreachq_tail, add);
+            }
+        }
+    }
+    for (i = 0; i < scan_num_workers; i++)
+        scan_workers[i].num_events = 0;
+    swap = scan_level_items;
+    scan_level_items = scan_next_items;
+    scan_next_items = swap;
+}
+
+/* Runs the primary scan one level at a time, building data's
+ * maybe-reachable queue.
+ */
+static void
+scan_parallel_run(reachability_data_t *data)
+{
+    uint i, level;
+    /* The registers were already scanned by worker 0: they are the first
+     * root item, followed by the root pieces.
+     */
+    scan_level_items.num = 0;
+    scan_item_add(&scan_level_items, NULL, NULL, NULL);
+    scan_level_items.items[0].worker = 0;
+    scan_level_items.items[0].events_begin = 0;
+    scan_level_items.items[0].events_end = scan_workers[0].num_events;
+    scan_collect_roots(&scan_level_items);
+    LOG(1, "parallel leak scan: %d workers, %d root pieces, %d chunks\n",
+        scan_num_workers, scan_level_items.num - 1, scan_num_chunks);
+    scan_next_item = 1;
+    for (level = 0; scan_level_items.num > 0; level++) {
+        LOG(2, "parallel leak scan level %d: %d items\n", level, scan_level_items.num);
+        scan_workers_finished = 0;
+        for (i = 1; i < scan_num_workers; i++)
+            dr_event_signal(scan_workers[i].go_event);
+        scan_worker_run(&scan_workers[0]);
+        while (scan_workers_finished < (int) scan_num_workers - 1)
+            dr_thread_yield();
+        scan_level_replay(data);
+        scan_level_is_roots = false;
+        scan_next_item = 0;
+    }
+}
+
+/* Transfers the parallel scan's results to the malloc table's client flags */
+static void
+scan_parallel_end(void)
+{
+    uint i;
+    for (i = 0; i < scan_num_chunks; i++) {
+        scan_chunk_t *chunk = &scan_chunks[i];
+        uint flags = 0;
+        if (chunk->reached)
+            flags |= MALLOC_REACHABLE;
+        if (chunk->maybe_reached)
+            flags |= MALLOC_MAYBE_REACHABLE;
+        if (flags != 0) {
+            IF_DEBUG(bool found =)
+                malloc_set_client_flag(chunk->start, flags);
+            ASSERT(found, "malloc chunk must be in hashtable");
+        }
+    }
+    global_free(scan_chunks, scan_num_chunks * sizeof(*scan_chunks), HEAPSTAT_MISC);
+    scan_chunks = NULL;
+    scan_num_chunks = 0;
+#ifdef STATISTICS
+    for (i = 0; i < scan_num_workers; i++) {
+        scan_stats_t *stats = &scan_workers[i].stats;
+        midchunk_postsize_ptrs += stats->midchunk_postsize_ptrs;
+        midchunk_postnew_ptrs += stats->midchunk_postnew_ptrs;
+        midchunk_postinheritance_ptrs += stats->midchunk_postinheritance_ptrs;
+        midchunk_string_ptrs += stats->midchunk_string_ptrs;
+        strings_not_pointers += stats->strings_not_pointers;
+        leak_scan_words += stats->leak_scan_words;
+        leak_scan_candidates += stats->leak_scan_candidates;
+    }
+#endif
+}
+
 static bool
 malloc_iterate_identify_indirect_cb(malloc_info_t *info, void *iter_data)
 {
@@ -1226,6 +2064,40 @@ malloc_iterate_identify_indirect_cb(malloc_info_t *info, void *iter_data)
     return true;
 }
 
+/* The client data of the leaks we're about to report */
+typedef struct _leak_report_list_t {
+    void **client_data;
+    uint num;
+    uint capacity;
+} leak_report_list_t;
+
+static bool
+malloc_iterate_gather_leaks_cb(malloc_info_t *info, void *iter_data)
+{
+    leak_report_list_t *list = (leak_report_list_t *) iter_data;
+    /* Reachable chunks are only reported with -show_reachable, and early
+     * ones are reported without their client data.
+     */
+    if (!TESTANY(MALLOC_IGNORE_LEAK | MALLOC_INDIRECTLY_REACHABLE, info->client_flags) &&
+        (op_show_reachable || !TEST(MALLOC_REACHABLE, info->client_flags)) &&
+        !info->pre_us && info->client_data != NULL) {
+        if (list->num == list->capacity) {
+            uint new_cap = (list->capacity == 0) ? 64 : list->capacity * 2;
+            void **grown = (void **)
+                global_alloc(new_cap * sizeof(*grown), HEAPSTAT_MISC);
+            if (list->client_data != NULL) {
+                memcpy(grown, list->client_data, list->num * sizeof(*grown));
+                global_free(list->client_data, list->capacity * sizeof(*grown),
+                            HEAPSTAT_MISC);
+            }
+            list->client_data = grown;
+            list->capacity = new_cap;
+        }
+        list->client_data[list->num++] = info->client_data;
+    }
+    return true;
+}
+
 static bool
 malloc_iterate_cb(malloc_info_t *info, void *iter_data)
 {
@@ -1343,9 +2215,10 @@ leak_scan_for_leaks(bool at_exit)
     bool *was_app_state = NULL;
     uint num_threads = 0, i;
     dr_mcontext_t mc; /* do not init whole thing: memset is expensive */
-    reachability_data_t data;
+    reachability_data_t data, *root_data;
     void *my_drcontext = dr_get_current_drcontext();
     dr_mem_info_t mem_info;
+    bool parallel;
 #ifdef DEBUG
     static bool called_at_exit;
     if (at_exit) {
@@ -1418,6 +2291,10 @@ leak_scan_for_leaks(bool at_exit)
      * overhead shows up on heap-intensive bmarks (PR 535568).
      */
     malloc_iterate(malloc_iterate_build_tree_cb, (void *) data.alloc_tree);
+    pointer_filter_build(data.alloc_tree);
+
+    parallel = scan_parallel_begin(&data, at_exit);
+    root_data = parallel ? &scan_workers[0].data : &data;
 
     if (!at_exit || !op_have_defined_info) {
         /* Walk the thread's registers.  We rely on mcontext field ordering here. */
@@ -1425,20 +2302,25 @@ leak_scan_for_leaks(bool at_exit)
             LOG(3, "\nwalking registers of thread "TIDFMT"\n",
                 dr_get_thread_id(drcontexts[i]));
             dr_get_mcontext(drcontexts[i], &mc);
-            check_reachability_regs(drcontexts[i], &mc, &data);
+            check_reachability_regs(drcontexts[i], &mc, root_data);
         }
         LOG(3, "\nwalking registers of thread "TIDFMT"\n",
             dr_get_thread_id(my_drcontext));
         dr_get_mcontext(my_drcontext, &mc);
-        check_reachability_regs(my_drcontext, &mc, &data);
+        check_reachability_regs(my_drcontext, &mc, root_data);
     }
 
-    check_reachability_helper(NULL, (app_pc)POINTER_MAX, true/*skip heap*/, &data);
-    LOG(3, "\nwalking reachable-chunk queue\n");
-    for (e = data.reachq_head; e != NULL; e = next_e) {
-        check_reachability_helper(e->start, e->end, false, &data);
-        next_e = e->next;
-        global_free(e, sizeof(*e), HEAPSTAT_MISC);
+    if (parallel) {
+        scan_parallel_run(&data);
+        scan_parallel_end();
+    } else {
+        check_reachability_helper(NULL, (app_pc)POINTER_MAX, true/*skip heap*/, &data);
+        LOG(3, "\nwalking reachable-chunk queue\n");
+        for (e = data.reachq_head; e != NULL; e = next_e) {
+            check_reachability_helper(e->start, e->end, false, &data);
+            next_e = e->next;
+            global_free(e, sizeof(*e), HEAPSTAT_MISC);
+        }
     }
     data.primary_scan = false;
 
@@ -1480,6 +2362,18 @@ leak_scan_for_leaks(bool at_exit)
 
     /* up to caller to call report_leak_stats_{checkpoint,revert} if desired */
 
+    /* Let the client prepare for reporting all the leaks at once */
+    {
+        leak_report_list_t list = {NULL, 0, 0};
+        malloc_iterate(malloc_iterate_gather_leaks_cb, &list);
+        if (list.num > 0)
+            client_prepare_leak_reports(list.client_data, list.num);
+        if (list.client_data != NULL) {
+            global_free(list.client_data, list.capacity * sizeof(*list.client_data),
+                        HEAPSTAT_MISC);
+        }
+    }
+
     /* in order to separate reachable from real leaks we do two passes */
     if (op_show_reachable)
         data.first_of_2_iters = true;
@@ -1499,7 +2393,77 @@ leak_scan_for_leaks(bool at_exit)
     /* We do not maintain the tree throughout execution: we make a new one for
      * each reachability scan.
      */
+    pointer_filter_free();
     rb_iterate(data.alloc_tree, rb_cleanup_entries, NULL);
     rb_tree_destroy(data.alloc_tree);
     rb_tree_destroy(data.stack_tree);
 }
+
+/***************************************************************************
+ * Unit tests
+ */
+
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+/* Compares the vector pointer filters against the scalar one for every
+ * start within a 32-byte vector and every block length, so each tail size
+ * is exercised, over words straddling both ends of the filter span.
+ */
+static void
+test_pointer_filter_kernels(void)
+{
+    pointer_filter_func_t kernels[3];
+    uint num_kernels = 0, k, shift, align, count, trial, i, seed = 1;
+    ptr_uint_t storage[FILTER_BLOCK_WORDS + 8 + 32/sizeof(ptr_uint_t)];
+    ptr_uint_t *buf = (ptr_uint_t *)ALIGN_FORWARD(storage, 32);
+    kernels[num_kernels++] = pointer_filter_scalar;
+#ifdef X86
+    if (proc_has_feature(FEATURE_SSE2))
+        kernels[num_kernels++] = pointer_filter_sse2;
+# ifdef HAVE_TARGET_AVX2
+    if (proc_avx_enabled() && cpu_has_avx2())
+        kernels[num_kernels++] = pointer_filter_avx2;
+# endif
+#endif
+    for (shift = 0; shift < sizeof(ptr_uint_t)*8 - 1; shift++) {
+        for (trial = 0; trial < 4; trial++) {
+            seed = seed * 1103515245 + 12345;
+            /* include a span that wraps around the top of the address space */
+            filter_min = (trial == 0) ? (ptr_uint_t)0 - ((ptr_uint_t)1 << shift) / 2 :
+                ((ptr_uint_t)seed << 12);
+            filter_shift = shift;
+            for (align = 0; align < 8; align++) {
+                ptr_uint_t *words = buf + align;
+                for (i = 0; i < FILTER_BLOCK_WORDS; i++) {
+                    seed = seed * 1103515245 + 12345;
+                    switch ((seed >> 16) % 5) {
+                    case 0: words[i] = filter_min; break;
+                    case 1: words[i] = filter_min + ((ptr_uint_t)1 << shift) - 1; break;
+                    case 2: words[i] = filter_min + ((ptr_uint_t)1 << shift); break;
+                    case 3: words[i] = filter_min - 1; break;
+                    default: words[i] = filter_min + (seed >> 8); break;
+                    }
+                }
+                for (count = 0; count <= FILTER_BLOCK_WORDS; count++) {
+                    uint want = 0;
+                    for (i = 0; i < count; i++) {
+                        if (words[i] - filter_min < ((ptr_uint_t)1 << shift))
+                            want |= 1U << i;
+                    }
+                    for (k = 0; k < num_kernels; k++)
+                        EXPECT(kernels[k](words, count) == want);
+                }
+            }
+        }
+    }
+    filter_min = 0;
+    filter_shift = 0;
+}
+
+void
+leak_unit_tests(void)
+{
+    test_pointer_filter_kernels();
+
+    /* add more tests here */
+}
+#endif
@@ -35,6 +35,8 @@ extern uint midchunk_postnew_ptrs;
 extern uint midchunk_postinheritance_ptrs;
 extern uint midchunk_string_ptrs;
 extern uint strings_not_pointers;
+extern uint leak_scan_words;
+extern uint leak_scan_candidates;
 # ifdef WINDOWS
 extern uint pointers_encoded;
 extern uint encoded_pointers_scanned;
@@ -50,6 +52,14 @@ client_found_leak(app_pc start, app_pc end, size_t indirect_bytes,
                   bool maybe_reachable, void *client_data,
                   bool count_reachable, bool show_reachable);
 
+/* Called with the client_data of every leak about to be passed to
+ * client_found_leak() by leak_scan_for_leaks(), so the client can batch
+ * any per-leak work.  Does not include leaks of allocations from before
+ * the tool took control.
+ */
+void
+client_prepare_leak_reports(void **client_data, uint num);
+
 /**************************/
 /* Must be called by client */
 
@@ -87,4 +97,9 @@ void
 leak_remove_malloc_on_destroy(HANDLE heap, byte *start, byte *end);
 #endif
 
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+void
+leak_unit_tests(void);
+#endif
+
 #endif /* _LEAK_H_ */
@@ -374,6 +374,9 @@ OPTION_CLIENT_BOOL(client, scan_read_only_files, false,
 OPTION_CLIENT_BOOL(client, strings_vs_pointers, true,
                    "Use heuristics to rule out sub-strings as leak scan pointers",
                    "Use heuristics to rule out sub-strings as leak scan pointers, preventing strings from anchoring heap objects and resulting in false negatives.")
+OPTION_CLIENT(client, leak_scan_threads, uint, 0, 0, 64,
+              "Number of threads to use for mid-run leak scans",
+              "If greater than 1, leak scans requested in the middle of a run (e.g., by a nudge) split their search for reachable allocations across this many threads, including the thread performing the scan.  The leaks and possible leaks reported are identical to those of a single-threaded scan.  The leak scan at process exit is always single-threaded.")
 OPTION_CLIENT_BOOL(client, show_reachable, false,
                    "List reachable allocs",
                    "Whether to list reachable allocations when leak checking.  Requires -check_leaks.")
@@ -457,6 +460,9 @@ OPTION_CLIENT_STRING(drmemscope, symcache_dir, "<install>/logs/symcache",
 OPTION_CLIENT(client, symcache_minsize, uint, 1000, 0, UINT_MAX,
                    "Minimum module size to cache symbols for",
                    "Minimum module size to cache symbols for.  Note that there's little downside to caching and it is pretty much always better to cache.")
+OPTION_CLIENT(client, symcache_preload_threads, uint, 0, 0, 64,
+              "Threads to use to read symbol caches at startup",
+              "Number of threads to use to read in the symbol cache files of the modules present at startup in parallel.  0 disables the preload, leaving each file to be read when its module load event is delivered.  Requires -use_symcache to be true.")
 OPTION_CLIENT_BOOL(drmemscope, use_symcache_postcall, true,
                    "Cache post-call sites to speed up future runs",
                    "Cache post-call sites to speed up future runs.  Requires -use_symcache to be true.")
@@ -478,7 +484,7 @@ OPTION_CLIENT_BOOL(drmemscope, warn_null_ptr, false,
                    "Whether to warn when NULL is passed to free() or realloc().")
 OPTION_CLIENT_SCOPE(drmemscope, delay_frees, uint, 2000, 0, UINT_MAX,
                     "Frees to delay before committing",
-                    "Frees to delay before committing.  The larger this number, the greater the likelihood that "TOOLNAME" will identify use-after-free errors.  However, the larger this number, the more memory will be used.  This value is separate for each set of allocation routines and each Windows Heap.")
+                    "Frees to delay before committing.  The larger this number, the greater the likelihood that "TOOLNAME" will identify use-after-free errors.  However, the larger this number, the more memory will be used.  This value is separate for each set of allocation routines and each Windows Heap.  With -no_replace_malloc, the delayed frees are split evenly among up to 8 queues, with each thread using one of them, so a single thread's frees are delayed by a fraction of this value.")
 OPTION_CLIENT_SCOPE(drmemscope, delay_frees_maxsz, uint, 20000000, 0, UINT_MAX,
                     "Maximum size of frees to delay before committing",
                     "Maximum size of frees to delay before committing.  The larger this number, the greater the likelihood that "TOOLNAME" will identify use-after-free errors.  However, the larger this number, the more memory will be used.  This value is separate for each set of allocation routines and each Windows Heap.")
@@ -878,6 +884,30 @@ OPTION_CLIENT(internal, share_xl8_max_diff, uint, 2048, 0, SHADOW_REDZONE_SIZE*4
 OPTION_CLIENT(internal, share_xl8_max_flushes, uint, 64, 0, UINT_MAX,
               "How many flushes before abandoning sharing altogether",
               "How many flushes before abandoning sharing altogether")
+OPTION_CLIENT_BOOL(internal, shadow_simd, true,
+                   "Use SIMD kernels for shadow range scans",
+                   "Use SSE2 or AVX2 kernels, selected at runtime via CPUID, when scanning large shadow ranges.  If disabled, the scalar reference kernel is used.")
+OPTION_CLIENT_BOOL(internal, leak_scan_simd, true,
+                   "Use SIMD kernels to filter leak scan pointer candidates",
+                   "Use SSE2 or AVX2 kernels, selected at runtime via CPUID, to discard words that cannot point into the heap before looking them up during a leak scan.  If disabled, a scalar filter is used.")
+OPTION_CLIENT_BOOL(internal, callstack_tree, false,
+                   "Store malloc callstacks in a calling-context tree",
+                   "Store the frames of unique malloc callstacks in a tree shared by all of them, so that callstacks with common outer frames share the memory for those frames.  A tree node costs nearly three times what a frame in a callstack's own array does, so this only saves memory when unique callstacks share most of their outer frames.  If disabled, each unique callstack has its own array of frames.")
+OPTION_CLIENT_BOOL(internal, callstack_memoize, true,
+                   "Reuse the outer frames of recent callstack walks",
+                   "When walking the stack for a malloc callstack, reuse the rest of one of the thread's recent walks once the frame pointer walk reaches one of its frames, after checking that those frames are still on the stack.  If disabled, every callstack is walked in full.")
+OPTION_CLIENT_BOOL(internal, callstack_use_cfi, true,
+                   "Use .eh_frame unwind info to walk callstacks",
+                   "Where a module has .eh_frame unwind information covering a frame, use it to find the caller's frame rather than following the frame pointer or scanning the stack.  This finds frames in code built without frame pointers.  Currently only supported on Linux.")
+OPTION_CLIENT_BOOL(internal, symbol_lookup_cache, true,
+                   "Cache symbol lookups by module offset",
+                   "Cache the result of each symbol lookup by module and offset, so that a frame shared by many reported callstacks is only looked up once.  Also look up the symbols for all leaks being reported in one pass per module, in offset order, before reporting them.")
+OPTION_CLIENT_BOOL(internal, suppress_index, true,
+                   "Index suppressions by top frame",
+                   "Index suppressions by their top frame when it contains no wildcards, so that each new error is only compared against the suppressions that could match it, and remember which suppression each distinct callstack matched.")
+OPTION_CLIENT_BOOL(internal, suppress_cache, true,
+                   "Cache suppression results by callstack",
+                   "Remember which suppression, if any, matched each callstack for each error type, so that a callstack seen again does not need to be symbolized to determine whether it is suppressed.")
 OPTION_CLIENT_BOOL(internal, check_memset_unaddr, true,
                    "Check for in-heap unaddr in memset",
                    "Check for in-heap unaddr in memset")
@@ -920,6 +950,9 @@ OPTION_CLIENT_BOOL(internal, pattern_use_malloc_tree, false,
 OPTION_CLIENT_BOOL(internal, replace_malloc, true,
                    "Replace malloc rather than wrapping existing routines",
                    "Replace malloc with custom routines rather than wrapping existing routines.  Replacing is more efficient and avoids several issues with the Windows debug C library where wrapping must disable some of Dr. Memory's checks.")
+OPTION_CLIENT_BOOL(internal, replace_malloc_thread_cache, false,
+                   "Use per-thread caches of free chunks with -replace_malloc",
+                   "With -replace_malloc, keeps a small per-thread cache of free chunks for each small size class so that most allocations need not acquire the heap lock.  Small frees are queued per thread and added to the -delay_frees queue in batches, and a chunk still passes through that queue before it becomes eligible for a cache.  Currently UNIX-only, and ignored with -pattern.")
 OPTION_CLIENT_SCOPE(internal, pattern_max_2byte_faults, int, 0x1000, -1, INT_MAX,
                     "The max number of faults caused by 2-byte pattern checks we could tolerate before switching to 4-byte checks only",
                     "The max number of faults caused by 2-byte pattern checks we could tolerate before switching to 4-byte checks only. 0 means do not use 2-byte checks, and negative value means always use 2-byte checks")
@@ -42,6 +42,7 @@
 # include <errno.h>
 #endif
 #include <limits.h>
+#include <ctype.h> /* for tolower */
 
 #define FUZZER_MSG_SZ 0x100
 
@@ -353,6 +354,22 @@ print_double_null_term_string(const char *s, const char *sep);
  * suppression list
  */
 
+/* Each pattern string is classified once, when its suppression is finished, so
+ * that the common cases can be matched without the general wildcard matcher.
+ * A zeroed pattern is SUPP_PAT_GLOB and thus always safe to use.
+ */
+typedef enum {
+    SUPP_PAT_GLOB,    /* general pattern: use text_matches_pattern() */
+    SUPP_PAT_ANY,     /* only '*'s: matches everything */
+    SUPP_PAT_LITERAL, /* no wildcards */
+    SUPP_PAT_PREFIX   /* literal followed by trailing '*'s */
+} supp_pattern_kind_t;
+
+typedef struct _supp_pattern_t {
+    supp_pattern_kind_t kind;
+    size_t literal_len; /* for SUPP_PAT_PREFIX */
+} supp_pattern_t;
+
 /* For each error type, we have a list of callstacks, with each
  * callstack a list of frames
  */
@@ -363,6 +380,9 @@ typedef struct _suppress_frame_t {
     char *modname;
     char *modoffs; /* string b/c we allow wildcards in it */
     char *func;
+    supp_pattern_t modname_pat;
+    supp_pattern_t modoffs_pat;
+    supp_pattern_t func_pat;
     struct _suppress_frame_t *next;
 } suppress_frame_t;
 
@@ -373,6 +393,7 @@ struct _suppress_spec_t {
     char *name;
     uint count_used;
     char *instruction; /* i#498 */
+    supp_pattern_t instruction_pat;
     uint num_frames;
     suppress_frame_t *frames;
     suppress_frame_t *last_frame;
@@ -385,6 +406,11 @@ struct _suppress_spec_t {
      * list.
      */
     struct _suppress_spec_t *next;
+    /* Position in supp_list[type], and the next spec in the same index bucket,
+     * both set by suppress_index_build().
+     */
+    uint index;
+    struct _suppress_spec_t *next_candidate;
 };
 
 /* We suppress error type separately (PR 507837) */
@@ -392,6 +418,79 @@ static suppress_spec_t *supp_list[ERROR_MAX_VAL];
 static uint supp_num[ERROR_MAX_VAL];
 static bool have_module_wildcard;
 
+/* With thousands of suppressions, walking supp_list for every new error is
+ * expensive, so once all files are read we index each type's list.  A spec
+ * whose top frame is a literal "mod!func" (or a literal non-module frame) can
+ * only match a callstack with that same top frame (or second frame, when the
+ * top one is skipped: i#1189), so it goes into a bucket keyed by that frame.
+ * All other specs go on a residual list that is always checked.  Both hold
+ * specs in supp_list order, and we merge them by index to preserve the
+ * first-match semantics that the usage counts depend on.
+ *
+ * When the callstack's packed form is not available to key supp_verdict_table
+ * below, we instead memoize the verdict keyed by the callstack fields that the
+ * type's suppressions can look at.  A run with many distinct callstacks would
+ * grow the memo without bound, so once it holds SUPP_MEMO_MAX_ENTRIES keys we
+ * clear it and start over.
+ * The memo is protected by error_lock, which our callers hold.
+ */
+typedef struct _supp_bucket_t {
+    suppress_spec_t *head;
+    suppress_spec_t *tail;
+} supp_bucket_t;
+
+typedef struct _supp_index_t {
+    hashtable_t literal_table; /* "mod!func" => supp_bucket_t */
+    supp_bucket_t residual;
+    bool uses_modoffs;         /* any "<mod+offs>" frames */
+    bool uses_instruction;     /* any "instruction=" restrictions */
+    hashtable_t memo_table;    /* callstack key => suppress_spec_t or no-match */
+} supp_index_t;
+
+#define SUPP_LITERAL_HASH_BITS 8
+#define SUPP_MEMO_HASH_BITS 10
+#define SUPP_MEMO_MAX_ENTRIES 4096
+/* Memo keys longer than this are not memoized */
+#define SUPP_KEY_MAX 4096
+/* A symbolized frame's "mod!func" always fits in this, so a literal top frame
+ * with a longer key could never match and is left unindexed.
+ */
+#define SUPP_FRAME_KEY_MAX (MAX_SYMBOL_LEN + 1)
+
+static supp_index_t supp_index[ERROR_MAX_VAL];
+static bool supp_index_built;
+/* Memo payload for "no suppression matched" */
+static byte supp_memo_no_match;
+/* Protected by error_lock */
+static char supp_memo_key[SUPP_KEY_MAX];
+
+/* The primary verdict cache: for each packed callstack and suppression list
+ * consulted, which spec matched, so that a callstack seen before (e.g., leaked
+ * under another leak type, as every leak type falls back to the ERROR_LEAK
+ * list, or seen before a fork reset) can be judged without symbolizing it.
+ * Like the memo above, it is cleared once it holds SUPP_VERDICT_MAX_ENTRIES.
+ * Protected by error_lock.
+ */
+typedef struct _supp_verdict_t {
+    packed_callstack_t *pcs;
+    uint type;             /* the supp_list[] consulted */
+    suppress_spec_t *spec; /* NULL if nothing matched */
+} supp_verdict_t;
+
+#define SUPP_VERDICT_HASH_BITS 10
+#define SUPP_VERDICT_MAX_ENTRIES 4096
+static hashtable_t supp_verdict_table;
+
+#ifdef STATISTICS
+static uint suppress_checks;
+static uint suppress_memo_hits;
+static uint suppress_memo_clears;
+static uint suppress_specs_compared;
+static uint suppress_verdict_hits;
+static uint suppress_verdict_misses;
+static uint suppress_verdict_clears;
+#endif
+
 #ifdef USE_DRSYMS
 static void *suppress_file_lock;
 #endif
@@ -459,10 +558,13 @@ suppress_spec_create(int type, bool is_default)
     spec->name = NULL; /* for i#50 NYI */
     spec->num = num_suppressions;
     spec->instruction = NULL;
+    spec->instruction_pat.kind = SUPP_PAT_GLOB;
     spec->num_frames = 0;
     spec->frames = NULL;
     spec->last_frame = NULL;
     spec->next = NULL;
+    spec->index = 0;
+    spec->next_candidate = NULL;
     return spec;
 }
 
@@ -534,11 +636,67 @@ is_module_wildcard(suppress_spec_t *spec)
             spec->frames[0].func[1] == '\0');
 }
 
+static void
+supp_pattern_compile(supp_pattern_t *pat, const char *pattern)
+{
+    const char *c;
+    pat->kind = SUPP_PAT_GLOB;
+    pat->literal_len = 0;
+    if (pattern == NULL)
+        return;
+    for (c = pattern; *c != '\0' && *c != '*' && *c != '?'; c++)
+        ; /* empty */
+    if (*c == '\0') {
+        pat->kind = SUPP_PAT_LITERAL;
+        return;
+    }
+    pat->literal_len = c - pattern;
+    while (*c == '*')
+        c++;
+    if (*c == '\0')
+        pat->kind = (pat->literal_len == 0) ? SUPP_PAT_ANY : SUPP_PAT_PREFIX;
+}
+
+static inline bool
+supp_char_equal(char a, char b, bool ignore_case)
+{
+    /* Same case folding as text_matches_pattern() */
+    if (ignore_case)
+        return (char) tolower(a) == (char) tolower(b);
+    return a == b;
+}
+
+static bool
+supp_pattern_matches(const char *text, const char *pattern, const supp_pattern_t *pat,
+                     bool ignore_case)
+{
+    size_t i;
+    switch (pat->kind) {
+    case SUPP_PAT_ANY:
+        return true;
+    case SUPP_PAT_LITERAL:
+        for (i = 0; text[i] != '\0'; i++) {
+            if (!supp_char_equal(text[i], pattern[i], ignore_case))
+                return false;
+        }
+        return pattern[i] == '\0';
+    case SUPP_PAT_PREFIX:
+        for (i = 0; i < pat->literal_len; i++) {
+            if (text[i] == '\0' || !supp_char_equal(text[i], pattern[i], ignore_case))
+                return false;
+        }
+        return true;
+    default:
+        return text_matches_pattern(text, pattern, ignore_case);
+    }
+}
+
 static suppress_spec_t *
 suppress_spec_finish(suppress_spec_t *spec,
                      const char *orig_start,
                      const char *orig_end)
 {
+    suppress_frame_t *frame;
     ASSERT(spec->type >= 0 && spec->type < ERROR_MAX_VAL, "internal error type error");
     if (spec->frames == NULL) {
         report_malformed_suppression(orig_start, orig_end,
@@ -550,6 +708,12 @@ suppress_spec_finish(suppress_spec_t *spec,
                                      "The given suppression ends with '...'");
         ASSERT(false, "should not reach here");
     }
+    supp_pattern_compile(&spec->instruction_pat, spec->instruction);
+    for (frame = spec->frames; frame != NULL; frame = frame->next) {
+        supp_pattern_compile(&frame->modname_pat, frame->modname);
+        supp_pattern_compile(&frame->modoffs_pat, frame->modoffs);
+        supp_pattern_compile(&frame->func_pat, frame->func);
+    }
     LOG(3, "added suppression #%d of type %s\n", spec->num, suppress_name[spec->type]);
     /* insert into list */
     spec->next = supp_list[spec->type];
@@ -997,8 +1161,8 @@ frame_matches_modname(const error_callstack_t *ecs, uint idx,
 {
     ASSERT(supp != NULL && supp->is_module && supp->modname != NULL,
            "Must have a suppression with a modname!");
-    return text_matches_pattern(symbolized_callstack_frame_modname(&ecs->scs, idx),
-                                supp->modname, FILESYS_CASELESS);
+    return supp_pattern_matches(symbolized_callstack_frame_modname(&ecs->scs, idx),
+                                supp->modname, &supp->modname_pat, FILESYS_CASELESS);
 }
 
 static bool
@@ -1028,8 +1192,9 @@ top_frame_matches_suppression_frame(const error_callstack_t *ecs,
 
     if (!supp->is_module) {
         return (!symbolized_callstack_frame_is_module(&ecs->scs, idx) &&
-                text_matches_pattern(symbolized_callstack_frame_func(&ecs->scs, idx),
-                                     supp->func, false/*consider case*/));
+                supp_pattern_matches(symbolized_callstack_frame_func(&ecs->scs, idx),
+                                     supp->func, &supp->func_pat,
+                                     false/*consider case*/));
     }
 
     if (supp->func == NULL) {
@@ -1037,8 +1202,9 @@ top_frame_matches_suppression_frame(const error_callstack_t *ecs,
         if (!symbolized_callstack_frame_is_module(&ecs->scs, idx))
             return false;
         return (frame_matches_modname(ecs, idx, supp) &&
-                text_matches_pattern(symbolized_callstack_frame_modoffs(&ecs->scs, idx),
-                                     supp->modoffs, true/*ignore case*/));
+                supp_pattern_matches(symbolized_callstack_frame_modoffs(&ecs->scs, idx),
+                                     supp->modoffs, &supp->modoffs_pat,
+                                     true/*ignore case*/));
     } else {
         /* "mod!fun" suppression frame */
         const char *func = symbolized_callstack_frame_func(&ecs->scs, idx);
@@ -1054,7 +1220,8 @@ top_frame_matches_suppression_frame(const error_callstack_t *ecs,
             symbolized_callstack_frame_modname(&ecs->scs, idx),
             symbolized_callstack_frame_func(&ecs->scs, idx));
         return (frame_matches_modname(ecs, idx, supp) &&
-                text_matches_pattern(func, supp->func, false/*consider case*/));
+                supp_pattern_matches(func, supp->func, &supp->func_pat,
+                                     false/*consider case*/));
     }
 }
 
@@ -1068,8 +1235,8 @@ stack_matches_suppression(const error_callstack_t *ecs, const suppress_spec_t *s
 
     /* i#498: allow restricting by instruction */
     if (spec->instruction != NULL) {
-        if (!text_matches_pattern(ecs->instruction, spec->instruction,
-                                  false/*consider case*/)) {
+        if (!supp_pattern_matches(ecs->instruction, spec->instruction,
+                                  &spec->instruction_pat, false/*consider case*/)) {
             LOG(4, "  supp: instruction \"%s\" != \"%s\"\n",
                 ecs->instruction, spec->instruction);
             return false;
@@ -1130,46 +1297,406 @@ stack_matches_suppression(const error_callstack_t *ecs, const suppress_spec_t *s
     return (supp == NULL);
 }
 
+/* Writes the index key for a frame into buf.  Returns false if it does not fit. */
 static bool
-on_suppression_list_helper(uint type, error_callstack_t *ecs,
-                           suppress_spec_t **matched OUT)
+supp_frame_key(char *buf, size_t bufsz, bool is_module, const char *modname,
+               const char *func)
+{
+    int len = dr_snprintf(buf, bufsz, "%s!%s", is_module ? modname : "", func);
+    if (len < 0 || (size_t)len >= bufsz)
+        return false;
+    if (FILESYS_CASELESS && is_module) {
+        char *c;
+        for (c = buf; *c != '!'; c++)
+            *c = (char) tolower(*c);
+    }
+    return true;
+}
+
+static bool
+supp_frame_is_replace_routine(const char *modname, const char *func)
+{
+    return (func != NULL &&
+            text_matches_pattern(func, "replace_*", false/*consider case*/) &&
+            (modname == NULL ||
+             text_matches_pattern(modname, DRMEMORY_LIBNAME, FILESYS_CASELESS)));
+}
+
+static void
+supp_bucket_append(supp_bucket_t *bucket, suppress_spec_t *spec)
+{
+    if (bucket->tail == NULL)
+        bucket->head = spec;
+    else
+        bucket->tail->next_candidate = spec;
+    bucket->tail = spec;
+}
+
+static void
+supp_bucket_free(void *p)
+{
+    global_free(p, sizeof(supp_bucket_t), HEAPSTAT_REPORT);
+}
+
+static void
+suppress_index_build(void)
+{
+    uint type;
+    char key[SUPP_FRAME_KEY_MAX];
+    for (type = 0; type < ERROR_MAX_VAL; type++) {
+        supp_index_t *idx = &supp_index[type];
+        suppress_spec_t *spec;
+        uint num = 0, num_literal = 0;
+        hashtable_init_ex(&idx->literal_table, SUPP_LITERAL_HASH_BITS, HASH_STRING,
+                          true/*strdup*/, false/*!synch: read-only once built*/,
+                          supp_bucket_free, NULL, NULL);
+        hashtable_init_ex(&idx->memo_table, SUPP_MEMO_HASH_BITS, HASH_STRING,
+                          true/*strdup*/, false/*!synch: using error_lock*/,
+                          NULL, NULL, NULL);
+        for (spec = supp_list[type]; spec != NULL; spec = spec->next) {
+            suppress_frame_t *top = spec->frames, *frame;
+            spec->index = num++;
+            spec->next_candidate = NULL;
+            if (spec->instruction != NULL)
+                idx->uses_instruction = true;
+            for (frame = spec->frames; frame != NULL; frame = frame->next) {
+                if (frame->modoffs != NULL)
+                    idx->uses_modoffs = true;
+            }
+            if (!top->is_ellipsis && !top->is_star && top->func != NULL &&
+                top->func_pat.kind == SUPP_PAT_LITERAL &&
+                (!top->is_module ||
+                 (top->modname != NULL && top->modname_pat.kind == SUPP_PAT_LITERAL)) &&
+                /* a top replace_ frame may be skipped (i#1189) */
+                (options.replace_malloc ||
+                 !supp_frame_is_replace_routine(top->modname, top->func)) &&
+                supp_frame_key(key, BUFFER_SIZE_ELEMENTS(key), top->is_module,
+                               top->modname, top->func)) {
+                supp_bucket_t *bucket = hashtable_lookup(&idx->literal_table, key);
+                if (bucket == NULL) {
+                    bucket = global_alloc(sizeof(*bucket), HEAPSTAT_REPORT);
+                    bucket->head = NULL;
+                    bucket->tail = NULL;
+                    hashtable_add(&idx->literal_table, key, bucket);
+                }
+                supp_bucket_append(bucket, spec);
+                num_literal++;
+            } else
+                supp_bucket_append(&idx->residual, spec);
+        }
+        LOG(1, "suppression index for %s: %d literal top frames, %d residual\n",
+            suppress_name[type], num_literal, num - num_literal);
+    }
+    supp_index_built = true;
+}
+
+static void
+suppress_index_free(void)
+{
+    uint type;
+    if (!supp_index_built)
+        return;
+    for (type = 0; type < ERROR_MAX_VAL; type++) {
+        hashtable_delete(&supp_index[type].literal_table);
+        hashtable_delete_with_stats(&supp_index[type].memo_table, "suppression memo");
+    }
+}
+
+static supp_bucket_t *
+supp_index_lookup(supp_index_t *idx, const error_callstack_t *ecs, uint frame)
+{
+    char key[SUPP_FRAME_KEY_MAX];
+    if (!supp_frame_key(key, BUFFER_SIZE_ELEMENTS(key),
+                        symbolized_callstack_frame_is_module(&ecs->scs, frame),
+                        symbolized_callstack_frame_modname(&ecs->scs, frame),
+                        symbolized_callstack_frame_func(&ecs->scs, frame)))
+        return NULL;
+    return (supp_bucket_t *) hashtable_lookup(&idx->literal_table, key);
+}
+
+/* Writes the memo key for ecs into supp_memo_key: every callstack field that
+ * a suppression of this type could examine.  Returns false if it does not fit.
+ */
+static bool
+supp_memo_key_build(supp_index_t *idx, const error_callstack_t *ecs)
 {
+    char *buf = supp_memo_key;
+    size_t bufsz = BUFFER_SIZE_ELEMENTS(supp_memo_key);
+    size_t sofar = 0;
+    ssize_t len;
+    uint i;
+    if (idx->uses_instruction)
+        BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len, "%s\n", ecs->instruction);
+    for (i = 0; i < ecs->scs.num_frames && sofar < bufsz; i++) {
+        if (!supp_frame_key(buf + sofar, bufsz - sofar,
+                            symbolized_callstack_frame_is_module(&ecs->scs, i),
+                            symbolized_callstack_frame_modname(&ecs->scs, i),
+                            symbolized_callstack_frame_func(&ecs->scs, i)))
+            return false;
+        sofar += strlen(buf + sofar);
+        if (idx->uses_modoffs && symbolized_callstack_frame_is_module(&ecs->scs, i)) {
+            BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len, "+%s",
+                               symbolized_callstack_frame_modoffs(&ecs->scs, i));
+        }
+        BUFPRINT_NO_ASSERT(buf, bufsz, sofar, len, "\n");
+    }
+    return sofar < bufsz - 1;
+}
+
+/* Returns the first spec in supp_list order from the candidate lists, advancing
+ * the list it came from.
+ */
+static suppress_spec_t *
+supp_candidates_next(suppress_spec_t **lists, uint num_lists)
+{
+    uint i, min = num_lists;
     suppress_spec_t *spec;
-    ASSERT(type >= 0 && type < ERROR_MAX_VAL, "invalid error type");
-    for (spec = supp_list[type]; spec != NULL; spec = spec->next) {
+    for (i = 0; i < num_lists; i++) {
+        if (lists[i] != NULL && (min == num_lists || lists[i]->index < lists[min]->index))
+            min = i;
+    }
+    if (min == num_lists)
+        return NULL;
+    spec = lists[min];
+    lists[min] = spec->next_candidate;
+    return spec;
+}
+
+static suppress_spec_t *
+find_matching_suppression(uint type, error_callstack_t *ecs)
+{
+    supp_index_t *idx = &supp_index[type];
+    suppress_spec_t *lists[3];
+    uint num_lists = 0;
+    suppress_spec_t *spec;
+    supp_bucket_t *bucket, *skip_bucket = NULL;
+
+    if (!options.suppress_index || !supp_index_built) {
+        for (spec = supp_list[type]; spec != NULL; spec = spec->next) {
+            DOLOG(3, {
+                suppress_frame_print(LOGFILE_LOOKUP(), spec->frames,
+                                     "supp: comparing error to suppression pattern");
+            });
+            STATS_INC(suppress_specs_compared);
+            if (stack_matches_suppression(ecs, spec))
+                return spec;
+        }
+        return NULL;
+    }
+
+    lists[num_lists++] = idx->residual.head;
+    if (ecs->scs.num_frames > 0) {
+        bucket = supp_index_lookup(idx, ecs, 0);
+        if (bucket != NULL)
+            lists[num_lists++] = bucket->head;
+        /* stack_matches_suppression() skips a top replace_ frame (i#1189) */
+        if (options.replace_malloc && ecs->scs.num_frames > 1 &&
+            symbolized_callstack_frame_is_module(&ecs->scs, 0) &&
+            supp_frame_is_replace_routine
+            (symbolized_callstack_frame_modname(&ecs->scs, 0),
+             symbolized_callstack_frame_func(&ecs->scs, 0)))
+            skip_bucket = supp_index_lookup(idx, ecs, 1);
+        if (skip_bucket != NULL && skip_bucket != bucket)
+            lists[num_lists++] = skip_bucket->head;
+    }
+    while ((spec = supp_candidates_next(lists, num_lists)) != NULL) {
         DOLOG(3, {
             suppress_frame_print(LOGFILE_LOOKUP(), spec->frames,
                                  "supp: comparing error to suppression pattern");
         });
-        if (stack_matches_suppression(ecs, spec)) {
-            LOG(3, "matched suppression %s\n",
-                (spec->name == NULL) ? "<no name>" : spec->name);
-            if (matched != NULL)
-                *matched = spec;
-            spec->count_used++;
-            if (type_is_leak(type))
-                spec->bytes_leaked += ecs->bytes_leaked;
+        STATS_INC(suppress_specs_compared);
+        if (stack_matches_suppression(ecs, spec))
+            return spec;
+    }
+    return NULL;
+}
+
+static void
+suppress_spec_note_match(uint type, suppress_spec_t *spec, error_callstack_t *ecs,
+                         suppress_spec_t **matched OUT)
+{
+    LOG(3, "matched suppression %s\n", (spec->name == NULL) ? "<no name>" : spec->name);
+    if (matched != NULL)
+        *matched = spec;
+    spec->count_used++;
+    if (type_is_leak(type))
+        spec->bytes_leaked += ecs->bytes_leaked;
+}
+
+/* use_memo says whether to consult the symbolized-callstack memo, which we
+ * only do when the verdict is not being cached by packed callstack.
+ * Caller must hold error_lock.
+ */
+static bool
+on_suppression_list_helper(uint type, error_callstack_t *ecs, bool use_memo,
+                           suppress_spec_t **matched OUT)
+{
+    suppress_spec_t *spec;
+    supp_index_t *idx = &supp_index[type];
+    bool memoize = false;
+    ASSERT(type >= 0 && type < ERROR_MAX_VAL, "invalid error type");
+    STATS_INC(suppress_checks);
+    if (supp_list[type] == NULL)
+        return false;
+    if (use_memo && options.suppress_index && supp_index_built) {
+        memoize = supp_memo_key_build(idx, ecs);
+        if (memoize) {
+            spec = (suppress_spec_t *) hashtable_lookup(&idx->memo_table,
+                                                       supp_memo_key);
+            if (spec != NULL) {
+                STATS_INC(suppress_memo_hits);
+                if (spec == (suppress_spec_t *) &supp_memo_no_match)
+                    return false;
+                goto suppressed;
+            }
+        }
+    }
+    spec = find_matching_suppression(type, ecs);
+    if (memoize) {
+        if (idx->memo_table.entries >= SUPP_MEMO_MAX_ENTRIES) {
+            LOG(2, "suppression memo for %s is full: clearing\n", suppress_name[type]);
+            STATS_INC(suppress_memo_clears);
+            hashtable_clear(&idx->memo_table);
+        }
+        hashtable_add(&idx->memo_table, supp_memo_key,
+                      (spec == NULL) ? (void *) &supp_memo_no_match : (void *) spec);
+    }
+    if (spec == NULL)
+        return false;
+ suppressed:
+    suppress_spec_note_match(type, spec, ecs, matched);
+    return true;
+}
+
+static uint
+supp_verdict_hash(supp_verdict_t *verdict)
+{
+    return packed_callstack_hash(verdict->pcs) ^ verdict->type;
+}
+
+static bool
+supp_verdict_cmp(supp_verdict_t *verdict1, supp_verdict_t *verdict2)
+{
+    return (verdict1->type == verdict2->type &&
+            packed_callstack_cmp(verdict1->pcs, verdict2->pcs));
+}
+
+static void
+supp_verdict_free(supp_verdict_t *verdict)
+{
+    packed_callstack_free(verdict->pcs);
+    global_free(verdict, sizeof(*verdict), HEAPSTAT_REPORT);
+}
+
+/* Caller must hold error_lock */
+static void
+supp_verdict_record(uint type, packed_callstack_t *pcs, suppress_spec_t *spec)
+{
+    supp_verdict_t *verdict, key;
+    if (!options.suppress_cache || pcs == NULL || supp_list[type] == NULL)
+        return;
+    key.pcs = pcs;
+    key.type = type;
+    if (hashtable_lookup(&supp_verdict_table, &key) != NULL)
+        return;
+    if (supp_verdict_table.entries >= SUPP_VERDICT_MAX_ENTRIES) {
+        LOG(2, "suppression verdict cache is full: clearing\n");
+        STATS_INC(suppress_verdict_clears);
+        hashtable_clear(&supp_verdict_table);
+    }
+    verdict = global_alloc(sizeof(*verdict), HEAPSTAT_REPORT);
+    /* lifetimes differ so we must clone */
+    verdict->pcs = packed_callstack_clone(pcs);
+    verdict->type = type;
+    verdict->spec = spec;
+    hashtable_add(&supp_verdict_table, verdict, verdict);
+}
+
+/* Returns the suppression list types that on_suppression_list() consults for type */
+static uint
+suppress_list_types(uint type, uint types[2])
+{
+    uint num = 0;
+    types[num++] = type;
+    /* qualified leak reports should be checked against LEAK suppressions */
+    if (type_is_leak(type) && type != ERROR_LEAK)
+        types[num++] = ERROR_LEAK;
+    return num;
+}
+
+/* Determines whether pcs is suppressed for type from cached verdicts alone,
+ * without symbolizing it.  Returns false if the verdict is not known, in which
+ * case the caller should symbolize and call on_suppression_list().  Otherwise
+ * returns true and sets *suppressed and, if suppressed, *matched, updating the
+ * suppression's usage counts just like on_suppression_list().
+ * Caller must hold error_lock.
+ */
+static bool
+on_suppression_list_cached(uint type, packed_callstack_t *pcs, error_callstack_t *ecs,
+                           bool *suppressed OUT, suppress_spec_t **matched OUT)
+{
+    uint types[2], num, i;
+    supp_verdict_t *verdict, key;
+    ASSERT(type >= 0 && type < ERROR_MAX_VAL, "invalid error type");
+    if (!options.suppress_cache || pcs == NULL)
+        return false;
+    num = suppress_list_types(type, types);
+    for (i = 0; i < num; i++) {
+        if (supp_list[types[i]] == NULL)
+            continue;
+        key.pcs = pcs;
+        key.type = types[i];
+        verdict = (supp_verdict_t *) hashtable_lookup(&supp_verdict_table, &key);
+        if (verdict == NULL) {
+            STATS_INC(suppress_verdict_misses);
+            return false;
+        }
+        STATS_INC(suppress_verdict_hits);
+        if (verdict->spec != NULL) {
+            suppress_spec_note_match(types[i], verdict->spec, ecs, matched);
+            *suppressed = true;
             return true;
         }
     }
-    return false;
+    *suppressed = false;
+    return true;
 }
 
+/* pcs is the callstack that ecs was symbolized from, if any, for caching the
+ * verdict.  Caller must hold error_lock.
+ */
 static bool
-on_suppression_list(uint type, error_callstack_t *ecs, suppress_spec_t **matched OUT)
+on_suppression_list(uint type, packed_callstack_t *pcs, error_callstack_t *ecs,
+                    suppress_spec_t **matched OUT)
 {
+    uint types[2], num, i;
+    /* The string memo is only a fallback for verdicts we can't cache by pcs */
+    bool use_memo = (!options.suppress_cache || pcs == NULL);
     ASSERT(type >= 0 && type < ERROR_MAX_VAL, "invalid error type");
-    if (on_suppression_list_helper(type, ecs, matched))
-        return true;
-    /* qualified leak reports should be checked against LEAK suppressions */
-    if (type_is_leak(type) && type != ERROR_LEAK) {
-        if (on_suppression_list_helper(ERROR_LEAK, ecs, matched))
+    num = suppress_list_types(type, types);
+    for (i = 0; i < num; i++) {
+        suppress_spec_t *spec;
+        if (on_suppression_list_helper(types[i], ecs, use_memo, &spec)) {
+            supp_verdict_record(types[i], pcs, spec);
+            if (matched != NULL)
+                *matched = spec;
             return true;
+        }
+        supp_verdict_record(types[i], pcs, NULL);
     }
     LOG(3, "supp: no match\n");
     return false;
 }
 
+/* Whether print_error_report() prints suppressed errors, and thus needs their
+ * symbolized callstacks.
+ */
+static inline bool
+suppressed_errors_printed(void)
+{
+    return IF_DRSYMS_ELSE(options.log_suppressed_errors || options.verbose >= 2, true);
+}
+
 /* Returns true if we have a whole-module suppression of the same type covering
  * the app pc.  Updates the suppression usage counts if it does.
  */
@@ -1501,6 +2028,13 @@ report_init(void)
                       (void (*)(void*)) stored_error_free,
                       (uint (*)(void*)) stored_error_hash,
                       (bool (*)(void*, void*)) stored_error_cmp);
+    if (options.suppress_cache) {
+        hashtable_init_ex(&supp_verdict_table, SUPP_VERDICT_HASH_BITS, HASH_CUSTOM,
+                          false/*!str_dup*/, false/*using error_lock*/,
+                          (void (*)(void*)) supp_verdict_free,
+                          (uint (*)(void*)) supp_verdict_hash,
+                          (bool (*)(void*, void*)) supp_verdict_cmp);
+    }
 
 #ifdef USE_DRSYMS
     /* callstack.c wants these as null-separated, double-null-terminated */
@@ -1560,6 +2094,10 @@ report_init(void)
     callstack_ops.fp_flags = 0;
     if (!options.callstack_use_fp)
         callstack_ops.fp_flags |= FP_DO_NOT_WALK_FP;
+    if (!options.callstack_memoize)
+        callstack_ops.fp_flags |= FP_DO_NOT_MEMOIZE_WALK;
+    if (!options.callstack_use_cfi)
+        callstack_ops.fp_flags |= FP_DO_NOT_UNWIND_CFI;
     if (options.callstack_conservative) {
         /* We don't expose FP_VERIFY_CROSS_MODULE_TARGET, although it can be a big
          * perf win over FP_VERIFY_CALL_TARGET (see i#703 numbers) -- so should we
@@ -1597,6 +2135,8 @@ report_init(void)
     callstack_ops.dump_app_stack = options.callstack_dump_stack;
     callstack_ops.module_load = callstack_module_load_cb;
     callstack_ops.module_unload = callstack_module_unload_cb;
+    callstack_ops.frame_tree = options.callstack_tree;
+    callstack_ops.symbol_cache = options.symbol_lookup_cache;
     callstack_init(&callstack_ops);
 
 #ifdef USE_DRSYMS
@@ -1652,6 +2192,8 @@ report_init(void)
         open_and_read_suppression_file(c, false);
         c += strlen(c) + 1;
     }
+    if (options.suppress_index)
+        suppress_index_build();
 
     if (options.show_threads || options.show_all_threads) {
         main_thread = dr_get_thread_id(dr_get_current_drcontext());
@@ -1949,10 +2491,13 @@ report_exit(void)
     report_summary();
 
     hashtable_delete(&error_table);
+    if (options.suppress_cache)
+        hashtable_delete_with_stats(&supp_verdict_table, "suppression verdicts");
     dr_mutex_destroy(error_lock);
 
     callstack_exit();
 
+    suppress_index_free();
     for (i = 0; i < ERROR_MAX_VAL; i++) {
         suppress_spec_t *spec, *next;
         for (spec = supp_list[i]; spec != NULL; spec = next) {
@@ -1969,6 +2514,19 @@ report_exit(void)
     drmgr_unregister_tls_field(tls_idx_report);
 }
 
+#ifdef STATISTICS
+void
+report_dump_statistics(file_t f)
+{
+    dr_fprintf(f, "suppression checks: %6u, memo hits: %6u, specs compared: %8u\n",
+               suppress_checks, suppress_memo_hits, suppress_specs_compared);
+    dr_fprintf(f, "suppression memo clears: %6u\n", suppress_memo_clears);
+    dr_fprintf(f, "suppression verdicts by callstack: %6u hits, %6u misses, "
+               "%6u clears\n", suppress_verdict_hits, suppress_verdict_misses,
+               suppress_verdict_clears);
+}
+#endif
+
 void
 report_exit_if_errors(void)
 {
@@ -2694,6 +3252,7 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
     stored_error_t *err;
     bool reporting = false;
     suppress_spec_t *spec;
+    bool verdict_known, suppressed;
     error_callstack_t ecs;
     char  *errbuf;
     size_t errbufsz;
@@ -2817,11 +3376,24 @@ report_error(error_toprint_t *etp, dr_mcontext_t *mc, packed_callstack_t *pcs)
     if (!options.replace_malloc && etp->errtype == ERROR_INVALID_HEAP_ARG)
         packed_callstack_first_frame_retaddr(err->pcs);
 
-    /* Convert to symbolized so we can compare to suppressions */
-    packed_callstack_to_symbolized(err->pcs, &ecs.scs);
+    /* Convert to symbolized so we can compare to suppressions, unless we
+     * already know the error is suppressed and won't print its callstack.
+     */
+    if (err->count == 1) {
+        verdict_known = on_suppression_list_cached(etp->errtype, err->pcs, &ecs,
+                                                   &suppressed, &spec);
+    } else {
+        verdict_known = true;
+        suppressed = err->suppressed;
+    }
+    if (!verdict_known || !suppressed || suppressed_errors_printed())
+        packed_callstack_to_symbolized(err->pcs, &ecs.scs);
 
     if (err->count == 1) {
-        reporting = !on_suppression_list(etp->errtype, &ecs, &spec);
+        if (verdict_known)
+            reporting = !suppressed;
+        else
+            reporting = !on_suppression_list(etp->errtype, err->pcs, &ecs, &spec);
         if (!reporting) {
             err->suppressed = true;
             err->suppressed_by_default = spec->is_default;
@@ -3325,6 +3897,7 @@ report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
     uint type;
     uint set = ERROR_NORMAL;
     suppress_spec_t *spec;
+    bool verdict_known = false, suppressed = false;
     error_toprint_t etp = {0};
     error_callstack_t ecs;
     error_callstack_init(&ecs);
@@ -3429,7 +4002,14 @@ report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
          */
         if (!early && (!reachable || show_reachable)) {
             ASSERT(pcs != NULL, "non-early allocs must have stacks");
-            packed_callstack_to_symbolized(pcs, &ecs.scs);
+            /* Skip symbolizing a leak we already know is suppressed, unless
+             * we'll print its callstack.
+             */
+            if (type < ERROR_MAX_VAL)
+                verdict_known = on_suppression_list_cached(type, err->pcs, &ecs,
+                                                           &suppressed, &spec);
+            if (!verdict_known || !suppressed || suppressed_errors_printed())
+                packed_callstack_to_symbolized(pcs, &ecs.scs);
         }
 
         if (locked_malloc)
@@ -3439,8 +4019,12 @@ report_leak(bool known_malloc, app_pc addr, size_t size, size_t indirect_size,
         if (type < ERROR_MAX_VAL) {
             if (reachable && !show_reachable)
                 reporting = true; /* suppressions not supported: i#1852 */
-            else
-                reporting = !on_suppression_list(type, &ecs, &spec);
+            else if (verdict_known)
+                reporting = !suppressed;
+            else {
+                reporting = !on_suppression_list(type, early ? NULL : err->pcs, &ecs,
+                                                 &spec);
+            }
         }
 
         if (reporting && type < ERROR_MAX_VAL) {
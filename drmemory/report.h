@@ -43,6 +43,11 @@ report_exit(void);
 void
 report_exit_if_errors(void);
 
+#ifdef STATISTICS
+void
+report_dump_statistics(file_t f);
+#endif
+
 #ifdef UNIX
 void
 report_fork_init(void);
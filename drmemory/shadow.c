@@ -29,6 +29,10 @@
 #include "instru.h"
 #include <limits.h> /* UINT_MAX */
 #include <stddef.h>
+#ifdef X86
+# include <emmintrin.h> /* SSE2 */
+# include <immintrin.h> /* AVX2 */
+#endif
 #ifdef TOOL_DR_HEAPSTAT
 # include "../drheapstat/staleness.h"
 #endif
@@ -55,6 +59,7 @@ typedef uint* bitmap_t;
 
 /* 2 bits of shadow per real byte: or 4 real bytes shadowed by one shadow byte */
 #define BITMAPx2_UNIT     16 /* one uint shadows 16 real bytes */
+#define BITMAPx2_BITS     2  /* shadow bits per real byte, for Umbra */
 #define BITMAPx2_SHIFT(i) (((i) % BITMAPx2_UNIT) * 2)
 #define BITMAPx2_MASK(i)  (3 << BITMAPx2_SHIFT)
 #define BITMAPx2_IDX(i)   ((i) / BITMAPx2_UNIT)
@@ -161,6 +166,129 @@ bytemap_4to1_ushort(bitmap_t bm, uint i)
 }
 #endif
 
+/***************************************************************************
+ * VECTORIZED SHADOW SCANNING
+ */
+
+/* In both the 2-bit and the 4B-to-1B modes one shadow byte covers
+ * SHADOW_GRANULARITY app bytes, so a run of app bytes that all have the
+ * same shadow value is a run of shadow bytes equal to val_to_dword[value].
+ * Each kernel returns the index of the first of the count shadow bytes at
+ * shadow that differs from expect, or count if they all match.  A 16-byte
+ * vector thus classifies 64 app bytes at once.
+ */
+typedef size_t (*shadow_scan_func_t)(const byte *shadow, size_t count, byte expect);
+
+/* The reference kernel: used on ARM, on old processors, and for -no_shadow_simd */
+static size_t
+shadow_scan_scalar(const byte *shadow, size_t count, byte expect)
+{
+    size_t i = 0;
+    ptr_uint_t pattern = (ptr_uint_t)expect * ((ptr_uint_t)POINTER_MAX / 0xff);
+    for (; i < count && !ALIGNED(shadow + i, sizeof(ptr_uint_t)); i++) {
+        if (shadow[i] != expect)
+            return i;
+    }
+    for (; i + sizeof(ptr_uint_t) <= count; i += sizeof(ptr_uint_t)) {
+        if (*(ptr_uint_t *)(shadow + i) != pattern)
+            break;
+    }
+    for (; i < count; i++) {
+        if (shadow[i] != expect)
+            return i;
+    }
+    return count;
+}
+
+#ifdef X86
+static TARGET_SSE2 size_t
+shadow_scan_sse2(const byte *shadow, size_t count, byte expect)
+{
+    size_t i = 0;
+    __m128i pattern = _mm_set1_epi8((char)expect);
+    uint mask;
+    for (; i < count && !ALIGNED(shadow + i, 16); i++) {
+        if (shadow[i] != expect)
+            return i;
+    }
+    /* 256 app bytes per iteration */
+    for (; i + 64 <= count; i += 64) {
+        __m128i eq = _mm_and_si128
+            (_mm_and_si128(_mm_cmpeq_epi8(_mm_load_si128((__m128i *)(shadow + i)),
+                                          pattern),
+                           _mm_cmpeq_epi8(_mm_load_si128((__m128i *)(shadow + i + 16)),
+                                          pattern)),
+             _mm_and_si128(_mm_cmpeq_epi8(_mm_load_si128((__m128i *)(shadow + i + 32)),
+                                          pattern),
+                           _mm_cmpeq_epi8(_mm_load_si128((__m128i *)(shadow + i + 48)),
+                                          pattern)));
+        if (_mm_movemask_epi8(eq) != 0xffff)
+            break;
+    }
+    /* locates the mismatch, if any, within the last 64 bytes */
+    for (; i + 16 <= count; i += 16) {
+        mask = (uint)_mm_movemask_epi8
+            (_mm_cmpeq_epi8(_mm_load_si128((__m128i *)(shadow + i)), pattern));
+        if (mask != 0xffff)
+            return i + bitscan_forward32(~mask);
+    }
+    return i + shadow_scan_scalar(shadow + i, count - i, expect);
+}
+
+# ifdef HAVE_TARGET_AVX2
+static TARGET_AVX2 size_t
+shadow_scan_avx2(const byte *shadow, size_t count, byte expect)
+{
+    size_t i = 0;
+    __m256i pattern = _mm256_set1_epi8((char)expect);
+    uint mask;
+    for (; i < count && !ALIGNED(shadow + i, 32); i++) {
+        if (shadow[i] != expect)
+            return i;
+    }
+    /* 256 app bytes per iteration */
+    for (; i + 64 <= count; i += 64) {
+        __m256i eq = _mm256_and_si256
+            (_mm256_cmpeq_epi8(_mm256_load_si256((__m256i *)(shadow + i)), pattern),
+             _mm256_cmpeq_epi8(_mm256_load_si256((__m256i *)(shadow + i + 32)),
+                               pattern));
+        if ((uint)_mm256_movemask_epi8(eq) != 0xffffffff)
+            break;
+    }
+    for (; i + 32 <= count; i += 32) {
+        mask = (uint)_mm256_movemask_epi8
+            (_mm256_cmpeq_epi8(_mm256_load_si256((__m256i *)(shadow + i)), pattern));
+        if (mask != 0xffffffff)
+            return i + bitscan_forward32(~mask);
+    }
+    return i + shadow_scan_scalar(shadow + i, count - i, expect);
+}
+# endif /* HAVE_TARGET_AVX2 */
+#endif /* X86 */
+
+static shadow_scan_func_t shadow_scan_bytes = shadow_scan_scalar;
+
+static void
+shadow_scan_init(void)
+{
+#ifdef X86
+    if (!options.shadow_simd)
+        return;
+# ifdef HAVE_TARGET_AVX2
+    /* proc_avx_enabled() also checks that the OS saves the ymm state */
+    if (proc_avx_enabled() && cpu_has_avx2()) {
+        LOG(1, "using AVX2 shadow scan kernel\n");
+        shadow_scan_bytes = shadow_scan_avx2;
+        return;
+    }
+# endif
+    if (proc_has_feature(FEATURE_SSE2)) {
+        LOG(1, "using SSE2 shadow scan kernel\n");
+        shadow_scan_bytes = shadow_scan_sse2;
+    }
+#endif
+}
+
 /***************************************************************************
  * MEMORY SHADOWING DATA STRUCTURES
  */
@@ -455,20 +583,13 @@ shadow_get_ptrsz(INOUT umbra_shadow_memory_info_t *info, app_pc addr)
 #endif
 }
 
-/* Sets the two bits for the byte at the passed-in address */
-/* see comment in shadow_get_byte about using umbra_shadow_memory_info_t */
-void
-shadow_set_byte(INOUT umbra_shadow_memory_info_t *info, app_pc addr, uint val)
+/* Ensures that the shadow block in info, which must contain addr, is a
+ * normal writable block: a special shared block is replaced and a lazily
+ * allocated block is allocated.
+ */
+static void
+shadow_make_writable(INOUT umbra_shadow_memory_info_t *info, app_pc addr)
 {
-    ASSERT(val <= 4, "invalid shadow value");
-    if (addr < info->app_base || addr >= info->app_base + info->app_size) {
-        ASSERT(info->struct_size == sizeof(*info),
-               "shadow memory info is not initialized properly");
-        if (umbra_get_shadow_memory(umbra_map, addr,
-                                    NULL, info) != DRMF_SUCCESS) {
-            ASSERT(false, "fail to get shadow memory info");
-        }
-    }
     /* If non-app-memory (no shadow supported there for x64), we can't recover
      * (FIXME i#1640: umbra should be more robust).
      */
@@ -482,11 +603,6 @@ shadow_set_byte(INOUT umbra_shadow_memory_info_t *info, app_pc addr, uint val)
     if (info->shadow_type == UMBRA_SHADOW_MEMORY_TYPE_SHARED ||
         /* Lazily allocated */
         info->shadow_type == UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC) {
-        /* Avoid replacing special on nop write */
-        if (val == shadow_get_byte(info, addr)) {
-            LOG(5, "writing "PFX" => nop (already special %d)\n", addr, val);
-            return;
-        }
         /* If it's special shared shadow memory, recreate normal shadow memory.
          * If it's lazily allocated, allocate the shadow (umbra_write_shadow_memory()
          * would do that for us).
@@ -506,6 +622,31 @@ shadow_set_byte(INOUT umbra_shadow_memory_info_t *info, app_pc addr, uint val)
             ASSERT(false, "fail to get shadow memory info");
     }
     ASSERT(info->shadow_type != UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC, "will fault");
+}
+
+/* Sets the two bits for the byte at the passed-in address */
+/* see comment in shadow_get_byte about using umbra_shadow_memory_info_t */
+void
+shadow_set_byte(INOUT umbra_shadow_memory_info_t *info, app_pc addr, uint val)
+{
+    ASSERT(val <= 4, "invalid shadow value");
+    if (addr < info->app_base || addr >= info->app_base + info->app_size) {
+        ASSERT(info->struct_size == sizeof(*info),
+               "shadow memory info is not initialized properly");
+        if (umbra_get_shadow_memory(umbra_map, addr,
+                                    NULL, info) != DRMF_SUCCESS) {
+            ASSERT(false, "fail to get shadow memory info");
+        }
+    }
+    if (info->shadow_type == UMBRA_SHADOW_MEMORY_TYPE_SHARED ||
+        info->shadow_type == UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC) {
+        /* Avoid replacing special on nop write */
+        if (val == shadow_get_byte(info, addr)) {
+            LOG(5, "writing "PFX" => nop (already special %d)\n", addr, val);
+            return;
+        }
+    }
+    shadow_make_writable(info, addr);
     LOG(5, "writing "PFX" ("PIFX") => %d\n", addr, addr - info->app_base, val);
     if (!MAP_4B_TO_1B) {
         bitmapx2_set((bitmap_t)info->shadow_base,
@@ -614,7 +755,6 @@ shadow_set_range(app_pc start, app_pc end, uint val)
 {
     umbra_shadow_memory_info_t info;
     app_pc aligned_start, aligned_end;
-    app_pc pc;
     size_t shadow_size;
     ASSERT(options.shadowing, "shadowing disabled");
     ASSERT(val <= 4, "invalid shadow value");
@@ -627,18 +767,19 @@ shadow_set_range(app_pc start, app_pc end, uint val)
     });
     if (start >= end)
         return;
+    if (!MAP_4B_TO_1B) {
+        /* Umbra updates the partial shadow bytes at either end for us */
+        if (umbra_shadow_set_range_bits(umbra_map, start, end - start,
+                                        BITMAPx2_BITS, val) != DRMF_SUCCESS)
+            ASSERT(false, "fail to set shadow memory");
+        return;
+    }
     /* for case like [0x1001, 0x1003]: align_start=0x1004, align_end=0x1000 */
     aligned_start = (app_pc)ALIGN_FORWARD(start, SHADOW_GRANULARITY);
     aligned_end   = (app_pc)ALIGN_BACKWARD(end, SHADOW_GRANULARITY);
-    /* set unaligned start */
-    pc = start;
-    while (pc < aligned_start && pc < end) {
-        shadow_set_byte(&info, pc, val);
-        LOG(4, "\tset byte "PFX"\n", pc);
-        if (POINTER_OVERFLOW_ON_ADD(pc, 1))
-            break;
-        pc++;
-    }
+    /* set unaligned start: one write covers the whole unit in 4B-to-1B mode */
+    if (start < aligned_start || aligned_start == NULL/*overflow*/)
+        shadow_set_byte(&info, start, val);
     /* set aligned byte */
     if (aligned_end > aligned_start &&
         umbra_shadow_set_range(umbra_map,
@@ -650,16 +791,188 @@ shadow_set_range(app_pc start, app_pc end, uint val)
         ASSERT(false, "fail to set shadow memory");
     }
     /* set unaligned end */
-    if (aligned_end >= aligned_start) {
-        pc = aligned_end;
-        while (pc < end) {
-            shadow_set_byte(&info, pc, val);
-            LOG(4, "\tset byte "PFX"\n", pc);
-            if (POINTER_OVERFLOW_ON_ADD(pc, 1))
-                break;
+    if (aligned_end >= aligned_start && aligned_end < end)
+        shadow_set_byte(&info, aligned_end, val);
+}
+
+void
+shadow_set_ranges(umbra_shadow_range_t *ranges INOUT, uint num_ranges)
+{
+    uint i;
+    ASSERT(options.shadowing, "shadowing disabled");
+    LOG(2, "set %d ranges\n", num_ranges);
+    if (MAP_4B_TO_1B) {
+        for (i = 0; i < num_ranges; i++)
+            shadow_set_range(ranges[i].start, ranges[i].end, (uint)ranges[i].value);
+        return;
+    }
+    DOLOG(3, {
+        for (i = 0; i < num_ranges; i++) {
+            LOG(3, "\t"PFX"-"PFX" => 0x%x\n", ranges[i].start, ranges[i].end,
+                (uint)ranges[i].value);
+        }
+    });
+    if (umbra_shadow_set_ranges_bits(umbra_map, ranges, num_ranges,
+                                     BITMAPx2_BITS) != DRMF_SUCCESS)
+        ASSERT(false, "fail to set shadow memory");
+}
+
+/* Returns the index of the first of the count shadow bytes at shadow that
+ * holds an unaddressable or bitlevel value, or count if every byte they
+ * shadow is either defined or undefined.  Those two are the values whose
+ * two bits differ, so one xor finds them in each field.
+ */
+static size_t
+shadow_scan_not_unaddr(const byte *shadow, size_t count)
+{
+    size_t i = 0;
+    ptr_uint_t lows = (ptr_uint_t)0x55 * ((ptr_uint_t)POINTER_MAX / 0xff);
+    for (; i < count && !ALIGNED(shadow + i, sizeof(ptr_uint_t)); i++) {
+        if (((shadow[i] ^ (shadow[i] >> 1)) & 0x55) != 0)
+            return i;
+    }
+    for (; i + sizeof(ptr_uint_t) <= count; i += sizeof(ptr_uint_t)) {
+        ptr_uint_t word = *(ptr_uint_t *)(shadow + i);
+        if (((word ^ (word >> 1)) & lows) != 0)
+            break;
+    }
+    for (; i < count; i++) {
+        if (((shadow[i] ^ (shadow[i] >> 1)) & 0x55) != 0)
+            return i;
+    }
+    return count;
+}
+
+/* Marks the undefined bytes of [start, end) defined, stopping at the first
+ * unaddressable or bitlevel byte, whose value is returned.  Returns
+ * SHADOW_DEFINED if the whole range was handled.
+ */
+static uint
+shadow_define_range(INOUT umbra_shadow_memory_info_t *info, app_pc start, app_pc end)
+{
+    app_pc pc = start;
+    uint val;
+    size_t avail, units;
+    while (pc < end) {
+        val = shadow_get_byte(info, pc);
+        /* computed this way to avoid overflow at the top of the address space */
+        avail = info->app_size - (pc - info->app_base);
+        if (avail > (size_t)(end - pc))
+            avail = end - pc;
+        if (val != SHADOW_DEFINED && val != SHADOW_UNDEFINED)
+            return val;
+        if (SHADOW_IS_SHARED_ONLY(info->shadow_type)) {
+            /* a special block holds one value throughout */
+            if (val == SHADOW_DEFINED)
+                pc += avail;
+            else
+                shadow_make_writable(info, pc);
+            continue;
+        }
+        units = 0;
+        if (!MAP_4B_TO_1B && ALIGNED(pc, SHADOW_GRANULARITY)) {
+            byte *shadow = info->shadow_base +
+                BLOCK_AS_BYTE_ARRAY_IDX(pc - info->app_base);
+            units = shadow_scan_not_unaddr(shadow, avail / SHADOW_GRANULARITY);
+            memset(shadow, SHADOW_DWORD_DEFINED, units);
+        }
+        if (units > 0)
+            pc += units * SHADOW_GRANULARITY;
+        else {
+            /* unaligned, a partial unit at the end, or a mixed unit */
+            if (val == SHADOW_UNDEFINED)
+                shadow_set_byte(info, pc, SHADOW_DEFINED);
             pc++;
         }
     }
+    return SHADOW_DEFINED;
+}
+
+void
+shadow_define_ranges(umbra_shadow_range_t *ranges INOUT, uint num_ranges)
+{
+    umbra_shadow_memory_info_t info;
+    uint i;
+    ASSERT(options.shadowing, "shadowing disabled");
+    umbra_shadow_memory_info_init(&info);
+    for (i = 0; i < num_ranges; i++) {
+        ASSERT(ranges[i].end >= ranges[i].start, "invalid range");
+        ranges[i].value = shadow_define_range(&info, ranges[i].start, ranges[i].end);
+        LOG(3, "define "PFX"-"PFX" => 0x%x\n", ranges[i].start, ranges[i].end,
+            (uint)ranges[i].value);
+    }
+}
+
+/* Copies the shadow of [src, src+size) to [dst, dst+size) in 4B-to-1B mode,
+ * where each of the two ranges lies within a single shadow block.  Walks
+ * backward if requested.
+ */
+static void
+shadow_copy_block_range(app_pc src, app_pc dst, size_t size, bool backward)
+{
+    umbra_shadow_memory_info_t info_src;
+    umbra_shadow_memory_info_t info_dst;
+    uint val;
+    size_t i, idx;
+    /* A prior chunk may have replaced a block, so we look up afresh. */
+    umbra_shadow_memory_info_init(&info_src);
+    umbra_shadow_memory_info_init(&info_dst);
+    val = shadow_get_byte(&info_src, src);
+    if (info_src.shadow_type != UMBRA_SHADOW_MEMORY_TYPE_NORMAL) {
+        /* special, unallocated, or non-app: all identical */
+        shadow_set_range(dst, dst + size, val);
+        return;
+    }
+    shadow_get_byte(&info_dst, dst);
+    shadow_make_writable(&info_dst, dst);
+    for (i = 0; i < size; i++) {
+        idx = backward ? size - 1 - i : i;
+        bytemap_4to1_set((bitmap_t)info_dst.shadow_base,
+                         dst + idx - info_dst.app_base,
+                         bytemap_4to1_byte((bitmap_t)info_src.shadow_base,
+                                           src + idx - info_src.app_base));
+    }
+}
+
+/* Handles shadow_copy_range() in 4B-to-1B mode when the two ranges are not
+ * equally aligned, one pair of shadow blocks at a time, with no temporary buffer.
+ */
+static void
+shadow_copy_range_unaligned(app_pc old_start, app_pc new_start, size_t size)
+{
+    umbra_shadow_memory_info_t info_src;
+    umbra_shadow_memory_info_t info_dst;
+    /* If the destination overlaps the end of the source we must go backward
+     * so we don't clobber source values before we read them.
+     */
+    bool backward = (new_start > old_start && new_start - old_start < size);
+    size_t done, n;
+    app_pc src, dst;
+    for (done = 0; done < size; done += n) {
+        umbra_shadow_memory_info_init(&info_src);
+        umbra_shadow_memory_info_init(&info_dst);
+        if (backward) {
+            /* the last byte of what remains */
+            src = old_start + (size - done) - 1;
+            dst = new_start + (size - done) - 1;
+            shadow_get_byte(&info_src, src);
+            shadow_get_byte(&info_dst, dst);
+            n = MIN(src - info_src.app_base, dst - info_dst.app_base) + 1;
+            n = MIN(n, size - done);
+            src = src + 1 - n;
+            dst = dst + 1 - n;
+        } else {
+            src = old_start + done;
+            dst = new_start + done;
+            shadow_get_byte(&info_src, src);
+            shadow_get_byte(&info_dst, dst);
+            /* computed this way to avoid overflow at the top of the address space */
+            n = MIN(info_src.app_size - (src - info_src.app_base),
+                    info_dst.app_size - (dst - info_dst.app_base));
+            n = MIN(n, size - done);
+        }
+        shadow_copy_block_range(src, dst, n, backward);
+    }
 }
 
 /* Copies the values for each byte in the range [old_start, old_start+size) to
@@ -668,73 +981,37 @@ shadow_set_range(app_pc start, app_pc end, uint val)
 void
 shadow_copy_range(app_pc old_start, app_pc new_start, size_t size)
 {
-    size_t shdw_size;
-    app_pc old_pc, new_pc, old_end;
-    umbra_shadow_memory_info_t info_src;
-    umbra_shadow_memory_info_t info_dst;
-    uint head_val[SHADOW_GRANULARITY], tail_val[SHADOW_GRANULARITY];
-    uint head_bit, tail_bit, i;
+    size_t shdw_size, copy_size;
+    uint head_bit;
 
     LOG(2, "copy range "PFX"-"PFX" to "PFX"-"PFX"\n",
          old_start, old_start+size, new_start, new_start+size);
-    umbra_shadow_memory_info_init(&info_src);
-    umbra_shadow_memory_info_init(&info_dst);
-
+    if (!MAP_4B_TO_1B) {
+        /* Umbra shifts the values when the two ranges are aligned differently
+         * within a shadow byte, and preserves the values outside the range
+         * that share a shadow byte with its ends.
+         */
+        if (umbra_shadow_copy_range_bits(umbra_map, old_start, new_start, size,
+                                         BITMAPx2_BITS) != DRMF_SUCCESS)
+            ASSERT(false, "fail to copy shadow memory");
+        return;
+    }
+    if (size == 0)
+        return;
     head_bit = (ptr_uint_t)old_start % SHADOW_GRANULARITY;
     if (head_bit != ((ptr_uint_t)new_start % SHADOW_GRANULARITY)) {
-        /* Alignments don't match (e.g., 0x...3 and 0x...1).  We use a slow,
-         * brute-force appraoch as this should be rare.  We handle overlap by
-         * copying to a temp, with the assumption that anything big like an mmap
-         * will be page-aligned and won't come here.
-         *
-         * XXX: we should add a unit test framework so we can easily write
-         * a test for this.
-         */
-        /* For simplicity we store each pair of 2 bits in one byte */
-        byte *temp = global_alloc(size, HEAPSTAT_SHADOW);
-        for (i = 0; i < size; i++)
-            temp[i] = (byte) shadow_get_byte(&info_src, old_start + i);
-        for (i = 0; i < size; i++)
-            shadow_set_byte(&info_dst, new_start + i, temp[i]);
-        global_free(temp, size, HEAPSTAT_SHADOW);
+        shadow_copy_range_unaligned(old_start, new_start, size);
         return;
     }
-    old_end  = old_start + size;
-    tail_bit = (ptr_uint_t)old_end % SHADOW_GRANULARITY;
-    /* It is 1B-2-2b mapping and umbra only support full byte copy, so we have
-     * to handle the unaligned byte copy.
-     */
-    /* XXX: maybe umbra should support partial byte update and the code can be
-     * moved into umbra.
+    /* A shadow byte holds a single value for its whole unit in 4B-to-1B mode,
+     * so a partial unit at either end is copied as the whole unit.
      */
-    if (head_bit != 0) {
-        for (i = 0; i+head_bit < SHADOW_GRANULARITY; i++)
-            head_val[i+head_bit] = shadow_get_byte(&info_src, old_start+i);
-    }
-    if (tail_bit != 0) {
-        old_end = (app_pc)ALIGN_BACKWARD(old_end, SHADOW_GRANULARITY);
-        for (i = 0; i < tail_bit; i++)
-            tail_val[i] = shadow_get_byte(&info_src, old_end+i);
-    }
-    old_pc  = (app_pc)ALIGN_FORWARD(old_start, SHADOW_GRANULARITY);
-    if (old_end > old_pc) {
-        size_t copy_size = old_end - old_pc;
-        new_pc = (app_pc)ALIGN_FORWARD(new_start, SHADOW_GRANULARITY);
-        if (umbra_shadow_copy_range(umbra_map, old_pc, new_pc, copy_size,
-                                    &shdw_size) != DRMF_SUCCESS ||
-            shdw_size != shadow_scale_app_to_shadow(copy_size))
-            ASSERT(false, "fail to copy shadow memory");
-    }
-    if (head_bit != 0) {
-        for (i = 0; i+head_bit < SHADOW_GRANULARITY; i++)
-            shadow_set_byte(&info_dst, new_start+i, head_val[i+head_bit]);
-    }
-    if (tail_bit != 0) {
-        app_pc new_end =
-            (app_pc)ALIGN_BACKWARD(new_start + size, SHADOW_GRANULARITY);
-        for (i = 0; i < tail_bit; i++)
-            shadow_set_byte(&info_dst, new_end+i, tail_val[i]);
-    }
+    copy_size = ALIGN_FORWARD(head_bit + size, SHADOW_GRANULARITY);
+    if (umbra_shadow_copy_range(umbra_map, old_start - head_bit,
+                                new_start - head_bit, copy_size,
+                                &shdw_size) != DRMF_SUCCESS ||
+        shdw_size != shadow_scale_app_to_shadow(copy_size))
+        ASSERT(false, "fail to copy shadow memory");
 }
 
 void
@@ -800,25 +1077,38 @@ shadow_check_range(app_pc start, size_t size, uint expect,
     uint val;
     uint bad_val = 0;
     bool res = true;
-    size_t incr;
+    size_t incr, avail, matched;
     ASSERT(expect <= 4, "invalid shadow value");
     ASSERT(start+size > start, "invalid param");
     umbra_shadow_memory_info_init(&info);
     while (pc < start+size) {
         val = shadow_get_byte(&info, pc);
-        if (!ALIGNED(pc, 16)) {
+        /* computed this way to avoid overflow at the top of the address space */
+        avail = info.app_size - (pc - info.app_base);
+        if (SHADOW_IS_SHARED_ONLY(info.shadow_type) ||
+            info.shadow_type == UMBRA_SHADOW_MEMORY_TYPE_SHADOW_NOT_ALLOC ||
+            info.shadow_type == UMBRA_SHADOW_MEMORY_TYPE_NOT_SHADOW) {
+            incr = avail;
+        } else if (!ALIGNED(pc, SHADOW_GRANULARITY)) {
             incr = 1;
-        } else if (SHADOW_IS_SHARED_ONLY(info.shadow_type)) {
-            incr = info.app_base + info.app_size - pc;
         } else {
-            val = bitmapx2_dword((bitmap_t)info.shadow_base, pc-info.app_base);
-            val = dqword_to_val(val);
-            if (val == UINT_MAX) {
-                /* mixed: have to drop to per-byte */
-                val = shadow_get_byte(&info, pc);
+            /* Skip the whole run of bytes identical to what we are currently
+             * looking for: expect, or the bad value whose extent we want.
+             */
+            byte *shadow = info.shadow_base +
+                BLOCK_AS_BYTE_ARRAY_IDX(pc - info.app_base);
+            uint target = res ? expect : bad_val;
+            if (avail > (size_t)(start + size - pc))
+                avail = start + size - pc;
+            matched = shadow_scan_bytes(shadow, avail / SHADOW_GRANULARITY,
+                                        (byte)val_to_dword[target]);
+            if (matched > 0) {
+                ASSERT(val == target, "scan kernel mismatch");
+                incr = matched * SHADOW_GRANULARITY;
+            } else {
+                /* mixed or a partial unit at the end: drop to per-byte */
                 incr = 1;
-            } else /* all identical */
-                incr = 16;
+            }
         }
         if (!res) {
             /* we know we have some non-matching bytes, but we want to know
@@ -2007,6 +2297,7 @@ shadow_init(void)
     ASSERT(options.shadowing, "shadowing disabled");
     shadow_registers_init();
     shadow_table_init();
+    shadow_scan_init();
 }
 
 void
@@ -2016,3 +2307,158 @@ shadow_exit(void)
     shadow_table_exit();
 }
 
+/***************************************************************************
+ * Unit tests
+ */
+
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+#define TEST_BITMAP_UINTS 16
+#define TEST_BITMAP_VALUES (TEST_BITMAP_UINTS * BITMAPx2_UNIT)
+
+static void
+test_bitmapx2_fill(bitmap_t bm, uint *seed)
+{
+    uint i;
+    for (i = 0; i < TEST_BITMAP_UINTS; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        bm[i] = *seed;
+    }
+}
+
+/* Compares bitstream_copy() on 2-bit values against a per-value copy from a
+ * snapshot
+ */
+static void
+test_bitmapx2_copy_one(bitmap_t dst, uint dst_idx, bitmap_t src, uint src_idx,
+                       uint count)
+{
+    uint snapshot[TEST_BITMAP_UINTS], expect[TEST_BITMAP_UINTS];
+    uint i;
+    memcpy(snapshot, src, sizeof(snapshot));
+    memcpy(expect, dst, sizeof(expect));
+    for (i = 0; i < count; i++)
+        bitmapx2_set(expect, dst_idx + i, bitmapx2_get(snapshot, src_idx + i));
+    bitstream_copy((byte *)dst, dst_idx * BITMAPx2_BITS, (byte *)src,
+                   src_idx * BITMAPx2_BITS, count * BITMAPx2_BITS);
+    EXPECT(memcmp(dst, expect, sizeof(expect)) == 0);
+}
+
+static void
+test_bitmapx2_copy(void)
+{
+    static const uint counts[] = {
+        0, 1, 2, 3, 4, 5, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 129, 200,
+    };
+    uint src[TEST_BITMAP_UINTS], dst[TEST_BITMAP_UINTS];
+    uint seed = 1;
+    uint src_idx, dst_idx, i;
+    for (src_idx = 0; src_idx < 40; src_idx++) {
+        for (dst_idx = 0; dst_idx < 40; dst_idx++) {
+            for (i = 0; i < BUFFER_SIZE_ELEMENTS(counts); i++) {
+                if (counts[i] + MAX(src_idx, dst_idx) > TEST_BITMAP_VALUES)
+                    continue;
+                /* separate bitmaps */
+                test_bitmapx2_fill(src, &seed);
+                test_bitmapx2_fill(dst, &seed);
+                test_bitmapx2_copy_one(dst, dst_idx, src, src_idx, counts[i]);
+                /* overlapping within one bitmap, in both directions */
+                test_bitmapx2_fill(src, &seed);
+                test_bitmapx2_copy_one(src, dst_idx, src, src_idx, counts[i]);
+            }
+        }
+    }
+    /* the whole bitmap shifted by one value each way */
+    test_bitmapx2_fill(src, &seed);
+    test_bitmapx2_copy_one(src, 1, src, 0, TEST_BITMAP_VALUES - 1);
+    test_bitmapx2_fill(src, &seed);
+    test_bitmapx2_copy_one(src, 0, src, 1, TEST_BITMAP_VALUES - 1);
+}
+
+/* Compares bitstream_fill() on 2-bit values against per-value sets */
+static void
+test_bitmapx2_fill_range(void)
+{
+    uint bm[TEST_BITMAP_UINTS], expect[TEST_BITMAP_UINTS];
+    uint seed = 1;
+    uint idx, count, i, val;
+    for (val = 0; val < 4; val++) {
+        for (idx = 0; idx < 40; idx++) {
+            for (count = 0; count + idx <= 100; count++) {
+                test_bitmapx2_fill(bm, &seed);
+                memcpy(expect, bm, sizeof(expect));
+                for (i = 0; i < count; i++)
+                    bitmapx2_set(expect, idx + i, val);
+                bitstream_fill((byte *)bm, idx * BITMAPx2_BITS,
+                               count * BITMAPx2_BITS, (byte)(val * 0x55));
+                EXPECT(memcmp(bm, expect, sizeof(expect)) == 0);
+            }
+        }
+    }
+}
+
+/* Runs every scan kernel this processor supports over randomized shadow
+ * and compares each result against a plain byte loop, across all start
+ * alignments within a 64-byte line and lengths that leave every tail size.
+ */
+#define TEST_SCAN_BYTES 320
+
+static void
+test_shadow_scan_kernels(void)
+{
+    shadow_scan_func_t kernels[3];
+    uint num_kernels = 0, k, align, count, seed = 1;
+    byte storage[TEST_SCAN_BYTES + 64 + 64];
+    byte *buf = (byte *)ALIGN_FORWARD(storage, 64);
+    kernels[num_kernels++] = shadow_scan_scalar;
+#ifdef X86
+    if (proc_has_feature(FEATURE_SSE2))
+        kernels[num_kernels++] = shadow_scan_sse2;
+# ifdef HAVE_TARGET_AVX2
+    if (proc_avx_enabled() && cpu_has_avx2())
+        kernels[num_kernels++] = shadow_scan_avx2;
+# endif
+#endif
+    for (align = 0; align < 64; align++) {
+        for (count = 0; count + align <= TEST_SCAN_BYTES; count++) {
+            byte *shadow = buf + align;
+            byte expect;
+            size_t want, i;
+            uint trial;
+            /* all-match, one mismatch at a random spot, and random bytes */
+            for (trial = 0; trial < 3; trial++) {
+                seed = seed * 1103515245 + 12345;
+                expect = (byte)(seed >> 16);
+                memset(shadow, expect, count);
+                if (trial == 1 && count > 0) {
+                    seed = seed * 1103515245 + 12345;
+                    shadow[(seed >> 8) % count] = (byte)~expect;
+                } else if (trial == 2) {
+                    for (i = 0; i < count; i++) {
+                        seed = seed * 1103515245 + 12345;
+                        /* mostly matching so the vector loops get exercised */
+                        if (((seed >> 16) & 0x3f) == 0)
+                            shadow[i] = (byte)(seed >> 8);
+                    }
+                }
+                /* bytes past the end must not affect the result */
+                shadow[count] = (byte)~expect;
+                for (want = 0; want < count && shadow[want] == expect; want++)
+                    ; /* nothing */
+                for (k = 0; k < num_kernels; k++)
+                    EXPECT(kernels[k](shadow, count, expect) == want);
+            }
+        }
+    }
+}
+
+void
+shadow_unit_tests(void)
+{
+    test_bitmapx2_copy();
+    test_bitmapx2_fill_range();
+    test_shadow_scan_kernels();
+
+    /* add more tests here */
+}
+#endif
+
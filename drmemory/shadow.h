@@ -227,6 +227,24 @@ shadow_free_buffer(shadow_buffer_t *shadow_buffer);
 void
 shadow_set_range(app_pc start, app_pc end, uint val);
 
+/* Sets the two bits for each byte in each of the num_ranges ranges, whose
+ * values are shadow values.  The ranges may be in any order, and adjacent
+ * ranges in the same shadow block share one block lookup.  The array is
+ * reordered and its contents are unspecified on return.
+ */
+void
+shadow_set_ranges(umbra_shadow_range_t *ranges INOUT, uint num_ranges);
+
+/* Marks each of the num_ranges ranges defined in one walk of their shadow,
+ * with consecutive ranges in the same shadow block sharing one block lookup.
+ * Only undefined bytes are changed.  Sets each range's value to
+ * SHADOW_DEFINED, or, for a range holding an unaddressable or bitlevel byte,
+ * to that byte's value: the bytes from there on are left unchanged and the
+ * caller must handle that range some other way.
+ */
+void
+shadow_define_ranges(umbra_shadow_range_t *ranges INOUT, uint num_ranges);
+
 /* Copies the values for each byte in the range [old_start, old_start+size) to
  * [new_start, new_start+size).  The two ranges can overlap.
  */
@@ -366,4 +384,9 @@ set_shadow_inheap(uint val);
 bool
 is_shadow_register_defined(uint val);
 
+#if defined(TOOL_DR_MEMORY) && defined(BUILD_UNIT_TESTS)
+void
+shadow_unit_tests(void);
+#endif
+
 #endif /* _SHADOW_H_ */
@@ -36,12 +36,15 @@
 #include "alloc_drmem.h"
 #include "heap.h"
 #include "alloc.h"
+#include "alloc_replace.h"
 #include "report.h"
 #include "shadow.h"
 #include "syscall.h"
 #include "replace.h"
 #include "perturb.h"
 #include "annotations.h"
+#include "leak.h"
+#include "unwind.h"
 #ifdef TOOL_DR_HEAPSTAT
 # include "../drheapstat/staleness.h"
 #endif
@@ -1924,6 +1927,14 @@ main(int argc, char *argv[])
 
     slowpath_unit_tests_arch(drcontext);
 
+    shadow_unit_tests();
+
+    leak_unit_tests();
+
+    unwind_unit_tests();
+
+    alloc_replace_unit_tests();
+
     /* add more tests here */
 
     dr_printf("success\n");
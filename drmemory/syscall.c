@@ -378,6 +378,70 @@ check_sysmem(uint flags, drsys_sysnum_t sysnum, app_pc ptr, size_t sz, dr_mconte
     }
 }
 
+/* Post-syscall writes are batched and handed to shadow_define_ranges()
+ * together, so that a syscall with many output buffers (readv, recvmsg,
+ * ioctls) pays for one walk of the shadow rather than one per buffer.  Only
+ * a buffer holding unaddressable bytes then goes through check_sysmem(), to
+ * report them.
+ */
+#define SYSCALL_WRITE_BATCH_MAX 32
+
+typedef struct _syscall_write_batch_t {
+    umbra_shadow_range_t ranges[SYSCALL_WRITE_BATCH_MAX];
+    /* drsyscall only builds names on the stack for pre-syscall string arrays */
+    const char *names[SYSCALL_WRITE_BATCH_MAX];
+    uint num_ranges;
+    /* all the buffers belong to the same syscall */
+    drsys_sysnum_t sysnum;
+    dr_mcontext_t *mc;
+} syscall_write_batch_t;
+
+static void
+syscall_write_batch_flush(syscall_write_batch_t *batch)
+{
+    uint i;
+    if (batch->num_ranges == 0)
+        return;
+    shadow_define_ranges(batch->ranges, batch->num_ranges);
+    for (i = 0; i < batch->num_ranges; i++) {
+        if (batch->ranges[i].value != SHADOW_DEFINED) {
+            check_sysmem(MEMREF_WRITE, batch->sysnum, batch->ranges[i].start,
+                         batch->ranges[i].end - batch->ranges[i].start,
+                         batch->mc, batch->names[i]);
+        }
+    }
+    batch->num_ranges = 0;
+}
+
+/* Queues the post-syscall write of arg's buffer.  Returns false if the
+ * buffer must go through check_sysmem() right away instead.
+ */
+static bool
+syscall_write_batch_add(syscall_write_batch_t *batch, drsys_arg_t *arg)
+{
+    app_pc start = (app_pc) arg->start_addr;
+    ASSERT(INSTRUMENT_MEMREFS(), "memory reference checking disabled");
+    if (!options.check_uninitialized)
+        return true; /* check_sysmem() would ignore the write */
+    if (start == NULL || arg->size == 0)
+        return true;
+    if (start + arg->size < start)
+        return false;
+    if (batch->num_ranges == SYSCALL_WRITE_BATCH_MAX)
+        syscall_write_batch_flush(batch);
+    batch->sysnum = arg->sysnum;
+    batch->mc = arg->mc;
+    batch->ranges[batch->num_ranges].start = start;
+    batch->ranges[batch->num_ranges].end = start + arg->size;
+    batch->ranges[batch->num_ranges].value = SHADOW_DEFINED;
+    batch->names[batch->num_ranges] = arg->arg_name;
+    batch->num_ranges++;
+    LOG(SYSCALL_VERBOSE, "\t  marking "PIFX"-"PIFX" written %s\n",
+        start, start + arg->size, (arg->arg_name == NULL) ? "" : arg->arg_name);
+    return true;
+}
+
+/* user_data is a syscall_write_batch_t for post-syscall iteration */
 static bool
 drsys_iter_memarg_cb(drsys_arg_t *arg, void *user_data)
 {
@@ -415,6 +479,9 @@ drsys_iter_memarg_cb(drsys_arg_t *arg, void *user_data)
         }
     } else {
         ASSERT(TEST(DRSYS_PARAM_OUT, arg->mode), "shouldn't see IN params in post");
+        if (user_data != NULL &&
+            syscall_write_batch_add((syscall_write_batch_t *) user_data, arg))
+            return true; /* keep going */
         flags = MEMREF_WRITE;
     }
     check_sysmem(flags, arg->sysnum, arg->start_addr, arg->size, arg->mc, arg->arg_name);
@@ -557,10 +624,13 @@ event_post_syscall(void *drcontext, int sysnum)
         /* post-syscall, eax is defined */
         register_shadow_set_ptrsz(DR_REG_PTR_RETURN, SHADOW_PTRSZ_DEFINED);
         if (success) {
-            /* commit the writes via MEMREF_WRITE */
-            if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, NULL) !=
+            /* commit the writes in one batch */
+            syscall_write_batch_t batch;
+            batch.num_ranges = 0;
+            if (drsys_iterate_memargs(drcontext, drsys_iter_memarg_cb, &batch) !=
                 DRMF_SUCCESS)
                 ASSERT(false, "drsys_iterate_memargs failed");
+            syscall_write_batch_flush(&batch);
         }
         if (auxlib_known_syscall(sysnum))
             auxlib_shadow_post_syscall(drcontext, sysnum, mc);
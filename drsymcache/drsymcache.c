@@ -57,21 +57,64 @@
  */
 #define SYMCACHE_VERSION 14
 
+/* Caches are written in a binary format that is copied in and queried in place,
+ * avoiding the cost of parsing every cache file at module load.  We still read
+ * caches in the text format above (rewriting them in the binary format), so
+ * this has its own version number.
+ *
+ * The file consists of a symcache_bin_header_t followed by these arrays, each
+ * 8-byte-aligned at the offset given in the header:
+ * + buckets: an open-addressed hashtable of num_buckets uints, a power of 2,
+ *   holding 1 + the index of a symbol, or 0 for an empty bucket.  Collisions
+ *   are resolved by linear probing.
+ * + symbols: num_symbols symcache_bin_symbol_t entries.
+ * + offsets: num_offsets uint module offsets, with each symbol's entries
+ *   contiguous and in the order they were added.
+ * + strings: the null-terminated symbol names.
+ */
+#define SYMCACHE_BIN_MAGIC "DrMemSym"
+#define SYMCACHE_BIN_VERSION 1
+
+typedef struct _symcache_bin_header_t {
+    /* We order the fields to avoid any padding, for the same layout everywhere */
+    char magic[8];
+    uint version;
+    uint header_size; /* sizeof(symcache_bin_header_t) */
+    uint64 cache_file_size; /* for self-consistency */
+    /* Module consistency fields.  Those not used on this platform are 0. */
+    uint64 module_file_size;
+    uint64 file_version;
+    uint64 product_version;
+    uint64 module_internal_size;
+    /* File offsets of the arrays */
+    uint64 buckets_offs;
+    uint64 symbols_offs;
+    uint64 offsets_offs;
+    uint64 strings_offs;
+    uint64 strings_size;
+    uint checksum;
+    uint timestamp;
+    uint current_version;
+    uint compatibility_version;
+    uint has_debug_info;
+    uint num_buckets;
+    uint num_symbols;
+    uint num_offsets;
+    byte uuid[16];
+} symcache_bin_header_t;
+
+typedef struct _symcache_bin_symbol_t {
+    uint hash;      /* symcache_bin_hash() of the name */
+    uint name_offs; /* into the strings array */
+    uint offs_start; /* index of the first entry in the offsets array */
+    uint offs_count;
+} symcache_bin_symbol_t;
+
 /* we need a separate hashtable per module */
 #define SYMCACHE_MASTER_TABLE_HASH_BITS 6
 #define SYMCACHE_MODULE_TABLE_HASH_BITS 6
 #define SYMCACHE_OLIST_TABLE_HASH_BITS 5
 
-/* Size of the buffer used to write the symbol cache.  This is stack allocated,
- * so it should not be increased.
- */
-#define SYMCACHE_BUFFER_SIZE 4096
-
-/* The number of digits used for the decimal representation of the file size of
- * the symcache file.
- */
-#define SYMCACHE_SIZE_DIGITS 10
-
 #define SYMCACHE_MAX_TMP_TRIES 1000
 
 /* We key on full path to reduce chance of duplicate name (i#729).
@@ -81,8 +124,14 @@
  */
 static hashtable_t symcache_table;
 
-/* simple synch scheme: hold this lock across all operations on outer or inner tables */
-static void *symcache_lock;
+/* Synch scheme: symcache_table_lock is a read-write lock on the outer table,
+ * which is only written when modules are added or removed.  Each module's
+ * data is protected by its own lock, acquired while holding the outer lock
+ * for reading, so that lookups in different modules proceed in parallel and a
+ * module cannot be freed while in use.  Cache files are read without holding
+ * either lock.
+ */
+static void *symcache_table_lock;
 
 static bool initialized;
 
@@ -92,10 +141,20 @@ static int symcache_init_count;
 typedef struct _mod_cache_t {
     /* strdup-ed modname since key now holds path */
     const char *modname;
+    /* Protects all fields below once the entry is in symcache_table */
+    void *lock;
     bool from_file; /* came from a cache file */
     bool appended; /* added to since read from file? */
-    /* Table of offset_list_t entries */
+    /* Table of offset_list_t entries.  Once there is a binary image, this only
+     * holds symbols added or changed since then, which take precedence.
+     */
     hashtable_t table;
+    /* The binary format image, either copied from the cache file or built by our
+     * last write to it.  Read-only.  We do not keep the file mapped, as on Windows
+     * that would prevent replacing it when we save.
+     */
+    const byte *bin;
+    size_t bin_size;
     /* Values for consistency that we cache until ready to write to file */
     uint64 module_file_size;
 #ifdef WINDOWS
@@ -154,20 +213,44 @@ symcache_module_load_save(void *drcontext, const module_data_t *mod, bool loaded
 static void
 symcache_module_unload(void *drcontext, const module_data_t *mod);
 
+typedef struct _preload_data_t preload_data_t;
+
+/* The data of the in-flight or finished drsymcache_preload(), if any */
+static preload_data_t *preload;
+
+static void
+symcache_preload_release(preload_data_t *data);
+
+static void
+symcache_preload_drain(const module_data_t *mod, bool stop);
+
 static bool
 module_has_symbols(const module_data_t *mod)
 {
     return (drsym_module_has_symbols(mod->full_path) == DRSYM_SUCCESS);
 }
 
-/* caller must hold symcache_lock, even at exit time */
+static void
+symcache_bin_free(mod_cache_t *modcache)
+{
+    if (modcache->bin == NULL)
+        return;
+    global_free((void *)modcache->bin, modcache->bin_size, HEAPSTAT_HASHTABLE);
+    modcache->bin = NULL;
+    modcache->bin_size = 0;
+}
+
+/* Caller must hold symcache_table_lock for writing, even at exit time,
+ * unless modcache was never added to symcache_table.
+ */
 static void
 symcache_free_entry(void *v)
 {
     mod_cache_t *modcache = (mod_cache_t *) v;
-    ASSERT(dr_mutex_self_owns(symcache_lock), "missing symcache lock");
     if (modcache != NULL) {
         hashtable_delete(&modcache->table);
+        symcache_bin_free(modcache);
+        dr_mutex_destroy(modcache->lock);
         if (modcache->modname != NULL) {
             global_free((void *)modcache->modname, strlen(modcache->modname) + 1,
                         HEAPSTAT_HASHTABLE);
@@ -177,20 +260,103 @@ symcache_free_entry(void *v)
 }
 
 static void
-symcache_get_filename(const char *modname, char *symfile, size_t symfile_count)
+symcache_get_filename(const char *modname, bool binary, char *symfile,
+                      size_t symfile_count)
 {
-    dr_snprintf(symfile, symfile_count, "%s/%s.txt", symcache_dir, modname);
+    dr_snprintf(symfile, symfile_count, "%s/%s.%s", symcache_dir, modname,
+                binary ? "bin" : "txt");
     symfile[symfile_count-1] = '\0';
 }
 
+static inline const symcache_bin_header_t *
+symcache_bin_header(mod_cache_t *modcache)
+{
+    return (const symcache_bin_header_t *) modcache->bin;
+}
+
+static uint
+symcache_bin_hash(const char *symbol)
+{
+    /* FNV-1a.  This is part of the file format. */
+    uint hash = 2166136261U;
+    for (; *symbol != '\0'; symbol++) {
+        hash ^= (byte) *symbol;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/* The image's section bounds are checked when it's read in, but to avoid
+ * touching every entry at load time we check each symbol entry as we use it.
+ */
+static const symcache_bin_symbol_t *
+symcache_bin_find(mod_cache_t *modcache, const char *symbol)
+{
+    const symcache_bin_header_t *hdr = symcache_bin_header(modcache);
+    const uint *buckets;
+    const symcache_bin_symbol_t *symbols;
+    const char *strings;
+    uint hash, mask, i, probes;
+    if (hdr == NULL || hdr->num_symbols == 0)
+        return NULL;
+    buckets = (const uint *) (modcache->bin + hdr->buckets_offs);
+    symbols = (const symcache_bin_symbol_t *) (modcache->bin + hdr->symbols_offs);
+    strings = (const char *) (modcache->bin + hdr->strings_offs);
+    hash = symcache_bin_hash(symbol);
+    mask = hdr->num_buckets - 1;
+    for (i = hash & mask, probes = 0; probes < hdr->num_buckets;
+         i = (i + 1) & mask, probes++) {
+        const symcache_bin_symbol_t *sym;
+        if (buckets[i] == 0 || buckets[i] > hdr->num_symbols)
+            return NULL;
+        sym = &symbols[buckets[i] - 1];
+        if (sym->hash == hash && sym->name_offs < hdr->strings_size &&
+            strcmp(strings + sym->name_offs, symbol) == 0)
+            return sym;
+    }
+    return NULL;
+}
+
+/* Returns the offsets array for sym, or NULL if the image is corrupted */
+static const uint *
+symcache_bin_offsets(mod_cache_t *modcache, const symcache_bin_symbol_t *sym)
+{
+    const symcache_bin_header_t *hdr = symcache_bin_header(modcache);
+    const uint *offs;
+    if (sym->offs_count == 0 ||
+        (uint64)sym->offs_start + sym->offs_count > hdr->num_offsets) {
+        WARN("WARNING: %s binary symbol cache file is corrupted\n", modcache->modname);
+        return NULL;
+    }
+    offs = (const uint *) (modcache->bin + hdr->offsets_offs) + sym->offs_start;
+#ifdef WINDOWS
+    {
+        /* Guard against corrupted files that cause DrMem to crash (i#1465) */
+        uint i;
+        for (i = 0; i < sym->offs_count; i++) {
+            if (offs[i] >= modcache->module_internal_size) {
+                /* This one we want to know about */
+                NOTIFY("SYMCACHE ERROR: %s file has too-large entry "PIFX" for %s"NL,
+                       modcache->modname, (ptr_uint_t)offs[i],
+                       (const char *) (modcache->bin + hdr->strings_offs) +
+                       sym->name_offs);
+                return NULL;
+            }
+        }
+    }
+#endif
+    return offs;
+}
+
 /* If an entry already exists and is 0, replaces it; else adds a new
  * offset for that symbol.
  *
- * If symtable is visible outside of this thread, the caller must hold symcache_lock.
+ * If symtable is visible outside of this thread, the caller must hold the module's
+ * lock.
  */
 static bool
-symcache_symbol_add(const char *modname, hashtable_t *symtable,
-                    const char *symbol, size_t offs)
+symcache_symbol_add_to_table(const char *modname, hashtable_t *symtable,
+                             const char *symbol, size_t offs)
 {
     offset_list_t *olist;
     offset_entry_t *e;
@@ -269,34 +435,221 @@ symcache_symbol_add(const char *modname, hashtable_t *symtable,
     return true;
 }
 
-/* caller must hold symcache_lock */
+/* Adds to the table, first copying any entry from the read-only binary image.
+ * Returns whether anything changed.
+ *
+ * If modcache is visible outside of this thread, the caller must hold modcache->lock.
+ */
+static bool
+symcache_symbol_add(mod_cache_t *modcache, const char *symbol, size_t offs)
+{
+    const symcache_bin_symbol_t *sym;
+    const uint *bin_offs;
+    uint i;
+    if (modcache->bin == NULL ||
+        hashtable_lookup(&modcache->table, (void *)symbol) != NULL)
+        return symcache_symbol_add_to_table(modcache->modname, &modcache->table,
+                                            symbol, offs);
+    sym = symcache_bin_find(modcache, symbol);
+    bin_offs = (sym == NULL) ? NULL : symcache_bin_offsets(modcache, sym);
+    if (bin_offs != NULL) {
+        for (i = 0; i < sym->offs_count; i++) {
+            if (bin_offs[i] == offs) {
+                LOG(2, "%s: ignoring dup entry %s\n", __FUNCTION__, symbol);
+                return false;
+            }
+        }
+        for (i = 0; i < sym->offs_count; i++) {
+            symcache_symbol_add_to_table(modcache->modname, &modcache->table,
+                                         symbol, bin_offs[i]);
+        }
+    }
+    return symcache_symbol_add_to_table(modcache->modname, &modcache->table,
+                                        symbol, offs);
+}
+
+static void
+symcache_bin_insert(uint *buckets, uint num_buckets, uint hash, uint idx)
+{
+    uint i;
+    for (i = hash & (num_buckets - 1); buckets[i] != 0; i = (i + 1) & (num_buckets - 1))
+        ; /* linear probing */
+    buckets[i] = idx + 1;
+}
+
+/* Returns a binary image holding both the table and any existing image entries
+ * that the table does not override, or NULL if there are no entries.
+ * Caller must hold modcache->lock.
+ */
+static byte *
+symcache_bin_build(mod_cache_t *modcache, size_t *image_size OUT)
+{
+    hashtable_t *symtable = &modcache->table;
+    const symcache_bin_header_t *old = symcache_bin_header(modcache);
+    const symcache_bin_symbol_t *old_symbols = NULL;
+    const char *old_strings = NULL;
+    symcache_bin_header_t *hdr;
+    symcache_bin_symbol_t *symbols;
+    uint *buckets, *offsets;
+    char *strings;
+    uint num_symbols = 0, num_offsets = 0, num_buckets, i, j;
+    size_t strings_size = 0, size;
+    byte *image;
+
+    if (old != NULL) {
+        old_symbols = (const symcache_bin_symbol_t *) (modcache->bin + old->symbols_offs);
+        old_strings = (const char *) (modcache->bin + old->strings_offs);
+    }
+
+    /* First size everything */
+    for (i = 0; i < HASHTABLE_SIZE(symtable->table_bits); i++) {
+        hash_entry_t *he;
+        for (he = symtable->table[i]; he != NULL; he = he->next) {
+            offset_list_t *olist = (offset_list_t *) he->payload;
+            if (olist == NULL)
+                continue;
+            num_symbols++;
+            num_offsets += olist->num;
+            strings_size += strlen((const char *) he->key) + 1;
+        }
+    }
+    for (i = 0; old != NULL && i < old->num_symbols; i++) {
+        const char *name = old_strings + old_symbols[i].name_offs;
+        if (old_symbols[i].name_offs >= old->strings_size ||
+            hashtable_lookup(symtable, (void *)name) != NULL ||
+            symcache_bin_offsets(modcache, &old_symbols[i]) == NULL)
+            continue;
+        num_symbols++;
+        num_offsets += old_symbols[i].offs_count;
+        strings_size += strlen(name) + 1;
+    }
+    if (num_symbols == 0)
+        return NULL;
+    /* Keep the load factor at or below 1/2 */
+    for (num_buckets = 1; num_buckets < num_symbols * 2; num_buckets *= 2)
+        ; /* empty */
+
+    size = ALIGN_FORWARD(sizeof(*hdr), 8);
+    size += ALIGN_FORWARD(num_buckets * sizeof(*buckets), 8);
+    size += ALIGN_FORWARD(num_symbols * sizeof(*symbols), 8);
+    size += ALIGN_FORWARD(num_offsets * sizeof(*offsets), 8);
+    size += strings_size;
+    image = (byte *) global_alloc(size, HEAPSTAT_HASHTABLE);
+    memset(image, 0, size);
+
+    hdr = (symcache_bin_header_t *) image;
+    memcpy(hdr->magic, SYMCACHE_BIN_MAGIC, sizeof(hdr->magic));
+    hdr->version = SYMCACHE_BIN_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->cache_file_size = size;
+    hdr->module_file_size = modcache->module_file_size;
+    hdr->timestamp = modcache->timestamp;
+#ifdef WINDOWS
+    hdr->file_version = modcache->file_version.version;
+    hdr->product_version = modcache->product_version.version;
+    hdr->module_internal_size = modcache->module_internal_size;
+    hdr->checksum = modcache->checksum;
+#elif defined(MACOS)
+    hdr->current_version = modcache->current_version;
+    hdr->compatibility_version = modcache->compatibility_version;
+    memcpy(hdr->uuid, modcache->uuid, sizeof(hdr->uuid));
+#endif
+    hdr->has_debug_info = modcache->has_debug_info;
+    hdr->num_buckets = num_buckets;
+    hdr->num_symbols = num_symbols;
+    hdr->num_offsets = num_offsets;
+    hdr->buckets_offs = ALIGN_FORWARD(sizeof(*hdr), 8);
+    hdr->symbols_offs = hdr->buckets_offs +
+        ALIGN_FORWARD(num_buckets * sizeof(*buckets), 8);
+    hdr->offsets_offs = hdr->symbols_offs +
+        ALIGN_FORWARD(num_symbols * sizeof(*symbols), 8);
+    hdr->strings_offs = hdr->offsets_offs +
+        ALIGN_FORWARD(num_offsets * sizeof(*offsets), 8);
+    hdr->strings_size = strings_size;
+    buckets = (uint *) (image + hdr->buckets_offs);
+    symbols = (symcache_bin_symbol_t *) (image + hdr->symbols_offs);
+    offsets = (uint *) (image + hdr->offsets_offs);
+    strings = (char *) (image + hdr->strings_offs);
+
+    /* Now fill it in, re-using the counters as cursors */
+    num_symbols = 0;
+    num_offsets = 0;
+    strings_size = 0;
+    for (i = 0; i < HASHTABLE_SIZE(symtable->table_bits); i++) {
+        hash_entry_t *he;
+        for (he = symtable->table[i]; he != NULL; he = he->next) {
+            offset_list_t *olist = (offset_list_t *) he->payload;
+            const char *name = (const char *) he->key;
+            offset_entry_t *e;
+            if (olist == NULL)
+                continue;
+            symbols[num_symbols].hash = symcache_bin_hash(name);
+            symbols[num_symbols].name_offs = (uint) strings_size;
+            symbols[num_symbols].offs_start = num_offsets;
+            symbols[num_symbols].offs_count = olist->num;
+            for (e = olist->list; e != NULL; e = e->next)
+                offsets[num_offsets++] = (uint) e->offs;
+            strcpy(strings + strings_size, name);
+            strings_size += strlen(name) + 1;
+            symcache_bin_insert(buckets, num_buckets, symbols[num_symbols].hash,
+                                num_symbols);
+            num_symbols++;
+        }
+    }
+    for (i = 0; old != NULL && i < old->num_symbols; i++) {
+        const char *name = old_strings + old_symbols[i].name_offs;
+        const uint *old_offs;
+        if (old_symbols[i].name_offs >= old->strings_size ||
+            hashtable_lookup(symtable, (void *)name) != NULL)
+            continue;
+        old_offs = symcache_bin_offsets(modcache, &old_symbols[i]);
+        if (old_offs == NULL)
+            continue;
+        symbols[num_symbols] = old_symbols[i];
+        symbols[num_symbols].name_offs = (uint) strings_size;
+        symbols[num_symbols].offs_start = num_offsets;
+        for (j = 0; j < old_symbols[i].offs_count; j++)
+            offsets[num_offsets++] = old_offs[j];
+        strcpy(strings + strings_size, name);
+        strings_size += strlen(name) + 1;
+        symcache_bin_insert(buckets, num_buckets, symbols[num_symbols].hash,
+                            num_symbols);
+        num_symbols++;
+    }
+    ASSERT(num_symbols == hdr->num_symbols && num_offsets == hdr->num_offsets &&
+           strings_size == hdr->strings_size, "symcache image size mismatch");
+    *image_size = size;
+    return image;
+}
+
+/* Writes the binary image, which then replaces both the prior image and the
+ * table as the in-memory cache.
+ * Caller must hold modcache->lock.
+ */
 static void
 symcache_write_symfile(const char *modname, mod_cache_t *modcache)
 {
     uint i;
     file_t f;
-    hashtable_t *symtable = &modcache->table;
-    char buf[SYMCACHE_BUFFER_SIZE];
-    size_t sofar = 0;
-    ssize_t len;
-    size_t bsz = BUFFER_SIZE_ELEMENTS(buf);
-    size_t filesz_loc;
+    byte *image;
+    size_t image_size;
     char symfile[MAXIMUM_PATH];
     char symfile_tmp[MAXIMUM_PATH];
-    int64 file_size;
 
-    ASSERT(dr_mutex_self_owns(symcache_lock), "missing symcache lock");
+    ASSERT(dr_mutex_self_owns(modcache->lock), "missing symcache lock");
 
     /* if from file, we assume it's a waste of time to re-write file:
      * the version matched after all, unless we appended to it.
      */
     if (modcache->from_file && !modcache->appended)
         return;
-    if (symtable->entries == 0)
+    image = symcache_bin_build(modcache, &image_size);
+    if (image == NULL)
         return; /* nothing to write */
 
     /* Open the temp symcache that we will rename.  */
-    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    symcache_get_filename(modname, true/*binary*/, symfile,
+                          BUFFER_SIZE_ELEMENTS(symfile));
     f = INVALID_FILE;
     i = 0;
     while (f == INVALID_FILE && i < SYMCACHE_MAX_TMP_TRIES) {
@@ -309,79 +662,161 @@ symcache_write_symfile(const char *modname, mod_cache_t *modcache)
     if (f == INVALID_FILE) {
         NOTIFY("WARNING: Unable to create symcache temp file %s"NL,
                symfile_tmp);
+        global_free(image, image_size, HEAPSTAT_HASHTABLE);
         return;
     }
-
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "%s %d\n",
-                   SYMCACHE_FILE_HEADER, SYMCACHE_VERSION);
-    /* Leave room for file size for self-consistency check */
-    filesz_loc = sofar;  /* XXX: Assumes that the buffer hasn't been flushed. */
-    BUFFERED_WRITE(f, buf, bsz, sofar, len,
-                   "%"STRINGIFY(SYMCACHE_SIZE_DIGITS)"u,", 0);
-#ifdef WINDOWS
-    BUFFERED_WRITE(f, buf, bsz, sofar, len,
-                   UINT64_FORMAT_STRING","UINT64_FORMAT_STRING","
-                   UINT64_FORMAT_STRING",%u,%u,%lu\n",
-                   modcache->module_file_size, modcache->file_version.version,
-                   modcache->product_version.version,
-                   modcache->checksum, modcache->timestamp,
-                   modcache->module_internal_size);
-#else
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, UINT64_FORMAT_STRING",%u",
-                   modcache->module_file_size, modcache->timestamp);
-# ifdef MACOS
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, ",%u,%u,",
-                   modcache->current_version, modcache->compatibility_version);
-    /* For easy sscanf we print as 4 ints */
-    for (i = 0; i < 4; i++)
-        BUFFERED_WRITE(f, buf, bsz, sofar, len, "%08x,", *(int*)(&modcache->uuid[i*4]));
-# endif
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "\n");
-#endif
-    BUFFERED_WRITE(f, buf, bsz, sofar, len, "%u\n", modcache->has_debug_info);
-    for (i = 0; i < HASHTABLE_SIZE(symtable->table_bits); i++) {
-        hash_entry_t *he;
-        for (he = symtable->table[i]; he != NULL; he = he->next) {
-            offset_list_t *olist = (offset_list_t *) he->payload;
-            offset_entry_t *e;
-            if (olist == NULL)
-                continue;
-            /* skip symbol in dup entries to save space */
-            BUFFERED_WRITE(f, buf, bsz, sofar, len, "%s", he->key);
-            e = olist->list;
-            while (e != NULL) {
-                BUFFERED_WRITE(f, buf, bsz, sofar, len, ",0x%x\n", e->offs);
-                e = e->next;
-            }
-        }
-    }
-
-    /* now update size */
-    FLUSH_BUFFER(f, buf, sofar);
-    if ((file_size = dr_file_tell(f)) < 0 ||
-        dr_snprintf(buf, BUFFER_SIZE_ELEMENTS(buf),
-                    "%"STRINGIFY(SYMCACHE_SIZE_DIGITS)"u", (uint)file_size) < 0 ||
-        !dr_file_seek(f, filesz_loc, DR_SEEK_SET) ||
-        dr_write_file(f, buf, SYMCACHE_SIZE_DIGITS) != SYMCACHE_SIZE_DIGITS) {
-        /* If any steps fail, warn and give up. */
-        NOTIFY("WARNING: Unable to write symcache file size."NL);
+    if (dr_write_file(f, image, image_size) != (ssize_t) image_size) {
+        NOTIFY("WARNING: Unable to write symcache file."NL);
         dr_close_file(f);
         dr_delete_file(symfile_tmp);
+        global_free(image, image_size, HEAPSTAT_HASHTABLE);
         return;
-    } else {
-        LOG(3, "Wrote symcache %s file size %u to pos "SZFMT"\n",
-            modname, (uint)file_size, filesz_loc);
-        ASSERT(strlen(buf) <= SYMCACHE_SIZE_DIGITS, "not enough space for file size");
     }
-
+    LOG(3, "Wrote symcache %s file size "SZFMT"\n", modname, image_size);
     dr_close_file(f);
 
+    /* Switch to the new image, which now matches the file */
+    symcache_bin_free(modcache);
+    modcache->bin = image;
+    modcache->bin_size = image_size;
+    hashtable_clear(&modcache->table);
+    modcache->from_file = true;
+    modcache->appended = false;
+
     if (!dr_rename_file(symfile_tmp, symfile, /*replace*/true)) {
         NOTIFY_ERROR("WARNING: Failed to rename the symcache file."NL);
         dr_delete_file(symfile_tmp);
     }
 }
 
+/* Whether an array of num elements of elem_size at file offset offs lies within
+ * a file of map_size bytes.  The offset comes from the file, so we compare it
+ * on its own before adding anything to it.
+ */
+static inline bool
+symcache_bin_array_fits(uint64 offs, uint num, size_t elem_size, uint64 map_size)
+{
+    /* num * elem_size can't overflow 64 bits */
+    return offs <= map_size && (uint64)num * elem_size <= map_size - offs;
+}
+
+/* Maps in a binary symbol cache file, checking its consistency with the module,
+ * and keeps a copy of it.  Sets modcache->has_debug_info if successful.
+ * No lock is needed as we assume the caller hasn't exposed modcache outside this
+ * thread yet.
+ */
+static bool
+symcache_read_binfile(const module_data_t *mod, const char *modname,
+                      mod_cache_t *modcache)
+{
+    bool res = false;
+    const symcache_bin_header_t *hdr;
+    uint64 map_size;
+    size_t actual_size;
+    bool ok;
+    void *map = NULL;
+    char symfile[MAXIMUM_PATH];
+    file_t f;
+
+    symcache_get_filename(modname, true/*binary*/, symfile,
+                          BUFFER_SIZE_ELEMENTS(symfile));
+    f = dr_open_file(symfile, DR_FILE_READ);
+    if (f == INVALID_FILE)
+        goto symcache_read_binfile_done;
+    LOG(2, "mapping binary symbol cache file for %s\n", modname);
+    ok = dr_file_size(f, &map_size);
+    if (ok) {
+        actual_size = (size_t) map_size;
+        ASSERT(actual_size == map_size, "file size too large");
+        map = dr_map_file(f, &actual_size, 0, NULL, DR_MEMPROT_READ, 0);
+    }
+    if (!ok || map == NULL || actual_size < map_size) {
+        NOTIFY_ERROR("Error mapping symcache file for %s"NL, modname);
+        goto symcache_read_binfile_done;
+    }
+    hdr = (const symcache_bin_header_t *) map;
+    if (map_size < sizeof(*hdr) ||
+        memcmp(hdr->magic, SYMCACHE_BIN_MAGIC, sizeof(hdr->magic)) != 0) {
+        WARN("WARNING: symbol cache file is corrupted\n");
+        goto symcache_read_binfile_done;
+    }
+    if (hdr->version != SYMCACHE_BIN_VERSION || hdr->header_size != sizeof(*hdr)) {
+        WARN("WARNING: symbol cache file has wrong version\n");
+        goto symcache_read_binfile_done;
+    }
+    if (hdr->cache_file_size != map_size) {
+        WARN("WARNING: %s symbol cache file is corrupted: map=%d vs file=%d\n",
+             modname, (uint)map_size, (uint)hdr->cache_file_size);
+        goto symcache_read_binfile_done;
+    }
+    /* Module consistency checks, as for the text format */
+#ifdef WINDOWS
+    if (hdr->module_file_size != modcache->module_file_size ||
+        hdr->file_version != modcache->file_version.version ||
+        hdr->product_version != modcache->product_version.version ||
+        hdr->checksum != modcache->checksum ||
+        hdr->timestamp != modcache->timestamp ||
+        hdr->module_internal_size != modcache->module_internal_size) {
+        LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
+        goto symcache_read_binfile_done;
+    }
+#elif defined(LINUX)
+    if (hdr->module_file_size != modcache->module_file_size ||
+        hdr->timestamp != modcache->timestamp) {
+        LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
+        goto symcache_read_binfile_done;
+    }
+#elif defined(MACOS)
+    if (hdr->current_version != modcache->current_version ||
+        hdr->compatibility_version != modcache->compatibility_version ||
+        memcmp(hdr->uuid, modcache->uuid, sizeof(hdr->uuid)) != 0) {
+        LOG(1, "module version mismatch: %s symbol cache file is stale\n", modname);
+        goto symcache_read_binfile_done;
+    }
+#endif
+    /* Check the array bounds here; individual entries are checked on use */
+    if ((hdr->num_symbols > 0 &&
+         (hdr->num_buckets < hdr->num_symbols ||
+          !IS_POWER_OF_2(hdr->num_buckets))) ||
+        !ALIGNED(hdr->buckets_offs, 8) || !ALIGNED(hdr->symbols_offs, 8) ||
+        !ALIGNED(hdr->offsets_offs, 8) ||
+        !symcache_bin_array_fits(hdr->buckets_offs, hdr->num_buckets, sizeof(uint),
+                                 map_size) ||
+        !symcache_bin_array_fits(hdr->symbols_offs, hdr->num_symbols,
+                                 sizeof(symcache_bin_symbol_t), map_size) ||
+        !symcache_bin_array_fits(hdr->offsets_offs, hdr->num_offsets, sizeof(uint),
+                                 map_size) ||
+        hdr->strings_offs > map_size || hdr->strings_size > map_size - hdr->strings_offs ||
+        (hdr->strings_size > 0 &&
+         ((const char *)map)[hdr->strings_offs + hdr->strings_size - 1] != '\0')) {
+        WARN("WARNING: %s symbol cache file is corrupted\n", modname);
+        goto symcache_read_binfile_done;
+    }
+    if (hdr->has_debug_info) {
+        /* We assume that the current availability of debug info doesn't matter */
+        modcache->has_debug_info = true;
+    } else {
+        /* We delay the costly check for symbols until we've read the symcache
+         * b/c if its entry indicates symbols we don't need to look
+         */
+        if (module_has_symbols(mod)) {
+            LOG(1, "module now has debug info: %s symbol cache is stale\n", modname);
+            goto symcache_read_binfile_done;
+        }
+    }
+    /* We copy the image and unmap the file so that a later save can replace it */
+    modcache->bin = (const byte *) global_alloc((size_t) map_size, HEAPSTAT_HASHTABLE);
+    memcpy((void *)modcache->bin, map, (size_t) map_size);
+    modcache->bin_size = (size_t) map_size;
+    res = true;
+ symcache_read_binfile_done:
+    if (map != NULL)
+        dr_unmap_file(map, actual_size);
+    if (f != INVALID_FILE)
+        dr_close_file(f);
+    return res;
+}
+
 #define MAX_SYMLEN 256
 
 /* Sets modcache->has_debug_info.
@@ -392,7 +827,6 @@ static bool
 symcache_read_symfile(const module_data_t *mod, const char *modname,
                       mod_cache_t *modcache)
 {
-    hashtable_t *symtable = &modcache->table;
     bool res = false;
     const char *line, *next_line;
     char symbol[MAX_SYMLEN];
@@ -404,7 +838,8 @@ symcache_read_symfile(const module_data_t *mod, const char *modname,
     char symfile[MAXIMUM_PATH];
     file_t f;
 
-    symcache_get_filename(modname, symfile, BUFFER_SIZE_ELEMENTS(symfile));
+    symcache_get_filename(modname, false/*text*/, symfile,
+                          BUFFER_SIZE_ELEMENTS(symfile));
     f = dr_open_file(symfile, DR_FILE_READ);
     if (f == INVALID_FILE)
         goto symcache_read_symfile_done;
@@ -566,7 +1001,7 @@ symcache_read_symfile(const module_data_t *mod, const char *modname,
                 goto symcache_read_symfile_done;
             }
 #endif
-            symcache_symbol_add(modname, symtable, symbol, offs);
+            symcache_symbol_add(modcache, symbol, offs);
         } else {
             WARN("WARNING: malformed symbol cache line \"%.*s\"\n",
                  next_line - line - 1, line);
@@ -633,7 +1068,7 @@ drsymcache_init(client_id_t client_id,
                       IF_WINDOWS_ELSE(HASH_STRING_NOCASE, HASH_STRING),
                       true/*strdup*/, false/*!synch*/,
                       symcache_free_entry, NULL, NULL);
-    symcache_lock = dr_mutex_create();
+    symcache_table_lock = dr_rwlock_create();
 
     dr_snprintf(symcache_dir, BUFFER_SIZE_ELEMENTS(symcache_dir),
                 "%s", symcache_dir_in);
@@ -687,17 +1122,26 @@ drsymcache_exit(void)
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
 
-    dr_mutex_lock(symcache_lock);
+    /* No preload thread may touch the table or its locks once we free them */
+    if (preload != NULL) {
+        symcache_preload_drain(NULL, true/*stop*/);
+        symcache_preload_release(preload);
+        preload = NULL;
+    }
+
+    dr_rwlock_write_lock(symcache_table_lock);
     for (i = 0; i < HASHTABLE_SIZE(symcache_table.table_bits); i++) {
         hash_entry_t *he;
         for (he = symcache_table.table[i]; he != NULL; he = he->next) {
             mod_cache_t *modcache = (mod_cache_t *) he->payload;
+            dr_mutex_lock(modcache->lock);
             symcache_write_symfile(modcache->modname, modcache);
+            dr_mutex_unlock(modcache->lock);
         }
     }
     hashtable_delete(&symcache_table);
-    dr_mutex_unlock(symcache_lock);
-    dr_mutex_destroy(symcache_lock);
+    dr_rwlock_write_unlock(symcache_table_lock);
+    dr_rwlock_destroy(symcache_table_lock);
 
     drmgr_unregister_module_load_event(symcache_module_load);
     drmgr_unregister_module_unload_event(symcache_module_unload);
@@ -746,17 +1190,18 @@ symcache_module_load(void *drcontext, const module_data_t *mod, bool loaded)
     }
 
     /* support initializing prior to module events => called twice */
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_read_lock(symcache_table_lock);
     modcache = (mod_cache_t *) hashtable_lookup(&symcache_table,
                                                 (void *)mod->full_path);
-    dr_mutex_unlock(symcache_lock);
+    dr_rwlock_read_unlock(symcache_table_lock);
     if (modcache != NULL) /* already there: e.g., ntdll, which we add early */
         return;
 
     modcache = (mod_cache_t *) global_alloc(sizeof(*modcache), HEAPSTAT_HASHTABLE);
     memset(modcache, 0, sizeof(*modcache));
+    modcache->lock = dr_mutex_create();
     hashtable_init_ex(&modcache->table, SYMCACHE_MODULE_TABLE_HASH_BITS,
-                      HASH_STRING, true/*strdup*/, false/*!synch: using global synch*/,
+                      HASH_STRING, true/*strdup*/, false/*!synch: using modcache->lock*/,
                       symcache_free_list, NULL, NULL);
 
     /* store consistency fields */
@@ -784,19 +1229,152 @@ symcache_module_load(void *drcontext, const module_data_t *mod, bool loaded)
 #endif
 
     modcache->modname = drmem_strdup(modname, HEAPSTAT_HASHTABLE);
-    modcache->from_file = symcache_read_symfile(mod, modname, modcache);
+    /* We prefer the binary cache.  A text cache, from an older version, is
+     * still used but is marked appended so it will be re-written as binary.
+     */
+    modcache->from_file = symcache_read_binfile(mod, modname, modcache);
+    if (!modcache->from_file) {
+        modcache->from_file = symcache_read_symfile(mod, modname, modcache);
+        if (modcache->from_file)
+            modcache->appended = true;
+    }
 
-    dr_mutex_lock(symcache_lock);
+    dr_rwlock_write_lock(symcache_table_lock);
     if (!hashtable_add(&symcache_table, (void *)mod->full_path, (void *)modcache)) {
-        /* this should be really rare to have dup paths (xref i#729) -- and
-         * actually we now have a lookup up above so we should only get here
-         * on a race while we let go of the lock
+        /* We have a lookup up above so we should only get here on a race
+         * with drsymcache_preload() or, really rarely, on dup paths (xref i#729).
+         * Either way the entry already there has the same data.
          */
-        WARN("WARNING: duplicate module paths: only caching symbols from first\n");
-        hashtable_delete(&modcache->table);
-        global_free(modcache, sizeof(*modcache), HEAPSTAT_HASHTABLE);
+        LOG(1, "%s: %s already cached: only caching symbols from first\n",
+            __FUNCTION__, mod->full_path);
+        symcache_free_entry(modcache);
+    }
+    dr_rwlock_write_unlock(symcache_table_lock);
+}
+
+/* Looks up the entry for mod and acquires its lock, or returns NULL.
+ * The caller must call symcache_module_release() if non-NULL is returned.
+ */
+static mod_cache_t *
+symcache_module_acquire(const module_data_t *mod)
+{
+    mod_cache_t *modcache;
+    dr_rwlock_read_lock(symcache_table_lock);
+    modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
+    if (modcache == NULL) {
+        dr_rwlock_read_unlock(symcache_table_lock);
+        return NULL;
+    }
+    dr_mutex_lock(modcache->lock);
+    return modcache;
+}
+
+static void
+symcache_module_release(mod_cache_t *modcache)
+{
+    dr_mutex_unlock(modcache->lock);
+    dr_rwlock_read_unlock(symcache_table_lock);
+}
+
+/* Shared by the threads of a drsymcache_preload().  Each thread holds a
+ * reference, as does the preload global until drsymcache_exit(), so a thread
+ * that only starts running after exit (client threads created during init do
+ * not run until init returns) still finds the data, and its lock, valid.
+ */
+struct _preload_data_t {
+    module_data_t **mods; /* entries set to NULL once unloaded */
+    uint num_mods;
+    int refcount;
+    /* Protects the fields below */
+    void *lock;
+    uint next_mod;
+    bool stopped;     /* no more modules will be claimed */
+    uint busy;        /* number of modules being read */
+    void *idle_event; /* signaled when busy is 0 */
+};
+
+static void
+symcache_preload_release(preload_data_t *data)
+{
+    uint i;
+    if (dr_atomic_add32_return_sum(&data->refcount, -1) > 0)
+        return;
+    for (i = data->next_mod; i < data->num_mods; i++) {
+        if (data->mods[i] != NULL)
+            dr_free_module_data(data->mods[i]);
+    }
+    global_free(data->mods, data->num_mods * sizeof(*data->mods), HEAPSTAT_HASHTABLE);
+    dr_event_destroy(data->idle_event);
+    dr_mutex_destroy(data->lock);
+    global_free(data, sizeof(*data), HEAPSTAT_HASHTABLE);
+}
+
+/* Called by the preload threads and by the thread that started the preload */
+static void
+symcache_preload_work(void *arg)
+{
+    preload_data_t *data = (preload_data_t *) arg;
+    void *drcontext = dr_get_current_drcontext();
+    while (true) {
+        module_data_t *mod;
+        dr_mutex_lock(data->lock);
+        if (data->stopped || data->next_mod >= data->num_mods) {
+            dr_mutex_unlock(data->lock);
+            break;
+        }
+        mod = data->mods[data->next_mod++];
+        if (mod == NULL) {
+            /* unloaded before we got to it */
+            dr_mutex_unlock(data->lock);
+            continue;
+        }
+        if (data->busy++ == 0)
+            dr_event_reset(data->idle_event);
+        dr_mutex_unlock(data->lock);
+
+        symcache_module_load(drcontext, mod, false/*!loaded: already present*/);
+        dr_free_module_data(mod);
+
+        dr_mutex_lock(data->lock);
+        if (--data->busy == 0)
+            dr_event_signal(data->idle_event);
+        dr_mutex_unlock(data->lock);
+    }
+    symcache_preload_release(data);
+}
+
+/* Waits until no preload thread is reading a module.  If mod is non-NULL,
+ * first drops mod from the modules still to be read, so that no preload thread
+ * adds an entry for it after it is unloaded.  If stop is set, no more modules
+ * will be read at all.
+ */
+static void
+symcache_preload_drain(const module_data_t *mod, bool stop)
+{
+    preload_data_t *data = preload;
+    uint i;
+    bool busy;
+    if (data == NULL)
+        return;
+    dr_mutex_lock(data->lock);
+    if (stop)
+        data->stopped = true;
+    if (mod != NULL) {
+        for (i = data->next_mod; i < data->num_mods; i++) {
+            if (data->mods[i] != NULL &&
+                strcmp(data->mods[i]->full_path, mod->full_path) == 0) {
+                dr_free_module_data(data->mods[i]);
+                data->mods[i] = NULL;
+            }
+        }
     }
-    dr_mutex_unlock(symcache_lock);
+    busy = (data->busy > 0);
+    dr_mutex_unlock(data->lock);
+    /* The event is only reset when busy goes up from 0, so this returns once
+     * the modules being read now are done, even if others are claimed later.
+     */
+    if (busy)
+        dr_event_wait(data->idle_event);
 }
 
 static drmf_status_t
@@ -808,14 +1386,99 @@ symcache_module_save_common(const module_data_t *mod, bool remove)
         return DRMF_ERROR_INVALID_PARAMETER; /* don't support caching */
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
-    dr_mutex_lock(symcache_lock);
-    modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
-    if (modcache != NULL) {
-        symcache_write_symfile(modname, modcache);
-        if (remove)
+    /* A preload thread reading mod must finish before we remove its entry */
+    if (remove)
+        symcache_preload_drain(mod, false/*!stop*/);
+    /* We write while only holding the outer lock for reading, to avoid
+     * blocking lookups in other modules on file I/O.
+     */
+    modcache = symcache_module_acquire(mod);
+    if (modcache == NULL)
+        return DRMF_SUCCESS;
+    symcache_write_symfile(modname, modcache);
+    symcache_module_release(modcache);
+    if (remove) {
+        dr_rwlock_write_lock(symcache_table_lock);
+        modcache = (mod_cache_t *)
+            hashtable_lookup(&symcache_table, (void *)mod->full_path);
+        if (modcache != NULL) {
+            /* This is a nop unless something was added since the write above */
+            dr_mutex_lock(modcache->lock);
+            symcache_write_symfile(modname, modcache);
+            dr_mutex_unlock(modcache->lock);
             hashtable_remove(&symcache_table, (void *)mod->full_path);
+        }
+        dr_rwlock_write_unlock(symcache_table_lock);
+    }
+    return DRMF_SUCCESS;
+}
+
+DR_EXPORT
+drmf_status_t
+drsymcache_preload(uint num_threads)
+{
+    preload_data_t *data;
+    dr_module_iterator_t *iter;
+    uint i, capacity = 64;
+    if (!initialized)
+        return DRMF_ERROR_NOT_INITIALIZED;
+    if (preload != NULL)
+        return DRMF_ERROR_INVALID_CALL; /* only one preload is supported */
+    data = (preload_data_t *) global_alloc(sizeof(*data), HEAPSTAT_HASHTABLE);
+    memset(data, 0, sizeof(*data));
+    data->mods = (module_data_t **)
+        global_alloc(capacity * sizeof(*data->mods), HEAPSTAT_HASHTABLE);
+    iter = dr_module_iterator_start();
+    while (dr_module_iterator_hasnext(iter)) {
+        module_data_t *mod = dr_module_iterator_next(iter);
+        if (data->num_mods == capacity) {
+            module_data_t **grown = (module_data_t **)
+                global_alloc(capacity * 2 * sizeof(*grown), HEAPSTAT_HASHTABLE);
+            memcpy(grown, data->mods, capacity * sizeof(*grown));
+            global_free(data->mods, capacity * sizeof(*grown), HEAPSTAT_HASHTABLE);
+            data->mods = grown;
+            capacity *= 2;
+        }
+        data->mods[data->num_mods++] = mod;
     }
-    dr_mutex_unlock(symcache_lock);
+    dr_module_iterator_stop(iter);
+    if (data->num_mods == 0) {
+        global_free(data->mods, capacity * sizeof(*data->mods), HEAPSTAT_HASHTABLE);
+        global_free(data, sizeof(*data), HEAPSTAT_HASHTABLE);
+        return DRMF_SUCCESS;
+    }
+    /* Trim to the size that symcache_preload_work() frees */
+    if (data->num_mods < capacity) {
+        module_data_t **trimmed = (module_data_t **)
+            global_alloc(data->num_mods * sizeof(*trimmed), HEAPSTAT_HASHTABLE);
+        memcpy(trimmed, data->mods, data->num_mods * sizeof(*trimmed));
+        global_free(data->mods, capacity * sizeof(*trimmed), HEAPSTAT_HASHTABLE);
+        data->mods = trimmed;
+    }
+    LOG(1, "%s: preloading %d modules with %d threads\n", __FUNCTION__,
+        data->num_mods, num_threads);
+    data->lock = dr_mutex_create();
+    data->idle_event = dr_event_create();
+    dr_event_signal(data->idle_event);
+
+    /* This thread counts as one worker.  We can't wait here for the others,
+     * which may not start running until after we return (e.g., if called from
+     * the client's init routine): this thread keeps claiming modules until none
+     * are left, and a module load event for a module still being read by
+     * another thread simply reads it again.  A module's unload event and
+     * drsymcache_exit() instead wait for the modules being read.
+     */
+    data->refcount = 2; /* this thread and the preload global */
+    preload = data;
+    for (i = 1; i < num_threads && i < data->num_mods; i++) {
+        dr_atomic_add32_return_sum(&data->refcount, 1);
+        if (!dr_create_client_thread(symcache_preload_work, data)) {
+            LOG(1, "WARNING: unable to create symcache preload thread\n");
+            dr_atomic_add32_return_sum(&data->refcount, -1);
+            break;
+        }
+    }
+    symcache_preload_work(data);
     return DRMF_SUCCESS;
 }
 
@@ -850,13 +1513,14 @@ symcache_module_has_data(const module_data_t *mod, bool require_syms, bool *res)
         return DRMF_ERROR_INVALID_PARAMETER; /* don't support caching */
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
-    dr_mutex_lock(symcache_lock);
-    modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
+    modcache = symcache_module_acquire(mod);
     if (modcache != NULL) {
-        *res = (modcache->table.entries > 0 &&
+        const symcache_bin_header_t *hdr = symcache_bin_header(modcache);
+        *res = ((modcache->table.entries > 0 ||
+                 (hdr != NULL && hdr->num_symbols > 0)) &&
                 (!require_syms || modcache->has_debug_info));
+        symcache_module_release(modcache);
     }
-    dr_mutex_unlock(symcache_lock);
     return DRMF_SUCCESS;
 }
 
@@ -893,17 +1557,15 @@ drsymcache_add(const module_data_t *mod, const char *symbol, size_t offs)
         return DRMF_ERROR_INVALID_PARAMETER;
     if (!initialized)
         return DRMF_ERROR_NOT_INITIALIZED;
-    dr_mutex_lock(symcache_lock);
-    modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
+    modcache = symcache_module_acquire(mod);
     if (modcache == NULL) {
         LOG(2, "%s: there is no cache for %s\n", __FUNCTION__, modname);
-        dr_mutex_unlock(symcache_lock);
         return DRMF_ERROR_NOT_FOUND;
     }
-    if (symcache_symbol_add(modname, &modcache->table, symbol, offs) &&
+    if (symcache_symbol_add(modcache, symbol, offs) &&
         modcache->from_file)
         modcache->appended = true;
-    dr_mutex_unlock(symcache_lock);
+    symcache_module_release(modcache);
     return DRMF_SUCCESS;
 }
 
@@ -924,16 +1586,32 @@ drsymcache_lookup(const module_data_t *mod, const char *symbol,
     if (symbol == NULL || offs_array == NULL || num_entries == NULL ||
         offs_single == NULL)
         return DRMF_ERROR_INVALID_PARAMETER;
-    dr_mutex_lock(symcache_lock);
-    modcache = (mod_cache_t *) hashtable_lookup(&symcache_table, (void *)mod->full_path);
-    if (modcache == NULL) {
-        dr_mutex_unlock(symcache_lock);
+    modcache = symcache_module_acquire(mod);
+    if (modcache == NULL)
         return DRMF_ERROR_NOT_FOUND;
-    }
+    /* The table holds only entries added since the image was produced */
     olist = (offset_list_t *) hashtable_lookup(&modcache->table, (void *)symbol);
     if (olist == NULL) {
-        dr_mutex_unlock(symcache_lock);
-        return DRMF_ERROR_NOT_FOUND;
+        const symcache_bin_symbol_t *sym = symcache_bin_find(modcache, symbol);
+        const uint *bin_offs = (sym == NULL) ? NULL : symcache_bin_offsets(modcache, sym);
+        if (bin_offs == NULL) {
+            symcache_module_release(modcache);
+            return DRMF_ERROR_NOT_FOUND;
+        }
+        if (sym->offs_count == 1)
+            *offs_array = offs_single;
+        else {
+            *offs_array = (size_t *) global_alloc(sym->offs_count * sizeof(size_t),
+                                                  HEAPSTAT_HASHTABLE);
+        }
+        *num_entries = sym->offs_count;
+        for (i = 0; i < sym->offs_count; i++) {
+            (*offs_array)[i] = bin_offs[i];
+            LOG(2, "sym lookup of %s in %s => symcache hit %d of %d == "PIFX"\n",
+                symbol, mod->full_path, i, sym->offs_count, (*offs_array)[i]);
+        }
+        symcache_module_release(modcache);
+        return DRMF_SUCCESS;
     }
     ASSERT(olist->num > 0, "empty list not allowed");
     if (olist->num == 1)
@@ -949,7 +1627,7 @@ drsymcache_lookup(const module_data_t *mod, const char *symbol,
         LOG(2, "sym lookup of %s in %s => symcache hit %d of %d == "PIFX"\n",
             symbol, mod->full_path, i, olist->num, e->offs);
     }
-    dr_mutex_unlock(symcache_lock);
+    symcache_module_release(modcache);
     return DRMF_SUCCESS;
 }
 
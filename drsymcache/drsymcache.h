@@ -164,6 +164,26 @@ DR_EXPORT
 drmf_status_t
 drsymcache_module_save_symcache(const module_data_t *mod);
 
+DR_EXPORT
+/**
+ * Reads in the symbol cache files for all modules currently loaded, using up
+ * to \p num_threads threads (including the calling thread) to read different
+ * modules' files in parallel.  Normally each module's file is read in its
+ * module load event, which for the modules present at startup happens
+ * serially; calling this routine after drsymcache_init() avoids that delay.
+ * Returns once every module has been claimed by some thread, without waiting
+ * for other threads to finish reading: a module load event for a module that
+ * is still being read simply reads it itself.  A module's unload event, and
+ * drsymcache_exit(), wait for any module still being read.  Only one preload
+ * is supported per drsymcache_init().
+ *
+ * @param[in]  num_threads  The maximum number of threads to use.
+ *
+ * \return success code.
+ */
+drmf_status_t
+drsymcache_preload(uint num_threads);
+
 DR_EXPORT
 /**
  * Adds a new entry for the symbol name \p symbol to the symbol cache for \p mod.
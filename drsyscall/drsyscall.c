@@ -124,6 +124,21 @@ void *systable_lock;
 static drsys_param_type_t
 map_to_exported_type(uint sysarg_type, size_t *sz_out OUT);
 
+static void
+sysarg_plans_init(void);
+
+static void
+sysarg_plan_compile(syscall_info_t *sysinfo);
+
+static void
+sysarg_plans_free(void);
+
+static void
+process_pre_syscall_plan(cls_syscall_t *pt, sysarg_iter_info_t *ii);
+
+static void
+process_post_syscall_plan(cls_syscall_t *pt, sysarg_iter_info_t *ii);
+
 /***************************************************************************
  * SYSTEM CALLS
  */
@@ -298,25 +313,213 @@ sysnum_cmp(void *v1, void *v2)
     return drsys_sysnums_equal(num1, num2);
 }
 
+/* To avoid taking systable_lock on every syscall, lookups use an immutable
+ * snapshot of systable and secondary_systable: an array indexed directly by
+ * syscall number for the dense range of primary numbers, with any other
+ * entries (secondaries, and primaries with large numbers) in sorted arrays for
+ * binary search.  The snapshot is built at init time and rebuilt if an
+ * os-specific module load event adds entries (Windows does so when syscall
+ * numbers are not known up front).  Replaced snapshots are kept until exit as
+ * a lookup may still be using them.
+ */
+#define SYSCALL_DISPATCH_MAX_DENSE 0x2000
+
+typedef struct _syscall_dispatch_t {
+    syscall_info_t **dense;  /* indexed by number, for secondary==0 */
+    uint num_dense;
+    syscall_info_t **sparse; /* other systable entries, sorted by number */
+    uint num_sparse;
+    syscall_info_t **secondary; /* secondary_systable entries, sorted */
+    uint num_secondary;
+    /* Used to detect additions since this was built */
+    uint systable_entries;
+    uint secondary_entries;
+    struct _syscall_dispatch_t *prev; /* replaced snapshot, freed at exit */
+} syscall_dispatch_t;
+
+static syscall_dispatch_t * volatile syscall_dispatch;
+
+static int
+sysnum_order(drsys_sysnum_t *num1, drsys_sysnum_t *num2)
+{
+    if (num1->number != num2->number)
+        return (num1->number < num2->number) ? -1 : 1;
+    if (num1->secondary != num2->secondary)
+        return (num1->secondary < num2->secondary) ? -1 : 1;
+    return 0;
+}
+
+static void
+syscall_dispatch_sort(syscall_info_t **array, uint num)
+{
+    /* Insertion sort: this runs once at init on a few hundred entries, which
+     * are mostly already in order.
+     */
+    uint i, j;
+    for (i = 1; i < num; i++) {
+        syscall_info_t *cur = array[i];
+        for (j = i; j > 0 && sysnum_order(&array[j-1]->num, &cur->num) > 0; j--)
+            array[j] = array[j-1];
+        array[j] = cur;
+    }
+}
+
+static syscall_info_t *
+syscall_dispatch_search(syscall_info_t **array, uint num, drsys_sysnum_t *sysnum)
+{
+    uint lo = 0, hi = num;
+    while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        int cmp = sysnum_order(&array[mid]->num, sysnum);
+        if (cmp == 0)
+            return array[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static syscall_info_t **
+syscall_dispatch_array(hashtable_t *table, uint *num OUT)
+{
+    syscall_info_t **array;
+    uint i, count = 0;
+    *num = table->entries;
+    if (table->entries == 0)
+        return NULL;
+    array = (syscall_info_t **)
+        global_alloc(table->entries * sizeof(*array), HEAPSTAT_MISC);
+    for (i = 0; i < HASHTABLE_SIZE(table->table_bits); i++) {
+        hash_entry_t *he;
+        for (he = table->table[i]; he != NULL; he = he->next)
+            array[count++] = (syscall_info_t *) he->payload;
+    }
+    ASSERT(count == table->entries, "hashtable count is off");
+    syscall_dispatch_sort(array, count);
+    return array;
+}
+
+static void
+syscall_dispatch_build(void)
+{
+    syscall_dispatch_t *d;
+    syscall_info_t **all;
+    uint i, num_all, max_dense = 0;
+    dr_recurlock_lock(systable_lock);
+    d = (syscall_dispatch_t *) global_alloc(sizeof(*d), HEAPSTAT_MISC);
+    memset(d, 0, sizeof(*d));
+    d->systable_entries = systable.entries;
+    d->secondary_entries = secondary_systable.entries;
+    d->secondary = syscall_dispatch_array(&secondary_systable, &d->num_secondary);
+
+    all = syscall_dispatch_array(&systable, &num_all);
+    for (i = 0; i < num_all; i++) {
+        if (all[i]->num.secondary == 0 && all[i]->num.number >= 0 &&
+            all[i]->num.number < SYSCALL_DISPATCH_MAX_DENSE &&
+            (uint)all[i]->num.number >= max_dense)
+            max_dense = all[i]->num.number + 1;
+    }
+    d->num_dense = max_dense;
+    if (max_dense > 0) {
+        d->dense = (syscall_info_t **)
+            global_alloc(max_dense * sizeof(*d->dense), HEAPSTAT_MISC);
+        memset(d->dense, 0, max_dense * sizeof(*d->dense));
+    }
+    for (i = 0; i < num_all; i++) {
+        if (all[i]->num.secondary == 0 && all[i]->num.number >= 0 &&
+            (uint)all[i]->num.number < max_dense)
+            d->dense[all[i]->num.number] = all[i];
+        else
+            all[d->num_sparse++] = all[i]; /* stays sorted */
+    }
+    if (d->num_sparse > 0) {
+        d->sparse = (syscall_info_t **)
+            global_alloc(d->num_sparse * sizeof(*d->sparse), HEAPSTAT_MISC);
+        memcpy(d->sparse, all, d->num_sparse * sizeof(*d->sparse));
+    }
+    if (all != NULL)
+        global_free(all, num_all * sizeof(*all), HEAPSTAT_MISC);
+    for (i = 0; i < d->num_dense; i++) {
+        if (d->dense[i] != NULL)
+            sysarg_plan_compile(d->dense[i]);
+    }
+    for (i = 0; i < d->num_sparse; i++)
+        sysarg_plan_compile(d->sparse[i]);
+    for (i = 0; i < d->num_secondary; i++)
+        sysarg_plan_compile(d->secondary[i]);
+    LOG(1, "syscall dispatch: %d dense, %d sparse, %d secondary\n",
+        d->num_dense, d->num_sparse, d->num_secondary);
+
+    d->prev = syscall_dispatch;
+    /* The fields must be visible before the pointer: we rely on x86 store
+     * ordering for rebuilds at module load time, which only happen on Windows.
+     */
+    syscall_dispatch = d;
+    dr_recurlock_unlock(systable_lock);
+}
+
+static void
+syscall_dispatch_free(void)
+{
+    syscall_dispatch_t *d = syscall_dispatch, *prev;
+    syscall_dispatch = NULL;
+    sysarg_plans_free();
+    for (; d != NULL; d = prev) {
+        prev = d->prev;
+        if (d->dense != NULL)
+            global_free(d->dense, d->num_dense * sizeof(*d->dense), HEAPSTAT_MISC);
+        if (d->sparse != NULL)
+            global_free(d->sparse, d->num_sparse * sizeof(*d->sparse), HEAPSTAT_MISC);
+        if (d->secondary != NULL) {
+            global_free(d->secondary, d->num_secondary * sizeof(*d->secondary),
+                        HEAPSTAT_MISC);
+        }
+        global_free(d, sizeof(*d), HEAPSTAT_MISC);
+    }
+}
+
+/* Returns whether entries were added since the snapshot was built */
+static inline bool
+syscall_dispatch_stale(syscall_dispatch_t *d)
+{
+    return (d == NULL || d->systable_entries != systable.entries ||
+            d->secondary_entries != secondary_systable.entries);
+}
+
 syscall_info_t *
 syscall_lookup(drsys_sysnum_t num, bool resolve_secondary)
 {
     /* The common case is lookup for syscalls without secondary component,
-     * which requires only one hashtable lookup. So we pay a cost of second
+     * which requires only one array lookup. So we pay a cost of second
      * lookup only if user queries it.
      */
     syscall_info_t *res = NULL;
+    syscall_dispatch_t *d = syscall_dispatch;
+    if (syscall_dispatch_stale(d)) {
+        /* We're still in init, or in a module load event adding entries */
+        dr_recurlock_lock(systable_lock);
+        if (resolve_secondary) {
+            res = (syscall_info_t *)
+                hashtable_lookup(&secondary_systable, (void *) &num);
+        }
+        if (res == NULL)
+            res = (syscall_info_t *) hashtable_lookup(&systable, (void *) &num);
+        dr_recurlock_unlock(systable_lock);
+        return res;
+    }
     /* First we look for secondary table to avoid collision with primary table
      * in case when user looks for secondary table for entry with .0 secondary num.
      */
-    dr_recurlock_lock(systable_lock);
-    if (resolve_secondary) {
-        res = (syscall_info_t *) hashtable_lookup(&secondary_systable, (void *) &num);
-    }
+    if (resolve_secondary && d->num_secondary > 0)
+        res = syscall_dispatch_search(d->secondary, d->num_secondary, &num);
     if (res == NULL) {
-        res = (syscall_info_t *) hashtable_lookup(&systable, (void *) &num);
+        if (num.secondary == 0 && num.number >= 0 && (uint)num.number < d->num_dense)
+            res = d->dense[num.number];
+        else if (d->num_sparse > 0)
+            res = syscall_dispatch_search(d->sparse, d->num_sparse, &num);
     }
-    dr_recurlock_unlock(systable_lock);
     return res;
 }
 
@@ -1417,6 +1620,10 @@ process_pre_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
 
     LOG(SYSCALL_VERBOSE, "processing pre system call #"SYSNUM_FMT"."SYSNUM_FMT" %s\n",
         pt->sysnum.number, pt->sysnum.secondary, sysinfo->name);
+    if (sysinfo->plan != NULL) {
+        process_pre_syscall_plan(pt, ii);
+        return;
+    }
     for (i=0; i<MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
         LOG(SYSCALL_VERBOSE, "\t  pre considering arg %d %d %x\n", sysinfo->arg[i].param,
             sysinfo->arg[i].size, sysinfo->arg[i].flags);
@@ -1505,6 +1712,10 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
         pt->sysnum.number, pt->sysnum.secondary);
     LOG(SYSCALL_VERBOSE, " %s res="PIFX"\n",
         sysinfo->name, dr_syscall_get_result(drcontext));
+    if (sysinfo->plan != NULL) {
+        process_post_syscall_plan(pt, ii);
+        return;
+    }
     for (i=0; i<MAX_ARGS_IN_ENTRY; i++) { /* not <arg_count b/c of double entries */
         LOG(SYSCALL_VERBOSE, "\t  post considering arg %d %d %x "PFX"\n",
             sysinfo->arg[i].param, sysinfo->arg[i].size, sysinfo->arg[i].flags,
@@ -1607,6 +1818,288 @@ process_post_syscall_reads_and_writes(cls_syscall_t *pt, sysarg_iter_info_t *ii)
     }
 }
 
+/***************************************************************************
+ * Compiled syscall arg plans
+ */
+
+/* The walks above re-derive on every syscall which entries of sysinfo->arg[]
+ * apply, their sizes, and their types.  Most entries have a constant size and
+ * no special handling, so we compile each syscall's entries once into a list
+ * of steps for pre and for post, with what is known statically filled in.
+ * The walks below execute these and must match the walks above.
+ */
+enum {
+    /* The size is in sysarg_plan_step_t.size and sysarg_get_size() is not needed */
+    SYSARG_PLAN_FIXED_SIZE      = 0x01,
+    /* An os-specific handler may take over the access (SYSARG_COMPLEX_TYPE) */
+    SYSARG_PLAN_HANDLER         = 0x02,
+    /* should_ignore_arg() may apply */
+    SYSARG_PLAN_IGNORE_IF_NULL  = 0x04,
+    /* The next entry in sysinfo->arg[] is valid */
+    SYSARG_PLAN_HAS_NEXT        = 0x08,
+    /* The next entry in sysinfo->arg[] is a second entry for the same param */
+    SYSARG_PLAN_DUP_FOLLOWS     = 0x10,
+};
+
+typedef struct _sysarg_plan_step_t {
+    ushort index; /* into sysinfo->arg[] */
+    ushort flags; /* SYSARG_PLAN_* */
+    uint size;    /* for SYSARG_PLAN_FIXED_SIZE */
+    drsys_param_mode_t mode;
+    drsys_param_type_t type;
+} sysarg_plan_step_t;
+
+typedef struct _sysarg_plan_t {
+    syscall_info_t *sysinfo;
+    struct _sysarg_plan_t *next; /* list of all plans, for freeing */
+    uint num_pre;
+    uint num_post;
+    sysarg_plan_step_t *pre;
+    sysarg_plan_step_t *post;
+    /* the steps follow in the same allocation */
+} sysarg_plan_t;
+
+/* Protected by systable_lock */
+static sysarg_plan_t *sysarg_plans;
+
+/* The id strings for report_memarg_ex(), to avoid printing one per arg */
+static char sysarg_param_ids[SYSCALL_NUM_ARG_STORE][16];
+
+static void
+sysarg_plans_init(void)
+{
+    int i;
+    for (i = 0; i < SYSCALL_NUM_ARG_STORE; i++) {
+        /* indicate which syscall arg (i#510) */
+        dr_snprintf(sysarg_param_ids[i], BUFFER_SIZE_ELEMENTS(sysarg_param_ids[i]),
+                    "parameter #%d", i);
+        NULL_TERMINATE_BUFFER(sysarg_param_ids[i]);
+    }
+}
+
+static inline const char *
+sysarg_param_id(int param)
+{
+    ASSERT(param >= 0 && param < SYSCALL_NUM_ARG_STORE, "param # out of range");
+    return sysarg_param_ids[param];
+}
+
+static void
+sysarg_plan_step_init(sysarg_plan_step_t *step, syscall_info_t *sysinfo, int i)
+{
+    sysinfo_arg_t *arg = &sysinfo->arg[i];
+    memset(step, 0, sizeof(*step));
+    step->index = (ushort) i;
+    step->mode = mode_from_flags(arg->flags);
+    step->type = type_from_arg_info(arg);
+    /* Mirror sysarg_get_size() for an immediate size */
+    if (arg->size > 0 &&
+        !TESTANY(SYSARG_LENGTH_INOUT | SYSARG_POST_SIZE_IO_STATUS, arg->flags) &&
+        !(TEST(SYSARG_SIZE_IN_ELEMENTS, arg->flags) && arg->misc <= 0)) {
+        step->flags |= SYSARG_PLAN_FIXED_SIZE;
+        step->size = arg->size;
+        if (TEST(SYSARG_SIZE_PLUS_1, arg->flags))
+            step->size++;
+        if (TEST(SYSARG_SIZE_IN_ELEMENTS, arg->flags))
+            step->size *= arg->misc;
+    }
+    if (TEST(SYSARG_COMPLEX_TYPE, arg->flags))
+        step->flags |= SYSARG_PLAN_HANDLER;
+    if (TESTANY(SYSARG_IGNORE_IF_NEXT_NULL | SYSARG_IGNORE_IF_PREV_NULL, arg->flags))
+        step->flags |= SYSARG_PLAN_IGNORE_IF_NULL;
+    if (i + 1 < MAX_ARGS_IN_ENTRY && !sysarg_invalid(&sysinfo->arg[i + 1])) {
+        step->flags |= SYSARG_PLAN_HAS_NEXT;
+        if (sysinfo->arg[i + 1].param == arg->param)
+            step->flags |= SYSARG_PLAN_DUP_FOLLOWS;
+    }
+}
+
+/* Caller must hold systable_lock */
+static void
+sysarg_plan_compile(syscall_info_t *sysinfo)
+{
+    sysarg_plan_step_t pre[MAX_ARGS_IN_ENTRY], post[MAX_ARGS_IN_ENTRY];
+    uint num_pre = 0, num_post = 0;
+    int i, last_param = -1;
+    sysarg_plan_t *plan;
+    /* A secondary-table entry's args are never walked */
+    if (sysinfo->plan != NULL || TEST(SYSINFO_SECONDARY_TABLE, sysinfo->flags))
+        return;
+    for (i = 0; i < MAX_ARGS_IN_ENTRY; i++) {
+        sysinfo_arg_t *arg = &sysinfo->arg[i];
+        if (sysarg_invalid(arg))
+            break;
+        if (arg->param < 0 || arg->param >= SYSCALL_NUM_ARG_STORE) {
+            /* Leave it to the interpreter and its asserts */
+            return;
+        }
+        /* As in process_pre_syscall_reads_and_writes(), 2nd entries are
+         * only for post, as are inlined and non-memarg entries.
+         */
+        if (arg->param != last_param) {
+            last_param = arg->param;
+            if (!TESTANY(SYSARG_INLINED | SYSARG_NON_MEMARG, arg->flags))
+                sysarg_plan_step_init(&pre[num_pre++], sysinfo, i);
+        }
+        if (TEST(SYSARG_WRITE, arg->flags))
+            sysarg_plan_step_init(&post[num_post++], sysinfo, i);
+    }
+    plan = (sysarg_plan_t *)
+        global_alloc(sizeof(*plan) + (num_pre + num_post) * sizeof(*pre),
+                     HEAPSTAT_MISC);
+    plan->sysinfo = sysinfo;
+    plan->num_pre = num_pre;
+    plan->num_post = num_post;
+    plan->pre = (sysarg_plan_step_t *) (plan + 1);
+    plan->post = plan->pre + num_pre;
+    memcpy(plan->pre, pre, num_pre * sizeof(*pre));
+    memcpy(plan->post, post, num_post * sizeof(*post));
+    plan->next = sysarg_plans;
+    sysarg_plans = plan;
+    sysinfo->plan = plan;
+}
+
+static void
+sysarg_plans_free(void)
+{
+    sysarg_plan_t *plan, *next;
+    for (plan = sysarg_plans; plan != NULL; plan = next) {
+        next = plan->next;
+        /* The tables are static and outlive us across re-attach */
+        plan->sysinfo->plan = NULL;
+        global_free(plan, sizeof(*plan) +
+                    (plan->num_pre + plan->num_post) * sizeof(*plan->pre),
+                    HEAPSTAT_MISC);
+    }
+    sysarg_plans = NULL;
+}
+
+/* Plan-driven version of process_pre_syscall_reads_and_writes() */
+static void
+process_pre_syscall_plan(cls_syscall_t *pt, sysarg_iter_info_t *ii)
+{
+    void *drcontext = ii->arg->drcontext;
+    syscall_info_t *sysinfo = pt->sysinfo;
+    sysarg_plan_t *plan = sysinfo->plan;
+    uint s;
+    for (s = 0; s < plan->num_pre; s++) {
+        sysarg_plan_step_t *step = &plan->pre[s];
+        sysinfo_arg_t *arg = &sysinfo->arg[step->index];
+        app_pc start = SYSARG_AS_PTR(pt, arg->param, app_pc);
+        ptr_uint_t size;
+        if (TEST(SYSARG_PLAN_FIXED_SIZE, step->flags)) {
+            size = step->size;
+        } else {
+            size = sysarg_get_size(drcontext, pt, ii, sysinfo, step->index,
+                                   true/*pre*/, start);
+        }
+        pt->sysarg_known_sz[arg->param] = size;
+        LOG(SYSCALL_VERBOSE, "\t  pre storing size "PIFX" for arg %d\n",
+            size, arg->param);
+        if (ii->abort)
+            break;
+        if (start != NULL && size > 0) {
+            size_t real_sz = (size == SIZE_DYNAMIC) ? 0 : size;
+            bool skip = false;
+            if (TEST(SYSARG_PLAN_HANDLER, step->flags)) {
+                skip = os_handle_pre_syscall_arg_access(ii, arg, start, real_sz);
+                if (ii->abort)
+                    break;
+            }
+            if (!skip && TEST(SYSARG_PLAN_IGNORE_IF_NULL, step->flags) &&
+                should_ignore_arg(pt, ii, sysinfo, step->index))
+                skip = true;
+            if (!skip &&
+                !report_memarg_ex(ii, arg->param, step->mode, start, real_sz,
+                                  sysarg_param_id(arg->param), step->type, NULL,
+                                  DRSYS_TYPE_INVALID))
+                break;
+        }
+    }
+}
+
+/* Plan-driven version of process_post_syscall_reads_and_writes() */
+static void
+process_post_syscall_plan(cls_syscall_t *pt, sysarg_iter_info_t *ii)
+{
+    void *drcontext = ii->arg->drcontext;
+    syscall_info_t *sysinfo = pt->sysinfo;
+    sysarg_plan_t *plan = sysinfo->plan;
+    ptr_uint_t last_size = 0;
+    int last_param = -1;
+    uint s;
+#ifdef WINDOWS
+    ptr_int_t result = dr_syscall_get_result(drcontext);
+#endif
+    for (s = 0; s < plan->num_post; s++) {
+        sysarg_plan_step_t *step = &plan->post[s];
+        int i = step->index;
+        sysinfo_arg_t *arg = &sysinfo->arg[i];
+        app_pc start;
+        ptr_uint_t size;
+        bool skip;
+#ifdef WINDOWS
+        /* i#486, i#531, i#932: for too-small buffer, only last param written */
+        if (TEST(SYSARG_PLAN_HAS_NEXT, step->flags) &&
+            os_syscall_ret_small_write_last(sysinfo, result))
+            continue;
+#endif
+        start = SYSARG_AS_PTR(pt, arg->param, app_pc);
+        if (TEST(SYSARG_PLAN_FIXED_SIZE, step->flags)) {
+            size = step->size;
+        } else {
+            size = sysarg_get_size(drcontext, pt, ii, sysinfo, i, false/*!pre*/,
+                                   start);
+        }
+        if (ii->abort)
+            break;
+        /* i#1119: use the written size, not the required size */
+        if (size > pt->sysarg_known_sz[arg->param])
+            size = pt->sysarg_known_sz[arg->param];
+
+        if (arg->param == last_param) {
+            /* For a double entry, the 2nd indicates the actual written size */
+            if (size == 0
+                IF_WINDOWS(|| result == STATUS_PENDING
+                           || result == STATUS_BUFFER_TOO_SMALL
+                           || result == STATUS_BUFFER_OVERFLOW))
+                size = last_size;
+            if (TEST(SYSARG_NO_WRITE_IF_COUNT_0, arg->flags)) {
+                ASSERT(i > 0, "logic error");
+                if (i > 0 && pt->sysarg[-sysinfo->arg[i-1].size] == 0)
+                    size = 0;
+            }
+            if (start != NULL && size > 0) {
+                skip = TEST(SYSARG_PLAN_HANDLER, step->flags) &&
+                    os_handle_post_syscall_arg_access(ii, arg, start, size);
+                if (!skip && TEST(SYSARG_PLAN_IGNORE_IF_NULL, step->flags) &&
+                    should_ignore_arg(pt, ii, sysinfo, i))
+                    skip = true;
+                if (!skip &&
+                    !report_memarg_ex(ii, arg->param, step->mode, start, size,
+                                      sysarg_param_id(arg->param), step->type, NULL,
+                                      DRSYS_TYPE_INVALID))
+                    break;
+            }
+            continue;
+        }
+        last_param = arg->param;
+        last_size = size;
+        /* If the first in a double entry, give 2nd entry precedence */
+        if (TEST(SYSARG_PLAN_DUP_FOLLOWS, step->flags))
+            continue;
+        if (start != NULL && size > 0) {
+            skip = TEST(SYSARG_PLAN_HANDLER, step->flags) &&
+                os_handle_post_syscall_arg_access(ii, arg, start, size);
+            if (!skip &&
+                !report_memarg_ex(ii, arg->param, step->mode, start, size,
+                                  sysarg_param_id(arg->param), step->type, NULL,
+                                  DRSYS_TYPE_INVALID))
+                break;
+        }
+    }
+}
+
 static syscall_info_t *
 get_sysinfo(void *drcontext, cls_syscall_t *pt, int initial_num,
             drsys_sysnum_t *sysnum OUT)
@@ -2074,6 +2567,8 @@ static void
 syscall_module_load(void *drcontext, const module_data_t *info, bool loaded)
 {
     drsyscall_os_module_load(drcontext, info, loaded);
+    if (syscall_dispatch_stale(syscall_dispatch))
+        syscall_dispatch_build();
 }
 
 static void
@@ -2209,6 +2704,8 @@ drsys_init(client_id_t client_id, drsys_options_t *ops)
     res = drsyscall_os_init(drcontext);
     if (res != DRMF_SUCCESS && res != DRMF_WARNING_UNSUPPORTED_KERNEL)
         return res;
+    sysarg_plans_init();
+    syscall_dispatch_build();
 
     /* We used to handle all the gory details of Windows pre- and
      * post-syscall hooking ourselves, including system call parameter
@@ -2272,6 +2769,7 @@ drsys_exit(void)
 
     hashtable_delete(&filtered_table);
 
+    syscall_dispatch_free();
     drsyscall_os_exit();
 
     dr_recurlock_destroy(systable_lock);
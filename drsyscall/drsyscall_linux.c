@@ -51,9 +51,10 @@ union ioctl_data {
  * syscall_lookup() while still sharing data for syscalls that are
  * identical between the two modes if we generated a static table from
  * macros.  But macros are a little ugly with commas which our nested
- * structs are full of.  So we go ahead and pay the cost of a
- * hashtable lookup.  We could list in x86 order and avoid the
- * hashtable lookup there except we want to eventually support
+ * structs are full of.  So we build the hashtables here, and
+ * drsyscall.c derives a directly indexed array from them at init time
+ * for syscall_lookup().  We could list in x86 order and index the
+ * static table directly except we want to eventually support
  * mixed-mode and thus we want both x64 and x86 entries in the same
  * list.  We assume syscall numbers easily fit in 16 bits and pack the
  * numbers for the two platforms together via PACKNUM.
@@ -295,6 +295,11 @@ typedef struct _syscall_info_t {
      * (I'd use a union but that makes syscall table initializers uglier)
      */
     drsys_sysnum_t *num_out;
+    /* Compiled form of arg[] for the memarg walks, built by drsyscall.c
+     * when the entry is added to the syscall lookup snapshot.  NULL until
+     * then, in which case arg[] is interpreted directly.
+     */
+    struct _sysarg_plan_t *plan;
 } syscall_info_t;
 
 typedef struct _cls_syscall_t {
@@ -360,6 +365,9 @@ typedef uint (*drsys_get_secnum_cb_t)(const char *name, uint primary_number);
  * stored in this table to the client.
  * We assume the source tables pointed into are set at process init
  * and never changed afterward.
+ * syscall_lookup() does not query this table directly but rather a lock-free
+ * snapshot of it built by drsyscall.c once drsyscall_os_init() returns and
+ * after any drsyscall_os_module_load() that adds to it.
  */
 extern hashtable_t systable;
 
@@ -0,0 +1,103 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Built with -fomit-frame-pointer: each level below main has no frame
+ * pointer and uses the frame pointer register as a general register, so
+ * only the .eh_frame unwind info finds the callers exactly.  Each level
+ * keeps a live local array and does work after the call so it is neither
+ * inlined nor turned into a tail call.  The callers also hold decoy return
+ * addresses in their frames, which a walk that scans the stack for return
+ * addresses rather than using the unwind info reports as extra frames.
+ */
+
+#define NOINLINE __attribute__((noinline))
+
+static char * volatile sink;
+
+static NOINLINE void *
+return_address(void)
+{
+    return __builtin_return_address(0);
+}
+
+/* Returns the address just past a call, as a stale return address would be */
+static NOINLINE void *
+decoy_retaddr(void)
+{
+    void *ra = return_address();
+    sink = ra; /* not a tail call */
+    return ra;
+}
+
+static NOINLINE int
+level3(int x)
+{
+    char *p = malloc(8);
+    int res;
+    sink = p;
+    /* read beyond the end of the allocation */
+    res = p[8];
+    free(p);
+    return res + x;
+}
+
+static NOINLINE int
+level2(int x)
+{
+    volatile int locals[5];
+    void * volatile decoys[2];
+    int i, sum = 0;
+    for (i = 0; i < 5; i++)
+        locals[i] = x + i;
+    decoys[0] = decoy_retaddr();
+    decoys[1] = decoys[0];
+    sum = level3(locals[2]);
+    for (i = 0; i < 5; i++)
+        sum += locals[i];
+    return sum;
+}
+
+static NOINLINE int
+level1(int x)
+{
+    volatile int locals[3];
+    void * volatile decoys[2];
+    int i, sum = 0;
+    for (i = 0; i < 3; i++)
+        locals[i] = x * i;
+    decoys[0] = decoy_retaddr();
+    decoys[1] = decoys[0];
+    sum = level2(locals[1]);
+    for (i = 0; i < 3; i++)
+        sum += locals[i];
+    return sum;
+}
+
+int
+main(int argc, char **argv)
+{
+    int res = level1(argc);
+    printf("all done%s\n", res == 0x7fffffff ? "!" : "");
+    return 0;
+}
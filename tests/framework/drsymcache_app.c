@@ -0,0 +1,59 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test of the Dr. SymCache Extension: each load of the library is a new
+ * module for drsymcache, which reads the cache file written at the last one.
+ * The count must be at least the number of stages in drsymcache_client.c.
+ */
+
+#include <stdio.h>
+#ifdef WINDOWS
+# include <windows.h>
+#else
+# include <dlfcn.h>
+#endif
+
+#define NUM_LOADS 8
+
+int
+main(int argc, char **argv)
+{
+    int i;
+    for (i = 0; i < NUM_LOADS; i++) {
+#ifdef WINDOWS
+        HMODULE lib = LoadLibraryA(LIB_NAME);
+        if (lib == NULL) {
+            fprintf(stderr, "failed to load %s\n", LIB_NAME);
+            return 1;
+        }
+        FreeLibrary(lib);
+#else
+        void *lib = dlopen(LIB_NAME, RTLD_NOW | RTLD_LOCAL);
+        if (lib == NULL) {
+            fprintf(stderr, "failed to load %s: %s\n", LIB_NAME, dlerror());
+            return 1;
+        }
+        dlclose(lib);
+#endif
+    }
+    fprintf(stderr, "done\n");
+    return 0;
+}
@@ -0,0 +1,275 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Test of the Dr. SymCache Extension's cache files.  drsymcache_app loads
+ * and unloads drsymcache_lib once per stage below.  drsymcache reads the
+ * library's cache file at each load and writes it at load and unload, and
+ * before each read we may replace the file with a corrupted copy.
+ */
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "drsyms.h"
+#include "drsymcache.h"
+#include <stddef.h> /* offsetof */
+#include <string.h>
+
+#undef ASSERT /* we don't want msgbox */
+#define ASSERT(cond, msg) \
+    ((void)((!(cond)) ? \
+     (dr_fprintf(STDERR, "ASSERT FAILURE: %s:%d: %s (%s)", \
+                 __FILE__,  __LINE__, #cond, msg), \
+      dr_abort(), 0) : 0))
+
+#define BUFFER_SIZE_ELEMENTS(buf) (sizeof(buf) / sizeof((buf)[0]))
+#define NULL_TERMINATE_BUFFER(buf) (buf)[BUFFER_SIZE_ELEMENTS(buf)-1] = '\0'
+
+/* The start of symcache_bin_header_t in drsymcache.c, whose layout is part
+ * of the file format.
+ */
+typedef struct _bin_header_t {
+    char magic[8];
+    uint version;
+    uint header_size;
+    uint64 cache_file_size;
+    uint64 module_file_size;
+    uint64 file_version;
+    uint64 product_version;
+    uint64 module_internal_size;
+    uint64 buckets_offs;
+    uint64 symbols_offs;
+    uint64 offsets_offs;
+    uint64 strings_offs;
+    uint64 strings_size;
+} bin_header_t;
+
+/* A value that wraps past the file size when added to, and is 8-aligned to
+ * get past the alignment checks.
+ */
+#define WRAPPING_OFFS (~(uint64)7)
+
+enum {
+    STAGE_WRITE,        /* No file: add symbols, which are then saved */
+    STAGE_ROUND_TRIP,   /* Read them back, and add one to replace the file */
+    STAGE_REPLACED,     /* Read the replacement, and keep a copy of it */
+    STAGE_TRUNCATED,    /* The rest each corrupt the copy and expect no cache */
+    STAGE_WRAP_SYMBOLS,
+    STAGE_WRAP_OFFSETS,
+    STAGE_WRAP_STRINGS,
+    STAGE_RESTORED,     /* The unmodified copy must still read fine */
+    STAGE_COUNT,
+};
+
+static char symcache_dir[MAXIMUM_PATH];
+static int stage;
+static byte *good_file;
+static size_t good_size;
+
+static bool
+is_test_lib(const module_data_t *mod)
+{
+    const char *name = dr_module_preferred_name(mod);
+    return name != NULL && strstr(name, "drsymcache_lib") != NULL;
+}
+
+static void
+get_cache_path(const module_data_t *mod, char *path, size_t path_count)
+{
+    dr_snprintf(path, path_count, "%s/%s.bin", symcache_dir,
+                dr_module_preferred_name(mod));
+    path[path_count-1] = '\0';
+}
+
+static void
+write_cache_file(const module_data_t *mod, const byte *data, size_t size)
+{
+    char path[MAXIMUM_PATH];
+    file_t f;
+    get_cache_path(mod, path, BUFFER_SIZE_ELEMENTS(path));
+    dr_delete_file(path);
+    f = dr_open_file(path, DR_FILE_WRITE_OVERWRITE);
+    ASSERT(f != INVALID_FILE, "failed to open cache file");
+    ASSERT(dr_write_file(f, data, size) == (ssize_t)size, "failed to write cache file");
+    dr_close_file(f);
+}
+
+static void
+read_cache_file(const module_data_t *mod)
+{
+    char path[MAXIMUM_PATH];
+    uint64 size;
+    file_t f;
+    get_cache_path(mod, path, BUFFER_SIZE_ELEMENTS(path));
+    f = dr_open_file(path, DR_FILE_READ);
+    ASSERT(f != INVALID_FILE, "failed to open cache file");
+    ASSERT(dr_file_size(f, &size), "failed to size cache file");
+    ASSERT(size >= sizeof(bin_header_t), "cache file too small");
+    good_size = (size_t) size;
+    good_file = (byte *) dr_global_alloc(good_size);
+    ASSERT(dr_read_file(f, good_file, good_size) == (ssize_t)good_size,
+           "failed to read cache file");
+    dr_close_file(f);
+}
+
+static void
+write_corrupted_file(const module_data_t *mod, size_t field_offs, uint64 value)
+{
+    byte *copy = (byte *) dr_global_alloc(good_size);
+    memcpy(copy, good_file, good_size);
+    *(uint64 *)(copy + field_offs) = value;
+    write_cache_file(mod, copy, good_size);
+    dr_global_free(copy, good_size);
+}
+
+static void
+check_symbol(const module_data_t *mod, const char *symbol, uint expect_num,
+             size_t expect_first, size_t expect_second)
+{
+    size_t *offs, offs_single;
+    uint num;
+    drmf_status_t res = drsymcache_lookup(mod, symbol, &offs, &num, &offs_single);
+    if (expect_num == 0) {
+        ASSERT(res == DRMF_ERROR_NOT_FOUND, "symbol should not be cached");
+        return;
+    }
+    ASSERT(res == DRMF_SUCCESS, "symbol should be cached");
+    ASSERT(num == expect_num, "wrong number of entries");
+    ASSERT(offs[0] == expect_first, "wrong offset");
+    if (num > 1)
+        ASSERT(offs[1] == expect_second, "wrong second offset");
+    drsymcache_free_lookup(offs, num);
+}
+
+static void
+check_symbols(const module_data_t *mod, bool expect_added)
+{
+    check_symbol(mod, "sym_one", 1, 0x10, 0);
+    check_symbol(mod, "sym_multi", 2, 0x20, 0x30);
+    /* A negative entry */
+    check_symbol(mod, "sym_none", 1, 0, 0);
+    check_symbol(mod, "sym_added", expect_added ? 1 : 0, 0x40, 0);
+    check_symbol(mod, "sym_missing", 0, 0, 0);
+}
+
+static void
+check_not_cached(const module_data_t *mod)
+{
+    bool cached;
+    ASSERT(drsymcache_module_is_cached(mod, &cached) == DRMF_SUCCESS, "query failed");
+    ASSERT(!cached, "corrupted cache file should be rejected");
+    check_symbol(mod, "sym_one", 0, 0, 0);
+}
+
+/* Runs before drsymcache reads the cache file */
+static void
+event_module_load_pre(void *drcontext, const module_data_t *mod, bool loaded)
+{
+    if (!is_test_lib(mod))
+        return;
+    switch (stage) {
+    case STAGE_WRITE: {
+        char path[MAXIMUM_PATH];
+        get_cache_path(mod, path, BUFFER_SIZE_ELEMENTS(path));
+        dr_delete_file(path); /* from a prior run */
+        break;
+    }
+    case STAGE_REPLACED:
+        read_cache_file(mod);
+        break;
+    case STAGE_TRUNCATED:
+        write_cache_file(mod, good_file, good_size / 2);
+        break;
+    case STAGE_WRAP_SYMBOLS:
+        write_corrupted_file(mod, offsetof(bin_header_t, symbols_offs), WRAPPING_OFFS);
+        break;
+    case STAGE_WRAP_OFFSETS:
+        write_corrupted_file(mod, offsetof(bin_header_t, offsets_offs), WRAPPING_OFFS);
+        break;
+    case STAGE_WRAP_STRINGS:
+        write_corrupted_file(mod, offsetof(bin_header_t, strings_size), WRAPPING_OFFS);
+        break;
+    case STAGE_RESTORED:
+        write_cache_file(mod, good_file, good_size);
+        break;
+    }
+}
+
+/* Runs after drsymcache reads the cache file and before it saves it */
+static void
+event_module_load(void *drcontext, const module_data_t *mod, bool loaded)
+{
+    if (!is_test_lib(mod))
+        return;
+    switch (stage) {
+    case STAGE_WRITE:
+        check_not_cached(mod);
+        ASSERT(drsymcache_add(mod, "sym_one", 0x10) == DRMF_SUCCESS, "add failed");
+        ASSERT(drsymcache_add(mod, "sym_multi", 0x20) == DRMF_SUCCESS, "add failed");
+        ASSERT(drsymcache_add(mod, "sym_multi", 0x30) == DRMF_SUCCESS, "add failed");
+        ASSERT(drsymcache_add(mod, "sym_none", 0) == DRMF_SUCCESS, "add failed");
+        check_symbols(mod, false);
+        break;
+    case STAGE_ROUND_TRIP:
+        check_symbols(mod, false);
+        /* Saving this replaces the file we just read */
+        ASSERT(drsymcache_add(mod, "sym_added", 0x40) == DRMF_SUCCESS, "add failed");
+        break;
+    case STAGE_REPLACED:
+    case STAGE_RESTORED:
+        check_symbols(mod, true);
+        break;
+    default:
+        check_not_cached(mod);
+        break;
+    }
+    stage++;
+}
+
+static void
+exit_event(void)
+{
+    ASSERT(stage == STAGE_COUNT, "library not loaded enough times");
+    if (good_file != NULL)
+        dr_global_free(good_file, good_size);
+    if (drsymcache_exit() != DRMF_SUCCESS)
+        ASSERT(false, "drsymcache failed to exit");
+    drsym_exit();
+    drmgr_exit();
+    dr_fprintf(STDERR, "TEST PASSED\n");
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    drmgr_priority_t pri_pre = {sizeof(pri_pre), "drsymcache_test_pre", NULL, NULL,
+                                DRMGR_PRIORITY_MODLOAD_DRSYMCACHE_READ - 1};
+    ASSERT(argc == 2, "usage: <symcache dir>");
+    dr_snprintf(symcache_dir, BUFFER_SIZE_ELEMENTS(symcache_dir), "%s", argv[1]);
+    NULL_TERMINATE_BUFFER(symcache_dir);
+    drmgr_init();
+    if (drsym_init(0) != DRSYM_SUCCESS)
+        ASSERT(false, "drsyms failed to init");
+    if (drsymcache_init(id, symcache_dir, 0) != DRMF_SUCCESS)
+        ASSERT(false, "drsymcache failed to init");
+    drmgr_register_module_load_event_ex(event_module_load_pre, &pri_pre);
+    drmgr_register_module_load_event(event_module_load);
+    dr_register_exit_event(exit_event);
+}
@@ -0,0 +1,205 @@
+/* **************************************************************
+ * Copyright (c) 2017 Google, Inc.  All rights reserved.
+ * **************************************************************/
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of Google, Inc. nor the names of its contributors may be
+ *   used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL GOOGLE, INC. OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+/* Tests umbra_shadow_set_range_bits(), umbra_shadow_copy_range_bits(), and
+ * umbra_shadow_set_ranges_bits() with 2 shadow bits per app byte, including
+ * ranges that begin and end in the middle of a shadow byte and copies between
+ * ranges aligned differently.
+ */
+
+#include <string.h>
+
+#include "dr_api.h"
+#include "drmgr.h"
+#include "umbra.h"
+
+#define BITS 2
+#define BUF_SIZE 256
+
+static umbra_map_t *umbra_map;
+
+/* We only use the addresses of this buffer, never its contents. */
+static byte buf[BUF_SIZE * 2];
+
+static uint
+get_value(app_pc addr)
+{
+    byte shadow;
+    size_t shadow_size = sizeof(shadow);
+    app_pc base = (app_pc) ALIGN_BACKWARD(addr, 4);
+    if (umbra_read_shadow_memory(umbra_map, base, 4, &shadow_size,
+                                 &shadow) != DRMF_SUCCESS ||
+        shadow_size != sizeof(shadow))
+        DR_ASSERT(false);
+    return (shadow >> ((addr - base) * BITS)) & ((1 << BITS) - 1);
+}
+
+static void
+check_range(app_pc start, const uint *expect, size_t size)
+{
+    size_t i;
+    for (i = 0; i < size; i++)
+        DR_ASSERT(get_value(start + i) == expect[i]);
+}
+
+static void
+test_partial_bytes(void)
+{
+    app_pc start = (app_pc) ALIGN_FORWARD(buf, 64);
+    uint expect[BUF_SIZE], old[BUF_SIZE];
+    size_t i;
+
+    /* set all, then unaligned pieces on top */
+    if (umbra_shadow_set_range_bits(umbra_map, start, BUF_SIZE, BITS, 1)
+        != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    for (i = 0; i < BUF_SIZE; i++)
+        expect[i] = 1;
+    if (umbra_shadow_set_range_bits(umbra_map, start + 1, 2, BITS, 3) != DRMF_SUCCESS ||
+        umbra_shadow_set_range_bits(umbra_map, start + 5, 30, BITS, 2) != DRMF_SUCCESS ||
+        umbra_shadow_set_range_bits(umbra_map, start + 39, 1, BITS, 0) != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    for (i = 1; i < 3; i++)
+        expect[i] = 3;
+    for (i = 5; i < 35; i++)
+        expect[i] = 2;
+    expect[39] = 0;
+    check_range(start, expect, BUF_SIZE);
+
+    /* a value too large for the bits is rejected */
+    if (umbra_shadow_set_range_bits(umbra_map, start, 4, BITS, 4) == DRMF_SUCCESS)
+        DR_ASSERT(false);
+
+    /* copy to a differently aligned destination */
+    if (umbra_shadow_copy_range_bits(umbra_map, start + 1, start + 130, 41, BITS)
+        != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    for (i = 0; i < 41; i++)
+        expect[130 + i] = expect[1 + i];
+    check_range(start, expect, BUF_SIZE);
+
+    /* overlapping copies in both directions */
+    memcpy(old, expect, sizeof(old));
+    if (umbra_shadow_copy_range_bits(umbra_map, start, start + 3, 50, BITS)
+        != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    for (i = 0; i < 50; i++)
+        expect[3 + i] = old[i];
+    check_range(start, expect, BUF_SIZE);
+    memcpy(old, expect, sizeof(old));
+    if (umbra_shadow_copy_range_bits(umbra_map, start + 7, start + 2, 50, BITS)
+        != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    for (i = 0; i < 50; i++)
+        expect[2 + i] = old[7 + i];
+    check_range(start, expect, BUF_SIZE);
+}
+
+static void
+test_batched_ranges(void)
+{
+    app_pc start = (app_pc) ALIGN_FORWARD(buf, 64);
+    umbra_shadow_range_t ranges[5];
+    uint expect[BUF_SIZE];
+    size_t i;
+
+    if (umbra_shadow_set_range_bits(umbra_map, start, BUF_SIZE, BITS, 0)
+        != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    for (i = 0; i < BUF_SIZE; i++)
+        expect[i] = 0;
+    /* out of order, adjacent, overlapping with the same value, and empty */
+    ranges[0].start = start + 100;
+    ranges[0].end = start + 103;
+    ranges[0].value = 3;
+    ranges[1].start = start + 5;
+    ranges[1].end = start + 10;
+    ranges[1].value = 1;
+    ranges[2].start = start + 10;
+    ranges[2].end = start + 13;
+    ranges[2].value = 1;
+    ranges[3].start = start + 101;
+    ranges[3].end = start + 150;
+    ranges[3].value = 3;
+    ranges[4].start = start + 200;
+    ranges[4].end = start + 200;
+    ranges[4].value = 2;
+    if (umbra_shadow_set_ranges_bits(umbra_map, ranges, 5, BITS) != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    for (i = 5; i < 13; i++)
+        expect[i] = 1;
+    for (i = 100; i < 150; i++)
+        expect[i] = 3;
+    check_range(start, expect, BUF_SIZE);
+
+    /* overlapping ranges with different values are rejected untouched */
+    ranges[0].start = start + 20;
+    ranges[0].end = start + 30;
+    ranges[0].value = 2;
+    ranges[1].start = start + 29;
+    ranges[1].end = start + 31;
+    ranges[1].value = 1;
+    if (umbra_shadow_set_ranges_bits(umbra_map, ranges, 2, BITS) == DRMF_SUCCESS)
+        DR_ASSERT(false);
+    check_range(start, expect, BUF_SIZE);
+}
+
+static void
+exit_event(void)
+{
+    if (umbra_destroy_mapping(umbra_map) != DRMF_SUCCESS)
+        DR_ASSERT(false);
+    umbra_exit();
+    drmgr_exit();
+}
+
+DR_EXPORT void
+dr_client_main(client_id_t id, int argc, const char *argv[])
+{
+    umbra_map_options_t umbra_map_ops;
+
+    drmgr_init();
+
+    memset(&umbra_map_ops, 0, sizeof(umbra_map_ops));
+    umbra_map_ops.scale              = UMBRA_MAP_SCALE_DOWN_4X;
+    umbra_map_ops.flags              = UMBRA_MAP_CREATE_SHADOW_ON_TOUCH;
+    umbra_map_ops.default_value      = 0;
+    umbra_map_ops.default_value_size = 1;
+
+    if (umbra_init(id) != DRMF_SUCCESS)
+        DR_ASSERT_MSG(false, "fail to init umbra");
+    if (umbra_create_mapping(&umbra_map_ops, &umbra_map) != DRMF_SUCCESS)
+        DR_ASSERT_MSG(false, "fail to create shadow memory mapping");
+    test_partial_bytes();
+    test_batched_ranges();
+    dr_register_exit_event(exit_event);
+}
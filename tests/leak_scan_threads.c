@@ -0,0 +1,70 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Run with several -leak_scan_threads: the mid-run leak scan, which we
+ * request with the valgrind annotation, runs on the workers while the scan
+ * at exit is serial, and both must report the same leaks.
+ */
+
+#include "memcheck.h"
+
+/* = is head pointer, - is mid-chunk pointer:
+ *
+ * root_mid ---------> A <===> B
+ *                             ^
+ * root_head ==> R ------------|
+ *
+ * A and B are a cycle of possible leaks.  The serial scan finds A from the
+ * roots and B only from R, so A is first on the maybe-reachable queue and
+ * B is reported as indirectly reachable from it.  B is allocated first so
+ * that it usually sits at a lower address than A, which catches a scan
+ * that orders the queue by address rather than by discovery.
+ */
+static char **root_mid;
+static char **root_head;
+
+static void
+build(void)
+{
+    char **pA, **pB, **pR;
+    pB = malloc(sizeof(*pB)*6);
+    pA = malloc(sizeof(*pA)*8);
+    pR = malloc(sizeof(*pR)*4);
+    pA[0] = (char *) pB;
+    pB[0] = (char *) pA;
+    /* Avoid the offsets of the mid-chunk heuristics */
+    pR[1] = (char *) (pB + 5);
+    root_mid = pA + 5;
+    root_head = pR;
+}
+
+int
+main()
+{
+    build();
+    printf("built\n");
+    VALGRIND_DO_LEAK_CHECK;
+    printf("all done\n");
+    return 0;
+}
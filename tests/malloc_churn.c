@@ -0,0 +1,132 @@
+/* **********************************************************
+ * Copyright (c) 2026 Google, Inc.  All rights reserved.
+ * **********************************************************/
+
+/* Dr. Memory: the memory debugger
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License, and no later version.
+
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Run with -replace_malloc_thread_cache: several threads churn small
+ * mallocs and frees across the cached size classes, and hand some of
+ * their chunks to a neighbor to free, so chunks move between the
+ * per-thread caches, the queued frees, and the arena lists.  Each thread
+ * stamps its chunks and checks the stamp before freeing them, which
+ * catches a chunk handed out to two threads at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define NUM_THREADS 4
+#define ITERS 20000
+#define LIVE_SLOTS 64
+#define MAX_SIZE 600 /* beyond the largest cached size class */
+
+/* one chunk per thread waiting for its neighbor to free it */
+static char *handoff[NUM_THREADS];
+static pthread_mutex_t handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int corrupted;
+
+static void
+check_and_free(char *p, size_t size, char stamp)
+{
+    size_t i;
+    for (i = 0; i < size; i++) {
+        if (p[i] != stamp) {
+            corrupted = 1;
+            break;
+        }
+    }
+    free(p);
+}
+
+static void *
+churn(void *arg)
+{
+    int id = (int)(size_t)arg;
+    char *live[LIVE_SLOTS];
+    size_t sizes[LIVE_SLOTS];
+    unsigned int seed = id + 1;
+    int i;
+    memset(live, 0, sizeof(live));
+    for (i = 0; i < ITERS; i++) {
+        int slot = rand_r(&seed) % LIVE_SLOTS;
+        char *give = NULL, *take;
+        if (live[slot] != NULL) {
+            check_and_free(live[slot], sizes[slot], (char)id);
+            live[slot] = NULL;
+            continue;
+        }
+        sizes[slot] = 1 + rand_r(&seed) % MAX_SIZE;
+        live[slot] = malloc(sizes[slot]);
+        if (live[slot] == NULL) {
+            corrupted = 1;
+            break;
+        }
+        memset(live[slot], id, sizes[slot]);
+        if (i % 16 == 0) {
+            /* pass a zeroed chunk to the next thread and free the one we got */
+            give = calloc(1, 48);
+            pthread_mutex_lock(&handoff_lock);
+            take = handoff[id];
+            handoff[id] = NULL;
+            if (handoff[(id + 1) % NUM_THREADS] == NULL) {
+                handoff[(id + 1) % NUM_THREADS] = give;
+                give = NULL;
+            }
+            pthread_mutex_unlock(&handoff_lock);
+            if (take != NULL)
+                check_and_free(take, 48, 0);
+            if (give != NULL)
+                check_and_free(give, 48, 0);
+        }
+    }
+    for (i = 0; i < LIVE_SLOTS; i++) {
+        if (live[i] != NULL)
+            check_and_free(live[i], sizes[i], (char)id);
+    }
+    return NULL;
+}
+
+int
+main()
+{
+    pthread_t threads[NUM_THREADS];
+    char *p;
+    int i;
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, churn, (void *)(size_t)i) != 0) {
+            fprintf(stderr, "cannot create thread\n");
+            return 1;
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    for (i = 0; i < NUM_THREADS; i++)
+        free(handoff[i]);
+    printf("churn %s\n", corrupted ? "corrupted a chunk" : "done");
+
+    /* A small free is queued on this thread before it joins the delayed
+     * free queue, and must already be reported as freed.
+     */
+    p = malloc(64);
+    free(p);
+    *(volatile char *)(p + 32) = 'x'; /* avoid corrupting the free list */
+    printf("all done\n");
+    return 0;
+}
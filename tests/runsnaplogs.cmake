@@ -0,0 +1,76 @@
+# **********************************************************
+# Copyright (c) 2026 Google, Inc.  All rights reserved.
+# **********************************************************
+
+# Dr. Memory: the memory debugger
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation;
+# version 2.1 of the License, and no later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Library General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Runs an app under Dr. Heapstat and then has postprocess.pl read back every
+# snapshot it wrote, to test the snapshot log writers against the readers.
+#
+# input:
+# * cmd = command to run, with intra-arg space=@@ and inter-arg space=@
+# * exe = the application that cmd runs
+# * logdir = the -logdir that cmd passes
+# * postprocess = path to Dr. Heapstat's postprocess.pl
+# * DRMEMORY_CTEST_DR_DIR = DynamoRIO cmake dir, overridden by the env var
+
+if (NOT "$ENV{DRMEMORY_CTEST_DR_DIR}" STREQUAL "")
+  set(DRMEMORY_CTEST_DR_DIR "$ENV{DRMEMORY_CTEST_DR_DIR}")
+endif ()
+
+# See runtest.cmake: we expand ".." in the DR path.
+string(REGEX MATCH "{DRMEMORY_CTEST_DR_DIR}[^@]*" cmd_raw "${cmd}")
+string(REGEX REPLACE "{DRMEMORY_CTEST_DR_DIR}"
+  "${DRMEMORY_CTEST_DR_DIR}" cmd_raw "${cmd_raw}")
+get_filename_component(cmd_abs "${cmd_raw}" ABSOLUTE)
+string(REGEX REPLACE "{DRMEMORY_CTEST_DR_DIR}[^@]*" "${cmd_abs}" cmd "${cmd}")
+
+# intra-arg space=@@ and inter-arg space=@
+string(REGEX REPLACE "@@" " " cmd "${cmd}")
+string(REGEX REPLACE "@" ";" cmd "${cmd}")
+
+find_program(PERL perl)
+if (NOT PERL)
+  message(FATAL_ERROR "cannot find perl")
+endif (NOT PERL)
+
+file(REMOVE_RECURSE "${logdir}")
+file(MAKE_DIRECTORY "${logdir}")
+execute_process(COMMAND ${cmd}
+  RESULT_VARIABLE cmd_result
+  ERROR_VARIABLE cmd_err
+  OUTPUT_VARIABLE cmd_out)
+if (cmd_result)
+  message(FATAL_ERROR "*** ${cmd} failed (${cmd_result}): ${cmd_err}***\n")
+endif (cmd_result)
+
+file(GLOB profdir "${logdir}/DrHeapstat-*")
+list(LENGTH profdir num_profdirs)
+if (NOT num_profdirs EQUAL 1)
+  message(FATAL_ERROR "*** expected one log dir in ${logdir}: ${profdir}***\n")
+endif ()
+
+# -stale_since 0 makes postprocess.pl read the staleness log too.
+execute_process(COMMAND ${PERL} ${postprocess} -x ${exe} -profdir ${profdir}
+  -stale_since 0 -check_logs
+  RESULT_VARIABLE post_result
+  ERROR_VARIABLE post_err
+  OUTPUT_VARIABLE post_out)
+if (post_result OR NOT "${post_out}" MATCHES "checked [1-9][0-9]* snapshots")
+  message(FATAL_ERROR
+    "*** postprocess.pl -check_logs failed (${post_result}): ${post_out}${post_err}***\n")
+endif ()
@@ -68,6 +68,44 @@ umbra_map_scale_shadow_to_app(umbra_map_t *map, ptr_uint_t value)
     return value;
 }
 
+byte
+umbra_bits_pattern(ptr_uint_t value, uint bits_per_app_byte)
+{
+    byte pattern = 0;
+    uint i;
+    for (i = 0; i < 8; i += bits_per_app_byte)
+        pattern |= (byte)(value << i);
+    return pattern;
+}
+
+size_t
+umbra_map_next_copy_chunk(umbra_map_t *map, app_pc app_src, app_pc app_dst,
+                          size_t app_size, size_t done, bool backward,
+                          OUT app_pc *src, OUT app_pc *dst)
+{
+    size_t src_off, dst_off, n;
+    if (backward) {
+        /* the last byte of what remains */
+        *src = app_src + (app_size - done - 1);
+        *dst = app_dst + (app_size - done - 1);
+        src_off = (ptr_uint_t)*src & (map->app_block_size - 1);
+        dst_off = (ptr_uint_t)*dst & (map->app_block_size - 1);
+        n = MIN(src_off, dst_off) + 1;
+        n = MIN(n, app_size - done);
+        *src -= n - 1;
+        *dst -= n - 1;
+    } else {
+        *src = app_src + done;
+        *dst = app_dst + done;
+        src_off = (ptr_uint_t)*src & (map->app_block_size - 1);
+        dst_off = (ptr_uint_t)*dst & (map->app_block_size - 1);
+        /* computed this way to avoid overflow at the top of the address space */
+        n = map->app_block_size - MAX(src_off, dst_off);
+        n = MIN(n, app_size - done);
+    }
+    return n;
+}
+
 void
 umbra_lock()
 {
@@ -564,6 +602,125 @@ umbra_shadow_copy_range(IN  umbra_map_t *map,
                                         app_size, shadow_size);
 }
 
+/* Returns whether bits_per_app_byte is usable for sub-byte updates in map */
+static bool
+umbra_bits_per_app_byte_valid(umbra_map_t *map, uint bits_per_app_byte)
+{
+    if (bits_per_app_byte != 1 && bits_per_app_byte != 2 && bits_per_app_byte != 4)
+        return false;
+    /* Each shadow byte covers 1 << shift app bytes in a scale-down map. */
+    if (!UMBRA_MAP_SCALE_IS_DOWN(map->options.scale) &&
+        map->options.scale != UMBRA_MAP_SCALE_SAME_1X)
+        return false;
+    return (bits_per_app_byte << map->shift) <= 8;
+}
+
+DR_EXPORT
+drmf_status_t
+umbra_shadow_set_range_bits(IN   umbra_map_t *map,
+                            IN   app_pc       app_addr,
+                            IN   size_t       app_size,
+                            IN   uint         bits_per_app_byte,
+                            IN   ptr_uint_t   value)
+{
+    umbra_shadow_range_t range;
+    if (map == NULL || map->magic != UMBRA_MAP_MAGIC) {
+        ASSERT(false, "invalid umbra_map");
+        return DRMF_ERROR_INVALID_PARAMETER;
+    }
+    if (!umbra_bits_per_app_byte_valid(map, bits_per_app_byte) ||
+        value >= ((ptr_uint_t)1 << bits_per_app_byte))
+        return DRMF_ERROR_INVALID_PARAMETER;
+    /* overflow */
+    if (app_addr + app_size < app_addr)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (app_size == 0)
+        return DRMF_SUCCESS;
+    range.start = app_addr;
+    range.end = app_addr + app_size;
+    range.value = value;
+    return umbra_shadow_set_ranges_bits_arch(map, &range, 1, bits_per_app_byte);
+}
+
+/* Sorts ranges by start address.  We expect few ranges, often already in
+ * order, so we use an insertion sort.
+ */
+static void
+umbra_sort_ranges(umbra_shadow_range_t *ranges, uint num_ranges)
+{
+    umbra_shadow_range_t tmp;
+    uint i, j;
+    for (i = 1; i < num_ranges; i++) {
+        if (ranges[i - 1].start <= ranges[i].start)
+            continue;
+        tmp = ranges[i];
+        for (j = i; j > 0 && ranges[j - 1].start > tmp.start; j--)
+            ranges[j] = ranges[j - 1];
+        ranges[j] = tmp;
+    }
+}
+
+DR_EXPORT
+drmf_status_t
+umbra_shadow_set_ranges_bits(IN    umbra_map_t          *map,
+                             INOUT umbra_shadow_range_t *ranges,
+                             IN    uint                  num_ranges,
+                             IN    uint                  bits_per_app_byte)
+{
+    uint i, num;
+    if (map == NULL || map->magic != UMBRA_MAP_MAGIC) {
+        ASSERT(false, "invalid umbra_map");
+        return DRMF_ERROR_INVALID_PARAMETER;
+    }
+    if (ranges == NULL && num_ranges > 0)
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (!umbra_bits_per_app_byte_valid(map, bits_per_app_byte))
+        return DRMF_ERROR_INVALID_PARAMETER;
+    /* drop empty ranges and validate the rest */
+    for (i = 0, num = 0; i < num_ranges; i++) {
+        if (ranges[i].end < ranges[i].start ||
+            ranges[i].value >= ((ptr_uint_t)1 << bits_per_app_byte))
+            return DRMF_ERROR_INVALID_PARAMETER;
+        if (ranges[i].end > ranges[i].start)
+            ranges[num++] = ranges[i];
+    }
+    umbra_sort_ranges(ranges, num);
+    /* Merge adjacent and overlapping ranges in place */
+    if (num == 0)
+        return DRMF_SUCCESS;
+    for (i = 1, num_ranges = num, num = 1; i < num_ranges; i++) {
+        umbra_shadow_range_t *last = &ranges[num - 1];
+        if (ranges[i].start < last->end && ranges[i].value != last->value)
+            return DRMF_ERROR_INVALID_PARAMETER;
+        if (ranges[i].start <= last->end && ranges[i].value == last->value) {
+            if (ranges[i].end > last->end)
+                last->end = ranges[i].end;
+        } else
+            ranges[num++] = ranges[i];
+    }
+    return umbra_shadow_set_ranges_bits_arch(map, ranges, num, bits_per_app_byte);
+}
+
+DR_EXPORT
+drmf_status_t
+umbra_shadow_copy_range_bits(IN  umbra_map_t *map,
+                             IN  app_pc  app_src,
+                             IN  app_pc  app_dst,
+                             IN  size_t  app_size,
+                             IN  uint    bits_per_app_byte)
+{
+    if (map == NULL || map->magic != UMBRA_MAP_MAGIC) {
+        ASSERT(false, "invalid umbra_map");
+        return DRMF_ERROR_INVALID_PARAMETER;
+    }
+    if (!umbra_bits_per_app_byte_valid(map, bits_per_app_byte))
+        return DRMF_ERROR_INVALID_PARAMETER;
+    if (app_size == 0 || app_src == app_dst)
+        return DRMF_SUCCESS;
+    return umbra_shadow_copy_range_bits_arch(map, app_src, app_dst, app_size,
+                                             bits_per_app_byte);
+}
+
 DR_EXPORT
 drmf_status_t
 umbra_value_in_shadow_memory(IN    umbra_map_t *map,
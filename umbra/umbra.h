@@ -182,6 +182,16 @@ typedef struct _umbra_shadow_memory_info_t {
     umbra_shadow_memory_type_t shadow_type;
 } umbra_shadow_memory_info_t;
 
+/** An application memory range and the shadow value to set for it. */
+typedef struct _umbra_shadow_range_t {
+    /** Start of the application memory range */
+    app_pc start;
+    /** End of the application memory range (exclusive) */
+    app_pc end;
+    /** The value to be set for each application byte in the range */
+    ptr_uint_t value;
+} umbra_shadow_range_t;
+
 /** Opaque "Umbra map handle" type.  See #umbra_map_t. */
 struct _umbra_map_t;
 /**
@@ -494,6 +504,99 @@ umbra_shadow_copy_range(IN  umbra_map_t *map,
                         IN  size_t  app_size,
                         OUT size_t *shadow_size);
 
+DR_EXPORT
+/**
+ * Set the shadow values for the application memory [\p app_addr,
+ * \p app_addr + \p app_size) when each application byte is shadowed by
+ * \p bits_per_app_byte bits, which is useful for a map with a scale of
+ * #UMBRA_MAP_SCALE_DOWN_4X that stores 2 bits per application byte.  Unlike
+ * umbra_shadow_set_range(), neither end of the range needs to be aligned to
+ * a shadow byte: the bits of a partially covered shadow byte that belong to
+ * application bytes outside of the range are preserved.  The values within
+ * a shadow byte are stored from the least significant bit up, in
+ * application address order.
+ *
+ * @param[in]  map                The mapping object to use.
+ * @param[in]  app_addr           Application memory address.
+ * @param[in]  app_size           Application memory size.
+ * @param[in]  bits_per_app_byte  The number of shadow bits per application
+ *                                byte, which must be 1, 2, or 4, and must not
+ *                                exceed the bits available per application
+ *                                byte in the map's scale.
+ * @param[in]  value              The value to be set for each application
+ *                                byte, which must fit in \p bits_per_app_byte.
+ *
+ * \return success code.  If \p app_addr is not a valid application address
+ * and the shadow mapping implementation does not support shadow memory
+ * for invalid addresses, returns DRMF_ERROR_INVALID_ADDRESS.
+ */
+drmf_status_t
+umbra_shadow_set_range_bits(IN   umbra_map_t *map,
+                            IN   app_pc       app_addr,
+                            IN   size_t       app_size,
+                            IN   uint         bits_per_app_byte,
+                            IN   ptr_uint_t   value);
+
+DR_EXPORT
+/**
+ * Copy the shadow values for the application memory at \p app_src to the
+ * shadow values for the application memory at \p app_dst, when each
+ * application byte is shadowed by \p bits_per_app_byte bits.  Unlike
+ * umbra_shadow_copy_range(), neither address needs to be aligned to a shadow
+ * byte, and the two need not be aligned alike: the values are shifted as
+ * needed.  The bit layout is as described for umbra_shadow_set_range_bits().
+ *
+ * @param[in]  map                The mapping object to use.
+ * @param[in]  app_src            Source application memory address.
+ * @param[in]  app_dst            Destination application memory address.
+ * @param[in]  app_size           Application memory size.
+ * @param[in]  bits_per_app_byte  The number of shadow bits per application
+ *                                byte, with the same restrictions as for
+ *                                umbra_shadow_set_range_bits().
+ *
+ * \return success code.  If \p app_addr is not a valid application address
+ * and the shadow mapping implementation does not support shadow memory
+ * for invalid addresses, returns DRMF_ERROR_INVALID_ADDRESS.
+ *
+ * \note: Overlap is allowed.
+ */
+drmf_status_t
+umbra_shadow_copy_range_bits(IN  umbra_map_t *map,
+                             IN  app_pc  app_src,
+                             IN  app_pc  app_dst,
+                             IN  size_t  app_size,
+                             IN  uint    bits_per_app_byte);
+
+DR_EXPORT
+/**
+ * Set the shadow values for a set of application memory ranges in one call,
+ * with each application byte shadowed by \p bits_per_app_byte bits as for
+ * umbra_shadow_set_range_bits().  The ranges are sorted by address and
+ * adjacent or overlapping ranges with the same value are merged, so the
+ * shadow of ranges that share a block is updated with a single lookup of
+ * that block.  Empty ranges are ignored.
+ *
+ * @param[in]     map                The mapping object to use.
+ * @param[in,out] ranges             The ranges to set.  The array is sorted in
+ *                                   place and its contents are unspecified on
+ *                                   return.
+ * @param[in]     num_ranges         The number of entries in \p ranges.
+ * @param[in]     bits_per_app_byte  The number of shadow bits per application
+ *                                   byte, with the same restrictions as for
+ *                                   umbra_shadow_set_range_bits().
+ *
+ * \return success code.  If ranges with different values overlap, returns
+ * DRMF_ERROR_INVALID_PARAMETER without modifying any shadow memory.  If an
+ * address is not a valid application address and the shadow mapping
+ * implementation does not support shadow memory for invalid addresses,
+ * returns DRMF_ERROR_INVALID_ADDRESS.
+ */
+drmf_status_t
+umbra_shadow_set_ranges_bits(IN    umbra_map_t          *map,
+                             INOUT umbra_shadow_range_t *ranges,
+                             IN    uint                  num_ranges,
+                             IN    uint                  bits_per_app_byte);
+
 DR_EXPORT
 /**
  * Check whether \p value is in the shadow memory for application memory at
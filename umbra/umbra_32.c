@@ -826,6 +826,104 @@ umbra_shadow_copy_range_arch(IN  umbra_map_t *map,
     return res;
 }
 
+drmf_status_t
+umbra_shadow_set_ranges_bits_arch(IN   umbra_map_t          *map,
+                                  IN   umbra_shadow_range_t *ranges,
+                                  IN   uint                  num_ranges,
+                                  IN   uint                  bits_per_app_byte)
+{
+    app_pc start, app_blk_base, cur_blk_base = NULL;
+    byte  *shadow_blk = NULL;
+    size_t size, done, n;
+    uint i;
+    byte pattern;
+    bool blk_special = false;
+    ptr_uint_t blk_val = 0;
+
+    for (i = 0; i < num_ranges; i++) {
+        size = ranges[i].end - ranges[i].start;
+        pattern = umbra_bits_pattern(ranges[i].value, bits_per_app_byte);
+        /* We count bytes rather than use APP_RANGE_LOOP, whose closed end can
+         * land on a block base for an unaligned size.
+         */
+        for (done = 0; done < size; done += n) {
+            start = ranges[i].start + done;
+            app_blk_base = (app_pc) ALIGN_BACKWARD(start, map->app_block_size);
+            n = MIN(map->app_block_size - (start - app_blk_base), size - done);
+            /* consecutive ranges in the same block share its lookup */
+            if (shadow_blk == NULL || app_blk_base != cur_blk_base) {
+                shadow_blk = shadow_table_app_to_shadow(map, app_blk_base);
+                if (shadow_table_is_in_default_block(map, shadow_blk, NULL))
+                    return DRMF_ERROR_INVALID_PARAMETER;
+                blk_special =
+                    shadow_table_is_in_special_block(map, shadow_blk,
+                                                     &blk_val, NULL, NULL);
+                cur_blk_base = app_blk_base;
+            }
+            if (blk_special) {
+                /* avoid replacing a special block on a nop write */
+                if (blk_val == pattern)
+                    continue;
+                shadow_table_replace_block(map, app_blk_base);
+                shadow_blk = shadow_table_app_to_shadow(map, app_blk_base);
+                blk_special = false;
+            }
+            bitstream_fill(shadow_blk, (start - app_blk_base) * bits_per_app_byte,
+                           n * bits_per_app_byte, pattern);
+        }
+    }
+    return DRMF_SUCCESS;
+}
+
+drmf_status_t
+umbra_shadow_copy_range_bits_arch(IN  umbra_map_t *map,
+                                  IN  app_pc  app_src,
+                                  IN  app_pc  app_dst,
+                                  IN  size_t  app_size,
+                                  IN  uint    bits_per_app_byte)
+{
+    app_pc src, dst, src_blk, dst_blk;
+    byte *src_shadow, *dst_shadow;
+    ptr_uint_t src_val, dst_val;
+    size_t done, n;
+    bool backward;
+
+    if (POINTER_OVERFLOW_ON_ADD(app_src, app_size-1) || /* just hitting top is ok */
+        POINTER_OVERFLOW_ON_ADD(app_dst, app_size-1))   /* just hitting top is ok */
+        return DRMF_ERROR_INVALID_SIZE;
+    /* If the destination overlaps the end of the source we walk the blocks
+     * backward so we don't clobber source values before we read them.
+     */
+    backward = (app_dst > app_src && app_dst - app_src < app_size);
+    for (done = 0; done < app_size; done += n) {
+        n = umbra_map_next_copy_chunk(map, app_src, app_dst, app_size, done,
+                                      backward, &src, &dst);
+        src_blk = (app_pc) ALIGN_BACKWARD(src, map->app_block_size);
+        dst_blk = (app_pc) ALIGN_BACKWARD(dst, map->app_block_size);
+        src_shadow = shadow_table_app_to_shadow(map, src_blk);
+        dst_shadow = shadow_table_app_to_shadow(map, dst_blk);
+        if (shadow_table_is_in_default_block(map, src_shadow, NULL) ||
+            shadow_table_is_in_default_block(map, dst_shadow, NULL))
+            return DRMF_ERROR_INVALID_PARAMETER;
+        if (shadow_table_is_in_special_block(map, dst_shadow,
+                                             &dst_val, NULL, NULL)) {
+            /* avoid replacing a special block with identical contents */
+            if (shadow_table_is_in_special_block(map, src_shadow,
+                                                 &src_val, NULL, NULL) &&
+                src_val == dst_val)
+                continue;
+            shadow_table_replace_block(map, dst_blk);
+            dst_shadow = shadow_table_app_to_shadow(map, dst_blk);
+            /* the source may have been the same block */
+            src_shadow = shadow_table_app_to_shadow(map, src_blk);
+        }
+        bitstream_copy(dst_shadow, (dst - dst_blk) * bits_per_app_byte,
+                       src_shadow, (src - src_blk) * bits_per_app_byte,
+                       n * bits_per_app_byte);
+    }
+    return DRMF_SUCCESS;
+}
+
 drmf_status_t
 umbra_value_in_shadow_memory_arch(IN    umbra_map_t *map,
                                   INOUT app_pc *app_addr,
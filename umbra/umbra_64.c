@@ -1020,6 +1020,101 @@ umbra_shadow_copy_range_arch(IN  umbra_map_t *map,
     return res;
 }
 
+/* Returns in shadow_blk the shadow block for the app block at app_blk_base,
+ * creating the block if it does not exist and the map creates shadow on touch.
+ */
+static drmf_status_t
+umbra_shadow_block_get_or_create(umbra_map_t *map, app_pc app_blk_base,
+                                 OUT byte **shadow_blk)
+{
+    *shadow_blk = umbra_xl8_app_to_shadow(map, app_blk_base);
+    if (!umbra_shadow_block_exist(map, *shadow_blk)) {
+        if (!TEST(UMBRA_MAP_CREATE_SHADOW_ON_TOUCH, map->options.flags))
+            return DRMF_ERROR_INVALID_PARAMETER;
+        return umbra_create_shadow_memory_arch(map, 0, app_blk_base,
+                                               map->app_block_size,
+                                               map->options.default_value,
+                                               map->options.default_value_size);
+    }
+    return DRMF_SUCCESS;
+}
+
+drmf_status_t
+umbra_shadow_set_ranges_bits_arch(IN   umbra_map_t          *map,
+                                  IN   umbra_shadow_range_t *ranges,
+                                  IN   uint                  num_ranges,
+                                  IN   uint                  bits_per_app_byte)
+{
+    app_pc start, app_blk_base, cur_blk_base = NULL;
+    byte  *shadow_blk = NULL;
+    size_t size, done, n;
+    uint i;
+    byte pattern;
+    drmf_status_t res;
+
+    for (i = 0; i < num_ranges; i++) {
+        size = ranges[i].end - ranges[i].start;
+        pattern = umbra_bits_pattern(ranges[i].value, bits_per_app_byte);
+        /* We count bytes rather than use APP_RANGE_LOOP, whose closed end can
+         * land on a block base for an unaligned size.
+         */
+        for (done = 0; done < size; done += n) {
+            start = ranges[i].start + done;
+            app_blk_base = (app_pc) ALIGN_BACKWARD(start, map->app_block_size);
+            n = MIN(map->app_block_size - (start - app_blk_base), size - done);
+            /* consecutive ranges in the same block share its lookup */
+            if (shadow_blk == NULL || app_blk_base != cur_blk_base) {
+                res = umbra_shadow_block_get_or_create(map, app_blk_base,
+                                                       &shadow_blk);
+                if (res != DRMF_SUCCESS)
+                    return res;
+                cur_blk_base = app_blk_base;
+            }
+            bitstream_fill(shadow_blk, (start - app_blk_base) * bits_per_app_byte,
+                           n * bits_per_app_byte, pattern);
+        }
+    }
+    return DRMF_SUCCESS;
+}
+
+drmf_status_t
+umbra_shadow_copy_range_bits_arch(IN  umbra_map_t *map,
+                                  IN  app_pc  app_src,
+                                  IN  app_pc  app_dst,
+                                  IN  size_t  app_size,
+                                  IN  uint    bits_per_app_byte)
+{
+    app_pc src, dst, src_blk, dst_blk;
+    byte *src_shadow, *dst_shadow;
+    size_t done, n;
+    bool backward;
+    drmf_status_t res;
+
+    if (POINTER_OVERFLOW_ON_ADD(app_src, app_size-1) || /* just hitting top is ok */
+        POINTER_OVERFLOW_ON_ADD(app_dst, app_size-1))   /* just hitting top is ok */
+        return DRMF_ERROR_INVALID_SIZE;
+    /* If the destination overlaps the end of the source we walk the blocks
+     * backward so we don't clobber source values before we read them.
+     */
+    backward = (app_dst > app_src && app_dst - app_src < app_size);
+    for (done = 0; done < app_size; done += n) {
+        n = umbra_map_next_copy_chunk(map, app_src, app_dst, app_size, done,
+                                      backward, &src, &dst);
+        src_blk = (app_pc) ALIGN_BACKWARD(src, map->app_block_size);
+        dst_blk = (app_pc) ALIGN_BACKWARD(dst, map->app_block_size);
+        res = umbra_shadow_block_get_or_create(map, src_blk, &src_shadow);
+        if (res != DRMF_SUCCESS)
+            return res;
+        res = umbra_shadow_block_get_or_create(map, dst_blk, &dst_shadow);
+        if (res != DRMF_SUCCESS)
+            return res;
+        bitstream_copy(dst_shadow, (dst - dst_blk) * bits_per_app_byte,
+                       src_shadow, (src - src_blk) * bits_per_app_byte,
+                       n * bits_per_app_byte);
+    }
+    return DRMF_SUCCESS;
+}
+
 drmf_status_t
 umbra_value_in_shadow_memory_arch(IN    umbra_map_t *map,
                                   INOUT app_pc *app_addr,
@@ -132,6 +132,20 @@ umbra_map_scale_app_to_shadow(umbra_map_t *map, ptr_uint_t app_value);
 ptr_uint_t
 umbra_map_scale_shadow_to_app(umbra_map_t *map, ptr_uint_t shadow_value);
 
+/* Returns value replicated across a byte for bits_per_app_byte-bit values */
+byte
+umbra_bits_pattern(ptr_uint_t value, uint bits_per_app_byte);
+
+/* For a copy of app_size app bytes from app_src to app_dst of which done have
+ * been copied, returns the size of the next chunk for which both the source
+ * and the destination lie within a single app block, and its start addresses
+ * in src and dst.  If backward, chunks are taken from the end of what remains.
+ */
+size_t
+umbra_map_next_copy_chunk(umbra_map_t *map, app_pc app_src, app_pc app_dst,
+                          size_t app_size, size_t done, bool backward,
+                          OUT app_pc *src, OUT app_pc *dst);
+
 /* check if addr is application memory address */
 bool
 umbra_address_is_app_memory(app_pc addr);
@@ -218,6 +232,20 @@ umbra_shadow_copy_range_arch(IN  umbra_map_t *map,
                              IN  size_t  app_size,
                              OUT size_t *shadow_size);
 
+/* The ranges are sorted, non-empty, and non-overlapping */
+drmf_status_t
+umbra_shadow_set_ranges_bits_arch(IN   umbra_map_t          *map,
+                                  IN   umbra_shadow_range_t *ranges,
+                                  IN   uint                  num_ranges,
+                                  IN   uint                  bits_per_app_byte);
+
+drmf_status_t
+umbra_shadow_copy_range_bits_arch(IN  umbra_map_t *map,
+                                  IN  app_pc  app_src,
+                                  IN  app_pc  app_dst,
+                                  IN  size_t  app_size,
+                                  IN  uint    bits_per_app_byte);
+
 drmf_status_t
 umbra_iterate_shadow_memory_arch(umbra_map_t *map,
                                  void *user_data,